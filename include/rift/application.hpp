@@ -13,6 +13,16 @@ struct ContextOptions
 	int glMinor = 4;
 	int numSamples = 0;
 	bool fullscreen = false;
+	// number of frames the CPU can queue ahead of the GPU (2-4)
+	// more frames: better throughput, more latency
+	int framesInFlight = 3;
+	// opt-in: transient rings created on top of framesInFlight when the GPU is late,
+	// instead of waiting for the oldest frame (0-2, adds latency)
+	int extraTransientRings = 0;
+	// capacity of the mesh megabuffer shared by static meshes, allocated up front
+	// (kMeshVertexStride bytes per vertex, 2 per index); 0: meshes get their own buffers
+	unsigned meshMegabufferVertices = 0;
+	unsigned meshMegabufferIndices = 0;
 };
 
 class Application;
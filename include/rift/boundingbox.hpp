@@ -50,6 +50,42 @@ struct AABB
 
 		return dist;
 	}
+
+	glm::vec3 center() const {
+		return 0.5f * (min + max);
+	}
+
+	glm::vec3 extent() const {
+		return 0.5f * (max - min);
+	}
 };
 
+// Bounding sphere
+struct Sphere
+{
+	glm::vec3 center;
+	float radius;
+};
+
+// AABB enclosing the box transformed by m
+inline AABB transformAABB(const AABB &aabb, const glm::mat4 &m)
+{
+	auto c = glm::vec3(m * glm::vec4(aabb.center(), 1.0f));
+	auto e = aabb.extent();
+	auto we = glm::abs(glm::vec3(m[0])) * e.x
+		+ glm::abs(glm::vec3(m[1])) * e.y
+		+ glm::abs(glm::vec3(m[2])) * e.z;
+	return AABB{ c - we, c + we };
+}
+
+// sphere enclosing the sphere transformed by m (non-uniform scale takes the largest axis)
+inline Sphere transformSphere(const Sphere &sphere, const glm::mat4 &m)
+{
+	auto scale = glm::max(glm::max(
+		glm::length(glm::vec3(m[0])),
+		glm::length(glm::vec3(m[1]))),
+		glm::length(glm::vec3(m[2])));
+	return Sphere{ glm::vec3(m * glm::vec4(sphere.center, 1.0f)), sphere.radius * scale };
+}
+
 #endif
\ No newline at end of file
@@ -15,8 +15,21 @@ struct MeshData
 	util::small_vector<std::vector<glm::vec2>, 8> uv;
 	std::vector<uint16_t> indices;
 	std::vector<Submesh> submeshes;
+	// bounds of the whole mesh (object space)
+	AABB aabb;
+	Sphere boundingSphere;
+	// levels of detail (see Submesh::lodRanges), with their geometric error
+	// (object space, 0 for level 0)
+	unsigned numLods = 1;
+	float lodErrors[kMaxMeshLods] = {};
 
+	// version 3, or version 4 (levels of detail after the indices)
 	void loadFromStream(std::istream &in_stream);
+	// writes version 4, layout 5
+	void saveToStream(std::ostream &out_stream) const;
+	// computes the mesh and submesh bounds from the vertices
+	// (done by loadFromStream, call it after filling the data by hand)
+	void computeBounds();
 };
 
 #endif
\ No newline at end of file
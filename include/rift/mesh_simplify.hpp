@@ -0,0 +1,25 @@
+#ifndef MESH_SIMPLIFY_HPP
+#define MESH_SIMPLIFY_HPP
+
+#include <mesh_data.hpp>
+#include <array_ref.hpp>
+
+// Quadric error metric simplification of an indexed triangle list, by edge
+// collapses onto existing vertices: no vertex is created or moved, the result
+// indexes the same vertices. Vertices on open borders and on attribute seams
+// (several vertices at the same position) are locked.
+// Stops at targetIndexCount indices, or when no collapse is left. Returns the
+// geometric error of the result (object space distance, approximate).
+float simplifyTriangles(
+	util::array_ref<glm::vec3> vertices,
+	util::array_ref<uint16_t> indices,
+	unsigned targetIndexCount,
+	std::vector<uint16_t> &out);
+
+// Appends coarser levels of detail to a mesh that has none: each level has about
+// triangleRatio times the triangles of the previous one, and its indices go after
+// the existing ones. Stops at maxLods levels, or when a level would not be much
+// smaller than the previous one.
+void generateMeshLods(MeshData &data, unsigned maxLods = kMaxMeshLods, float triangleRatio = 0.5f);
+
+#endif /* end of include guard: MESH_SIMPLIFY_HPP */
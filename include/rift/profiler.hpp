@@ -0,0 +1,157 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+//---------------------------
+// Frame profiler
+// PROFILE_SCOPE(name) measures the enclosing block on the calling thread,
+// PROFILE_GPU_SCOPE(name) also measures the GPU commands issued in the block
+// with timestamp queries. Names must be string literals.
+// Each thread writes its events to its own ring buffer without locks,
+// endFrame() collects them once per frame and updates the per-scope averages.
+// GPU queries are read back kGpuLatency frames later at most, and never waited on.
+// Markers cost one relaxed atomic load when the profiler is disabled at run
+// time, and nothing when RIFT_DISABLE_PROFILER is defined.
+namespace profiler
+{
+	// events a thread can record between two calls to endFrame()
+	constexpr unsigned kThreadBufferSize = 16384;
+	// frames in flight for the GPU queries
+	constexpr unsigned kGpuLatency = 4;
+	// the averages are taken over the last frames in which a scope ran
+	constexpr unsigned kAverageFrames = 64;
+	// frames kept for the trace export
+	constexpr unsigned kTraceFrames = 16;
+	// thread index of the GPU scopes
+	constexpr unsigned kGpuThread = ~0u;
+
+	// a closed scope
+	struct Event
+	{
+		const char *name;
+		// nanoseconds (qpc_clock); GPU times are shifted to the CPU clock
+		uint64_t begin;
+		uint64_t end;
+		// nesting level on its thread
+		unsigned depth;
+		// index of the thread, or kGpuThread
+		unsigned thread;
+	};
+
+	// a node of the scope hierarchy
+	struct ScopeStats
+	{
+		const char *name;
+		unsigned depth;
+		bool gpu;
+		// last frame the scope ran in (GPU scopes lag a few frames behind)
+		unsigned lastFrame;
+		// calls and total time in that frame
+		unsigned lastCalls;
+		double lastMs;
+		// mean total time per frame
+		double avgMs;
+	};
+
+	namespace detail
+	{
+		extern std::atomic<bool> enabled;
+	}
+
+	inline bool isEnabled() {
+		return detail::enabled.load(std::memory_order_relaxed);
+	}
+
+	// disabled by default
+	void setEnabled(bool enabled);
+	// name of the calling thread in the trace ("thread <index>" by default)
+	void setThreadName(const char *name);
+
+	void beginScope(const char *name);
+	void endScope();
+	// GPU scopes must be opened and closed on the rendering thread
+	void beginGpuScope(const char *name);
+	void endGpuScope();
+
+	// The functions below must be called from a single thread (the main loop).
+	// collects the events of all threads, reads back the GPU queries
+	void endFrame();
+	// number of endFrame() calls
+	unsigned getFrameIndex();
+	// events lost because a thread buffer was full, or GPU frames not resolved in time
+	unsigned getNumDroppedEvents();
+
+	// parents before their children, siblings in the order they first ran;
+	// the GPU scopes come after the CPU ones
+	std::vector<ScopeStats> getScopeStats();
+	// events of the last kTraceFrames frames (CPU and resolved GPU scopes)
+	std::vector<Event> getTraceEvents();
+	// Chrome trace event format (chrome://tracing, ui.perfetto.dev)
+	void writeChromeTrace(std::ostream &out);
+	bool saveChromeTrace(const char *path);
+	// hierarchical view of the scopes that ran recently, as screen messages
+	void showScreenMessages(unsigned maxDepth = 3);
+	// forgets the stats and the trace (the thread buffers are emptied)
+	void reset();
+
+	class Scope
+	{
+	public:
+		explicit Scope(const char *name) : active(isEnabled()) {
+			if (active)
+				beginScope(name);
+		}
+
+		~Scope() {
+			if (active)
+				endScope();
+		}
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	private:
+		bool active;
+	};
+
+	class GpuScope
+	{
+	public:
+		explicit GpuScope(const char *name) : active(isEnabled()) {
+			if (active) {
+				beginScope(name);
+				beginGpuScope(name);
+			}
+		}
+
+		~GpuScope() {
+			if (active) {
+				endGpuScope();
+				endScope();
+			}
+		}
+
+		GpuScope(const GpuScope &) = delete;
+		GpuScope &operator=(const GpuScope &) = delete;
+
+	private:
+		bool active;
+	};
+}
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#ifdef RIFT_DISABLE_PROFILER
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) profiler::Scope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) profiler::GpuScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#endif
+
+#endif /* end of include guard: PROFILER_HPP */
@@ -1,6 +1,8 @@
 #ifndef RENDERER_COMMON_HPP
 #define RENDERER_COMMON_HPP
 
+#include <boundingbox.hpp>
+
 constexpr unsigned kMaxColorRenderTargets = 8;
  
 enum class PrimitiveType
@@ -80,6 +82,7 @@ enum class ElementFormat : int
     Depth16,
     Float16,
     Float,
+    Depth32F,
     Max
 };
 
@@ -267,6 +270,16 @@ struct BlendStateRenderTargetDesc
 	std::array<BlendStateRenderTargetDesc, kMaxColorRenderTargets> renderTargets;
 };*/
 
+// max levels of detail of a mesh (level 0 is the full mesh)
+constexpr unsigned kMaxMeshLods = 4;
+
+// indices of a submesh at one level of detail
+struct IndexRange
+{
+	unsigned startIndex;
+	unsigned numIndices;
+};
+
 struct Submesh {
 	PrimitiveType primitiveType;
 	// Index du premier vertex 
@@ -277,6 +290,16 @@ struct Submesh {
 	unsigned int numVertices;
 	// Nombre d'indices
 	unsigned int numIndices;
+	// bounds in object space (the sphere is centered on the AABB)
+	AABB aabb;
+	Sphere boundingSphere;
+	// indices of the coarser levels of detail (lodRanges[i] is level i + 1),
+	// drawn with the same vertices; the mesh holds the number of levels
+	IndexRange lodRanges[kMaxMeshLods - 1];
+
+	IndexRange getIndexRange(unsigned lod) const {
+		return lod ? lodRanges[lod - 1] : IndexRange{ startIndex, numIndices };
+	}
 };
 
 const char *getElementFormatName(ElementFormat format);
@@ -0,0 +1,55 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <boundingbox.hpp>
+#include <vector>
+
+// Frustum planes extracted from a view-projection matrix (world space)
+// Plane normals point inside and are normalized: a point p is inside
+// the plane if dot(plane.xyz, p) + plane.w >= 0
+struct FrustumPlanes
+{
+	enum { Left, Right, Bottom, Top, Near, Far, Count };
+	glm::vec4 planes[Count];
+
+	// viewProj: Camera::projMat * Camera::viewMat
+	static FrustumPlanes fromMatrix(const glm::mat4 &viewProj);
+
+	bool intersects(const AABB &aabb) const;
+	bool intersects(const Sphere &sphere) const;
+};
+
+// World-space bounds of a set of objects, in SoA layout for batch culling
+// Each object has an AABB (center + half-extents) and a bounding sphere
+// centered on the AABB.
+struct CullingBounds
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> extentX;
+	std::vector<float> extentY;
+	std::vector<float> extentZ;
+	std::vector<float> radius;
+
+	void clear();
+	void reserve(size_t count);
+	// returns the index of the object
+	unsigned push(const glm::vec3 &center, const glm::vec3 &extent, float radius);
+	// transformed object-space bounds
+	unsigned push(const AABB &aabb, const Sphere &sphere, const glm::mat4 &modelToWorld);
+
+	size_t size() const {
+		return centerX.size();
+	}
+};
+
+// Appends the indices of the objects intersecting the frustum to visible, in increasing order
+// An object is culled if it lies outside one of the planes; the plane distance is tested
+// against the smaller of the sphere radius and the projected AABB radius.
+// Uses SSE when available (4 objects at a time).
+void cullFrustum(const FrustumPlanes &frustum, const CullingBounds &bounds, std::vector<unsigned> &visible);
+// reference implementation (same results)
+void cullFrustumScalar(const FrustumPlanes &frustum, const CullingBounds &bounds, std::vector<unsigned> &visible);
+
+#endif /* end of include guard: CULLING_HPP */
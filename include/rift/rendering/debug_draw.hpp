@@ -0,0 +1,96 @@
+#ifndef DEBUG_DRAW_HPP
+#define DEBUG_DRAW_HPP
+
+#include <rendering/opengl4.hpp>
+#include <boundingbox.hpp>
+#include <array_ref.hpp>
+#include <glm/glm.hpp>
+#include <vector>
+
+// vertex of debug_draw.glsl
+struct DebugVertex
+{
+	glm::vec3 position;
+	// Unorm8x4
+	glm::uint32 color;
+};
+
+// depth-tested lines, and lines drawn on top of everything
+enum class DebugDepthMode
+{
+	Test,
+	NoTest,
+	Max
+};
+
+//---------------------------
+// Debug drawing
+// Wireframe primitives are accumulated during the frame as colored line
+// segments, in one stream per depth mode, and drawn by flush() with at most
+// two draw calls. Vertices over the capacity of the frame are dropped (and
+// counted).
+class DebugDraw
+{
+public:
+	// segments of the circles of spheres and capsules
+	static constexpr unsigned kCircleSegments = 24;
+	static constexpr unsigned kDefaultMaxVertices = 1 << 20;
+
+	struct Stats
+	{
+		unsigned numVertices[static_cast<int>(DebugDepthMode::Max)] = {};
+		unsigned numDroppedVertices = 0;
+		unsigned numDrawCalls = 0;
+		unsigned maxVertices = 0;
+	};
+
+	void drawLine(const glm::vec3 &a, const glm::vec3 &b, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	void drawBox(const AABB &box, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	// box in the space of transform
+	void drawBox(const AABB &box, const glm::mat4 &transform, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	void drawSphere(const glm::vec3 &center, float radius, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	// segment [a,b] swept by a sphere
+	void drawCapsule(const glm::vec3 &a, const glm::vec3 &b, float radius, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	// frustum of a view-projection matrix (GL clip space)
+	void drawFrustum(const glm::mat4 &viewProj, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+	// edges of a mesh on the CPU; primitive: TRIANGLES, LINES or LINE_STRIP; no indices: 0,1,2...
+	void drawMesh(const glm::mat4 &transform, GLenum primitive, util::array_ref<glm::vec3> vertices,
+		util::array_ref<uint16_t> indices, const glm::vec4 &color, DebugDepthMode mode = DebugDepthMode::Test);
+
+	bool empty() const;
+
+	// vertices per frame, for both depth modes
+	void setMaxVertices(unsigned maxVertices_) {
+		maxVertices = maxVertices_;
+	}
+
+	// draws the lines over the current render target and empties the streams;
+	// program: debug_draw.glsl
+	void flush(GraphicsContext &gc, GLuint program, const glm::mat4 &viewProj);
+	// forgets the lines without drawing them
+	void clear();
+
+	// stats of the last flush
+	const Stats &getStats() const {
+		return lastStats;
+	}
+
+	// lines of a depth mode, in the current frame
+	const std::vector<DebugVertex> &getVertices(DebugDepthMode mode) const {
+		return streams[static_cast<int>(mode)];
+	}
+
+private:
+	// returns nullptr if the frame is over capacity
+	DebugVertex *allocate(DebugDepthMode mode, unsigned numVertices);
+	void addCircle(DebugVertex *&v, const glm::vec3 &center, const glm::vec3 &u, const glm::vec3 &w,
+		float radius, float startAngle, float arc, unsigned numSegments, glm::uint32 color);
+
+	std::vector<DebugVertex> streams[static_cast<int>(DebugDepthMode::Max)];
+	unsigned maxVertices = kDefaultMaxVertices;
+	unsigned numDroppedVertices = 0;
+	Stats lastStats;
+	VAO vao;
+};
+
+#endif /* end of include guard: DEBUG_DRAW_HPP */
@@ -0,0 +1,384 @@
+#ifndef DEVICE_HPP
+#define DEVICE_HPP
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+#include <renderer_common.hpp>
+#include <gl_core_4_4.hpp>
+#include <glm/glm.hpp>
+#include <array_ref.hpp>
+
+//---------------------------
+// Graphics device
+// Thin layer under the opengl4.hpp helpers: every GL object creation,
+// state change and draw call of the renderer goes through the current device.
+// GLDevice forwards to OpenGL, RecordingDevice only counts and stores commands
+// in memory (no context needed: headless benchmarks, draw count checks).
+class GraphicsDevice
+{
+public:
+	virtual ~GraphicsDevice() {}
+
+	// true if the device does not execute commands on a GPU
+	virtual bool isHeadless() const = 0;
+	virtual void installDebugCallback() = 0;
+
+	// buffers
+	virtual GLuint createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData) = 0;
+	virtual void *mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access) = 0;
+	virtual void updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data) = 0;
+	virtual void copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size) = 0;
+	virtual void deleteBuffer(GLuint buf) = 0;
+	// offset alignment for uniform and shader storage buffer bindings
+	virtual GLint getBufferOffsetAlignment(GLenum target) = 0;
+
+	// fences
+	virtual GLsync fenceSync() = 0;
+	// returns true if the fence was signaled before the timeout (nanoseconds)
+	virtual bool waitSync(GLsync sync, uint64_t timeout) = 0;
+	virtual void deleteSync(GLsync sync) = 0;
+
+	// timer queries
+	virtual GLuint createQuery() = 0;
+	// the query gets the time (nanoseconds) when the previous commands are done
+	virtual void queryTimestamp(GLuint query) = 0;
+	// returns false if the result is not available yet, never waits
+	virtual bool getQueryResult(GLuint query, uint64_t &result) = 0;
+	virtual void deleteQuery(GLuint query) = 0;
+
+	// resources
+	// non-normalized integer formats are fetched as integers
+	// divisors: instance divisor of each input slot (empty: per-vertex data only)
+	virtual GLuint createVertexArray(util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors) = 0;
+	virtual void deleteVertexArray(GLuint vao) = 0;
+	virtual GLuint createTexture(GLenum target, unsigned numMipLevels, GLenum internalFormat, unsigned width, unsigned height) = 0;
+	// imageTarget is the face for cube maps
+	virtual void updateTexture(GLuint tex, GLenum target, GLenum imageTarget, int mipLevel, glm::ivec2 offset, glm::ivec2 size, GLenum format, GLenum type, const void *data) = 0;
+	// row alignment of the data of the next texture updates (1, 2, 4 or 8, GL default: 4)
+	virtual void setUnpackAlignment(int alignment) = 0;
+	virtual void deleteTexture(GLuint tex) = 0;
+	virtual GLuint createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget) = 0;
+	virtual void deleteFramebuffer(GLuint fbo) = 0;
+	virtual GLuint createSampler(GLenum minFilter, GLenum magFilter, GLenum wrapMode) = 0;
+	virtual void deleteSampler(GLuint sampler) = 0;
+	// throws std::runtime_error on compilation/link errors
+	virtual GLuint createShader(GLenum stage, const char *source) = 0;
+	virtual void deleteShader(GLuint shader) = 0;
+	virtual GLuint createProgram(GLuint vs, GLuint gs, GLuint ps) = 0;
+	virtual void deleteProgram(GLuint program) = 0;
+	// program binaries are only valid for the same driver string (vendor, renderer, version)
+	virtual std::string getDriverString() = 0;
+	// returns false if the driver gives no binary
+	virtual bool getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary) = 0;
+	// returns 0 if the driver rejects the binary
+	virtual GLuint createProgramFromBinary(GLenum format, const void *binary, size_t size) = 0;
+
+	// render state
+	virtual void bindFramebuffer(GLuint fbo) = 0;
+	virtual void viewport(int x, int y, int width, int height) = 0;
+	virtual void clear(GLbitfield mask, const glm::vec4 &color, float depth) = 0;
+	virtual void setEnabled(GLenum cap, bool enabled) = 0;
+	virtual void polygonMode(GLenum mode) = 0;
+	virtual void cullFace(GLenum face) = 0;
+	virtual void depthFunc(GLenum func) = 0;
+	virtual void depthMask(bool enabled) = 0;
+	virtual void blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha) = 0;
+	virtual void blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) = 0;
+	// all channels of all draw buffers
+	virtual void colorMask(bool enabled) = 0;
+	virtual void stencilFunc(GLenum func, int ref, unsigned mask) = 0;
+	// face: FRONT, BACK or FRONT_AND_BACK
+	virtual void stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass) = 0;
+
+	// bindings
+	virtual void useProgram(GLuint program) = 0;
+	virtual void bindVertexArray(GLuint vao) = 0;
+	virtual void bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides) = 0;
+	virtual void bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes) = 0;
+	virtual void bindTextures(unsigned first, unsigned count, const GLuint *textures) = 0;
+	virtual void bindSamplers(unsigned first, unsigned count, const GLuint *samplers) = 0;
+
+	// draw calls
+	// indexOffset is in bytes from the start of the index buffer
+	virtual void drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount) = 0;
+	virtual void drawArrays(GLenum mode, unsigned first, unsigned count) = 0;
+	// drawCount DrawElementsIndirectCommand structures read from indirectBuffer at indirectOffset
+	virtual void multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride) = 0;
+};
+
+// Device backed by the current OpenGL context
+class GLDevice : public GraphicsDevice
+{
+public:
+	bool isHeadless() const override { return false; }
+	void installDebugCallback() override;
+
+	GLuint createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData) override;
+	void *mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access) override;
+	void updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data) override;
+	void copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size) override;
+	void deleteBuffer(GLuint buf) override;
+	GLint getBufferOffsetAlignment(GLenum target) override;
+
+	GLsync fenceSync() override;
+	bool waitSync(GLsync sync, uint64_t timeout) override;
+	void deleteSync(GLsync sync) override;
+
+	GLuint createQuery() override;
+	void queryTimestamp(GLuint query) override;
+	bool getQueryResult(GLuint query, uint64_t &result) override;
+	void deleteQuery(GLuint query) override;
+
+	GLuint createVertexArray(util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors) override;
+	void deleteVertexArray(GLuint vao) override;
+	GLuint createTexture(GLenum target, unsigned numMipLevels, GLenum internalFormat, unsigned width, unsigned height) override;
+	void updateTexture(GLuint tex, GLenum target, GLenum imageTarget, int mipLevel, glm::ivec2 offset, glm::ivec2 size, GLenum format, GLenum type, const void *data) override;
+	void setUnpackAlignment(int alignment) override;
+	void deleteTexture(GLuint tex) override;
+	GLuint createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget) override;
+	void deleteFramebuffer(GLuint fbo) override;
+	GLuint createSampler(GLenum minFilter, GLenum magFilter, GLenum wrapMode) override;
+	void deleteSampler(GLuint sampler) override;
+	GLuint createShader(GLenum stage, const char *source) override;
+	void deleteShader(GLuint shader) override;
+	GLuint createProgram(GLuint vs, GLuint gs, GLuint ps) override;
+	void deleteProgram(GLuint program) override;
+	std::string getDriverString() override;
+	bool getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary) override;
+	GLuint createProgramFromBinary(GLenum format, const void *binary, size_t size) override;
+
+	void bindFramebuffer(GLuint fbo) override;
+	void viewport(int x, int y, int width, int height) override;
+	void clear(GLbitfield mask, const glm::vec4 &color, float depth) override;
+	void setEnabled(GLenum cap, bool enabled) override;
+	void polygonMode(GLenum mode) override;
+	void cullFace(GLenum face) override;
+	void depthFunc(GLenum func) override;
+	void depthMask(bool enabled) override;
+	void blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha) override;
+	void blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) override;
+	void colorMask(bool enabled) override;
+	void stencilFunc(GLenum func, int ref, unsigned mask) override;
+	void stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass) override;
+
+	void useProgram(GLuint program) override;
+	void bindVertexArray(GLuint vao) override;
+	void bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides) override;
+	void bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes) override;
+	void bindTextures(unsigned first, unsigned count, const GLuint *textures) override;
+	void bindSamplers(unsigned first, unsigned count, const GLuint *samplers) override;
+
+	void drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount) override;
+	void drawArrays(GLenum mode, unsigned first, unsigned count) override;
+	void multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride) override;
+
+private:
+	GLint ubo_offset_alignment = 0;
+	GLint ssbo_offset_alignment = 0;
+};
+
+// Null device that records commands in memory
+// Buffers are backed by CPU memory so that mapped pointers stay valid,
+// fences are always signaled, timestamp queries get the CPU time, other
+// objects only get a name. Program binaries are made of the driver string
+// and a hash of the shader sources.
+class RecordingDevice : public GraphicsDevice
+{
+public:
+	enum class CommandType
+	{
+		BindFramebuffer,
+		Viewport,
+		Clear,
+		SetEnabled,
+		PolygonMode,
+		CullFace,
+		DepthFunc,
+		DepthMask,
+		BlendEquation,
+		BlendFunc,
+		ColorMask,
+		StencilFunc,
+		StencilOp,
+		UseProgram,
+		BindVertexArray,
+		BindVertexBuffers,
+		BindBuffersRange,
+		BindTextures,
+		BindSamplers,
+		DrawElements,
+		DrawArrays,
+		MultiDrawElementsIndirect,
+		Max
+	};
+
+	struct Command
+	{
+		CommandType type;
+		// mode / cap / target / func, depending on the command
+		GLenum param;
+		// bound object or index buffer
+		GLuint obj;
+		unsigned first;
+		unsigned count;
+		unsigned instanceCount;
+		int baseVertex;
+		unsigned baseInstance;
+		size_t offset;
+		// range in getObjectNames() for multi-bind commands
+		unsigned objects_begin;
+	};
+
+	bool isHeadless() const override { return true; }
+	void installDebugCallback() override {}
+
+	GLuint createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData) override;
+	void *mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access) override;
+	void updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data) override;
+	void copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size) override;
+	void deleteBuffer(GLuint buf) override;
+	GLint getBufferOffsetAlignment(GLenum /*target*/) override { return 256; }
+
+	GLsync fenceSync() override;
+	bool waitSync(GLsync /*sync*/, uint64_t /*timeout*/) override { return true; }
+	void deleteSync(GLsync /*sync*/) override {}
+
+	GLuint createQuery() override { return newName(); }
+	void queryTimestamp(GLuint query) override;
+	bool getQueryResult(GLuint query, uint64_t &result) override;
+	void deleteQuery(GLuint query) override;
+
+	GLuint createVertexArray(util::array_ref<Attribute> /*attribs*/, util::array_ref<unsigned> /*divisors*/) override { return newName(); }
+	void deleteVertexArray(GLuint /*vao*/) override {}
+	GLuint createTexture(GLenum /*target*/, unsigned /*numMipLevels*/, GLenum /*internalFormat*/, unsigned /*width*/, unsigned /*height*/) override { return newName(); }
+	void updateTexture(GLuint /*tex*/, GLenum /*target*/, GLenum /*imageTarget*/, int /*mipLevel*/, glm::ivec2 /*offset*/, glm::ivec2 /*size*/, GLenum /*format*/, GLenum /*type*/, const void * /*data*/) override {}
+	void setUnpackAlignment(int alignment) override { unpack_alignment = alignment; }
+	void deleteTexture(GLuint /*tex*/) override {}
+	GLuint createFramebuffer(util::array_ref<GLuint> /*colorTargets*/, GLuint /*depthTarget*/) override { return newName(); }
+	void deleteFramebuffer(GLuint /*fbo*/) override {}
+	GLuint createSampler(GLenum /*minFilter*/, GLenum /*magFilter*/, GLenum /*wrapMode*/) override { return newName(); }
+	void deleteSampler(GLuint /*sampler*/) override {}
+	GLuint createShader(GLenum stage, const char *source) override;
+	void deleteShader(GLuint shader) override;
+	GLuint createProgram(GLuint vs, GLuint gs, GLuint ps) override;
+	void deleteProgram(GLuint program) override;
+	std::string getDriverString() override { return driver_string; }
+	bool getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary) override;
+	GLuint createProgramFromBinary(GLenum format, const void *binary, size_t size) override;
+
+	void bindFramebuffer(GLuint fbo) override;
+	void viewport(int x, int y, int width, int height) override;
+	void clear(GLbitfield mask, const glm::vec4 &color, float depth) override;
+	void setEnabled(GLenum cap, bool enabled) override;
+	void polygonMode(GLenum mode) override;
+	void cullFace(GLenum face) override;
+	void depthFunc(GLenum func) override;
+	void depthMask(bool enabled) override;
+	void blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha) override;
+	void blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) override;
+	// count: enabled
+	void colorMask(bool enabled) override;
+	// param: func, first: ref, count: mask
+	void stencilFunc(GLenum func, int ref, unsigned mask) override;
+	// param: face, first: stencil fail op, obj: depth fail op, count: depth pass op
+	void stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass) override;
+
+	void useProgram(GLuint program) override;
+	void bindVertexArray(GLuint vao) override;
+	void bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides) override;
+	void bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes) override;
+	void bindTextures(unsigned first, unsigned count, const GLuint *textures) override;
+	void bindSamplers(unsigned first, unsigned count, const GLuint *samplers) override;
+
+	void drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount) override;
+	void drawArrays(GLenum mode, unsigned first, unsigned count) override;
+	// obj: index buffer, objects: indirect buffer, count: draw count, first: stride
+	void multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride) override;
+
+	// if false, only the per-type counters are updated
+	void setStoreCommands(bool store) {
+		store_commands = store;
+	}
+
+	const std::vector<Command> &getCommands() const {
+		return commands;
+	}
+
+	const std::vector<GLuint> &getObjectNames() const {
+		return object_names;
+	}
+
+	unsigned getCommandCount(CommandType type) const {
+		return counters[static_cast<int>(type)];
+	}
+
+	unsigned getDrawCount() const;
+	// everything that is not a draw or a clear
+	unsigned getStateChangeCount() const;
+	size_t getBufferMemoryUsed() const {
+		return buffer_memory_used;
+	}
+
+	int getUnpackAlignment() const {
+		return unpack_alignment;
+	}
+
+	// binaries of another driver string are rejected (driver update)
+	void setDriverString(std::string str) {
+		driver_string = std::move(str);
+	}
+
+	// shaders compiled, programs linked and programs created from a binary
+	unsigned getShadersCompiled() const {
+		return shaders_compiled;
+	}
+
+	unsigned getProgramsLinked() const {
+		return programs_linked;
+	}
+
+	unsigned getProgramsFromBinary() const {
+		return programs_from_binary;
+	}
+
+	// forget recorded commands and reset the counters (objects are kept)
+	void reset();
+
+private:
+	GLuint newName() {
+		return next_name++;
+	}
+	Command &record(CommandType type);
+	unsigned recordObjects(unsigned count, const GLuint *objects);
+
+	bool store_commands = true;
+	std::vector<Command> commands;
+	std::vector<GLuint> object_names;
+	unsigned counters[static_cast<int>(CommandType::Max)] = {};
+	std::unordered_map<GLuint, std::vector<char> > buffers;
+	size_t buffer_memory_used = 0;
+	std::unordered_map<GLuint, uint64_t> query_results;
+	std::string driver_string = "RecordingDevice";
+	// source hash of shaders and programs
+	std::unordered_map<GLuint, size_t> shader_hashes;
+	std::unordered_map<GLuint, size_t> program_hashes;
+	unsigned shaders_compiled = 0;
+	unsigned programs_linked = 0;
+	unsigned programs_from_binary = 0;
+	GLuint next_name = 1;
+	uintptr_t next_sync = 1;
+	int unpack_alignment = 4;
+	// dummy command when commands are not stored
+	Command scratch;
+};
+
+// device used by the rendering helpers (a GLDevice by default)
+GraphicsDevice &getGraphicsDevice();
+// nullptr restores the default GL device. The device must outlive all objects created with it.
+void setGraphicsDevice(GraphicsDevice *device);
+
+#endif /* end of include guard: DEVICE_HPP */
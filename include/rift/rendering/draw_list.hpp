@@ -0,0 +1,166 @@
+#ifndef DRAW_LIST_HPP
+#define DRAW_LIST_HPP
+
+#include <rendering/render_queue.hpp>
+#include <rendering/culling.hpp>
+#include <functional>
+#include <vector>
+
+class Scene;
+class OcclusionBuffer;
+class LodSelector;
+struct MeshNode;
+
+namespace util
+{
+	class thread_pool;
+}
+
+// A visible draw, recorded without any graphics API call
+struct DrawPacket
+{
+	uint64_t sortKey;
+	DrawItem item;
+};
+
+// Visible draws recorded by a worker thread
+// Sort ids are assigned on first use, which is not thread-safe: the packets of
+// objects seen for the first time get their sort key from resolveSortKeys, on
+// the thread that sorts.
+class DrawPacketList
+{
+public:
+	void clear() {
+		packets.clear();
+		pendingKeys.clear();
+	}
+
+	// depth: see RenderQueue::makeSortKey
+	void push(const DrawItem &item, float depth);
+	void resolveSortKeys();
+
+	const std::vector<DrawPacket> &getPackets() const {
+		return packets;
+	}
+
+	size_t size() const {
+		return packets.size();
+	}
+
+private:
+	struct PendingKey
+	{
+		unsigned packet;
+		float depth;
+	};
+
+	std::vector<DrawPacket> packets;
+	std::vector<PendingKey> pendingKeys;
+};
+
+// Mesh nodes are processed in partitions: ranges of buckets of the entity map,
+// each handled by a single task. There are more partitions than threads, to
+// balance the load (mesh nodes are not evenly distributed over the buckets);
+// results are combined in partition order, so they do not depend on the number
+// of threads.
+unsigned getNumPartitions(size_t numBuckets, const util::thread_pool *pool);
+
+// Partition: a struct with firstBucket and endBucket members
+template <typename Partition>
+void splitBuckets(size_t numBuckets, const util::thread_pool *pool, std::vector<Partition> &partitions)
+{
+	const auto numPartitions = getNumPartitions(numBuckets, pool);
+	partitions.resize(numPartitions);
+	for (auto i = 0u; i < numPartitions; ++i) {
+		partitions[i].firstBucket = numBuckets * i / numPartitions;
+		partitions[i].endBucket = numBuckets * (i + 1) / numPartitions;
+	}
+}
+
+// fn(begin, end) on ranges of partitions, on the threads of pool, or on the
+// calling thread if pool is null
+void runPartitions(unsigned numPartitions, util::thread_pool *pool, const std::function<void(unsigned, unsigned)> &fn);
+
+// draws and triangles recorded at each level of detail
+struct LodStats
+{
+	unsigned numDraws[kMaxMeshLods] = {};
+	unsigned numTriangles[kMaxMeshLods] = {};
+};
+
+// First phase of the two-phase draw submission
+// The mesh nodes of the scene are split into partitions (ranges of buckets of
+// the entity map). Worker threads cull the partitions and record the visible
+// draws as packets, each partition into its own draw list. The lists are then
+// merged in partition order, so the result does not depend on the number of
+// threads; sorting and GL submission happen on the rendering thread.
+class DrawListRecorder
+{
+public:
+	// Reads scene.meshNodes and the world matrices of scene.transforms (updated
+	// beforehand), which must not change during the call. Mesh nodes without
+	// material use defaultMaterial.
+	// pool can be null (everything is recorded on the calling thread).
+	// Objects inside the frustum are then tested against occlusion, if not null
+	// (finished, and set up with the same view).
+	// The level of detail of the visible mesh nodes is picked by lods, and kept in
+	// MeshNode::lod for the next frame; level 0 is drawn if lods is null.
+	void record(
+		Scene &scene,
+		Material &defaultMaterial,
+		const glm::mat4 &viewProj,
+		util::thread_pool *pool,
+		const OcclusionBuffer *occlusion = nullptr,
+		const LodSelector *lods = nullptr);
+
+	// appends the recorded packets to a render queue (does not sort it)
+	void merge(RenderQueue &queue) const;
+
+	unsigned getNumCandidates() const {
+		return numCandidates;
+	}
+
+	unsigned getNumVisible() const {
+		return numVisible;
+	}
+
+	// inside the frustum, but hidden by the occluders
+	unsigned getNumOccluded() const {
+		return numOccluded;
+	}
+
+	const LodStats &getLodStats() const {
+		return lodStats;
+	}
+
+private:
+	struct Partition
+	{
+		size_t firstBucket = 0;
+		size_t endBucket = 0;
+		std::vector<DrawItem> candidates;
+		std::vector<MeshNode*> nodes;
+		CullingBounds bounds;
+		std::vector<unsigned> visible;
+		DrawPacketList packets;
+		unsigned numOccluded = 0;
+		LodStats lodStats;
+	};
+
+	void recordPartition(
+		Partition &partition,
+		Scene &scene,
+		Material &defaultMaterial,
+		const FrustumPlanes &frustum,
+		const glm::mat4 &viewProj,
+		const OcclusionBuffer *occlusion,
+		const LodSelector *lods);
+
+	std::vector<Partition> partitions;
+	unsigned numCandidates = 0;
+	unsigned numVisible = 0;
+	unsigned numOccluded = 0;
+	LodStats lodStats;
+};
+
+#endif /* end of include guard: DRAW_LIST_HPP */
@@ -0,0 +1,66 @@
+#ifndef INDIRECT_DRAWS_HPP
+#define INDIRECT_DRAWS_HPP
+
+#include <rendering/opengl4.hpp>
+#include <rendering/render_queue.hpp>
+#include <vector>
+
+// GL layout of an indirect indexed draw
+struct DrawElementsIndirectCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// Indirect draws for a sorted render queue, over the mesh megabuffer
+// Consecutive draws with the same material (same program and bindings) end up
+// in one batch of commands, submitted with a single multi-draw. Runs of draws
+// sharing a mesh and level of detail become instanced commands, as in the direct path. Meshes that
+// are not in the megabuffer get direct batches.
+// Draw i of the queue uses instance i of the per-frame instance data.
+class IndirectDrawBuilder
+{
+public:
+	struct Batch
+	{
+		Material *material;
+		// null for indirect batches
+		Mesh *mesh;
+		// indirect batch: range of commands; direct batch: range of instances
+		unsigned first;
+		unsigned count;
+		// direct batch: level of detail of the mesh
+		unsigned lod;
+	};
+
+	// instancingThreshold: see SceneRenderer::setInstancingThreshold
+	void build(const RenderQueue &queue, unsigned instancingThreshold);
+
+	// copies the commands to a transient indirect buffer (valid for the current frame)
+	BufferSlice upload(GraphicsContext &gc) const;
+
+	const std::vector<DrawElementsIndirectCommand> &getCommands() const {
+		return commands;
+	}
+
+	const std::vector<Batch> &getBatches() const {
+		return batches;
+	}
+
+private:
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<Batch> batches;
+};
+
+// issues the commands [firstCommand, firstCommand + numCommands) of an uploaded command buffer
+// (the megabuffer vertex buffer must be bound)
+void submitIndirectBatch(
+	const MeshMegabuffer &megabuffer,
+	const BufferSlice &indirectBuffer,
+	unsigned firstCommand,
+	unsigned numCommands);
+
+#endif /* end of include guard: INDIRECT_DRAWS_HPP */
@@ -0,0 +1,109 @@
+#ifndef LIGHT_CLUSTERING_HPP
+#define LIGHT_CLUSTERING_HPP
+
+#include <common.hpp>
+#include <utils/array_ref.hpp>
+#include <vector>
+
+namespace util
+{
+	class thread_pool;
+}
+
+// Bounding sphere of a light in view space
+struct ClusterLight
+{
+	glm::vec3 viewPos;
+	float radius;
+};
+
+// Froxel grid: screen-space tiles, depth slices distributed exponentially
+// between the near and far planes of the projection
+struct ClusterGridParams
+{
+	unsigned tilesX = 16;
+	unsigned tilesY = 9;
+	unsigned slices = 24;
+	// extra lights touching a cluster are dropped
+	unsigned maxLightsPerCluster = 128;
+};
+
+// Light-to-cluster assignment for clustered forward shading
+// Clusters are indexed by (slice * tilesY + tileY) * tilesX + tileX, tile (0,0)
+// being at the bottom left of the viewport. The slice of a view depth d is
+// floor(log(d) * sliceScale + sliceBias).
+// The results (per-cluster ranges in a light index list) are meant to be
+// uploaded as is; light indices are indices in the array passed to assignLights.
+class LightClusterer
+{
+public:
+	// rebuilds the cluster bounds if the projection or the grid changed
+	// (perspective projections only)
+	void setup(const glm::mat4 &projMat, const ClusterGridParams &params);
+
+	// SIMD kernel, slices are distributed over the thread pool (can be null)
+	void assignLights(util::array_ref<ClusterLight> lights, util::thread_pool *pool);
+	// brute-force reference: every light against every cluster (same results)
+	void assignLightsReference(util::array_ref<ClusterLight> lights);
+
+	// (offset, count) in the light index list, per cluster
+	const std::vector<glm::uvec2> &getClusters() const {
+		return clusters;
+	}
+
+	const std::vector<uint32_t> &getLightIndices() const {
+		return lightIndices;
+	}
+
+	const ClusterGridParams &getParams() const {
+		return params;
+	}
+
+	unsigned getNumClusters() const {
+		return params.tilesX * params.tilesY * params.slices;
+	}
+
+	float getSliceScale() const {
+		return sliceScale;
+	}
+
+	float getSliceBias() const {
+		return sliceBias;
+	}
+
+	// light references dropped because of maxLightsPerCluster during the last assignment
+	unsigned getNumDroppedLights() const {
+		return numDroppedLights;
+	}
+
+private:
+	void buildClusterBounds();
+	unsigned getSlice(float viewDepth) const;
+	// fills the scratch lists of one slice
+	void assignSlice(unsigned slice, util::array_ref<ClusterLight> lights);
+	// scratch lists -> clusters + lightIndices
+	void compact();
+
+	ClusterGridParams params;
+	glm::mat4 projMat = glm::mat4(0.0f);
+	float nearPlane = 0.0f;
+	float farPlane = 0.0f;
+	float sliceScale = 0.0f;
+	float sliceBias = 0.0f;
+	// clusters of a slice are padded to a multiple of 4 (empty boxes)
+	unsigned sliceStride = 0;
+	// view-space cluster bounds (SoA)
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+	// per-light slice range
+	std::vector<glm::uvec2> lightSlices;
+	// per-cluster light lists, maxLightsPerCluster entries each
+	std::vector<uint32_t> scratchIndices;
+	std::vector<uint32_t> scratchCounts;
+	std::vector<unsigned> sliceDropped;
+	unsigned numDroppedLights = 0;
+	std::vector<glm::uvec2> clusters;
+	std::vector<uint32_t> lightIndices;
+};
+
+#endif /* end of include guard: LIGHT_CLUSTERING_HPP */
@@ -0,0 +1,46 @@
+#ifndef LOD_HPP
+#define LOD_HPP
+
+#include <renderer_common.hpp>
+
+struct Mesh;
+
+// Level of detail selection thresholds
+struct LodParams
+{
+	// geometric error allowed on screen (pixels)
+	float maxPixelError = 1.0f;
+	// global bias: the allowed error is scaled by 2^bias (> 0 selects coarser levels)
+	float bias = 0.0f;
+	// a coarser level is picked when its error goes below this fraction of the
+	// allowed error, and kept until it goes above it (no popping at the threshold)
+	float hysteresis = 0.75f;
+};
+
+// Picks the level of detail of the meshes for a view
+// The error of each level (Mesh::lodErrors) is scaled with the object and
+// projected at the distance of the nearest point of its bounding sphere: the
+// larger the sphere on screen, the finer the level.
+class LodSelector
+{
+public:
+	LodSelector() = default;
+	// projMatrix: perspective projection; viewportHeight in pixels
+	LodSelector(const glm::vec3 &eye, const glm::mat4 &projMatrix, float viewportHeight, const LodParams &params);
+
+	// on-screen error (pixels) of an object-space error, for an object with the given
+	// world-space bounding sphere and scale
+	float getProjectedError(float error, const glm::vec3 &center, float radius, float scale) const;
+
+	// previous: level picked for the object in the last frame
+	unsigned select(const Mesh &mesh, const glm::vec3 &center, float radius, unsigned previous) const;
+
+private:
+	glm::vec3 eye;
+	// pixels per world unit at distance 1
+	float pixelsPerUnit = 1.0f;
+	float allowedError = 1.0f;
+	float hysteresis = 0.75f;
+};
+
+#endif /* end of include guard: LOD_HPP */
@@ -105,6 +105,7 @@ enum NVGimageFlags {
 	NVG_IMAGE_REPEATY			= 1<<2,		// Repeat image in Y direction.
 	NVG_IMAGE_FLIPY				= 1<<3,		// Flips (inverses) image in Y direction when rendered.
 	NVG_IMAGE_PREMULTIPLIED		= 1<<4,		// Image data has premultiplied alpha.
+	NVG_IMAGE_NEAREST			= 1<<5,		// Image interpolation is Nearest instead Linear
 };
 
 // Begin drawing a new frame
@@ -450,6 +451,41 @@ void nvgFill(NVGcontext* ctx);
 void nvgStroke(NVGcontext* ctx);
 
 
+//
+// Retained paths
+//
+// A retained path keeps the commands of a path which does not change between frames
+// (panels, frames of a HUD), and caches its tessellation. The tessellation is keyed by
+// the scale of the transform (or the whole linear part when the transform is not
+// a rotation with uniform scale) and by the stroke parameters; when it is the same as
+// in an earlier fill or stroke, the cached vertices are only moved by the rotation
+// and translation of the current transform, without flattening or expanding the path.
+//
+// The retained path is not owned by the context, delete it before the context.
+
+typedef struct NVGretainedPath NVGretainedPath;
+
+// Creates a retained path from the current path. The path is kept in the local space
+// of the current transform: it is drawn with the transform current at fill or stroke.
+// Returns NULL if the current path is empty.
+NVGretainedPath* nvgRetainPath(NVGcontext* ctx);
+
+// Deletes a retained path.
+void nvgDeleteRetainedPath(NVGcontext* ctx, NVGretainedPath* path);
+
+// Fills the retained path with current fill style and transform.
+// Does not change the current path.
+void nvgFillRetained(NVGcontext* ctx, NVGretainedPath* path);
+
+// Strokes the retained path with current stroke style and transform.
+// Does not change the current path.
+void nvgStrokeRetained(NVGcontext* ctx, NVGretainedPath* path);
+
+// Number of retained fills and strokes since nvgBeginFrame() which reused a cached
+// tessellation (hits) or tessellated the path (misses). Pointers can be NULL.
+void nvgRetainedStats(NVGcontext* ctx, int* hits, int* misses);
+
+
 //
 // Text
 //
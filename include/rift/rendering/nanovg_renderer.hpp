@@ -0,0 +1,143 @@
+#ifndef NANOVG_RENDERER_HPP
+#define NANOVG_RENDERER_HPP
+
+#include <rendering/opengl4.hpp>
+#include <rendering/nanovg/nanovg.h>
+#include <rendering/nanovg/nanovg_gl.h>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------
+// nanovg render backend on the graphics context
+// Replaces the GL3 backend of nanovg_gl.h. The paths, vertices and fragment
+// uniforms of a frame are collected on the CPU, and copied at flush
+// (nvgEndFrame) to the transient buffers of the graphics context instead of
+// re-specifying GL buffers with glBufferData. All commands go through the
+// graphics device (state cache, recording device), and the samplers are the
+// shared samplers of the context.
+class NanoVGRenderer
+{
+public:
+	struct Stats
+	{
+		// fills, strokes and triangle sets
+		unsigned numCalls = 0;
+		unsigned numDrawCalls = 0;
+		unsigned numVertices = 0;
+		// vertices and uniforms
+		size_t transientBytes = 0;
+	};
+
+	// flags: NVG_ANTIALIAS, NVG_STENCIL_STROKES (NVGcreateFlags of nanovg_gl.h)
+	NanoVGRenderer(GraphicsContext &gc, int flags);
+	~NanoVGRenderer();
+
+	NVGcontext *getContext() {
+		return ctx;
+	}
+
+	// stats of the last flush
+	const Stats &getStats() const {
+		return lastStats;
+	}
+
+	// nanovg image of a texture owned by the caller
+	int createImageFromTexture(GLuint texture, int width, int height, int imageFlags);
+
+private:
+	// NVGparams callbacks
+	struct Callbacks;
+
+	// see nanovg.glsl
+	struct FragUniforms
+	{
+		// mat3 as 3 vec4
+		float scissorMat[12];
+		float paintMat[12];
+		NVGcolor innerCol;
+		NVGcolor outerCol;
+		float scissorExt[2];
+		float scissorScale[2];
+		float extent[2];
+		float radius;
+		float feather;
+		float strokeMult;
+		float strokeThr;
+		int texType;
+		int type;
+	};
+
+	enum class CallType
+	{
+		Fill,
+		ConvexFill,
+		Stroke,
+		Triangles
+	};
+
+	struct Call
+	{
+		CallType type;
+		int image;
+		unsigned firstPath;
+		unsigned numPaths;
+		unsigned triangleOffset;
+		unsigned triangleCount;
+		// index of the first FragUniforms
+		unsigned uniformIndex;
+	};
+
+	struct Path
+	{
+		unsigned fillOffset;
+		unsigned fillCount;
+		unsigned strokeOffset;
+		unsigned strokeCount;
+	};
+
+	struct Image
+	{
+		GLuint texture;
+		glm::ivec2 size;
+		int type;
+		int flags;
+		// false for the textures of createImageFromTexture
+		bool owned;
+	};
+
+	bool convertPaint(FragUniforms &frag, const NVGpaint &paint, const NVGscissor &scissor,
+		float width, float fringe, float strokeThr);
+	unsigned addPaths(Call &call, const NVGpath *paths, int npaths, bool fills);
+	// binds the uniforms of the call and the texture of the image
+	void setUniforms(unsigned uniformIndex, int image);
+	void flush();
+	void drawFill(const Call &call);
+	void drawConvexFill(const Call &call);
+	void drawStroke(const Call &call);
+	void drawTriangles(const Call &call);
+	void drawArrays(GLenum mode, unsigned first, unsigned count);
+	void reset();
+
+	GraphicsContext &gc;
+	int flags;
+	NVGcontext *ctx = nullptr;
+	GLuint program = 0;
+	VAO vao;
+	glm::vec2 viewSize;
+	std::unordered_map<int, Image> images;
+	int nextImageId = 1;
+	// frame data
+	std::vector<Call> calls;
+	std::vector<Path> paths;
+	std::vector<NVGvertex> vertices;
+	std::vector<FragUniforms> uniforms;
+	// bindings of the frame
+	BufferSlice vertexBuffer;
+	BufferSlice uniformBuffer;
+	size_t uniformStride = 0;
+	Stats stats;
+	Stats lastStats;
+};
+
+#endif /* end of include guard: NANOVG_RENDERER_HPP */
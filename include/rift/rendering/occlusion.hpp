@@ -0,0 +1,151 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <mesh_data.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Scene;
+
+// Low-poly triangle proxy of a mesh, drawn into the occlusion buffer
+struct OccluderMesh
+{
+	using Ptr = std::unique_ptr<OccluderMesh>;
+
+	// object space
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned> indices;
+
+	unsigned getNumTriangles() const {
+		return static_cast<unsigned>(indices.size() / 3);
+	}
+
+	// Triangles of the triangle-list submeshes. Meshes with more than maxTriangles
+	// triangles keep their largest ones: the proxy is a part of the surface of the
+	// mesh, so it never hides what the mesh does not hide.
+	// Returns null if there are no triangles, or if the kept triangles cover less
+	// than half of the surface (finely tessellated meshes: not worth a proxy).
+	static Ptr fromMeshData(const MeshData &data, unsigned maxTriangles);
+};
+
+// Small software depth buffer for occlusion culling
+// With SSE, the vertices of an occluder are transformed 4 at a time, the
+// triangles set up 4 at a time and rasterized 4 pixels at a time, and the 8
+// corners of the tested boxes are projected 4 at a time.
+// The depth written is the farthest depth of the triangle within the pixel, so
+// the buffer is never nearer than the occluders. The max depth of each 8x8 tile
+// is kept, so that most tests are decided per tile, without touching the pixels.
+// Depth is normalized (0 near, 1 far), rows go from the bottom of the screen.
+class OcclusionBuffer
+{
+public:
+	// the size is rounded up to a multiple of the tile size
+	OcclusionBuffer(unsigned width = 256, unsigned height = 128);
+
+	unsigned getWidth() const {
+		return width;
+	}
+
+	unsigned getHeight() const {
+		return height;
+	}
+
+	// clears the buffer and sets the view of the next rasterize/isOccluded calls
+	void clear(const glm::mat4 &viewProj);
+	// triangles are clipped against the near plane
+	void rasterize(const OccluderMesh &occluder, const glm::mat4 &modelToWorld);
+	// computes the tile depths, call after rasterizing the occluders
+	void finish();
+
+	// world-space AABB: true if it is entirely behind the occluders
+	// (boxes crossing the near plane are never occluded)
+	bool isOccluded(const glm::vec3 &center, const glm::vec3 &extent) const;
+
+	float getDepth(unsigned x, unsigned y) const {
+		return depth[y * width + x];
+	}
+
+	// when disabled, uses the scalar rasterizer and box test (same results)
+	void setSimdEnabled(bool enabled) {
+		simd = enabled;
+	}
+
+	unsigned getNumTrianglesRasterized() const {
+		return numTriangles;
+	}
+
+private:
+	// clip-space vertices of the occluder, and their screen-space position
+	// (pixels, depth) if they are in front of the near plane
+	void transformVertices(const std::vector<glm::vec3> &vertices, const glm::mat4 &modelToClip);
+	// triangle with a vertex behind the near plane
+	void rasterizeClipped(unsigned i0, unsigned i1, unsigned i2);
+	// screen-space vertices
+	void rasterizeTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2);
+	// up to 4 triangles (offsets in indices) with their vertices in front of the near plane
+	void rasterizeTriangles4(const unsigned *indices, const unsigned *triangles, unsigned count);
+	// screen-space bounds of a box, false if it crosses the near plane
+	bool projectBox(const glm::vec3 &center, const glm::vec3 &extent, glm::vec3 &smin, glm::vec3 &smax) const;
+
+	unsigned width;
+	unsigned height;
+	unsigned tilesX;
+	unsigned tilesY;
+	glm::mat4 viewProj;
+	std::vector<float> depth;
+	std::vector<float> tileMaxDepth;
+	// vertices of the occluder being rasterized
+	std::vector<glm::vec4> clipVertices;
+	std::vector<glm::vec4> screenVertices;
+	std::vector<uint8_t> inFront;
+	bool simd = true;
+	unsigned numTriangles = 0;
+};
+
+// Occlusion culling of a scene view
+// beginFrame() hands the occluders of the scene to a worker thread owned by the
+// culler, which rasterizes them while the rendering thread goes on with the
+// frame; getBuffer() waits for it.
+class OcclusionCuller
+{
+public:
+	OcclusionCuller(unsigned width = 256, unsigned height = 128);
+	~OcclusionCuller();
+
+	OcclusionCuller(const OcclusionCuller &) = delete;
+	OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+	// Reads scene.meshNodes and the world matrices of scene.transforms: they must
+	// not change until getBuffer() returns. The mesh nodes marked as occluders
+	// that have a proxy and intersect the view frustum are rasterized.
+	void beginFrame(const Scene &scene, const glm::mat4 &viewProj);
+	// waits for the occluders of the frame
+	const OcclusionBuffer &getBuffer();
+
+	// occluders rasterized by the last frame
+	unsigned getNumOccluders() const {
+		return numOccluders;
+	}
+
+private:
+	void workerMain();
+	void rasterizeOccluders(const Scene &scene, const glm::mat4 &viewProj);
+
+	OcclusionBuffer buffer;
+	unsigned numOccluders = 0;
+	// frame handed to the worker, pending until rasterized
+	const Scene *jobScene = nullptr;
+	glm::mat4 jobViewProj;
+	bool jobPending = false;
+	bool quit = false;
+	std::mutex mutex;
+	std::condition_variable jobReady;
+	std::condition_variable jobDone;
+	std::thread worker;
+};
+
+#endif /* end of include guard: OCCLUSION_HPP */
@@ -13,6 +13,15 @@
 #include <asset.hpp>
 #include <asset_database.hpp>
 #include <mesh_data.hpp>
+#include <rendering/device.hpp>
+#include <rendering/state_cache.hpp>
+#include <rendering/program_cache.hpp>
+#include <rendering/shader_preprocessor.hpp>
+#include <rendering/shader_variants.hpp>
+#include <utils/tlsf_allocator.hpp>
+#include <deque>
+#include <functional>
+#include <map>
 
 struct Buffer;
 class Texture;
@@ -21,6 +30,7 @@ class TextureCubeMap;
 class RenderTarget;
 class VAO;
 class GraphicsContext;
+struct OccluderMesh;
 
 // constants 
 // TODO do we need them?
@@ -57,28 +67,41 @@ void checkForUnusualColorFormats(ElementFormat f);
 bool isSamplerType(GLenum type);
 
 //---------------------------
-// buffers
+// buffers (through the current device)
 struct PoolBlockIndex
 {
 	unsigned page_index;
+	// block handle in the page allocator
 	unsigned block_index;
 };
 GLuint allocBufferRaw(GLenum target, size_t size, GLbitfield flags, const void *initialData);	
 void updateBufferRaw(GLuint buf, GLenum target, int offset, int size, const void *data);
+void copyBufferRaw(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size);
 
 //---------------------------
 // shader utils
-struct ShaderKeyword
-{
-	std::string define;
-	std::string value;
-};
 GLuint compileShader(
 	const char *source,
 	const char *include_path,
 	GLenum stage,
 	util::array_ref<ShaderKeyword> keywords);
 GLuint compileProgram(GLuint vs, GLuint gs, GLuint ps);
+// source given to the driver: #version, stage and keyword defines, includes
+// (through the include graph of getShaderPreprocessor())
+std::string preprocessShader(
+	const char *source,
+	const char *include_path,
+	GLenum stage,
+	util::array_ref<ShaderKeyword> keywords);
+// program from the vertex and fragment stages of the sources, through the program cache of the context
+// (paths: files of the sources, for includes and the include graph)
+GLuint compileProgram(
+	GraphicsContext &gc,
+	const char *vsSource,
+	const char *vsPath,
+	const char *psSource,
+	const char *psPath,
+	util::array_ref<ShaderKeyword> keywords);
 std::string loadShaderSource(const char *path);
 
 //---------------------------
@@ -96,16 +119,30 @@ GLuint createTexture2D(ElementFormat colorFormat, unsigned numMipLevels, unsigne
 // debug
 void setDebugCallback();
 
+//---------------------------
+// buffer slices
+// A range inside a GL buffer object (does not own the storage)
+struct BufferSlice
+{
+	GLuint obj = 0;
+	size_t offset = 0;
+	size_t size = 0;
+	// persistently mapped pointer to the start of the range
+	void *ptr = nullptr;
+};
+
 //---------------------------
 // binding helpers
-void bindVertexBuffers(util::array_ref<const Buffer*> vbs, const VAO &vao);	
-void bindBuffersRangeHelper(unsigned first, util::array_ref<const Buffer*> buffers);
+void bindVertexBuffers(util::array_ref<BufferSlice> vbs, const VAO &vao);	
+// binds uniform buffers
+void bindBuffersRangeHelper(unsigned first, util::array_ref<BufferSlice> buffers);
+void bindBuffersRangeHelper(GLenum target, unsigned first, util::array_ref<BufferSlice> buffers);
 
 //---------------------------
 // draw helpers
 void drawIndexed(
 	GLenum mode,
-	const Buffer &ib,
+	const BufferSlice &ib,
 	unsigned firstVertex,
 	unsigned firstIndex,
 	unsigned indexCount,
@@ -123,16 +160,17 @@ public:
 	VAO() = default;
 	~VAO() {
 		if (obj)
-			gl::DeleteVertexArrays(1, &obj);
+			getGraphicsDevice().deleteVertexArray(obj);
 	}
-	void create(unsigned num_buffers, util::array_ref<Attribute> attribs);
+	// divisors: instance divisor of each buffer slot (per-vertex if empty)
+	void create(unsigned num_buffers, util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors = {});
 	GLuint obj = 0;
 	util::small_vector<int, kMaxVertexBufferBindings> strides;
 };
 
 //---------------------------
 // buffer helper
-struct Buffer {
+struct Buffer : public BufferSlice {
 	using Ptr = std::unique_ptr < Buffer > ;
 	Buffer(GraphicsContext &gc_) : gc(gc_)
 	{}
@@ -142,14 +180,11 @@ struct Buffer {
 	
 	GraphicsContext &gc;
 	GLenum target;
-	GLuint obj;
-	// -1 if not part of a pool
-	unsigned pool_index;
 	// (-1, -1) if not part of a pool
 	PoolBlockIndex block_index;
-	size_t offset;
-	size_t size;
-	void *ptr;
+	// never moved by GraphicsContext::compactBufferPools (for owners that keep
+	// obj or offset elsewhere)
+	bool pinned = false;
 };
 
 template <typename T>
@@ -164,9 +199,9 @@ struct TBuffer {
 template <typename T>
 struct TTransientBuffer {
 	T *map() {
-		return static_cast<T*>(buf->ptr);
+		return static_cast<T*>(buf.ptr);
 	}
-	Buffer *buf;
+	BufferSlice buf;
 };
 
 // Texture assets
@@ -206,7 +241,7 @@ public:
 
 	~Texture2D()
 	{
-		gl::DeleteTextures(1, &id);
+		getGraphicsDevice().deleteTexture(id);
 	}
 
 	void update(
@@ -299,7 +334,7 @@ public:
 	~RenderTarget()
 	{
 		if (fbo)
-			gl::DeleteFramebuffers(1, &fbo);
+			getGraphicsDevice().deleteFramebuffer(fbo);
 	}
 
 	bool hasDepthTexture() const {
@@ -332,9 +367,75 @@ public:
 	Texture2D::Ptr depth_target;
 };
 
+// Vertex and index storage shared by all static meshes, so that meshes can
+// be drawn without rebinding buffers (and with multi-draw indirect)
+// Vertices are sub-allocated in units of one vertex, indices (16-bit) in bytes.
+class MeshMegabuffer
+{
+public:
+	using Ptr = std::unique_ptr<MeshMegabuffer>;
+
+	struct Allocation
+	{
+		uint32_t vertexBlock = util::tlsf_allocator::invalid_handle;
+		uint32_t indexBlock = util::tlsf_allocator::invalid_handle;
+		// relative to the vertex buffer binding
+		unsigned baseVertex = 0;
+		// relative to the start of the index buffer object
+		unsigned firstIndex = 0;
+	};
+
+	MeshMegabuffer(GraphicsContext &gc, unsigned vertexStride, unsigned maxVertices, unsigned maxIndices);
+
+	// returns false if there is not enough space left
+	bool allocate(unsigned numVertices, unsigned numIndices, Allocation &out);
+	// the ranges are reused once the GPU has finished the frames in flight
+	// (see GraphicsContext::deferUntilFrameComplete)
+	void free(Allocation &alloc);
+
+	void *getVertexData(const Allocation &alloc) const;
+	uint16_t *getIndexData(const Allocation &alloc) const;
+
+	// bind with the vertex stride
+	const Buffer &getVertexBuffer() const {
+		return *vbo;
+	}
+
+	// the index buffer slice starts at the beginning of the buffer object (firstIndex is absolute)
+	const BufferSlice &getIndexBuffer() const {
+		return indexBinding;
+	}
+
+	unsigned getVertexStride() const {
+		return vertexStride;
+	}
+
+	size_t getBytesUsed() const {
+		return ((size_t)vertexAllocator.bytes_used() >> util::tlsf_allocator::granularity_log2) * vertexStride
+			+ indexAllocator.bytes_used();
+	}
+
+private:
+	GraphicsContext &gc;
+	unsigned vertexStride;
+	Buffer::Ptr vbo;
+	Buffer::Ptr ibo;
+	BufferSlice indexBinding;
+	util::tlsf_allocator vertexAllocator;
+	util::tlsf_allocator indexAllocator;
+};
+
 class GraphicsContext
 {
 public:
+	// framesInFlight: number of frames the CPU can record before reusing 
+	// the transient memory of an earlier frame (2-4)
+	// extraTransientRings: opt-in, rings created on top of that instead of waiting
+	// when the GPU is late (0-2, the CPU then runs further ahead)
+	// installs the state cache in front of the current graphics device
+	GraphicsContext(unsigned framesInFlight = 3, unsigned extraTransientRings = 0);
+	~GraphicsContext();
+
 	void initialize();
 	void beginFrame();
 	void endFrame();
@@ -348,9 +449,21 @@ public:
 
 	// buffer_pool.cpp
 	Buffer::Ptr createBuffer(GLenum target, size_t size, const void *initialData = nullptr);
-	Buffer *createTransientBuffer(GLenum target, size_t size, const void *initialData = nullptr);
+	// transient buffers are valid until the end of the current frame
+	BufferSlice createTransientBuffer(GLenum target, size_t size, const void *initialData = nullptr);
+	// fn runs once the GPU has finished the current frame (or the last one,
+	// between frames), e.g. to reuse a range of a buffer that the draws
+	// of the frames in flight may still read
+	void deferUntilFrameComplete(std::function<void()> fn);
 	void deleteBuffer(Buffer &buf);
 
+	// Optional: moves the buffers out of the pool pages that are less than
+	// maxOccupancy full, and releases those pages once the frames in flight are
+	// done. Call it between beginFrame and endFrame after unloading large sets of
+	// long-lived buffers (meshes). The obj, offset and ptr of a moved buffer
+	// change; pages holding a pinned buffer are left alone.
+	void compactBufferPools(float maxOccupancy = 0.25f);
+
 	template <typename T>
 	TTransientBuffer<T> createTransientBuffer() {
 		return TTransientBuffer<T> { createTransientBuffer(gl::UNIFORM_BUFFER, sizeof(T)) };
@@ -358,58 +471,158 @@ public:
 
 	// helper
 	template <typename T>
-	Buffer *createTransientBuffer(GLenum target, const T &data)
+	BufferSlice createTransientBuffer(GLenum target, const T &data)
 	{
-		auto buf = createTransientBuffer(target, sizeof(T), &data);
-		return buf;
+		return createTransientBuffer(target, sizeof(T), &data);
 	}
 
 	unsigned getFrameCounter() const {
 		return frame_counter;
 	}
 
+	// bytes of transient memory used during the last completed frame
+	size_t getTransientBytesUsed() const {
+		return transient_last_bytes_used;
+	}
+
+	// maximum number of bytes of transient memory used in a single frame
+	size_t getTransientHighWaterMark() const {
+		return transient_high_water_mark;
+	}
+
+	unsigned getFramesInFlight() const {
+		return num_frames_in_flight;
+	}
+
+	// transient rings created so far (framesInFlight, plus the extra rings
+	// created while all the others were in flight)
+	unsigned getNumTransientRings() const {
+		return static_cast<unsigned>(transient_rings.size());
+	}
+
+	// mesh_megabuffer.cpp
+	// meshes created afterwards are stored in a shared megabuffer when they fit
+	void enableMeshMegabuffer(unsigned vertexStride, unsigned maxVertices, unsigned maxIndices);
+	// null if not enabled
+	MeshMegabuffer *getMeshMegabuffer() {
+		return mesh_megabuffer.get();
+	}
+
+	// time spent by the CPU waiting on fences during the last frame (seconds)
+	double getFenceWaitTime() const {
+		return fence_wait_time;
+	}
+
+	// redundant state changes are filtered here
+	// (call invalidate() after using GL directly)
+	StateCache &getStateCache() {
+		return state_cache;
+	}
+
+	// binaries of the programs of compileProgram(gc, ...), disabled until a directory is set
+	ProgramCache &getProgramCache() {
+		return program_cache;
+	}
+
+	// shader variants compiled so far, and by the previous runs when loaded
+	ShaderVariantUsage &getShaderVariantUsage() {
+		return shader_variant_usage;
+	}
+
 protected:
+	StateCache state_cache;
+	ProgramCache program_cache;
+	ShaderVariantUsage shader_variant_usage;
 	// pools
-	// 256 x 4096, 512 x 2048, 1024 x 1024, 2048 x 512, 4096 x 256, 8192 x 128,
-	// 16384 x 64, 32768 x 32, 65536 x 16
-	static const unsigned kNumPools = 9u;
-	static const unsigned kMinBlockSizeLog = 8u;
-	static const unsigned kMinBlockSize = 256u;
-	static const unsigned kMaxBlockSize = kMinBlockSize << (kNumPools - 1);
-	static const unsigned kPoolPageSize = 1024 * 1024ul; 
-	static size_t blockSizeFromPoolIndex(unsigned index);
-	// buffer pools
+	// Buffers smaller than a page are sub-allocated from large persistently
+	// mapped buffers with a TLSF allocator. Empty pages are released.
+	// Blocks are aligned by the allocator, the space skipped to align them stays free.
+	// Live pages are indexed by the size class of their largest free block: an
+	// allocation goes to the page with the smallest class that fits (fuller pages first).
+	static const unsigned kPoolPageSize = 16 * 1024 * 1024ul;
 	Buffer::Ptr allocLargeBuffer(GLenum target, size_t size, GLbitfield flags_, const void *initialData);
-	void createPool(unsigned pool_index);
-	PoolBlockIndex allocFromPool(unsigned pool_index);
+	unsigned createPoolPage();
+	void releasePoolPage(unsigned page_index);
+	// after an allocation or a release in the page
+	void updatePoolFreeSpace(unsigned page_index);
+	PoolBlockIndex allocFromPool(size_t size, size_t align);
+	size_t getBufferAlignment(GLenum target);
 	void showPoolDebugInfo();
+	// tlsf_allocator::max_alloc_size -> page index
+	using PoolFreeSpaceIndex = std::multimap<uint32_t, unsigned>;
 	struct BufferPool
 	{
 		BufferPool() = default;
-		GLenum target = 0;
+		// 0 if the page has been released
 		GLuint obj = 0;
-		// block size (multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)
-		size_t block_size = 0;
-		// number of blocks
-		size_t num_blocks = 0;
 		// persistently mapped pointer
 		void *mapped_ptr = nullptr;
+		util::tlsf_allocator allocator;
+		// buffer owning each block, indexed by block handle (for compaction)
+		std::vector<Buffer*> owners;
+		// set during compaction (until the page is released): no new allocations in this page
+		bool evacuating = false;
+		// entry in pool_free_space (live pages only)
+		PoolFreeSpaceIndex::iterator free_space;
+	};
+	std::vector<BufferPool> pools;
+	PoolFreeSpaceIndex pool_free_space;
+	// transient ring buffers
+	// one ring per frame in flight, each made of one or more persistently mapped chunks
+	// allocations are bump-pointer allocated and released all at once when the frame is reclaimed
+	// When all rings are in flight, the extra rings requested at construction are
+	// created (the CPU runs further ahead of the GPU). Past that maximum, the CPU
+	// blocks on the fence of the oldest frame until it signals, timeouts included:
+	// a ring is only reused once its fence has signaled.
+	static constexpr unsigned kMinFramesInFlight = 2u;
+	static constexpr unsigned kMaxFramesInFlight = 4u;
+	static constexpr unsigned kMaxExtraTransientRings = 2u;
+	static constexpr uint64_t kFrameFenceTimeout = 1000000000ull;
+	static const unsigned kTransientChunkSize = 4 * 1024 * 1024ul;
+	struct TransientChunk
+	{
+		GLuint obj = 0;
+		size_t size = 0;
+		void *mapped_ptr = nullptr;
 	};
-	std::vector<BufferPool> pools[kNumPools];
-	std::vector<PoolBlockIndex> free_list[kNumPools];
-	unsigned sync_cycle;
-	std::vector<Buffer::Ptr> transient_buffers[3];
-	GLsync transient_syncs[3];
-	std::vector<Buffer::Ptr> static_buffers;
+	struct TransientRing
+	{
+		std::vector<TransientChunk> chunks;
+		// chunk currently being filled
+		unsigned cur_chunk = 0;
+		// bump pointer in the current chunk
+		size_t offset = 0;
+		// bytes consumed this frame (including alignment padding)
+		size_t bytes_used = 0;
+		GLsync sync = 0;
+		// run when the ring is rewound (see deferUntilFrameComplete)
+		std::vector<std::function<void()>> deferred;
+	};
+	unsigned num_frames_in_flight;
+	// hard limit on transient_rings.size() (frames in flight + extra rings)
+	unsigned max_transient_rings;
+	std::vector<TransientRing> transient_rings;
+	// rings submitted to the GPU, oldest first
+	std::deque<unsigned> transient_in_flight;
+	// rings ready to be reused
+	std::vector<unsigned> transient_free_rings;
+	// ring of the current frame
+	unsigned cur_ring = 0;
+	double fence_wait_time = 0.0;
+	size_t transient_last_bytes_used = 0;
+	size_t transient_high_water_mark = 0;
+	void createTransientChunk(TransientRing &ring, size_t size);
+	void rewindTransientRing(TransientRing &ring);
 	void reclaimTransientBuffers();
 	void syncTransientBuffers();
 	// samplers
-	GLuint samLinearClamp;
-	GLuint samNearestClamp;
-	GLuint samLinearRepeat;
-	GLuint samNearestRepeat;
-	GLuint dummy_vao;
-	unsigned frame_counter;
+	GLuint samLinearClamp = 0;
+	GLuint samNearestClamp = 0;
+	GLuint samLinearRepeat = 0;
+	GLuint samNearestRepeat = 0;
+	GLuint dummy_vao = 0;
+	unsigned frame_counter = 0;
+	MeshMegabuffer::Ptr mesh_megabuffer;
 };
 
 enum class LightMode
@@ -423,16 +636,56 @@ struct Light
 {
 	LightMode mode;
 	glm::vec3 intensity;
+	// point and spot lights: distance at which the light fades out
+	float range = 20.0f;
+	// spot lights: half-angle of the cone (radians), the axis is +Z in the light frame
+	float spotAngle = 0.5f;
 };
 
+// size of a vertex in mesh vertex buffers (position, packed normal, tangent and uv)
+constexpr unsigned kMeshVertexStride = 24;
+
 struct Mesh : public Asset
 {
 	using Ptr = std::unique_ptr<Mesh>;
+	// out of line: OccluderMesh is incomplete here
+	Mesh();
+	~Mesh();
+	// vertex buffer binding, index buffer, and offsets of the mesh in them
+	// (own buffers, or the megabuffer)
+	const BufferSlice &getVertexBuffer() const {
+		return megabuffer ? megabuffer->getVertexBuffer() : *vbo;
+	}
+	const BufferSlice &getIndexBuffer() const {
+		return megabuffer ? megabuffer->getIndexBuffer() : *ibo;
+	}
+	unsigned getBaseVertex() const {
+		return megabuffer ? megabufferAlloc.baseVertex : 0;
+	}
+	unsigned getFirstIndex() const {
+		return megabuffer ? megabufferAlloc.firstIndex : 0;
+	}
+	// triangles of all the submeshes at a level of detail
+	unsigned getNumTriangles(unsigned lod) const;
+
 	std::vector<Submesh> submeshes;
+	// null if the mesh is in the megabuffer
 	Buffer::Ptr vbo;
 	Buffer::Ptr ibo;
+	MeshMegabuffer *megabuffer = nullptr;
+	MeshMegabuffer::Allocation megabufferAlloc;
 	unsigned nbvertex;
 	unsigned nbindex;
+	// object-space bounds (the sphere is centered on the AABB)
+	AABB aabb;
+	Sphere boundingSphere;
+	// levels of detail (see Submesh::lodRanges), with their object-space error
+	unsigned numLods = 1;
+	float lodErrors[kMaxMeshLods] = {};
+	// render queue sort id (assigned on first use)
+	unsigned sortId = 0;
+	// proxy for occlusion culling (null if the mesh has no triangles)
+	std::unique_ptr<OccluderMesh> occluder;
 };
 
 std::unique_ptr<Mesh> createMesh(GraphicsContext &gc, MeshData &data);
@@ -449,11 +702,10 @@ struct Shader : public Asset
 {
 	using Ptr = std::unique_ptr<Shader>;
 	MaterialType materialType = MaterialType::Lambertian;
-	GLuint programShadowStandard = 0;
-	GLuint programForwardPointLight = 0;
-	GLuint programForwardSpotLight = 0;
-	GLuint programForwardDirectionalLight = 0;
-	GLuint programDeferred = 0;
+	// programs by keywords (see loadShaderAsset for the axes)
+	ShaderVariants variants;
+	// render queue sort id (assigned on first use)
+	unsigned sortId = 0;
 };
 
 struct Material : public Asset
@@ -464,6 +716,8 @@ struct Material : public Asset
 	Texture2D *diffuseMap = nullptr;
 	Texture2D *normalMap = nullptr;
 	Buffer *userParams = nullptr;
+	// render queue sort id (assigned on first use)
+	unsigned sortId = 0;
 };
 
 Mesh *loadMeshAsset(AssetDatabase &assetDb, GraphicsContext &gc, std::string assetId);
@@ -0,0 +1,87 @@
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include <gl_core_4_4.hpp>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+//---------------------------
+// On-disk cache of program binaries
+// A program is keyed by a hash of the preprocessed sources of its stages
+// (version, stage and keyword defines included) and of the driver string.
+// Binaries are stored in <directory>/<key>.bin, the files present in the
+// directory are indexed when it is set. A binary rejected by the driver is
+// compiled again from the sources and written over.
+// Without a directory, programs are always compiled (the stats still count).
+class ProgramCache
+{
+public:
+	struct Stats
+	{
+		unsigned numLoaded = 0;
+		unsigned numCompiled = 0;
+		// binaries rejected by the driver (also counted in numCompiled)
+		unsigned numRejected = 0;
+		// seconds spent loading binaries and compiling
+		double loadTime = 0.0;
+		double compileTime = 0.0;
+	};
+
+	struct Binary
+	{
+		GLenum format = 0;
+		std::vector<char> data;
+	};
+
+	// empty: disabled. The directory is created if needed.
+	void setDirectory(std::string directory);
+
+	const std::string &getDirectory() const {
+		return directory;
+	}
+
+	bool isEnabled() const {
+		return !directory.empty();
+	}
+
+	// does not need a GL context
+	static uint64_t hashProgram(const std::string &vs, const std::string &gs, const std::string &ps, const std::string &driver);
+	// "<16 hex digits>.bin"
+	static std::string getFileName(uint64_t key);
+
+	// index of the binaries in the directory
+	bool contains(uint64_t key) const {
+		return index.count(key) != 0;
+	}
+
+	size_t size() const {
+		return index.size();
+	}
+
+	// false if the file is missing, truncated, or of another key
+	bool readBinary(uint64_t key, Binary &binary) const;
+	bool writeBinary(uint64_t key, const Binary &binary);
+
+	// program of the preprocessed stage sources (gs can be empty)
+	// throws std::runtime_error on compilation/link errors, like the device
+	GLuint getProgram(const std::string &vs, const std::string &gs, const std::string &ps);
+
+	const Stats &getStats() const {
+		return stats;
+	}
+
+	void resetStats() {
+		stats = Stats();
+	}
+
+private:
+	std::string getPath(uint64_t key) const;
+
+	std::string directory;
+	std::unordered_set<uint64_t> index;
+	Stats stats;
+};
+
+#endif /* end of include guard: PROGRAM_CACHE_HPP */
@@ -0,0 +1,211 @@
+#ifndef RENDER_GRAPH_HPP
+#define RENDER_GRAPH_HPP
+
+#include <renderer_common.hpp>
+#include <gl_core_4_4.hpp>
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+
+// size and format of a render target texture
+struct RenderTargetDesc
+{
+	glm::ivec2 size;
+	ElementFormat format;
+};
+
+inline bool operator==(const RenderTargetDesc &a, const RenderTargetDesc &b)
+{
+	return a.size == b.size && a.format == b.format;
+}
+
+bool isDepthFormat(ElementFormat format);
+size_t getRenderTargetMemorySize(const RenderTargetDesc &desc);
+
+// Version of a resource of a render graph
+// Writing to a resource gives a new version: passes that read the old one
+// run before the pass that writes it.
+struct RenderResource
+{
+	unsigned id = ~0u;
+
+	bool valid() const {
+		return id != ~0u;
+	}
+};
+
+//---------------------------
+// Render graph
+// The passes of a frame are declared with the resources they read and write.
+// compile() culls the passes that contribute neither to an imported resource
+// nor have side effects, orders the others after the passes they depend on,
+// and plans the transient render targets: resources of the same size and
+// format whose lifetimes do not overlap share a texture. It does not use the
+// graphics device. execute() takes the textures from a pool kept across
+// frames, binds the render targets written by each pass and runs it.
+class RenderGraph
+{
+public:
+	using ExecuteFn = std::function<void(RenderGraph &graph)>;
+
+	class PassBuilder
+	{
+	public:
+		// new transient render target, written by the pass
+		RenderResource create(const char *name, const RenderTargetDesc &desc);
+		// sampled by the pass
+		RenderResource read(RenderResource resource);
+		// render target of the pass (the previous content is kept),
+		// returns the new version; only the last version can be written
+		RenderResource write(RenderResource resource);
+		// the pass is never culled
+		void setSideEffects();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph &graph_, unsigned pass_) : graph(graph_), pass(pass_) {}
+
+		RenderGraph &graph;
+		unsigned pass;
+	};
+
+	struct MemoryStats
+	{
+		unsigned numTransientResources = 0;
+		unsigned numTextures = 0;
+		// every transient resource in its own texture
+		size_t unaliasedBytes = 0;
+		// textures of the plan
+		size_t allocatedBytes = 0;
+		// largest total size of the transient resources alive at the same time
+		size_t peakLiveBytes = 0;
+	};
+
+	RenderGraph() = default;
+	RenderGraph(const RenderGraph &) = delete;
+	RenderGraph &operator=(const RenderGraph &) = delete;
+	// deletes the pooled textures
+	~RenderGraph();
+
+	// forgets the passes and resources (the texture pool is kept)
+	void reset();
+	// name: string literal (also the profiler scope of the pass)
+	PassBuilder addPass(const char *name, ExecuteFn execute);
+	// texture owned by the caller; 0 is the default framebuffer
+	RenderResource importTexture(const char *name, const RenderTargetDesc &desc, GLuint texture);
+
+	// returns false if the dependencies have a cycle, or a pass writes the
+	// default framebuffer and other render targets
+	bool compile();
+	// runs the passes of the last compile()
+	void execute();
+
+	// during execute(): texture of a resource used by the current pass
+	GLuint getTexture(RenderResource resource) const;
+	const RenderTargetDesc &getDesc(RenderResource resource) const;
+
+	//---------------------------
+	// results of compile()
+	unsigned getNumPasses() const {
+		return static_cast<unsigned>(passes.size());
+	}
+
+	const char *getPassName(unsigned pass) const {
+		return passes[pass].name;
+	}
+
+	bool isPassCulled(unsigned pass) const {
+		return passes[pass].culled;
+	}
+
+	// passes run by execute(), by declaration index
+	const std::vector<unsigned> &getPassOrder() const {
+		return order;
+	}
+
+	// index of the texture of a transient resource in the plan, -1 if the
+	// resource is imported or not used
+	int getTextureIndex(RenderResource resource) const;
+
+	const MemoryStats &getMemoryStats() const {
+		return memoryStats;
+	}
+
+	// textures in the pool (also those kept from earlier frames)
+	unsigned getNumPooledTextures() const {
+		return static_cast<unsigned>(pool.size());
+	}
+
+private:
+	struct Resource
+	{
+		const char *name = nullptr;
+		RenderTargetDesc desc;
+		bool imported = false;
+		GLuint texture = 0;
+		unsigned lastVersion = 0;
+		// positions in the pass order
+		int firstUse = -1;
+		int lastUse = -1;
+		int textureIndex = -1;
+	};
+
+	struct Version
+	{
+		unsigned resource;
+		// pass that wrote it (-1: imported content)
+		int writer;
+		// version it was written over
+		int previous;
+		std::vector<unsigned> readers;
+	};
+
+	struct Pass
+	{
+		const char *name;
+		ExecuteFn execute;
+		std::vector<unsigned> reads;
+		std::vector<unsigned> writes;
+		bool sideEffects = false;
+		bool culled = true;
+	};
+
+	struct PooledTexture
+	{
+		RenderTargetDesc desc;
+		GLuint texture;
+		unsigned unusedFrames;
+		bool claimed;
+	};
+
+	struct Framebuffer
+	{
+		std::vector<GLuint> colors;
+		GLuint depth;
+		GLuint fbo;
+	};
+
+	unsigned addVersion(unsigned resource, int writer, int previous);
+	bool sortPasses();
+	void planTextures();
+	void acquireTextures();
+	void bindRenderTargets(const Pass &pass);
+	void releaseTexture(GLuint texture);
+	bool usesResource(const Pass &pass, unsigned resource) const;
+
+	std::vector<Resource> resources;
+	std::vector<Version> versions;
+	std::vector<Pass> passes;
+	std::vector<unsigned> order;
+	bool compiled = false;
+	// plan: descriptions of the transient textures, and their GL textures once acquired
+	std::vector<RenderTargetDesc> textureDescs;
+	std::vector<GLuint> textures;
+	MemoryStats memoryStats;
+	// pass running in execute()
+	const Pass *currentPass = nullptr;
+	std::vector<PooledTexture> pool;
+	std::vector<Framebuffer> framebuffers;
+};
+
+#endif /* end of include guard: RENDER_GRAPH_HPP */
@@ -0,0 +1,93 @@
+#ifndef RENDER_QUEUE_HPP
+#define RENDER_QUEUE_HPP
+
+#include <rendering/opengl4.hpp>
+#include <vector>
+#include <cstdint>
+
+// A draw waiting in a render queue
+struct DrawItem
+{
+	Mesh *mesh;
+	Material *material;
+	const glm::mat4 *modelToWorld;
+	// level of detail of the mesh
+	unsigned lod;
+};
+
+// Render queue
+// Each visible draw is pushed with a 64-bit sort key, and the queue is
+// radix-sorted once per frame so that draws sharing the same shader,
+// material and mesh end up next to each other.
+//
+// Key layout (msb first):
+//   pass     : 4 bits
+//   shader   : 12 bits (programs of the same shader only differ by light mode)
+//   material : 16 bits
+//   mesh     : 16 bits
+//   lod      : 2 bits (level of detail of the mesh)
+//   depth    : 14 bits (view distance, front to back)
+class RenderQueue
+{
+public:
+	enum class Pass : unsigned
+	{
+		Opaque = 0,
+		Transparent = 1
+	};
+
+	static uint64_t makeSortKey(
+		Pass pass,
+		Shader &shader,
+		Material &material,
+		Mesh &mesh,
+		unsigned lod,
+		float normalizedDepth);
+	// same key as makeSortKey, but never assigns sort ids, so that it can be
+	// called from several threads; returns false if an object has no id yet
+	static bool tryMakeSortKey(
+		Pass pass,
+		const Shader &shader,
+		const Material &material,
+		const Mesh &mesh,
+		unsigned lod,
+		float normalizedDepth,
+		uint64_t &sortKey);
+
+	void clear();
+	void reserve(size_t count);
+	void push(uint64_t sortKey, const DrawItem &item);
+	// sorts by increasing key
+	void sort();
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	bool empty() const {
+		return entries.empty();
+	}
+
+	// i-th draw in sort order (after sort())
+	const DrawItem &operator[](size_t i) const {
+		return items[entries[i].index];
+	}
+
+	uint64_t getSortKey(size_t i) const {
+		return entries[i].key;
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t key;
+		unsigned index;
+	};
+
+	std::vector<DrawItem> items;
+	std::vector<Entry> entries;
+	// radix sort scratch buffer
+	std::vector<Entry> tmp_entries;
+};
+
+#endif /* end of include guard: RENDER_QUEUE_HPP */
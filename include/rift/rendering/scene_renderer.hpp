@@ -3,8 +3,17 @@
 
 #include <scene/scene.hpp>
 #include <rendering/opengl4.hpp>
-
-struct NVGcontext; 
+#include <rendering/render_queue.hpp>
+#include <rendering/draw_list.hpp>
+#include <rendering/occlusion.hpp>
+#include <rendering/lod.hpp>
+#include <rendering/light_clustering.hpp>
+#include <rendering/indirect_draws.hpp>
+#include <rendering/shadows.hpp>
+#include <rendering/render_graph.hpp>
+#include <rendering/text_batcher.hpp>
+#include <rendering/debug_draw.hpp>
+#include <rendering/nanovg_renderer.hpp>
 
 struct SceneView
 {
@@ -19,19 +28,70 @@ struct SceneView
 struct ShadowPass
 {
 	SceneView *sceneView;
-	Buffer *sceneViewUBO;
+	BufferSlice sceneViewUBO;
+	const BufferSlice *lastVertexBuffer = nullptr;
+	GLuint lastProgram = 0;
+	// stats
+	unsigned numDrawCalls = 0;
 };
 
 struct ForwardPass
 {
 	ForwardPass() = default;
 	SceneView *sceneView = nullptr;
-	Buffer *sceneViewUBO = nullptr;
+	BufferSlice sceneViewUBO;
 	Light *light = nullptr;
-	Buffer *lightParamsUBO = nullptr;
-	// TODO shadow maps?
+	BufferSlice lightParamsUBO;
+	// all lights in one pass (light is null)
+	bool clustered = false;
+	// lights and cluster grid of the clustered pass (see prepareClusteredLights)
+	BufferSlice clusterParamsUBO;
+	BufferSlice lightsSSBO;
+	BufferSlice clustersSSBO;
+	BufferSlice lightIndicesSSBO;
+	// cascades of the shadowed directional light (see ShadowData in scene.glsl),
+	// and the same without cascades, for the other lights
+	const Light *shadowedLight = nullptr;
+	BufferSlice shadowUBO;
+	BufferSlice noShadowUBO;
 	Material *lastMaterial = nullptr;
+	const BufferSlice *lastVertexBuffer = nullptr;
 	GLuint lastProgram = 0;
+	// stats
+	unsigned numProgramChanges = 0;
+	unsigned numMaterialChanges = 0;
+	unsigned numVertexBufferChanges = 0;
+	unsigned numDrawCalls = 0;
+	unsigned numInstancedDrawCalls = 0;
+	// submesh instances drawn
+	unsigned numInstances = 0;
+	// commands in multi-draw indirect calls
+	unsigned numMultiDrawCommands = 0;
+};
+
+// draws of the last frame of a SceneRenderer
+struct SceneRenderStats
+{
+	// draw items in the render queue
+	unsigned numQueued = 0;
+	// forward passes (see ForwardPass)
+	unsigned numProgramChanges = 0;
+	unsigned numMaterialChanges = 0;
+	unsigned numVertexBufferChanges = 0;
+	unsigned numDrawCalls = 0;
+	unsigned numInstancedDrawCalls = 0;
+	unsigned numInstances = 0;
+	unsigned numMultiDrawCommands = 0;
+	// all the cascades
+	unsigned numShadowDrawCalls = 0;
+};
+
+enum class LightingMode
+{
+	// one forward pass per light
+	PerLight,
+	// all lights in one pass, assigned to view frustum clusters
+	Clustered
 };
 
 class SceneRenderer
@@ -41,6 +101,50 @@ public:
 
 	void setSceneCamera(const Camera &camera);
 
+	void setLightingMode(LightingMode mode) {
+		lightingMode = mode;
+	}
+
+	void setClusterGridParams(const ClusterGridParams &params) {
+		clusterGridParams = params;
+	}
+
+	// visible draws of the same mesh and material are merged into an instanced draw
+	// when there are at least this many of them (0 disables instancing)
+	void setInstancingThreshold(unsigned threshold) {
+		instancingThreshold = threshold;
+	}
+
+	// draw meshes in the mesh megabuffer with multi-draw indirect
+	// (needs GraphicsContext::enableMeshMegabuffer)
+	void setMultiDrawIndirect(bool enabled) {
+		multiDrawIndirect = enabled;
+	}
+
+	// screen-space error thresholds and global bias of the level of detail selection
+	void setLodParams(const LodParams &params) {
+		lodParams = params;
+	}
+
+	// test the visible objects against the occluders of the scene (see Scene::markOccluders)
+	void setOcclusionCulling(bool enabled) {
+		occlusionCulling = enabled;
+	}
+
+	// cascaded shadow maps of the first directional light
+	void setShadows(bool enabled) {
+		shadows = enabled;
+	}
+
+	void setShadowParams(const ShadowParams &params) {
+		shadowParams = params;
+	}
+
+	// draw calls and state changes of the last renderScene
+	const SceneRenderStats &getLastFrameStats() const {
+		return lastFrameStats;
+	}
+
 	//===========================================================
 	void renderScene(Scene &scene, float dt);
 	// add a mesh to render list (render this frame only)
@@ -49,8 +153,13 @@ public:
 	//===========================================================
 	// immediate mode
 
+	// debug lines, drawn over the scene by the next renderScene
+	DebugDraw &getDebugDraw() {
+		return debugDraw;
+	}
+
 	// draw a mesh in wireframe from data on the CPU
-	// A camera must be set before
+	// (batched with the debug lines, drawn by the next renderScene)
 	void drawWireMesh(
 		const Transform &transform,
 		GLenum mode,
@@ -58,15 +167,6 @@ public:
 		const util::array_ref<uint16_t> indices,
 		const glm::vec4 lineColor,
 		bool noDepthTest = false);
-	void drawWireMesh(
-		const Transform &transform,
-		GLenum mode,
-		Buffer *vertices,
-		unsigned nbvertices,
-		Buffer *indices,
-		unsigned nbindices,
-		const glm::vec4 lineColor,
-		bool noDepthTest = false);
 
 	// draw a line 
 	void drawLine();
@@ -85,18 +185,40 @@ private:
 
 	void prepareMaterialForwardPass(
 		Material &mat,
-		ForwardPass &pass, 
-		const glm::mat4 &modelToWorld);
+		ForwardPass &pass);
 
+	// draws instanceCount instances, starting at firstInstance in the instance data buffer
 	void drawMeshForwardPass(
 		ForwardPass &pass,
 		Mesh &mesh,
 		Material &material,
-		const glm::mat4 &modelToWorld);
+		unsigned lod,
+		unsigned firstInstance,
+		unsigned instanceCount);
 
-	void makeTextVBO(Font &font, const char *str, Buffer *&vb, Buffer *& ib, unsigned &len);
-	void drawTextVBO(Buffer *vb, Buffer *ib, unsigned len, const Font &font, glm::ivec2 pos, glm::vec4 fill, glm::vec4 outline);
-	void drawTextShadow(glm::ivec2 pos, const char *str);
+	void updateInstanceIndexBuffer(unsigned numInstances);
+	// culls the shadow casters and fits the cascades, sets the shadow data of the pass;
+	// returns false if there are no cascades to draw
+	bool prepareShadowMaps(Scene &scene, ForwardPass &forwardPass);
+	// draws the cascades in the atlas bound by the render graph
+	void drawShadowMaps();
+	void drawShadowQueue(ShadowPass &pass, const RenderQueue &queue, unsigned firstInstance);
+	void drawMeshShadowPass(
+		ShadowPass &pass,
+		Mesh &mesh,
+		Material &material,
+		unsigned lod,
+		unsigned firstInstance,
+		unsigned instanceCount);
+	// draws the render queue with the current lighting setup
+	void drawRenderQueue(ForwardPass &pass);
+	void drawRenderQueueIndirect(ForwardPass &pass);
+	void drawForwardPassPerLight(Scene &scene, ForwardPass &pass);
+	// assigns the lights to the clusters of the view, sets the light buffers of the pass
+	void prepareClusteredLights(Scene &scene, ForwardPass &pass);
+	void drawForwardPassClustered(Scene &scene, ForwardPass &pass);
+	// culling, queue and draw call stats of the frame
+	void showRenderStats(const ForwardPass &pass);
 
 	void drawScreenMessages();
 	void drawFrameTimeGraph(Scene &scene);
@@ -106,28 +228,59 @@ private:
 	Camera camera;
 	glm::ivec2 viewportSize;
 	GraphicsContext &graphicsContext;
+	// UI overlays
+	std::unique_ptr<NanoVGRenderer> nanovgRenderer;
 	NVGcontext *nvgContext;
 	Material::Ptr defaultMaterial;
+	// visibility and draw recording on the worker threads
+	DrawListRecorder drawLists;
+	// occluders rasterized on another thread, during the start of the frame
+	OcclusionCuller occlusionCuller;
+	bool occlusionCulling = false;
+	LodParams lodParams;
+	RenderQueue renderQueue;
+	// shadows
+	bool shadows = false;
+	ShadowParams shadowParams;
+	ShadowCasterCuller shadowCasters;
+	ShadowCascade shadowCascades[kMaxShadowCascades];
+	unsigned numShadowCascades = 0;
+	RenderQueue shadowQueues[kMaxShadowCascades];
+	// instances of the casters of each cascade
+	unsigned shadowFirstInstance[kMaxShadowCascades];
+	unsigned numShadowInstances = 0;
+	glm::vec3 shadowLightDir;
+	unsigned numShadowDrawCalls = 0;
+	SceneRenderStats lastFrameStats;
+	// lighting
+	LightingMode lightingMode = LightingMode::PerLight;
+	ClusterGridParams clusterGridParams;
+	LightClusterer lightClusterer;
+	std::vector<ClusterLight> clusterLights;
+	unsigned instancingThreshold = 2;
+	bool multiDrawIndirect = false;
+	IndirectDrawBuilder indirectDraws;
+	// commands of the current frame (null if not drawing indirect)
+	BufferSlice indirectBuffer;
+	// per-instance vertex stream holding 0,1,2... (grown on demand)
+	Buffer::Ptr instanceIndexBuffer;
+	unsigned instanceIndexBufferSize = 0;
 	VAO meshVao;
-	VAO textVao;
-	VAO immediateVao;
 	GLuint dummy_vao;
 	GLuint textProgram;
-	GLuint immediateProgram;
 	GLuint postprocProgram;
 	Font::Ptr defaultFont;
+	// screen messages, laid out once per distinct line
+	TextBatcher textBatcher;
+	DebugDraw debugDraw;
+	GLuint debugDrawProgram;
 
 	// Terrain rendering
 	VAO terrainVao;
 	GLuint terrainProgram;
 
-	// PostProc render targets (ping-pong FBOs)
-	// framebuffer
-	GLuint rt0_fb;
-	// color texture
-	GLuint rt0_color;
-	// depth texture
-	GLuint rt0_depth;
+	// passes of the frame, and the render targets they share
+	RenderGraph renderGraph;
 };
 
  
@@ -0,0 +1,110 @@
+#ifndef SHADER_PREPROCESSOR_HPP
+#define SHADER_PREPROCESSOR_HPP
+
+#include <gl_core_4_4.hpp>
+#include <array_ref.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct ShaderKeyword
+{
+	std::string define;
+	std::string value;
+};
+
+//---------------------------
+// GLSL preprocessor with an include graph
+// Handles #version and #pragma include <file>. Every file is read and scanned
+// once: its text is kept as fragments (runs of lines between directives),
+// with the include edges to the other files. The source of a stage and a set
+// of keywords is assembled from the fragments, each one behind a #line
+// directive (source string number: 0 for the source, then the included files
+// in order of appearance, see getSourceName).
+// Include lookups (directory of the including file, then
+// resources/shaders/include) are memoized.
+class ShaderPreprocessor
+{
+public:
+	struct Stats
+	{
+		// files read from disk, and sources given as strings that were scanned
+		unsigned numFilesRead = 0;
+		unsigned numSourcesParsed = 0;
+		unsigned numPreprocessed = 0;
+	};
+
+	// sourcePath: file of the source, or empty for sources that are not files
+	// (includes are then looked up in the current directory)
+	std::string preprocess(
+		const std::string &source,
+		const std::string &sourcePath,
+		GLenum stage,
+		util::array_ref<ShaderKeyword> keywords);
+
+	// file of a source string number in the #line directives of the last
+	// preprocessed source of sourcePath
+	const std::string &getSourceName(const std::string &sourcePath, int sourceStringNumber) const;
+	// files included by a file, directly or not
+	std::vector<std::string> getIncludes(const std::string &path) const;
+	// files that include a file, directly or not (the sources to rebuild when it changes)
+	std::vector<std::string> getDependents(const std::string &path) const;
+
+	// the file changed on disk: read again when it is next needed
+	void invalidate(const std::string &path);
+	void clear();
+
+	const Stats &getStats() const {
+		return stats;
+	}
+
+private:
+	struct Item
+	{
+		enum class Kind
+		{
+			Text,
+			Version,
+			Include
+		};
+		Kind kind;
+		// lines of the fragment, or name of the included file
+		std::string text;
+		// first line of the fragment, or line of the directive
+		int line;
+		// GLSL version, or index of the included file (-1 if not found)
+		int value;
+	};
+
+	struct File
+	{
+		std::string path;
+		bool loaded = false;
+		// sources given as strings: the source the items come from
+		std::string source;
+		std::vector<Item> items;
+		// preprocessed as a source: files of the source string numbers
+		std::vector<int> sourceFiles;
+	};
+
+	int getFileIndex(const std::string &path);
+	int loadFile(int index);
+	int loadSource(const std::string &source, const std::string &path);
+	std::vector<Item> parse(const std::string &path, std::istream &in);
+	int resolveInclude(const std::string &directory, const std::string &name);
+	void reloadInvalidated(int index, std::vector<bool> &visited);
+	int findVersion(int index, int depth, int version) const;
+	void emit(int index, int depth, int glslVersion, std::string &out, std::vector<int> &sourceFiles) const;
+	void collectIncludes(int index, std::vector<bool> &visited) const;
+
+	std::vector<File> files;
+	std::unordered_map<std::string, int> file_indices;
+	// directory + '\n' + include name -> file index (-1: not found)
+	std::unordered_map<std::string, int> resolved_includes;
+	Stats stats;
+};
+
+// preprocessor of preprocessShader and compileShader
+ShaderPreprocessor &getShaderPreprocessor();
+
+#endif /* end of include guard: SHADER_PREPROCESSOR_HPP */
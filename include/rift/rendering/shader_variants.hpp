@@ -0,0 +1,163 @@
+#ifndef SHADER_VARIANTS_HPP
+#define SHADER_VARIANTS_HPP
+
+#include <rendering/shader_preprocessor.hpp>
+#include <array_ref.hpp>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GraphicsContext;
+
+// stable key of a set of keywords (FNV-1a of the (define, value) pairs sorted
+// by define): the same across runs and whatever the order of the keywords
+uint64_t hashShaderKeywords(util::array_ref<ShaderKeyword> keywords);
+
+// a set of keywords and its key
+// (build once, e.g. for each pass of a renderer, then look up by key)
+struct ShaderVariant
+{
+	// no keywords
+	ShaderVariant();
+	explicit ShaderVariant(util::array_ref<ShaderKeyword> keywords);
+
+	uint64_t key;
+	// sorted by define
+	std::vector<ShaderKeyword> keywords;
+};
+
+//---------------------------
+// Open addressing table: variant key -> program
+// Linear probing, power of two capacity, at most half full.
+class ProgramTable
+{
+public:
+	// 0 if not present
+	GLuint find(uint64_t key) const {
+		if (slots.empty())
+			return 0;
+		auto mask = slots.size() - 1;
+		for (auto i = mix(key) & mask;; i = (i + 1) & mask) {
+			auto &slot = slots[i];
+			if (!slot.program || slot.key == key)
+				return slot.program;
+		}
+	}
+
+	// program must not be 0
+	void insert(uint64_t key, GLuint program);
+	void clear();
+
+	size_t size() const {
+		return count;
+	}
+
+private:
+	struct Slot
+	{
+		uint64_t key;
+		// 0: empty slot
+		GLuint program;
+	};
+
+	// variant keys are hashes already, but spread the low bits anyway
+	static uint64_t mix(uint64_t key) {
+		return (key ^ (key >> 29)) * 0xbf58476d1ce4e5b9ull;
+	}
+
+	std::vector<Slot> slots;
+	size_t count = 0;
+};
+
+//---------------------------
+// Programs of a shader for every set of keywords
+// The shader declares keyword axes: each axis is a list of mutually exclusive
+// keywords (an empty keyword: none of them defined), a variant picks at most
+// one keyword per axis. A variant is compiled on first use (through the
+// program cache of the context), or before with prewarm() from a list of
+// variants, e.g. the ones recorded in the ShaderVariantUsage of the context.
+class ShaderVariants
+{
+public:
+	// the path of the vertex stage also names the shader in the usage list
+	void setSources(std::string vsSource, std::string vsPath, std::string psSource, std::string psPath);
+	// fragment stage of the variants with SHADOW_PASS (depth only)
+	void setShadowPassSource(std::string psSource, std::string psPath);
+	void addAxis(std::vector<std::string> keywords);
+
+	const std::string &getName() const {
+		return vs_path;
+	}
+
+	// number of variants of the axes
+	size_t getNumPermutations() const;
+	// false if a keyword is in no axis, or two keywords are in the same axis
+	bool isValid(const ShaderVariant &variant) const;
+
+	// compiled on first use
+	// throws std::runtime_error on compilation/link errors, like compileProgram
+	GLuint getProgram(GraphicsContext &gc, const ShaderVariant &variant) {
+		auto program = programs.find(variant.key);
+		return program ? program : compileVariant(gc, variant);
+	}
+
+	// 0 if not compiled yet
+	GLuint findProgram(uint64_t key) const {
+		return programs.find(key);
+	}
+
+	// compiles the variants that are not compiled yet, returns their number
+	unsigned prewarm(GraphicsContext &gc, util::array_ref<ShaderVariant> variants);
+	// every permutation of the axes
+	unsigned prewarmAll(GraphicsContext &gc);
+
+	// in the order of compilation
+	const std::vector<ShaderVariant> &getCompiledVariants() const {
+		return compiled;
+	}
+
+private:
+	GLuint compileVariant(GraphicsContext &gc, const ShaderVariant &variant);
+
+	std::string vs_source;
+	std::string vs_path;
+	std::string ps_source;
+	std::string ps_path;
+	std::string shadow_ps_source;
+	std::string shadow_ps_path;
+	std::vector<std::vector<std::string>> axes;
+	ProgramTable programs;
+	std::vector<ShaderVariant> compiled;
+};
+
+//---------------------------
+// Variants compiled by the shaders, saved and loaded by the next runs to
+// compile them at load time instead of on first use.
+// File: one line per variant, "<shader> [DEFINE[=value]]..." (no spaces in
+// defines and values).
+class ShaderVariantUsage
+{
+public:
+	// false if the file cannot be read (nothing recorded)
+	bool load(const std::string &path);
+	bool save(const std::string &path);
+
+	// does nothing if already recorded
+	void record(const std::string &shader, const ShaderVariant &variant);
+	// empty if none recorded
+	const std::vector<ShaderVariant> &getVariants(const std::string &shader) const;
+
+	size_t size() const;
+
+	// recorded since the last load or save
+	bool isDirty() const {
+		return dirty;
+	}
+
+private:
+	std::unordered_map<std::string, std::vector<ShaderVariant>> variants;
+	bool dirty = false;
+};
+
+#endif /* end of include guard: SHADER_VARIANTS_HPP */
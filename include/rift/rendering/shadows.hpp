@@ -0,0 +1,132 @@
+#ifndef SHADOWS_HPP
+#define SHADOWS_HPP
+
+#include <rendering/draw_list.hpp>
+#include <utils/array_ref.hpp>
+#include <vector>
+
+constexpr unsigned kMaxShadowCascades = 4;
+// the cascades are tiles of a single depth texture (2x2 tiles)
+constexpr unsigned kShadowAtlasTiles = 2;
+
+struct ShadowParams
+{
+	unsigned numCascades = 4;
+	// shadows end at this view distance (or at the far plane)
+	float maxDistance = 150.0f;
+	// distribution of the splits: 0 uniform, 1 logarithmic
+	float splitLambda = 0.8f;
+	// size of a cascade in the atlas (texels)
+	unsigned resolution = 1024;
+	// Cascades are fitted to a bounding sphere of their slice of the view
+	// frustum, and moved by whole texels: shadow edges do not shimmer when the
+	// camera moves, but the tight fit (bounding box of the slice in light space)
+	// has a better resolution.
+	bool stabilize = false;
+	// casters smaller than this (in texels of the cascade) are skipped
+	float minCasterTexels = 1.0f;
+	// receivers are moved along their normal by this many texels before the
+	// lookup, and compared with this depth bias (normalized depth)
+	float normalOffset = 1.5f;
+	float depthBias = 0.001f;
+};
+
+// One cascade of a directional light shadow map
+struct ShadowCascade
+{
+	// view distances covered by the cascade
+	float splitNear;
+	float splitFar;
+	// light view (looking along the light direction) and orthographic projection
+	glm::mat4 viewMatrix;
+	glm::mat4 projMatrix;
+	glm::mat4 viewProjMatrix;
+	// culling volume of the casters: the box of the projection, extended
+	// towards the light up to the scene bounds
+	FrustumPlanes frustum;
+	// world-space size of a texel of the cascade
+	float texelSize;
+};
+
+// View distance of the far end of each cascade: blend of a uniform and a
+// logarithmic distribution of [nearPlane, farPlane] (lambda = 1: logarithmic)
+void computeCascadeSplits(float nearPlane, float farPlane, unsigned numCascades, float lambda, float *splits);
+
+// Orthographic fit of the slice [splitNear, splitFar] of a perspective view frustum
+// lightDir: direction the light travels (world space)
+// casterBounds: world bounds of the shadow casters; the box of the cascade is
+// clipped to them sideways, and reaches them towards the light
+ShadowCascade fitShadowCascade(
+	const glm::mat4 &viewMatrix,
+	const glm::mat4 &projMatrix,
+	float splitNear,
+	float splitFar,
+	const glm::vec3 &lightDir,
+	const AABB &casterBounds,
+	const ShadowParams &params);
+
+// splits and fits all the cascades, returns their number
+unsigned computeShadowCascades(
+	const glm::mat4 &viewMatrix,
+	const glm::mat4 &projMatrix,
+	const glm::vec3 &lightDir,
+	const AABB &casterBounds,
+	const ShadowParams &params,
+	ShadowCascade *cascades);
+
+// world position to shadow atlas texture coordinates (xy) and depth (z), in [0,1]
+glm::mat4 getShadowAtlasMatrix(const ShadowCascade &cascade, unsigned index);
+// viewport of a cascade in the atlas (x, y, width, height)
+glm::ivec4 getShadowAtlasViewport(unsigned index, unsigned resolution);
+
+// Shadow caster lists of the cascades, recorded on worker threads
+// gather() collects the world bounds of the mesh nodes and their union (to fit
+// the cascades), cull() tests them against the volume of each cascade with the
+// frustum culling kernel. Both work on the same partitions of the mesh nodes
+// as DrawListRecorder, each partition testing all the cascades at once.
+class ShadowCasterCuller
+{
+public:
+	// Reads scene.meshNodes and the world matrices of scene.transforms, which
+	// must not change until cull() returns; pool can be null.
+	void gather(Scene &scene, Material &defaultMaterial, util::thread_pool *pool);
+	// empty (min > max) if there are no mesh nodes
+	const AABB &getCasterBounds() const {
+		return casterBounds;
+	}
+
+	void cull(util::array_ref<ShadowCascade> cascades, const ShadowParams &params, util::thread_pool *pool);
+	// appends the casters of a cascade to a render queue (does not sort it)
+	void merge(unsigned cascade, RenderQueue &queue) const;
+
+	unsigned getNumCandidates() const {
+		return numCandidates;
+	}
+
+	unsigned getNumCasters(unsigned cascade) const {
+		return numCasters[cascade];
+	}
+
+private:
+	struct Partition
+	{
+		size_t firstBucket = 0;
+		size_t endBucket = 0;
+		std::vector<DrawItem> candidates;
+		CullingBounds bounds;
+		AABB casterBounds;
+		std::vector<unsigned> visible;
+		DrawPacketList packets[kMaxShadowCascades];
+	};
+
+	void gatherPartition(Partition &partition, Scene &scene, Material &defaultMaterial);
+	void cullPartition(Partition &partition, util::array_ref<ShadowCascade> cascades, const ShadowParams &params);
+
+	std::vector<Partition> partitions;
+	AABB casterBounds;
+	unsigned numCascades = 0;
+	unsigned numCandidates = 0;
+	unsigned numCasters[kMaxShadowCascades] = {};
+};
+
+#endif /* end of include guard: SHADOWS_HPP */
@@ -0,0 +1,202 @@
+#ifndef STATE_CACHE_HPP
+#define STATE_CACHE_HPP
+
+#include <rendering/device.hpp>
+
+enum class StateCategory
+{
+	Program,
+	VertexArray,
+	VertexBuffers,
+	// UBO and SSBO ranges
+	BufferRanges,
+	Textures,
+	Samplers,
+	// blend enable, equation and function
+	Blend,
+	// depth test enable, function and mask
+	Depth,
+	// polygon mode, face culling, viewport, color mask, stencil, other enables, unpack alignment
+	Raster,
+	Max
+};
+
+struct StateCacheStats
+{
+	// calls forwarded to the device
+	unsigned issued[static_cast<int>(StateCategory::Max)] = {};
+	// redundant calls dropped by the cache
+	unsigned filtered[static_cast<int>(StateCategory::Max)] = {};
+
+	unsigned getTotalIssued() const;
+	unsigned getTotalFiltered() const;
+};
+
+const char *getStateCategoryName(StateCategory category);
+
+//---------------------------
+// Shadow copy of the GL state set through the device
+// Sits in front of another device and drops the state changes that would not
+// change anything. Multi-bind calls are narrowed to the slots that change.
+// Object creation and deletion are forwarded, and forget the shadow state that
+// they can disturb. Code that calls GL directly (not through the device) must
+// call invalidate() afterwards.
+class StateCache : public GraphicsDevice
+{
+public:
+	StateCache(GraphicsDevice &device);
+
+	GraphicsDevice &getDevice() {
+		return device;
+	}
+
+	// forget all the shadow state (the next state changes are all issued)
+	void invalidate();
+	// when disabled, everything is forwarded (calls are still counted)
+	void setFilteringEnabled(bool enabled);
+
+	// moves the counters of the current frame to the last frame
+	void beginFrame();
+
+	const StateCacheStats &getLastFrameStats() const {
+		return last_frame_stats;
+	}
+
+	bool isHeadless() const override { return device.isHeadless(); }
+	void installDebugCallback() override { device.installDebugCallback(); }
+
+	GLuint createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData) override;
+	void *mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access) override;
+	void updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data) override;
+	void copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size) override;
+	void deleteBuffer(GLuint buf) override;
+	GLint getBufferOffsetAlignment(GLenum target) override;
+
+	GLsync fenceSync() override;
+	bool waitSync(GLsync sync, uint64_t timeout) override;
+	void deleteSync(GLsync sync) override;
+
+	GLuint createQuery() override;
+	void queryTimestamp(GLuint query) override;
+	bool getQueryResult(GLuint query, uint64_t &result) override;
+	void deleteQuery(GLuint query) override;
+
+	GLuint createVertexArray(util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors) override;
+	void deleteVertexArray(GLuint vao) override;
+	GLuint createTexture(GLenum target, unsigned numMipLevels, GLenum internalFormat, unsigned width, unsigned height) override;
+	void updateTexture(GLuint tex, GLenum target, GLenum imageTarget, int mipLevel, glm::ivec2 offset, glm::ivec2 size, GLenum format, GLenum type, const void *data) override;
+	void setUnpackAlignment(int alignment) override;
+	void deleteTexture(GLuint tex) override;
+	GLuint createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget) override;
+	void deleteFramebuffer(GLuint fbo) override;
+	GLuint createSampler(GLenum minFilter, GLenum magFilter, GLenum wrapMode) override;
+	void deleteSampler(GLuint sampler) override;
+	GLuint createShader(GLenum stage, const char *source) override;
+	void deleteShader(GLuint shader) override;
+	GLuint createProgram(GLuint vs, GLuint gs, GLuint ps) override;
+	void deleteProgram(GLuint program) override;
+	std::string getDriverString() override { return device.getDriverString(); }
+	bool getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary) override;
+	GLuint createProgramFromBinary(GLenum format, const void *binary, size_t size) override;
+
+	void bindFramebuffer(GLuint fbo) override;
+	void viewport(int x, int y, int width, int height) override;
+	void clear(GLbitfield mask, const glm::vec4 &color, float depth) override;
+	void setEnabled(GLenum cap, bool enabled) override;
+	void polygonMode(GLenum mode) override;
+	void cullFace(GLenum face) override;
+	void depthFunc(GLenum func) override;
+	void depthMask(bool enabled) override;
+	void blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha) override;
+	void blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) override;
+	void colorMask(bool enabled) override;
+	void stencilFunc(GLenum func, int ref, unsigned mask) override;
+	void stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass) override;
+
+	void useProgram(GLuint program) override;
+	void bindVertexArray(GLuint vao) override;
+	void bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides) override;
+	void bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes) override;
+	void bindTextures(unsigned first, unsigned count, const GLuint *textures) override;
+	void bindSamplers(unsigned first, unsigned count, const GLuint *samplers) override;
+
+	void drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount) override;
+	void drawArrays(GLenum mode, unsigned first, unsigned count) override;
+	void multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride) override;
+
+private:
+	// slots above these limits are not tracked (always issued)
+	static const unsigned kNumBufferSlots = 16;
+	static const unsigned kNumTextureUnits = 16;
+	static const unsigned kNumDrawBuffers = 8;
+	// name of a binding in an unknown state (never a valid GL object name)
+	static const GLuint kUnknown = ~0u;
+
+	struct BufferBinding
+	{
+		GLuint obj;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+
+	struct StencilOp
+	{
+		GLenum stencilFail;
+		GLenum depthFail;
+		GLenum depthPass;
+	};
+
+	struct Blend
+	{
+		GLenum modeRGB;
+		GLenum modeAlpha;
+		GLenum srcRGB;
+		GLenum dstRGB;
+		GLenum srcAlpha;
+		GLenum dstAlpha;
+	};
+
+	// -1: unknown
+	struct Capability
+	{
+		GLenum cap;
+		StateCategory category;
+		int enabled;
+	};
+
+	// true if the call must be issued
+	bool update(StateCategory category, bool changed);
+	void invalidateVertexBuffers();
+	BufferBinding *getBufferBindings(GLenum target);
+	void forgetBuffer(GLuint buf);
+
+	GraphicsDevice &device;
+	bool filtering = true;
+	StateCacheStats frame_stats;
+	StateCacheStats last_frame_stats;
+
+	GLuint program;
+	GLuint vertex_array;
+	// vertex buffer bindings are part of the VAO state: forgotten when the VAO changes
+	BufferBinding vertex_buffers[kNumBufferSlots];
+	BufferBinding uniform_buffers[kNumBufferSlots];
+	BufferBinding storage_buffers[kNumBufferSlots];
+	GLuint textures[kNumTextureUnits];
+	GLuint samplers[kNumTextureUnits];
+	Blend blend[kNumDrawBuffers];
+	Capability caps[4];
+	GLenum depth_func;
+	int depth_mask;
+	GLenum polygon_mode;
+	GLenum cull_face;
+	int color_mask;
+	GLenum stencil_func;
+	int stencil_ref;
+	unsigned stencil_mask;
+	// front, back
+	StencilOp stencil_op[2];
+	glm::ivec4 viewport_rect;
+	int unpack_alignment;
+};
+
+#endif /* end of include guard: STATE_CACHE_HPP */
@@ -0,0 +1,125 @@
+#ifndef TEXT_BATCHER_HPP
+#define TEXT_BATCHER_HPP
+
+#include <rendering/opengl4.hpp>
+#include <font.hpp>
+#include <glm/glm.hpp>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// glyph quad of a laid-out string, in pixels from the origin of the string (y down)
+struct GlyphQuad
+{
+	glm::vec2 min;
+	glm::vec2 max;
+	glm::vec2 texMin;
+	glm::vec2 texMax;
+};
+
+// vertex of the text shader
+struct TextVertex
+{
+	float x, y;
+	float tx, ty;
+	// Unorm8x4
+	glm::uint32 color;
+};
+
+//---------------------------
+// Text batcher
+// The strings added during a frame are written in one vertex stream per
+// font, drawn with one draw call each (per 16K glyphs). Drop shadows are
+// copies of the quads at an offset, in the same stream, before the text.
+// The quads of a string are cached by (font, string) across frames: a line
+// that does not change is a hash lookup and a copy. Fonts must outlive the
+// cached runs (see clearCache).
+class TextBatcher
+{
+public:
+	// cached runs not used for this many frames are dropped by endFrame()
+	static constexpr unsigned kRunCacheFrames = 120;
+	// quads per draw call (16-bit indices)
+	static constexpr unsigned kMaxQuadsPerDraw = 65536 / 4;
+
+	struct Stats
+	{
+		unsigned numStrings = 0;
+		unsigned numQuads = 0;
+		unsigned numDrawCalls = 0;
+		unsigned numCacheHits = 0;
+		unsigned numCacheMisses = 0;
+	};
+
+	// pos: top-left corner of the string, in pixels from the top-left of the viewport
+	void addText(const Font &font, glm::ivec2 pos, const char *str, const glm::vec4 &color);
+	// with a drop shadow under the text
+	void addTextShadow(const Font &font, glm::ivec2 pos, const char *str, const glm::vec4 &color,
+		glm::ivec2 shadowOffset, const glm::vec4 &shadowColor);
+	// quads of a string (laid out on a cache miss)
+	const std::vector<GlyphQuad> &layout(const Font &font, const char *str);
+
+	// draws the text of the frame over the current render target (with blending
+	// enabled) and empties the batch; program: text.glsl
+	void flush(GraphicsContext &gc, GLuint program, glm::ivec2 viewportSize);
+	// drops the runs that were not used recently, resets the stats
+	void endFrame();
+	void clearCache();
+
+	unsigned getNumCachedRuns() const {
+		return static_cast<unsigned>(runs.size());
+	}
+
+	// stats of the current frame
+	const Stats &getStats() const {
+		return stats;
+	}
+
+	// vertices of the current batch of a font (empty if none)
+	const std::vector<TextVertex> &getVertices(const Font &font) const;
+
+private:
+	struct RunKey
+	{
+		const Font *font;
+		std::string str;
+
+		bool operator==(const RunKey &other) const {
+			return font == other.font && str == other.str;
+		}
+	};
+
+	struct RunKeyHash
+	{
+		size_t operator()(const RunKey &key) const {
+			return std::hash<std::string>()(key.str) ^ (std::hash<const Font*>()(key.font) << 1);
+		}
+	};
+
+	struct GlyphRun
+	{
+		std::vector<GlyphQuad> quads;
+		unsigned lastFrame;
+	};
+
+	struct Batch
+	{
+		const Font *font;
+		std::vector<TextVertex> vertices;
+	};
+
+	void addQuads(Batch &batch, const std::vector<GlyphQuad> &quads, glm::vec2 offset, glm::uint32 color);
+	Batch &getBatch(const Font &font);
+
+	std::unordered_map<RunKey, GlyphRun, RunKeyHash> runs;
+	// reused for the lookups (no allocation on a hit)
+	RunKey lookupKey;
+	std::vector<Batch> batches;
+	unsigned frame = 0;
+	Stats stats;
+	VAO vao;
+	// 0,1,3,0,3,2... for kMaxQuadsPerDraw quads
+	Buffer::Ptr indexBuffer;
+};
+
+#endif /* end of include guard: TEXT_BATCHER_HPP */
@@ -4,6 +4,7 @@
 #include <rendering/opengl4.hpp>
 #include <mesh_data.hpp>
 #include <scene/entity.hpp>
+#include <scene/transform_hierarchy.hpp>
 #include <font.hpp>
 #include <transform.hpp>
 #include <camera.hpp>
@@ -14,6 +15,10 @@ struct MeshNode
 	EntityID entity;
 	Mesh *mesh;
 	Material *material;
+	// rasterized into the occlusion buffer (see OcclusionCuller)
+	bool occluder = false;
+	// level of detail drawn in the last frame (see LodSelector)
+	unsigned lod = 0;
 };
 
 struct LightNode
@@ -21,12 +26,6 @@ struct LightNode
 	Light light;
 };
 
-struct TransformNode
-{
-	EntityID parent = -1;
-	Transform transform;
-};
-
 class Scene
 {
 public:
@@ -37,19 +36,22 @@ public:
 	EntityID createEntity();
 	LightNode *createPointLight(EntityID id, const glm::vec3 &intensity);
 	LightNode *createDirectionalLight(EntityID id, const glm::vec3 &intensity);
-	TransformNode *getTransformNode(EntityID id);
 	MeshNode *createMeshNode(EntityID id, Mesh &mesh, Material &material);
 	void deleteEntity(EntityID id);
 
 	util::array_ref<EntityID> getEntities() const;
 
+	// marks the mesh nodes with a world bounding sphere larger than minRadius as
+	// occluders (needs up-to-date world matrices), returns the number of occluders
+	unsigned markOccluders(float minRadius);
+
 	// load scene for file
 	void loadFromFile(GraphicsContext &gc, const char *path);
 
 	EntityID lastEntityID = 0;
 	std::vector<EntityID> entities;
-	EntityMap<TransformNode> transforms;
-	EntityMap<glm::mat4> flattenedTransforms;
+	// local transforms and world matrices (see TransformHierarchy::update)
+	TransformHierarchy transforms;
 	EntityMap<MeshNode> meshNodes;
 	EntityMap<LightNode> lightNodes;
 	// Contains the last render times (for FPS graph)
@@ -0,0 +1,75 @@
+#ifndef TRANSFORM_HIERARCHY_HPP
+#define TRANSFORM_HIERARCHY_HPP
+
+#include <scene/entity.hpp>
+#include <transform.hpp>
+#include <vector>
+
+namespace util
+{
+	class thread_pool;
+}
+
+// Local transforms of the scene entities and their world matrices
+// Nodes are stored in SoA arrays in depth-first order: parents come before
+// their children and the subtree of each root is contiguous. update()
+// recomputes the world matrices of the nodes whose local transform changed
+// and of their descendants, in a single linear pass (root subtrees can be
+// updated in parallel). The order is rebuilt lazily after structural changes.
+class TransformHierarchy
+{
+public:
+	// adds a root node
+	void add(EntityID id, const Transform &local = Transform());
+	// children of the node become roots (they keep their local transform)
+	void remove(EntityID id);
+	bool contains(EntityID id) const;
+
+	// parent -1: root
+	void setParent(EntityID id, EntityID parent);
+	EntityID getParent(EntityID id) const;
+
+	void setLocalTransform(EntityID id, const Transform &local);
+	Transform getLocalTransform(EntityID id) const;
+
+	// pool can be null
+	void update(util::thread_pool *pool = nullptr);
+
+	// valid after update(), until the next structural change
+	const glm::mat4 &getWorldMatrix(EntityID id) const;
+
+	size_t size() const {
+		return entities.size();
+	}
+
+	// world matrices recomputed by the last update
+	unsigned getNumUpdated() const {
+		return numUpdated;
+	}
+
+private:
+	unsigned getIndex(EntityID id) const;
+	void rebuildOrder();
+	// returns the number of world matrices recomputed
+	unsigned updateRange(unsigned begin, unsigned end);
+
+	EntityMap<unsigned> indices;
+	std::vector<EntityID> entities;
+	// index of the parent node, ~0 for roots
+	std::vector<unsigned> parents;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scalings;
+	std::vector<glm::mat4> localMatrices;
+	std::vector<glm::mat4> worldMatrices;
+	// local transform modified since the last update
+	std::vector<uint8_t> dirty;
+	// world matrix recomputed during the current update
+	std::vector<uint8_t> changed;
+	// first node of each root subtree, plus the end
+	std::vector<unsigned> rootRanges;
+	bool orderDirty = false;
+	unsigned numUpdated = 0;
+};
+
+#endif /* end of include guard: TRANSFORM_HIERARCHY_HPP */
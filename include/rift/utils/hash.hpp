@@ -0,0 +1,36 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace util {
+
+// 64-bit FNV-1a
+// Stable across runs and builds: keys of the program cache and of the shader
+// variant usage lists are written to disk.
+const uint64_t kHashBasis = 0xcbf29ce484222325ull;
+const uint64_t kHashPrime = 0x100000001b3ull;
+
+inline uint64_t hashBytes(uint64_t hash, const void *data, size_t size)
+{
+	auto bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= kHashPrime;
+	}
+	return hash;
+}
+
+// length first: ("ab", "c") and ("a", "bc") are different
+inline uint64_t hashString(uint64_t hash, const std::string &str)
+{
+	uint64_t size = str.size();
+	hash = hashBytes(hash, &size, sizeof(size));
+	return hashBytes(hash, str.data(), str.size());
+}
+
+}
+
+#endif /* end of include guard: HASH_HPP */
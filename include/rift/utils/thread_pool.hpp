@@ -0,0 +1,60 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util
+{
+	// Fixed set of worker threads running one parallel loop at a time
+	// The calling thread takes part in the loop, so a pool with 0 workers
+	// runs everything serially.
+	class thread_pool
+	{
+	public:
+		// num_workers: defaults to hardware_concurrency - 1
+		explicit thread_pool(int num_workers = -1);
+		~thread_pool();
+
+		thread_pool(const thread_pool &) = delete;
+		thread_pool &operator=(const thread_pool &) = delete;
+
+		// calls fn(begin, end) over [0, count) in chunks of at most grain items,
+		// returns when all chunks are done
+		void parallel_for(unsigned count, unsigned grain, const std::function<void(unsigned, unsigned)> &fn);
+
+		unsigned num_threads() const {
+			return static_cast<unsigned>(workers.size()) + 1;
+		}
+
+	private:
+		void worker_main();
+		// runs chunks of the current job until there are none left
+		void run_chunks();
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable job_cv;
+		std::condition_variable done_cv;
+		// current job
+		const std::function<void(unsigned, unsigned)> *job_fn = nullptr;
+		unsigned job_count = 0;
+		unsigned job_grain = 1;
+		unsigned job_id = 0;
+		std::atomic<unsigned> next_chunk;
+		std::atomic<unsigned> chunks_done;
+		unsigned num_chunks = 0;
+		// workers inside run_chunks (guarded by mutex)
+		unsigned active_workers = 0;
+		bool stop = false;
+	};
+
+	// shared pool for engine jobs
+	thread_pool &get_thread_pool();
+}
+
+#endif /* end of include guard: THREAD_POOL_HPP */
@@ -0,0 +1,103 @@
+#ifndef TLSF_ALLOCATOR_HPP
+#define TLSF_ALLOCATOR_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace util
+{
+	// Two-level segregated fit allocator over a range of offsets [0, capacity)
+	// Does not touch the memory it manages (bookkeeping is stored out-of-band),
+	// so it can be used to sub-allocate GPU buffers.
+	// Allocation and deallocation are O(1), free neighbours are coalesced.
+	class tlsf_allocator
+	{
+	public:
+		static const uint32_t invalid_handle = 0xFFFFFFFFu;
+		// all offsets and sizes are multiple of the granularity
+		static const uint32_t granularity_log2 = 4u;
+		static const uint32_t granularity = 1u << granularity_log2;
+
+		tlsf_allocator(uint32_t capacity = 0);
+
+		// discard all allocations
+		void reset(uint32_t capacity);
+
+		// returns a block handle, or invalid_handle if there is no free block large enough
+		// align: power of two, at least the granularity; the space skipped in front
+		// of the block to align it goes back to the free lists
+		uint32_t allocate(uint32_t size, uint32_t align = granularity);
+		void deallocate(uint32_t handle);
+
+		uint32_t offset_of(uint32_t handle) const {
+			return blocks[handle].offset;
+		}
+
+		uint32_t size_of(uint32_t handle) const {
+			return blocks[handle].size;
+		}
+
+		uint32_t capacity() const {
+			return capacity_;
+		}
+
+		uint32_t bytes_used() const {
+			return bytes_used_;
+		}
+
+		bool empty() const {
+			return bytes_used_ == 0;
+		}
+
+		// upper bound on the number of block handles (for iterating over live blocks)
+		uint32_t max_handle() const {
+			return static_cast<uint32_t>(blocks.size());
+		}
+
+		bool is_allocated(uint32_t handle) const {
+			return handle < blocks.size() && blocks[handle].allocated;
+		}
+
+		// allocate(size, align) succeeds if size + align - granularity <= max_alloc_size()
+		// (lower bound of the size class of the largest free block)
+		uint32_t max_alloc_size() const;
+
+	private:
+		static const uint32_t sl_count_log2 = 4u;
+		static const uint32_t sl_count = 1u << sl_count_log2;
+		static const uint32_t fl_count = 32u - granularity_log2 - sl_count_log2 + 1u;
+
+		struct block
+		{
+			uint32_t offset;
+			uint32_t size;
+			// physical neighbours
+			uint32_t prev_phys;
+			uint32_t next_phys;
+			// free list links
+			uint32_t prev_free;
+			uint32_t next_free;
+			bool free;
+			bool allocated;
+		};
+
+		uint32_t new_block();
+		void release_block(uint32_t b);
+		void insert_free(uint32_t b);
+		void remove_free(uint32_t b);
+		static void mapping_insert(uint32_t size, uint32_t &fl, uint32_t &sl);
+		static void mapping_search(uint32_t size, uint32_t &fl, uint32_t &sl);
+		static uint32_t bin_size(uint32_t fl, uint32_t sl);
+		uint32_t find_free(uint32_t &fl, uint32_t &sl) const;
+
+		uint32_t capacity_;
+		uint32_t bytes_used_;
+		uint32_t fl_bitmap;
+		uint32_t sl_bitmap[fl_count];
+		uint32_t free_heads[fl_count][sl_count];
+		std::vector<block> blocks;
+		std::vector<uint32_t> unused_blocks;
+	};
+}
+
+#endif /* end of include guard: TLSF_ALLOCATOR_HPP */
@@ -14,3 +14,26 @@ solution "rift"
 	dofile "deps/links.lua"
 	include "src/rift"
 	include "src/main"
+	include "src/bench_culling"
+	include "src/bench_draw_recording"
+	include "src/bench_transient_alloc"
+	include "src/test_light_clustering"
+	include "src/test_indirect_draws"
+	include "src/test_state_cache"
+	include "src/test_transform_hierarchy"
+	include "src/test_occlusion_culling"
+	include "src/meshlod"
+	include "src/test_mesh_lod"
+	include "src/test_shadow_cascades"
+	include "src/test_profiler"
+	include "src/test_render_graph"
+	include "src/test_text_batcher"
+	include "src/test_debug_draw"
+	include "src/test_nanovg_renderer"
+	include "src/test_nanovg_retained"
+	include "src/test_program_cache"
+	include "src/test_shader_preprocessor"
+	include "src/test_shader_variants"
+	include "src/test_frames_in_flight"
+	include "src/test_buffer_pool"
+	include "src/test_render_scene"
@@ -0,0 +1,29 @@
+// shader for the batched debug lines (see DebugDraw)
+#version 430
+
+layout(std140, binding = 0) uniform DebugDrawParams
+{
+	mat4 viewProjMatrix;
+};
+
+//=============================================================
+#ifdef _VERTEX_
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec4 color;
+out vec4 lineColor;
+void main()
+{
+	gl_Position = viewProjMatrix * vec4(position, 1.f);
+	lineColor = color;
+}
+#endif
+
+//=============================================================
+#ifdef _FRAGMENT_
+in vec4 lineColor;
+out vec4 oColor;
+void main()
+{
+	oColor = lineColor;
+}
+#endif
@@ -3,10 +3,7 @@
 
 // test include
 #pragma include <scene.glsl>
-
-layout(std140, binding = 2) uniform PerObject {
-	mat4 modelMatrix;
-};
+#pragma include <instance.glsl>
 
 layout (binding = 0) uniform sampler2D diffuseMap;
 
@@ -35,12 +32,12 @@ out vec2 tex;
 //--- CODE ---------------------------
 void main() 
 {
+	mat4 modelMatrix = instances[instanceIndex].modelMatrix;
 	vec4 modelPos = modelMatrix * vec4(position, 1.f);
 	gl_Position = viewProjMatrix * modelPos;
 	wPos = modelPos.xyz;
 	vPos = (viewMatrix * modelPos).xyz;
-	// TODO normalmatrix
-	wN = (modelMatrix * vec4(normal, 0.f)).xyz;
+	wN = (instances[instanceIndex].normalMatrix * vec4(normal, 0.f)).xyz;
 	wT = (modelMatrix * vec4(tangent, 0.f)).xyz;
 	tex = uv;
 }
@@ -67,6 +64,20 @@ const vec4 vertColor = vec4(0.9f, 0.9f, 0.1f, 1.0f);
 void main()
 {
 	vec2 tex2 = vec2(tex.x, 1.0f-tex.y);
+#ifdef CLUSTERED_LIGHTING
+	vec4 albedo = texture(diffuseMap, tex2.xy);
+	uvec2 cluster = getCluster(gl_FragCoord.xy, -vPos.z);
+	vec3 color = vec3(0.0);
+	for (uint i = 0; i < getNumLights(cluster); ++i) {
+		vec3 L;
+		uint index = getLightIndex(cluster, i);
+		vec3 Li = getLightIncidence(index, wPos, L);
+		if (index == 0 && clusterGridSize.w > 0)
+			Li *= getDirectionalShadow(wPos, wN, -vPos.z);
+		color += PhongIllum(albedo, wN, L, wPos, 0.1, 0.8, 0.87, Li, 1.0, 4.0).xyz;
+	}
+	oColor = vec4(color, 1.0);
+#else
 	oColor = PhongIllum(
 		texture(diffuseMap, tex2.xy),
 		wN,
@@ -74,16 +85,23 @@ void main()
 		wLightDir.xyz,
 #endif
 #ifdef POINT_LIGHT
-		wPos - wLightPos.xyz,
+		wLightPos.xyz - wPos,
 #endif
 #ifdef SPOT_LIGHT
-		wLightPos.xyz,
+		wLightPos.xyz - wPos,
 #endif
 		wPos,
 		0.1, 0.8, 0.87,
+#ifdef DIRECTIONAL_LIGHT
+		intensity.xyz * getDirectionalShadow(wPos, wN, -vPos.z),
+#elif defined(SPOT_LIGHT)
+		intensity.xyz * getSpotAttenuation(wPos),
+#else
 		intensity.xyz,
+#endif
 		1.0,
 		4.0);
+#endif
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,17 @@
+// Per-draw data
+// Written once per frame by the renderer (InstanceData in scene_renderer.cpp),
+// each draw selects its entry through its base instance.
+struct InstanceData
+{
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+	InstanceData instances[];
+};
+
+#ifdef _VERTEX_
+// per-instance attribute containing 0,1,2...: offset by the base instance of the draw
+layout(location = 4) in uint instanceIndex;
+#endif
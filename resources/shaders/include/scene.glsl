@@ -15,6 +15,44 @@ layout(std140, binding = 0) uniform SceneData {
 	vec2 viewportSize;	// taille de la fenêtre
 };
 
+// Cascaded shadow map of the shadowed directional light (the first one)
+// The cascades are the 2x2 tiles of shadowMap (ShadowData in scene_renderer.cpp)
+layout(std140, binding = 2) uniform ShadowData {
+	mat4 shadowMatrices[4];	// world to atlas coordinates and depth, per cascade
+	vec4 shadowSplits;	// view depth of the far end of each cascade
+	vec4 shadowTexelSizes;	// world size of a texel, per cascade
+	vec4 shadowParams;	// number of cascades (0: no shadows), normal offset (texels), depth bias, atlas size (texels)
+};
+
+layout(binding = 4) uniform sampler2D shadowMap;
+
+// 1 if lit, 0 if in shadow
+float getDirectionalShadow(vec3 wPos, vec3 wN, float viewDepth)
+{
+	uint numCascades = uint(shadowParams.x);
+	if (numCascades == 0 || viewDepth > shadowSplits[numCascades - 1])
+		return 1.0;
+	uint c = 0;
+	while (c + 1 < numCascades && viewDepth > shadowSplits[c])
+		++c;
+	vec3 p = wPos + normalize(wN) * shadowTexelSizes[c] * shadowParams.y;
+	vec3 s = (shadowMatrices[c] * vec4(p, 1.0)).xyz;
+	// farther than all the casters
+	if (s.z > 1.0)
+		return 1.0;
+	// stay inside the tile of the cascade
+	float atlasSize = shadowParams.w;
+	vec2 tileMin = vec2(c & 1u, c >> 1u) * 0.5;
+	s.xy = clamp(s.xy, tileMin + 1.0 / atlasSize, tileMin + 0.5 - 1.0 / atlasSize);
+	// 2x2 percentage closer filtering, with bilinear weights
+	vec2 st = s.xy * atlasSize - 0.5;
+	vec2 f = fract(st);
+	vec4 d = textureGather(shadowMap, (floor(st) + 1.0) / atlasSize);
+	vec4 lit = step(s.z - shadowParams.z, d);
+	// gather order: (0,1) (1,1) (1,0) (0,0)
+	return mix(mix(lit.w, lit.z, f.x), mix(lit.x, lit.y, f.x), f.y);
+}
+
 #ifdef DIRECTIONAL_LIGHT
 layout(std140, binding = 1) uniform Light
 {
@@ -35,8 +73,20 @@ layout(std140, binding = 1) uniform Light
 layout(std140, binding = 1) uniform Light
 {
 	vec4 intensity;
-	vec4 wLightPos;
+	vec4 wLightPos;	// w: range
+	vec4 wSpotAxis;	// w: cos(cone angle)
 };
+
+// range window and cone of the spot light (same falloff as getLightIncidence)
+float getSpotAttenuation(vec3 wPos)
+{
+	vec3 d = wPos - wLightPos.xyz;
+	float dist = length(d);
+	float x = dist / wLightPos.w;
+	float atten = clamp(1.0 - x*x*x*x, 0.0, 1.0);
+	atten *= atten;
+	return atten * smoothstep(wSpotAxis.w, mix(wSpotAxis.w, 1.0, 0.1), dot(d / max(dist, 1e-4), wSpotAxis.xyz));
+}
 #endif
 
 float fresnel(float eta, float cosTheta)
@@ -74,4 +124,80 @@ vec4 PhongIllum(
 	return vec4((ambient + diffuse + specular).xyz, 1.0);
 	// TEST
 	//return vec4(position, 1.0f);
-}
\ No newline at end of file
+}
+
+#ifdef CLUSTERED_LIGHTING
+// Clustered forward lighting: all the lights are shaded in one pass
+// (clusters are built on the CPU by LightClusterer)
+layout(std140, binding = 1) uniform ClusterParams
+{
+	uvec4 clusterGridSize;	// tiles x, tiles y, depth slices, number of directional lights
+	vec4 clusterSliceParams;	// slice = log(view depth) * x + y
+};
+
+#define LIGHT_DIRECTIONAL 0
+#define LIGHT_POINT 1
+#define LIGHT_SPOT 2
+
+struct LightData
+{
+	vec4 position;	// xyz: world position, w: range
+	vec4 intensity;	// xyz: intensity, w: type
+	vec4 direction;	// xyz: directional: towards the light, spot: cone axis; w: cos(cone angle)
+};
+
+// directional lights first (they affect all clusters), then clustered lights
+layout(std430, binding = 1) readonly buffer Lights {
+	LightData lights[];
+};
+
+// (offset, count) in clusterLightIndices
+layout(std430, binding = 2) readonly buffer Clusters {
+	uvec2 clusters[];
+};
+
+layout(std430, binding = 3) readonly buffer ClusterLightIndices {
+	uint clusterLightIndices[];
+};
+
+uvec2 getCluster(vec2 fragCoord, float viewDepth)
+{
+	uvec2 tile = min(uvec2(fragCoord / viewportSize * vec2(clusterGridSize.xy)), clusterGridSize.xy - 1);
+	uint slice = uint(clamp(log(viewDepth) * clusterSliceParams.x + clusterSliceParams.y, 0.0, float(clusterGridSize.z - 1)));
+	return clusters[(slice * clusterGridSize.y + tile.y) * clusterGridSize.x + tile.x];
+}
+
+// directional lights + lights of the cluster
+uint getNumLights(uvec2 cluster)
+{
+	return clusterGridSize.w + cluster.y;
+}
+
+uint getLightIndex(uvec2 cluster, uint i)
+{
+	if (i < clusterGridSize.w)
+		return i;
+	return clusterGridSize.w + clusterLightIndices[cluster.x + i - clusterGridSize.w];
+}
+
+// returns the intensity reaching wPos, L is the direction towards the light
+vec3 getLightIncidence(uint index, vec3 wPos, out vec3 L)
+{
+	LightData light = lights[index];
+	int type = int(light.intensity.w);
+	if (type == LIGHT_DIRECTIONAL) {
+		L = light.direction.xyz;
+		return light.intensity.xyz;
+	}
+	vec3 d = light.position.xyz - wPos;
+	float dist = length(d);
+	L = d / max(dist, 1e-4);
+	// smooth window reaching 0 at the light range
+	float x = dist / light.position.w;
+	float atten = clamp(1.0 - x*x*x*x, 0.0, 1.0);
+	atten *= atten;
+	if (type == LIGHT_SPOT)
+		atten *= smoothstep(light.direction.w, mix(light.direction.w, 1.0, 0.1), dot(-L, light.direction.xyz));
+	return light.intensity.xyz * atten;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#version 430
+
+// nanovg paths (see nanovg_renderer.cpp)
+// EDGE_AA: antialiased strokes and fringes
+
+layout(std140, binding = 0) uniform NanoVGView
+{
+	vec2 viewSize;
+};
+
+layout(std140, binding = 1) uniform NanoVGFrag
+{
+	mat3 scissorMat;
+	mat3 paintMat;
+	vec4 innerCol;
+	vec4 outerCol;
+	vec2 scissorExt;
+	vec2 scissorScale;
+	vec2 extent;
+	float radius;
+	float feather;
+	float strokeMult;
+	float strokeThr;
+	int texType;
+	int type;
+};
+
+layout(binding = 0) uniform sampler2D tex;
+
+#ifdef _VERTEX_
+layout(location = 0) in vec2 vertex;
+layout(location = 1) in vec2 tcoord;
+out vec2 ftcoord;
+out vec2 fpos;
+void main()
+{
+	ftcoord = tcoord;
+	fpos = vertex;
+	gl_Position = vec4(2.0 * vertex.x / viewSize.x - 1.0, 1.0 - 2.0 * vertex.y / viewSize.y, 0, 1);
+}
+#endif
+
+#ifdef _FRAGMENT_
+in vec2 ftcoord;
+in vec2 fpos;
+out vec4 outColor;
+
+float sdroundrect(vec2 pt, vec2 ext, float rad)
+{
+	vec2 ext2 = ext - vec2(rad, rad);
+	vec2 d = abs(pt) - ext2;
+	return min(max(d.x, d.y), 0.0) + length(max(d, 0.0)) - rad;
+}
+
+float scissorMask(vec2 p)
+{
+	vec2 sc = (abs((scissorMat * vec3(p, 1.0)).xy) - scissorExt);
+	sc = vec2(0.5, 0.5) - sc * scissorScale;
+	return clamp(sc.x, 0.0, 1.0) * clamp(sc.y, 0.0, 1.0);
+}
+
+#ifdef EDGE_AA
+// stroke: from [0..1] to clipped pyramid, where the slope is 1px
+float strokeMask()
+{
+	return min(1.0, (1.0 - abs(ftcoord.x * 2.0 - 1.0)) * strokeMult) * min(1.0, ftcoord.y);
+}
+#endif
+
+vec4 fetch(vec2 uv)
+{
+	vec4 color = texture(tex, uv);
+	if (texType == 1) color = vec4(color.xyz * color.w, color.w);
+	if (texType == 2) color = vec4(color.x);
+	return color;
+}
+
+void main()
+{
+	vec4 result;
+	float scissor = scissorMask(fpos);
+#ifdef EDGE_AA
+	float strokeAlpha = strokeMask();
+#else
+	float strokeAlpha = 1.0;
+#endif
+	if (type == 0) {
+		// gradient
+		vec2 pt = (paintMat * vec3(fpos, 1.0)).xy;
+		float d = clamp((sdroundrect(pt, extent, radius) + feather * 0.5) / feather, 0.0, 1.0);
+		result = mix(innerCol, outerCol, d) * strokeAlpha * scissor;
+	}
+	else if (type == 1) {
+		// image
+		vec2 pt = (paintMat * vec3(fpos, 1.0)).xy / extent;
+		result = fetch(pt) * innerCol * strokeAlpha * scissor;
+	}
+	else if (type == 2) {
+		// stencil fill
+		result = vec4(1, 1, 1, 1);
+	}
+	else {
+		// textured triangles
+		result = fetch(ftcoord) * scissor * innerCol;
+	}
+#ifdef EDGE_AA
+	if (strokeAlpha < strokeThr) discard;
+#endif
+	outColor = result;
+}
+#endif
@@ -28,6 +28,7 @@ void main()
 {
 	//omColor = vec4(tex.x, tex.y, 0, 1);
 	omColor = texture(colorTex, tex);
+	gl_FragDepth = texture(depthTex, tex).r;
 }
 #endif
 
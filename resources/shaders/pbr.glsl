@@ -2,9 +2,10 @@
 #version 430
 
 #pragma include <scene.glsl>
+#pragma include <instance.glsl>
 
-layout(std140, binding = 1) uniform PerObject {
-	mat4 modelMatrix;
+// material parameters
+layout(std140, binding = 3) uniform Material {
 	vec4 color;
 	float eta;
 };
@@ -26,12 +27,11 @@ out vec2 tex;
 
 void main() 
 {
-	vec4 modelPos = modelMatrix * vec4(position, 1.f);
+	vec4 modelPos = instances[instanceIndex].modelMatrix * vec4(position, 1.f);
 	gl_Position = viewProjMatrix * modelPos;
 	wPos = modelPos.xyz;
 	vPos = (viewMatrix * modelPos).xyz;
-	// TODO normalmatrix
-	wN = (modelMatrix * vec4(normal, 0.f)).xyz;
+	wN = (instances[instanceIndex].normalMatrix * vec4(normal, 0.f)).xyz;
 	tex = texcoord;
 }
 
@@ -76,6 +76,21 @@ void main( void )
 	else
 		// non transparent or total internal reflection
 		omColor = Creflected * F;
+
+#ifdef CLUSTERED_LIGHTING
+	// direct lighting: diffuse for the light that is not reflected, specular highlights
+	uvec2 cluster = getCluster(gl_FragCoord.xy, -vPos.z);
+	for (uint i = 0; i < getNumLights(cluster); ++i) {
+		vec3 L;
+		uint index = getLightIndex(cluster, i);
+		vec3 Li = getLightIncidence(index, wPos, L);
+		if (index == 0 && clusterGridSize.w > 0)
+			Li *= getDirectionalShadow(wPos, wN, -vPos.z);
+		vec3 H = normalize(L + wVn);
+		omColor.xyz += (1.0 - F) * color.xyz * Li * max(dot(wNn, L), 0.0);
+		omColor.xyz += F * Li * pow(max(dot(wNn, H), 0.0), 64.0);
+	}
+#endif
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,10 @@
+// Fragment stage of the shadow map programs (SHADOW_PASS variants of Shader::variants)
+// Depth only: the vertex stage is the one of the material shader, compiled
+// with SHADOW_PASS.
+#version 430
+
+#ifdef _FRAGMENT_
+void main()
+{
+}
+#endif
@@ -3,7 +3,6 @@
 layout(std140, binding=0) uniform TextParams
 {
 	mat4 transform;
-	vec4 fillColor;
 	vec4 outlineColor;
 };
 
@@ -11,17 +10,22 @@ layout(binding = 0) uniform sampler2D fontTex;
 
 #ifdef _VERTEX_
 layout(location=0) in vec4 postex;
+// fill color
+layout(location=1) in vec4 color;
 out vec2 tex;
+out vec4 fillColor;
 void main()
 {
 	gl_Position=transform*vec4(postex.x,postex.y,0,1);
 	 /*vec4((position.x/uViewSize.x)*2-1,(1-position.y/uViewSize.y)*2-1,0, 1);*/
 	tex=postex.zw;
+	fillColor=color;
 }
 #endif
 
 #ifdef _FRAGMENT_
 in vec2 tex;
+in vec4 fillColor;
 out vec4 omColor;
 void main()
 {
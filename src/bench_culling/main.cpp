@@ -0,0 +1,63 @@
+// Frustum culling benchmark: SSE kernel vs scalar reference over 100k objects
+#include <rendering/culling.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+namespace
+{
+	const unsigned kNumObjects = 100000;
+	const unsigned kNumIterations = 200;
+
+	template <typename Fn>
+	double measure(Fn fn)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0u; i < kNumIterations; ++i)
+			fn();
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / kNumIterations;
+	}
+}
+
+int main()
+{
+	// random boxes in a 2km cube around the camera
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> size(0.5f, 20.0f);
+	CullingBounds bounds;
+	bounds.reserve(kNumObjects);
+	for (auto i = 0u; i < kNumObjects; ++i) {
+		auto extent = glm::vec3(size(rng), size(rng), size(rng));
+		bounds.push(glm::vec3(pos(rng), pos(rng), pos(rng)), extent, glm::length(extent));
+	}
+
+	auto proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 800.0f);
+	auto view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+	auto frustum = FrustumPlanes::fromMatrix(proj * view);
+
+	std::vector<unsigned> visibleScalar;
+	std::vector<unsigned> visibleSIMD;
+	visibleScalar.reserve(kNumObjects);
+	visibleSIMD.reserve(kNumObjects);
+
+	auto scalarTime = measure([&] {
+		visibleScalar.clear();
+		cullFrustumScalar(frustum, bounds, visibleScalar);
+	});
+	auto simdTime = measure([&] {
+		visibleSIMD.clear();
+		cullFrustum(frustum, bounds, visibleSIMD);
+	});
+
+	std::printf("%u objects, %u visible\n", kNumObjects, static_cast<unsigned>(visibleSIMD.size()));
+	std::printf("scalar : %.3f ms\n", scalarTime);
+	std::printf("SIMD   : %.3f ms (x%.2f)\n", simdTime, scalarTime / simdTime);
+	if (visibleScalar != visibleSIMD) {
+		std::printf("ERROR: results differ\n");
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,10 @@
+project "bench_culling"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/bench_culling"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,109 @@
+// Draw recording benchmark: cull + record + merge + sort of a scene with 100k
+// mesh nodes, with 1 to N threads
+#include <rendering/draw_list.hpp>
+#include <scene/scene.hpp>
+#include <utils/thread_pool.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+namespace
+{
+	const unsigned kNumMeshNodes = 100000;
+	const unsigned kNumMeshes = 64;
+	const unsigned kNumMaterials = 16;
+	const unsigned kNumIterations = 50;
+
+	template <typename Fn>
+	double measure(Fn fn)
+	{
+		// warm-up (sort ids, buffer growth)
+		fn();
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0u; i < kNumIterations; ++i)
+			fn();
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / kNumIterations;
+	}
+
+	bool sameQueue(const RenderQueue &a, const RenderQueue &b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (auto i = 0u; i < a.size(); ++i)
+			if (a.getSortKey(i) != b.getSortKey(i)
+				|| a[i].mesh != b[i].mesh
+				|| a[i].material != b[i].material
+				|| a[i].modelToWorld != b[i].modelToWorld)
+				return false;
+		return true;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> pos(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> size(0.5f, 20.0f);
+
+	Shader shader;
+	std::vector<Material> materials(kNumMaterials);
+	for (auto &m : materials)
+		m.shader = &shader;
+	std::vector<Mesh> meshes(kNumMeshes);
+	for (auto &m : meshes) {
+		auto extent = glm::vec3(size(rng), size(rng), size(rng));
+		m.aabb = AABB{ -extent, extent };
+		m.boundingSphere = Sphere{ glm::vec3(0.0f), glm::length(extent) };
+	}
+
+	Scene scene;
+	for (auto i = 0u; i < kNumMeshNodes; ++i) {
+		Transform t;
+		t.setPosition(glm::vec3(pos(rng), pos(rng), pos(rng)));
+		scene.createMeshPrefab(t, meshes[rng() % kNumMeshes], materials[rng() % kNumMaterials]);
+	}
+	scene.transforms.update();
+
+	auto proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 800.0f);
+	auto view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+	auto viewProj = proj * view;
+	Material defaultMaterial;
+	defaultMaterial.shader = &shader;
+
+	auto run = [&](DrawListRecorder &recorder, util::thread_pool *pool, RenderQueue &queue) {
+		recorder.record(scene, defaultMaterial, viewProj, pool);
+		queue.clear();
+		recorder.merge(queue);
+		queue.sort();
+	};
+
+	DrawListRecorder reference;
+	RenderQueue referenceQueue;
+	auto serialTime = measure([&] { run(reference, nullptr, referenceQueue); });
+	std::printf("%u mesh nodes, %u visible\n", kNumMeshNodes, reference.getNumVisible());
+	std::printf("serial    : %.3f ms\n", serialTime);
+
+	// 1, 2, 4... threads, and all the hardware threads
+	auto maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned> threadCounts;
+	for (auto n = 1u; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	bool ok = true;
+	for (auto numThreads : threadCounts) {
+		util::thread_pool pool(numThreads - 1);
+		DrawListRecorder recorder;
+		RenderQueue queue;
+		auto time = measure([&] { run(recorder, &pool, queue); });
+		std::printf("%2u thread%s: %.3f ms (x%.2f)\n", numThreads, numThreads > 1 ? "s" : " ", time, serialTime / time);
+		if (!sameQueue(queue, referenceQueue)) {
+			std::printf("ERROR: results differ with %u threads\n", numThreads);
+			ok = false;
+		}
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,10 @@
+project "bench_draw_recording"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/bench_draw_recording"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,10 @@
+project "bench_transient_alloc"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/bench_transient_alloc"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
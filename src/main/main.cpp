@@ -18,6 +18,7 @@
 #include <screen.hpp>
 #include <input.hpp>
 #include <time.hpp>
+#include <profiler.hpp>
 
 using namespace glm;
 
@@ -37,6 +38,7 @@ private:
 	float mLastTime = 0.f;
 	float mTotalTime = 0.f;
 	float mFPS = 0;
+	bool mTraceKeyDown = false;
 	struct PerObject
 	{
 		glm::mat4 modelMatrix;
@@ -84,14 +86,27 @@ void coroutineTest()
 void RiftGame::initialize(Application &app)
 {	
 	application = &app;
+	profiler::setEnabled(true);
 	auto &graphicsContext = app.getGraphicsContext();
 	int width = app.getWidth();
 	int height = app.getHeight();
+	// linked programs are saved, and loaded by the next runs
+	auto &programCache = graphicsContext.getProgramCache();
+	programCache.setDirectory("cache/programs");
+	// material shader variants used by the last run are compiled when the shaders load
+	graphicsContext.getShaderVariantUsage().load("cache/shader_variants.txt");
 	scene = std::make_unique<Scene>();
 	sceneRenderer = std::make_unique<SceneRenderer>(glm::ivec2(width, height), graphicsContext, assetDb);
+	sceneRenderer->setMultiDrawIndirect(true);
+	sceneRenderer->setLightingMode(LightingMode::Clustered);
+	sceneRenderer->setShadows(true);
+	sceneRenderer->setOcclusionCulling(true);
 	trackball = std::make_unique<TrackballCameraControl>(app, glm::vec3{ 0.0f, 0.0f, -5.0f }, 45.0f, 0.1, 1000.0, 0.01);
 	// load scene from file
 	scene->loadFromFile(graphicsContext, "resources/scenes/sample_scene/scene.bin");
+	// large meshes of the scene (walls, floors) hide the rest
+	scene->transforms.update();
+	scene->markOccluders(5.0f);
 	scene->createLightPrefab(Transform().move({ 0.0f, -50.0f, 0.0f }), LightMode::Directional, { 1.0f, 1.0f, 1.0f });
 
 	// test bounding volumes
@@ -109,6 +124,12 @@ void RiftGame::initialize(Application &app)
 	terrain = createTerrain(graphicsContext, init);
 	scene->terrain = terrain.get();
 
+	// startup time spent on programs, with and without binaries in the cache
+	auto &programStats = programCache.getStats();
+	LOG << "Programs: " << programStats.numLoaded << " loaded from the cache in " << programStats.loadTime * 1000.0 << " ms, "
+		<< programStats.numCompiled << " compiled in " << programStats.compileTime * 1000.0 << " ms ("
+		<< programStats.numRejected << " binaries rejected)";
+
 	cc = Coroutine::start(coroutineTest);
 }
 
@@ -122,11 +143,13 @@ void RiftGame::render(float dt)
 	auto win_size_f = glm::vec2(width, height);
 	auto cam = trackball->getCamera();
 	sceneRenderer->setSceneCamera(cam);
-	sceneRenderer->renderScene(*scene, dt);
+	// debug lines are drawn by renderScene
 	capsule_42->render(*sceneRenderer);
+	sceneRenderer->renderScene(*scene, dt);
 	Logging::screenMessage("F       : " + std::to_string(application->getFrameCount()));
 	Logging::screenMessage("DT      : " + std::to_string(dt));
 	Logging::screenMessage("E       : " + std::to_string(scene->getEntities().size()));
+	profiler::showScreenMessages();
 }
 
 //============================================================================
@@ -134,6 +157,12 @@ void RiftGame::update(float dt)
 {
 	cc.resume();
 
+	// F12: save the last frames for chrome://tracing
+	bool traceKeyDown = input::getKeyState(GLFW_KEY_F12) == GLFW_PRESS;
+	if (traceKeyDown && !mTraceKeyDown)
+		profiler::saveChromeTrace("profile.json");
+	mTraceKeyDown = traceKeyDown;
+
 	mLastTime += dt;
 	mTotalTime += dt;
 
@@ -147,6 +176,9 @@ void RiftGame::update(float dt)
 
 RiftGame::~RiftGame()
 {
+	auto &variantUsage = application->getGraphicsContext().getShaderVariantUsage();
+	if (variantUsage.isDirty())
+		variantUsage.save("cache/shader_variants.txt");
 	TwDeleteAllBars();
 	scene->deleteEntity(cubeId);
 }
@@ -158,6 +190,10 @@ int main()
 	options.glMajor = 4;
 	options.glMinor = 4;
 	options.numSamples = 0;
+	// static meshes share one vertex and index buffer, and are drawn with multi-draw indirect
+	// (24MB of vertices, 8MB of indices; meshes that do not fit get their own buffers)
+	options.meshMegabufferVertices = 1024 * 1024;
+	options.meshMegabufferIndices = 4 * 1024 * 1024;
 	Application app("Rift", 1280, 720, options);
 	app.run<RiftGame>();
 	return 0;
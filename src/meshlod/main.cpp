@@ -0,0 +1,40 @@
+// Offline level of detail generation: reads a .mesh file, simplifies it and
+// writes it back in version 4 with the levels of detail
+// usage: meshlod <input.mesh> <output.mesh> [levels] [triangle ratio]
+#include <mesh_simplify.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		std::printf("usage: meshlod <input.mesh> <output.mesh> [levels (max %u)] [triangle ratio]\n", kMaxMeshLods);
+		return 1;
+	}
+	auto levels = argc > 3 ? static_cast<unsigned>(std::atoi(argv[3])) : kMaxMeshLods;
+	auto ratio = argc > 4 ? static_cast<float>(std::atof(argv[4])) : 0.5f;
+
+	std::ifstream fileIn(argv[1], std::ios::binary);
+	if (!fileIn) {
+		std::printf("cannot open %s\n", argv[1]);
+		return 1;
+	}
+	MeshData data;
+	data.loadFromStream(fileIn);
+	if (data.numLods > 1) {
+		std::printf("%s already has %u levels of detail\n", argv[1], data.numLods);
+		return 1;
+	}
+	generateMeshLods(data, levels, ratio);
+
+	for (auto lod = 0u; lod < data.numLods; ++lod) {
+		unsigned numIndices = 0;
+		for (auto &sm : data.submeshes)
+			numIndices += sm.getIndexRange(lod).numIndices;
+		std::printf("level %u: %7u triangles, error %g\n", lod, numIndices / 3, data.lodErrors[lod]);
+	}
+	std::ofstream fileOut(argv[2], std::ios::binary);
+	data.saveToStream(fileOut);
+	return fileOut ? 0 : 1;
+}
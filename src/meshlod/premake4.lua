@@ -0,0 +1,10 @@
+project "meshlod"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/meshlod"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
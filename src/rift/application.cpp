@@ -1,5 +1,6 @@
 #include <application.hpp>
 #include <log.hpp>
+#include <profiler.hpp>
 #include <gl_core_4_4.hpp>
 #include <AntTweakBar.h>
 
@@ -97,7 +98,9 @@ scrollOffsetY(0.0)
 	glfwSetKeyCallback(window, GLFWKeyHandler);
 	glfwSetMouseButtonCallback(window, GLFWMouseButtonHandler);
 	glfwSetScrollCallback(window, GLFWScrollHandler);
-	graphicsContext = std::make_unique<GraphicsContext>();
+	graphicsContext = std::make_unique<GraphicsContext>(options.framesInFlight, options.extraTransientRings);
+	if (options.meshMegabufferVertices && options.meshMegabufferIndices)
+		graphicsContext->enableMeshMegabuffer(kMeshVertexStride, options.meshMegabufferVertices, options.meshMegabufferIndices);
 }
 
 GraphicsContext &Application::getGraphicsContext()
@@ -125,6 +128,7 @@ void Application::runMainLoop()
 {
 	using namespace std::chrono;
 	try {
+		profiler::setThreadName("main");
 		qpc_clock::time_point tb = qpc_clock::now();
 		qpc_clock::time_point tf;
 		// main loop
@@ -133,12 +137,22 @@ void Application::runMainLoop()
 			duration<float> frame = duration_cast<nanoseconds>(tf - tb);
 			tb = tf;
 			lastDeltaTime = frame.count();
-			graphicsContext->beginFrame();
-			mainLoop->render(lastDeltaTime);
-			graphicsContext->endFrame();
-			mainLoop->update(lastDeltaTime);
-			glfwSwapBuffers(window);
-			glfwPollEvents();
+			{
+				PROFILE_SCOPE("render");
+				graphicsContext->beginFrame();
+				mainLoop->render(lastDeltaTime);
+				graphicsContext->endFrame();
+			}
+			{
+				PROFILE_SCOPE("update");
+				mainLoop->update(lastDeltaTime);
+			}
+			{
+				PROFILE_SCOPE("swapBuffers");
+				glfwSwapBuffers(window);
+				glfwPollEvents();
+			}
+			profiler::endFrame();
 			++frameCount;
 		}
 	}
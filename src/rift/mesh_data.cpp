@@ -1,5 +1,6 @@
 #include <mesh_data.hpp>
 #include <utils/binary_io.hpp>
+#include <cfloat>
 
 namespace
 {
@@ -58,7 +59,7 @@ namespace
 			>> out.num_vertices
 			>> out.num_indices;
 
-		assert(out.version == 3);
+		assert(out.version == 3 || out.version == 4);
 		assert(num_submeshes < 65536);
 		assert(out.num_vertices < 40 * 1024 * 1024);
 		assert(out.num_indices < 40 * 1024 * 1024);
@@ -138,4 +139,107 @@ void MeshData::loadFromStream(std::istream &in_stream)
 	{
 		ar >> util::read16(indices[i]);
 	}
+
+	// levels of detail: error, then the index range of each submesh
+	numLods = 1;
+	if (mdh.version >= 4) {
+		ar >> util::read8(numLods);
+		assert(numLods >= 1 && numLods <= kMaxMeshLods);
+		for (auto lod = 1u; lod < numLods; ++lod) {
+			ar >> lodErrors[lod];
+			for (auto &sm : submeshes) {
+				auto &range = sm.lodRanges[lod - 1];
+				ar >> range.startIndex >> range.numIndices;
+				assert(range.startIndex + range.numIndices <= mdh.num_indices);
+			}
+		}
+	}
+
+	computeBounds();
+}
+
+void MeshData::saveToStream(std::ostream &out_stream) const
+{
+	auto writeFloats = [&](const float *v, unsigned count) {
+		out_stream.write(reinterpret_cast<const char*>(v), count * sizeof(float));
+	};
+	util::write_u8(out_stream, 4);
+	util::write_u8(out_stream, 5);
+	util::write_u16le(out_stream, static_cast<uint16_t>(submeshes.size()));
+	util::write_u32le(out_stream, static_cast<uint32_t>(vertices.size()));
+	util::write_u32le(out_stream, static_cast<uint32_t>(indices.size()));
+	for (auto &sm : submeshes) {
+		util::write_u32le(out_stream, sm.startVertex);
+		util::write_u32le(out_stream, sm.startIndex);
+		util::write_u32le(out_stream, sm.numVertices);
+		util::write_u32le(out_stream, sm.numIndices);
+	}
+	for (auto i = 0u; i < vertices.size(); ++i) {
+		writeFloats(&vertices[i].x, 3);
+		writeFloats(&normals[i].x, 3);
+		writeFloats(&tangents[i].x, 3);
+		writeFloats(&uv[0][i].x, 2);
+	}
+	for (auto index : indices)
+		util::write_u16le(out_stream, index);
+	util::write_u8(out_stream, static_cast<uint8_t>(numLods));
+	for (auto lod = 1u; lod < numLods; ++lod) {
+		writeFloats(&lodErrors[lod], 1);
+		for (auto &sm : submeshes) {
+			util::write_u32le(out_stream, sm.lodRanges[lod - 1].startIndex);
+			util::write_u32le(out_stream, sm.lodRanges[lod - 1].numIndices);
+		}
+	}
+}
+
+void MeshData::computeBounds()
+{
+	// AABB, then the sphere centered on it
+	auto computeSubsetBounds = [this](unsigned startVertex, unsigned startIndex, unsigned numIndices, AABB &aabb, Sphere &sphere) {
+		aabb.min = glm::vec3(FLT_MAX);
+		aabb.max = glm::vec3(-FLT_MAX);
+		for (auto i = startIndex; i < startIndex + numIndices; ++i) {
+			auto &v = vertices[startVertex + indices[i]];
+			aabb.min = glm::min(aabb.min, v);
+			aabb.max = glm::max(aabb.max, v);
+		}
+		sphere.center = aabb.center();
+		float radiusSq = 0.0f;
+		for (auto i = startIndex; i < startIndex + numIndices; ++i) {
+			auto d = vertices[startVertex + indices[i]] - sphere.center;
+			radiusSq = glm::max(radiusSq, glm::dot(d, d));
+		}
+		sphere.radius = glm::sqrt(radiusSq);
+	};
+
+	aabb.min = glm::vec3(FLT_MAX);
+	aabb.max = glm::vec3(-FLT_MAX);
+	for (auto &sm : submeshes) {
+		assert(sm.startIndex + sm.numIndices <= indices.size());
+		if (!sm.numIndices) {
+			sm.aabb = AABB{ glm::vec3(0.0f), glm::vec3(0.0f) };
+			sm.boundingSphere = Sphere{ glm::vec3(0.0f), 0.0f };
+			continue;
+		}
+		computeSubsetBounds(sm.startVertex, sm.startIndex, sm.numIndices, sm.aabb, sm.boundingSphere);
+		aabb.min = glm::min(aabb.min, sm.aabb.min);
+		aabb.max = glm::max(aabb.max, sm.aabb.max);
+	}
+
+	if (aabb.min.x > aabb.max.x) {
+		// no submeshes: empty bounds at the origin
+		aabb = AABB{ glm::vec3(0.0f), glm::vec3(0.0f) };
+		boundingSphere = Sphere{ glm::vec3(0.0f), 0.0f };
+		return;
+	}
+
+	// the mesh sphere must enclose the submesh spheres
+	boundingSphere.center = aabb.center();
+	boundingSphere.radius = 0.0f;
+	for (auto &sm : submeshes)
+		if (sm.numIndices)
+			boundingSphere.radius = glm::max(boundingSphere.radius,
+				glm::length(sm.boundingSphere.center - boundingSphere.center) + sm.boundingSphere.radius);
+	// but is no larger than the sphere around the mesh AABB
+	boundingSphere.radius = glm::min(boundingSphere.radius, glm::length(aabb.extent()));
 }
\ No newline at end of file
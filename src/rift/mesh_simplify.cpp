@@ -0,0 +1,274 @@
+#include <mesh_simplify.hpp>
+#include <profiler.hpp>
+#include <algorithm>
+#include <cassert>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	// levels that keep more than this fraction of the triangles are not worth it
+	const float kMinLodReduction = 0.8f;
+
+	// symmetric 4x4 matrix: sum of the squared distances to a set of planes
+	struct Quadric
+	{
+		// a00 a01 a02 a03 a11 a12 a13 a22 a23 a33
+		double a[10] = {};
+
+		void addPlane(const glm::dvec3 &n, double d)
+		{
+			a[0] += n.x * n.x; a[1] += n.x * n.y; a[2] += n.x * n.z; a[3] += n.x * d;
+			a[4] += n.y * n.y; a[5] += n.y * n.z; a[6] += n.y * d;
+			a[7] += n.z * n.z; a[8] += n.z * d;
+			a[9] += d * d;
+		}
+
+		Quadric &operator+=(const Quadric &q)
+		{
+			for (auto i = 0; i < 10; ++i)
+				a[i] += q.a[i];
+			return *this;
+		}
+
+		double evaluate(const glm::dvec3 &v) const
+		{
+			auto r = a[0] * v.x * v.x + 2.0 * a[1] * v.x * v.y + 2.0 * a[2] * v.x * v.z + 2.0 * a[3] * v.x
+				+ a[4] * v.y * v.y + 2.0 * a[5] * v.y * v.z + 2.0 * a[6] * v.y
+				+ a[7] * v.z * v.z + 2.0 * a[8] * v.z
+				+ a[9];
+			return glm::max(r, 0.0);
+		}
+	};
+
+	// collapse of vertex 'from' onto vertex 'to'
+	struct Collapse
+	{
+		double cost;
+		unsigned from;
+		unsigned to;
+		// versions of the vertices when the cost was computed
+		unsigned fromVersion;
+		unsigned toVersion;
+
+		bool operator>(const Collapse &c) const {
+			return cost > c.cost;
+		}
+	};
+
+	uint64_t edgeKey(unsigned a, unsigned b)
+	{
+		return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+	}
+}
+
+float simplifyTriangles(
+	util::array_ref<glm::vec3> vertices,
+	util::array_ref<uint16_t> indices,
+	unsigned targetIndexCount,
+	std::vector<uint16_t> &out)
+{
+	const auto numVertices = static_cast<unsigned>(vertices.size());
+	const auto numTriangles = static_cast<unsigned>(indices.size() / 3);
+	std::vector<unsigned> tris(indices.begin(), indices.begin() + numTriangles * 3);
+	std::vector<uint8_t> deadTris(numTriangles, 0);
+
+	// vertices sharing a position (seams) get the same position id
+	std::vector<unsigned> order(numVertices);
+	for (auto i = 0u; i < numVertices; ++i)
+		order[i] = i;
+	auto lessPos = [&](unsigned a, unsigned b) {
+		auto &pa = vertices[a];
+		auto &pb = vertices[b];
+		return pa.x != pb.x ? pa.x < pb.x : pa.y != pb.y ? pa.y < pb.y : pa.z < pb.z;
+	};
+	std::sort(order.begin(), order.end(), lessPos);
+	std::vector<unsigned> positionId(numVertices);
+	std::vector<uint8_t> locked(numVertices, 0);
+	for (auto i = 0u; i < numVertices;) {
+		auto end = i + 1;
+		while (end < numVertices && vertices[order[end]] == vertices[order[i]])
+			++end;
+		for (auto j = i; j < end; ++j) {
+			positionId[order[j]] = order[i];
+			locked[order[j]] = end - i > 1;
+		}
+		i = end;
+	}
+
+	// borders and non-manifold edges of the welded mesh are locked
+	std::unordered_map<uint64_t, unsigned> edgeUses;
+	for (auto t = 0u; t < numTriangles; ++t)
+		for (auto k = 0u; k < 3; ++k)
+			edgeUses[edgeKey(positionId[tris[t * 3 + k]], positionId[tris[t * 3 + (k + 1) % 3]])]++;
+	for (auto t = 0u; t < numTriangles; ++t)
+		for (auto k = 0u; k < 3; ++k) {
+			auto a = tris[t * 3 + k];
+			auto b = tris[t * 3 + (k + 1) % 3];
+			if (edgeUses[edgeKey(positionId[a], positionId[b])] != 2)
+				locked[a] = locked[b] = 1;
+		}
+
+	// plane quadrics, and triangles around each vertex
+	std::vector<Quadric> quadrics(numVertices);
+	std::vector<std::vector<unsigned>> vertexTris(numVertices);
+	unsigned liveTriangles = 0;
+	for (auto t = 0u; t < numTriangles; ++t) {
+		glm::dvec3 p0(vertices[tris[t * 3]]);
+		glm::dvec3 p1(vertices[tris[t * 3 + 1]]);
+		glm::dvec3 p2(vertices[tris[t * 3 + 2]]);
+		auto n = glm::cross(p1 - p0, p2 - p0);
+		auto len = glm::length(n);
+		if (len > 0.0) {
+			n /= len;
+			for (auto k = 0u; k < 3; ++k)
+				quadrics[tris[t * 3 + k]].addPlane(n, -glm::dot(n, p0));
+		}
+		for (auto k = 0u; k < 3; ++k)
+			vertexTris[tris[t * 3 + k]].push_back(t);
+		++liveTriangles;
+	}
+
+	std::vector<unsigned> versions(numVertices, 0);
+	std::vector<uint8_t> removed(numVertices, 0);
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+	auto pushCollapse = [&](unsigned from, unsigned to) {
+		if (locked[from])
+			return;
+		auto q = quadrics[from];
+		q += quadrics[to];
+		heap.push(Collapse{ q.evaluate(glm::dvec3(vertices[to])), from, to, versions[from], versions[to] });
+	};
+	for (auto t = 0u; t < numTriangles; ++t)
+		for (auto k = 0u; k < 3; ++k) {
+			auto a = tris[t * 3 + k];
+			auto b = tris[t * 3 + (k + 1) % 3];
+			pushCollapse(a, b);
+			pushCollapse(b, a);
+		}
+
+	// a collapse must not flip or flatten the triangles that stay
+	auto isValid = [&](unsigned from, unsigned to) {
+		glm::dvec3 pTo(vertices[to]);
+		for (auto t : vertexTris[from]) {
+			if (deadTris[t])
+				continue;
+			auto tri = &tris[t * 3];
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+				continue;
+			glm::dvec3 p[3], q[3];
+			for (auto k = 0u; k < 3; ++k) {
+				p[k] = glm::dvec3(vertices[tri[k]]);
+				q[k] = tri[k] == from ? pTo : p[k];
+			}
+			auto before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			auto after = glm::cross(q[1] - q[0], q[2] - q[0]);
+			if (glm::dot(before, after) <= 1e-3 * glm::length(before) * glm::length(after)
+				|| glm::length(after) == 0.0)
+				return false;
+		}
+		return true;
+	};
+
+	double maxCost = 0.0;
+	while (liveTriangles * 3 > targetIndexCount && !heap.empty()) {
+		auto c = heap.top();
+		heap.pop();
+		if (removed[c.from] || removed[c.to]
+			|| versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion
+			|| !isValid(c.from, c.to))
+			continue;
+
+		for (auto t : vertexTris[c.from]) {
+			if (deadTris[t])
+				continue;
+			auto tri = &tris[t * 3];
+			if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+				deadTris[t] = 1;
+				--liveTriangles;
+				continue;
+			}
+			for (auto k = 0u; k < 3; ++k)
+				if (tri[k] == c.from)
+					tri[k] = c.to;
+			vertexTris[c.to].push_back(t);
+		}
+		removed[c.from] = 1;
+		vertexTris[c.from].clear();
+		quadrics[c.to] += quadrics[c.from];
+		versions[c.to]++;
+		maxCost = glm::max(maxCost, c.cost);
+
+		// new costs of the edges around the merged vertex
+		for (auto t : vertexTris[c.to]) {
+			if (deadTris[t])
+				continue;
+			for (auto k = 0u; k < 3; ++k) {
+				auto v = tris[t * 3 + k];
+				if (v == c.to)
+					continue;
+				pushCollapse(c.to, v);
+				pushCollapse(v, c.to);
+			}
+		}
+	}
+
+	out.clear();
+	out.reserve(liveTriangles * 3);
+	for (auto t = 0u; t < numTriangles; ++t)
+		if (!deadTris[t])
+			for (auto k = 0u; k < 3; ++k)
+				out.push_back(static_cast<uint16_t>(tris[t * 3 + k]));
+	return static_cast<float>(glm::sqrt(maxCost));
+}
+
+void generateMeshLods(MeshData &data, unsigned maxLods, float triangleRatio)
+{
+	PROFILE_SCOPE("generateMeshLods");
+	assert(data.numLods == 1 && "the mesh already has levels of detail");
+	maxLods = glm::min(maxLods, kMaxMeshLods);
+	const auto numSubmeshes = data.submeshes.size();
+	// indices of each submesh at the previous level
+	std::vector<std::vector<uint16_t>> previous(numSubmeshes);
+	for (auto s = 0u; s < numSubmeshes; ++s) {
+		auto &sm = data.submeshes[s];
+		auto first = data.indices.begin() + sm.startIndex;
+		previous[s].assign(first, first + sm.numIndices);
+	}
+
+	std::vector<std::vector<uint16_t>> next(numSubmeshes);
+	for (auto lod = 1u; lod < maxLods; ++lod) {
+		unsigned before = 0;
+		unsigned after = 0;
+		float error = 0.0f;
+		for (auto s = 0u; s < numSubmeshes; ++s) {
+			auto &sm = data.submeshes[s];
+			before += static_cast<unsigned>(previous[s].size());
+			if (sm.primitiveType != PrimitiveType::Triangle) {
+				next[s] = previous[s];
+				after += static_cast<unsigned>(next[s].size());
+				continue;
+			}
+			auto target = static_cast<unsigned>(previous[s].size() / 3 * triangleRatio) * 3;
+			// vertices used by the submesh
+			unsigned numVertices = 0;
+			for (auto i : previous[s])
+				numVertices = glm::max(numVertices, i + 1u);
+			auto vertices = util::array_ref<glm::vec3>(data.vertices.data() + sm.startVertex, numVertices);
+			error = glm::max(error, simplifyTriangles(vertices, previous[s], target, next[s]));
+			after += static_cast<unsigned>(next[s].size());
+		}
+		if (after > before * kMinLodReduction)
+			break;
+
+		for (auto s = 0u; s < numSubmeshes; ++s) {
+			auto &sm = data.submeshes[s];
+			sm.lodRanges[lod - 1] = IndexRange{ static_cast<unsigned>(data.indices.size()), static_cast<unsigned>(next[s].size()) };
+			data.indices.insert(data.indices.end(), next[s].begin(), next[s].end());
+			previous[s].swap(next[s]);
+		}
+		// errors add up, since each level is simplified from the previous one
+		data.lodErrors[lod] = data.lodErrors[lod - 1] + error;
+		data.numLods = lod + 1;
+	}
+}
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "physicsystem.hpp"
+#include "profiler.hpp"
 
 #include <assert.h>
 #include <map>
@@ -56,6 +57,7 @@ void PhysicSystem::setViscosity(double visc){
 }
 
 void PhysicSystem::update(float dt){
+	PROFILE_SCOPE("PhysicSystem::update");
 	//======== 0. Save the last coordinates
 	std::vector<BoundingVolume *>::iterator itBV;
 	for (itBV = _bVolumes.begin(); itBV != _bVolumes.end(); ++itBV) {
@@ -0,0 +1,610 @@
+#include <profiler.hpp>
+#include <clock.hpp>
+#include <log.hpp>
+#include <rendering/device.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace profiler
+{
+	namespace detail
+	{
+		std::atomic<bool> enabled(false);
+	}
+
+	namespace
+	{
+		// deeper scopes are not recorded
+		const unsigned kMaxDepth = 32;
+		const unsigned kCpuRoot = 0;
+		const unsigned kGpuRoot = 1;
+
+		uint64_t now()
+		{
+			using namespace std::chrono;
+			return static_cast<uint64_t>(duration_cast<nanoseconds>(qpc_clock::now().time_since_epoch()).count());
+		}
+
+		struct OpenScope
+		{
+			const char *name;
+			uint64_t begin;
+		};
+
+		// Single producer (the thread), single consumer (endFrame) ring buffer
+		// The buffer of a thread that exited is freed by the next endFrame().
+		struct ThreadBuffer
+		{
+			unsigned index;
+			// guarded by the registry mutex
+			std::string name;
+			std::unique_ptr<Event[]> events{ new Event[kThreadBufferSize] };
+			std::atomic<unsigned> writePos{ 0 };
+			std::atomic<unsigned> readPos{ 0 };
+			std::atomic<unsigned> dropped{ 0 };
+			std::atomic<bool> exited{ false };
+			// only touched by the thread
+			std::vector<OpenScope> stack;
+		};
+
+		struct Registry
+		{
+			std::mutex mutex;
+			std::vector<std::unique_ptr<ThreadBuffer>> threads;
+			// thread indices are not reused
+			unsigned nextIndex = 0;
+		};
+
+		Registry &getRegistry()
+		{
+			static Registry registry;
+			return registry;
+		}
+
+		struct ThreadBufferRef
+		{
+			ThreadBuffer *buffer = nullptr;
+
+			~ThreadBufferRef() {
+				if (buffer)
+					buffer->exited.store(true, std::memory_order_release);
+			}
+		};
+
+		thread_local ThreadBufferRef threadBuffer;
+
+		ThreadBuffer &getThreadBuffer()
+		{
+			if (!threadBuffer.buffer) {
+				auto &registry = getRegistry();
+				std::lock_guard<std::mutex> lock(registry.mutex);
+				auto buffer = std::make_unique<ThreadBuffer>();
+				buffer->index = registry.nextIndex++;
+				buffer->name = "thread " + std::to_string(buffer->index);
+				buffer->stack.reserve(kMaxDepth);
+				threadBuffer.buffer = buffer.get();
+				registry.threads.push_back(std::move(buffer));
+			}
+			return *threadBuffer.buffer;
+		}
+
+		void pushEvent(ThreadBuffer &buffer, const Event &e)
+		{
+			auto w = buffer.writePos.load(std::memory_order_relaxed);
+			auto r = buffer.readPos.load(std::memory_order_acquire);
+			if (w - r >= kThreadBufferSize) {
+				buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			buffer.events[w % kThreadBufferSize] = e;
+			buffer.writePos.store(w + 1, std::memory_order_release);
+		}
+
+		void drainEvents(ThreadBuffer &buffer, std::vector<Event> &out)
+		{
+			auto r = buffer.readPos.load(std::memory_order_relaxed);
+			auto w = buffer.writePos.load(std::memory_order_acquire);
+			for (; r != w; ++r)
+				out.push_back(buffer.events[r % kThreadBufferSize]);
+			buffer.readPos.store(w, std::memory_order_release);
+		}
+
+		// node of the scope hierarchy
+		struct Node
+		{
+			const char *name;
+			unsigned depth;
+			bool gpu;
+			std::vector<unsigned> children;
+			// frame being accumulated
+			unsigned frameCalls = 0;
+			uint64_t frameTime = 0;
+			// last committed frame
+			bool seen = false;
+			unsigned lastFrame = 0;
+			unsigned lastCalls = 0;
+			double lastMs = 0.0;
+			// frame totals (ms), rolling
+			double history[kAverageFrames] = {};
+			unsigned historySize = 0;
+			unsigned historyPos = 0;
+		};
+
+		struct GpuQuery
+		{
+			const char *name;
+			unsigned depth;
+			GLuint begin;
+			GLuint end;
+			// when the begin timestamp was issued
+			uint64_t cpuBegin;
+		};
+
+		struct GpuFrame
+		{
+			unsigned frame = 0;
+			std::vector<GpuQuery> scopes;
+		};
+
+		struct TraceFrame
+		{
+			unsigned frame;
+			uint64_t begin;
+			uint64_t end;
+			std::vector<Event> events;
+		};
+
+		struct State
+		{
+			State() {
+				nodes.resize(2);
+				nodes[kCpuRoot].gpu = false;
+				nodes[kGpuRoot].gpu = true;
+				for (auto &n : nodes) {
+					n.name = nullptr;
+					n.depth = 0;
+				}
+			}
+
+			unsigned frameIndex = 0;
+			uint64_t frameBegin = 0;
+			unsigned numDropped = 0;
+			std::vector<Node> nodes;
+			std::vector<unsigned> touched;
+			std::deque<TraceFrame> trace;
+			std::vector<Event> scratch;
+			// GPU queries, one slot per frame in flight
+			GraphicsDevice *gpuDevice = nullptr;
+			GpuFrame gpuFrames[kGpuLatency];
+			unsigned gpuSlot = 0;
+			std::vector<unsigned> gpuStack;
+			std::vector<GLuint> freeQueries;
+		};
+
+		State &getState()
+		{
+			static State state;
+			return state;
+		}
+
+		unsigned findChild(State &s, unsigned parent, const char *name, bool gpu)
+		{
+			for (auto c : s.nodes[parent].children)
+				if (s.nodes[c].name == name || !std::strcmp(s.nodes[c].name, name))
+					return c;
+			Node node;
+			node.name = name;
+			node.depth = parent == kCpuRoot || parent == kGpuRoot ? 0 : s.nodes[parent].depth + 1;
+			node.gpu = gpu;
+			auto index = static_cast<unsigned>(s.nodes.size());
+			s.nodes.push_back(node);
+			s.nodes[parent].children.push_back(index);
+			return index;
+		}
+
+		// adds the events of one frame to the hierarchy
+		// events: of a single thread (or the GPU), sorted by begin time
+		void accumulate(State &s, const Event *events, size_t count, unsigned root)
+		{
+			unsigned path[kMaxDepth];
+			// levels of path that belong to the current branch
+			unsigned pathSize = 0;
+			for (auto i = 0u; i < count; ++i) {
+				auto &e = events[i];
+				if (e.depth >= kMaxDepth)
+					continue;
+				// the parent of a scope may have started in an earlier frame
+				auto parent = e.depth && e.depth <= pathSize ? path[e.depth - 1] : root;
+				auto node = findChild(s, parent, e.name, root == kGpuRoot);
+				path[e.depth] = node;
+				pathSize = e.depth + 1;
+				auto &n = s.nodes[node];
+				if (!n.frameCalls++)
+					s.touched.push_back(node);
+				n.frameTime += e.end - e.begin;
+			}
+		}
+
+		void commit(State &s, unsigned frame)
+		{
+			for (auto index : s.touched) {
+				auto &n = s.nodes[index];
+				n.seen = true;
+				n.lastFrame = frame;
+				n.lastCalls = n.frameCalls;
+				n.lastMs = double(n.frameTime) * 1e-6;
+				n.history[n.historyPos] = n.lastMs;
+				n.historyPos = (n.historyPos + 1) % kAverageFrames;
+				n.historySize = std::min(n.historySize + 1, kAverageFrames);
+				n.frameCalls = 0;
+				n.frameTime = 0;
+			}
+			s.touched.clear();
+		}
+
+		bool lessEvent(const Event &a, const Event &b)
+		{
+			// parents before their children
+			if (a.thread != b.thread)
+				return a.thread < b.thread;
+			return a.begin != b.begin ? a.begin < b.begin : a.depth < b.depth;
+		}
+
+		void recycleGpuFrame(State &s, GpuFrame &f)
+		{
+			for (auto &q : f.scopes) {
+				s.freeQueries.push_back(q.begin);
+				s.freeQueries.push_back(q.end);
+			}
+			f.scopes.clear();
+		}
+
+		// false if a query of the frame is not available yet
+		bool resolveGpuFrame(State &s, GpuFrame &f)
+		{
+			auto &device = *s.gpuDevice;
+			auto &events = s.scratch;
+			events.clear();
+			// the GPU clock is not the CPU clock: the scopes of the frame are shifted
+			// by the smallest offset that starts none of them before it was issued
+			auto offset = std::numeric_limits<int64_t>::min();
+			for (auto &q : f.scopes) {
+				uint64_t begin, end;
+				if (!device.getQueryResult(q.begin, begin) || !device.getQueryResult(q.end, end))
+					return false;
+				events.push_back(Event{ q.name, begin, end, q.depth, kGpuThread });
+				offset = std::max(offset, int64_t(q.cpuBegin) - int64_t(begin));
+			}
+			for (auto &e : events) {
+				e.begin = uint64_t(int64_t(e.begin) + offset);
+				e.end = uint64_t(int64_t(e.end) + offset);
+			}
+			std::sort(events.begin(), events.end(), lessEvent);
+			accumulate(s, events.data(), events.size(), kGpuRoot);
+			commit(s, f.frame);
+			for (auto &t : s.trace)
+				if (t.frame == f.frame)
+					t.events.insert(t.events.end(), events.begin(), events.end());
+			recycleGpuFrame(s, f);
+			return true;
+		}
+
+		void resolveGpuFrames(State &s)
+		{
+			// oldest first, the current frame last
+			for (auto i = 1u; i <= kGpuLatency; ++i) {
+				auto &f = s.gpuFrames[(s.gpuSlot + i) % kGpuLatency];
+				if (f.scopes.empty())
+					continue;
+				if (!resolveGpuFrame(s, f))
+					break;
+			}
+		}
+
+		void appendEscaped(std::string &out, const char *str)
+		{
+			for (; *str; ++str) {
+				if (*str == '"' || *str == '\\')
+					out += '\\';
+				if (static_cast<unsigned char>(*str) >= 0x20)
+					out += *str;
+			}
+		}
+
+		std::string formatMs(double ms)
+		{
+			char buf[32];
+			std::snprintf(buf, sizeof(buf), "%.2f", ms);
+			return buf;
+		}
+	}
+
+	void setEnabled(bool enabled)
+	{
+		detail::enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	void setThreadName(const char *name)
+	{
+		auto &buffer = getThreadBuffer();
+		std::lock_guard<std::mutex> lock(getRegistry().mutex);
+		buffer.name = name;
+	}
+
+	void beginScope(const char *name)
+	{
+		auto &buffer = getThreadBuffer();
+		buffer.stack.push_back(OpenScope{ name, now() });
+	}
+
+	void endScope()
+	{
+		auto &buffer = getThreadBuffer();
+		if (buffer.stack.empty())
+			return;
+		auto scope = buffer.stack.back();
+		buffer.stack.pop_back();
+		auto depth = static_cast<unsigned>(buffer.stack.size());
+		pushEvent(buffer, Event{ scope.name, scope.begin, now(), depth, buffer.index });
+	}
+
+	void beginGpuScope(const char *name)
+	{
+		auto &s = getState();
+		auto &device = getGraphicsDevice();
+		if (&device != s.gpuDevice) {
+			// queries of another device are forgotten
+			for (auto &f : s.gpuFrames)
+				f.scopes.clear();
+			s.freeQueries.clear();
+			s.gpuStack.clear();
+			s.gpuDevice = &device;
+		}
+		GpuQuery q;
+		q.name = name;
+		q.depth = static_cast<unsigned>(s.gpuStack.size());
+		for (auto query : { &q.begin, &q.end }) {
+			if (s.freeQueries.empty()) {
+				*query = device.createQuery();
+			}
+			else {
+				*query = s.freeQueries.back();
+				s.freeQueries.pop_back();
+			}
+		}
+		q.cpuBegin = now();
+		device.queryTimestamp(q.begin);
+		auto &frame = s.gpuFrames[s.gpuSlot];
+		s.gpuStack.push_back(static_cast<unsigned>(frame.scopes.size()));
+		frame.scopes.push_back(q);
+	}
+
+	void endGpuScope()
+	{
+		auto &s = getState();
+		if (s.gpuStack.empty())
+			return;
+		auto &scopes = s.gpuFrames[s.gpuSlot].scopes;
+		auto index = s.gpuStack.back();
+		s.gpuStack.pop_back();
+		// the scope is gone if reset() was called inside it
+		if (index < scopes.size())
+			s.gpuDevice->queryTimestamp(scopes[index].end);
+	}
+
+	void endFrame()
+	{
+		auto &s = getState();
+		auto frameEnd = now();
+		auto &events = s.scratch;
+		events.clear();
+		{
+			auto &registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			for (auto &t : registry.threads) {
+				auto exited = t->exited.load(std::memory_order_acquire);
+				drainEvents(*t, events);
+				s.numDropped += t->dropped.exchange(0, std::memory_order_relaxed);
+				if (exited)
+					t.reset();
+			}
+			registry.threads.erase(std::remove(registry.threads.begin(), registry.threads.end(), nullptr), registry.threads.end());
+		}
+
+		// CPU scopes, thread by thread
+		std::sort(events.begin(), events.end(), lessEvent);
+		for (size_t i = 0; i < events.size();) {
+			auto end = i + 1;
+			while (end < events.size() && events[end].thread == events[i].thread)
+				++end;
+			accumulate(s, events.data() + i, end - i, kCpuRoot);
+			i = end;
+		}
+		commit(s, s.frameIndex);
+
+		TraceFrame t;
+		t.frame = s.frameIndex;
+		t.begin = s.frameIndex ? s.frameBegin : frameEnd;
+		t.end = frameEnd;
+		for (auto &e : events)
+			t.begin = std::min(t.begin, e.begin);
+		t.events = events;
+		s.trace.push_back(std::move(t));
+		if (s.trace.size() > kTraceFrames)
+			s.trace.pop_front();
+
+		// GPU scopes of the frames that are done
+		assert(s.gpuStack.empty() && "GPU scope open across frames");
+		s.gpuStack.clear();
+		if (s.gpuDevice)
+			resolveGpuFrames(s);
+		s.gpuSlot = (s.gpuSlot + 1) % kGpuLatency;
+		auto &next = s.gpuFrames[s.gpuSlot];
+		if (!next.scopes.empty()) {
+			// still not available after kGpuLatency frames
+			s.numDropped += static_cast<unsigned>(next.scopes.size());
+			recycleGpuFrame(s, next);
+		}
+
+		s.frameBegin = frameEnd;
+		s.frameIndex++;
+		next.frame = s.frameIndex;
+	}
+
+	unsigned getFrameIndex()
+	{
+		return getState().frameIndex;
+	}
+
+	unsigned getNumDroppedEvents()
+	{
+		return getState().numDropped;
+	}
+
+	std::vector<ScopeStats> getScopeStats()
+	{
+		auto &s = getState();
+		std::vector<ScopeStats> stats;
+		// depth first, siblings in order
+		std::vector<unsigned> stack;
+		for (auto root : { kGpuRoot, kCpuRoot }) {
+			auto &children = s.nodes[root].children;
+			stack.insert(stack.end(), children.rbegin(), children.rend());
+		}
+		while (!stack.empty()) {
+			auto &n = s.nodes[stack.back()];
+			stack.pop_back();
+			if (!n.seen)
+				continue;
+			ScopeStats st;
+			st.name = n.name;
+			st.depth = n.depth;
+			st.gpu = n.gpu;
+			st.lastFrame = n.lastFrame;
+			st.lastCalls = n.lastCalls;
+			st.lastMs = n.lastMs;
+			double sum = 0.0;
+			for (auto i = 0u; i < n.historySize; ++i)
+				sum += n.history[i];
+			st.avgMs = sum / n.historySize;
+			stats.push_back(st);
+			stack.insert(stack.end(), n.children.rbegin(), n.children.rend());
+		}
+		return stats;
+	}
+
+	std::vector<Event> getTraceEvents()
+	{
+		std::vector<Event> events;
+		for (auto &t : getState().trace)
+			events.insert(events.end(), t.events.begin(), t.events.end());
+		return events;
+	}
+
+	void writeChromeTrace(std::ostream &out)
+	{
+		auto &s = getState();
+		std::vector<std::pair<unsigned, std::string>> threadNames;
+		unsigned gpuTid;
+		{
+			auto &registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			for (auto &t : registry.threads)
+				threadNames.emplace_back(t->index, t->name);
+			gpuTid = registry.nextIndex;
+		}
+		threadNames.emplace_back(gpuTid, "GPU");
+		auto base = s.trace.empty() ? 0 : s.trace.front().begin;
+
+		std::string json = "{\"traceEvents\":[\n";
+		char buf[128];
+		for (auto &thread : threadNames) {
+			std::snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"", thread.first);
+			json += buf;
+			appendEscaped(json, thread.second.c_str());
+			json += "\"}},\n";
+		}
+		for (auto &t : s.trace) {
+			for (auto &e : t.events) {
+				json += "{\"name\":\"";
+				appendEscaped(json, e.name);
+				std::snprintf(buf, sizeof(buf), "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f},\n",
+					e.thread == kGpuThread ? "gpu" : "cpu",
+					e.thread == kGpuThread ? gpuTid : e.thread,
+					double(int64_t(e.begin - base)) * 1e-3,
+					double(e.end - e.begin) * 1e-3);
+				json += buf;
+			}
+			std::snprintf(buf, sizeof(buf), "{\"name\":\"frame %u\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":%.3f},\n",
+				t.frame, double(t.end - base) * 1e-3);
+			json += buf;
+		}
+		json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"rift\"}}\n";
+		json += "],\"displayTimeUnit\":\"ms\"}\n";
+		out << json;
+	}
+
+	bool saveChromeTrace(const char *path)
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			WARNING << "could not write profiler trace " << path;
+			return false;
+		}
+		writeChromeTrace(out);
+		LOG << "profiler trace of " << getState().trace.size() << " frames saved to " << path;
+		return true;
+	}
+
+	void showScreenMessages(unsigned maxDepth)
+	{
+		auto &s = getState();
+		auto stats = getScopeStats();
+		Logging::screenMessage("PROFILE : frame " + std::to_string(s.frameIndex)
+			+ ", ms last frame (avg of " + std::to_string(kAverageFrames) + " frames)"
+			+ (s.numDropped ? ", " + std::to_string(s.numDropped) + " events dropped" : ""));
+		bool gpu = false;
+		for (auto &st : stats) {
+			if (st.depth >= maxDepth || st.lastFrame + kAverageFrames <= s.frameIndex)
+				continue;
+			if (st.gpu && !gpu) {
+				Logging::screenMessage("PROFILE : GPU");
+				gpu = true;
+			}
+			Logging::screenMessage("PROFILE :   " + std::string(st.depth * 2, ' ') + st.name + "  "
+				+ formatMs(st.lastMs) + " (" + formatMs(st.avgMs) + ")"
+				+ (st.lastCalls > 1 ? " x" + std::to_string(st.lastCalls) : ""));
+		}
+	}
+
+	void reset()
+	{
+		auto &s = getState();
+		{
+			auto &registry = getRegistry();
+			std::lock_guard<std::mutex> lock(registry.mutex);
+			std::vector<Event> discarded;
+			for (auto &t : registry.threads) {
+				drainEvents(*t, discarded);
+				t->dropped.store(0, std::memory_order_relaxed);
+			}
+		}
+		for (auto &f : s.gpuFrames)
+			recycleGpuFrame(s, f);
+		s.nodes.resize(2);
+		for (auto &n : s.nodes)
+			n.children.clear();
+		s.touched.clear();
+		s.trace.clear();
+		s.numDropped = 0;
+		s.frameBegin = now();
+	}
+}
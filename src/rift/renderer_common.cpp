@@ -63,7 +63,8 @@ namespace
 		/*Depth24*/       {3, "Depth24"},
 		/*Depth16*/       {2, "Depth16"},
 		/*Float16*/       {2, "Float16"},
-		/*Float*/         {4, "Float"}
+		/*Float*/         {4, "Float"},
+		/*Depth32F*/      {4, "Depth32F"}
 	};
 }
 
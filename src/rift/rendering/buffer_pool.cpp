@@ -1,54 +1,31 @@
 #include <rendering/opengl4.hpp>
 #include <cassert>
+#include <algorithm>
 #include <iomanip>
 #include <log.hpp>
+#include <clock.hpp>
 
 namespace
 {
-	unsigned syncPreviousFrame(unsigned sync_cycle, unsigned k) {
-		return (sync_cycle + 3 - k) % 3;
-	}
-
-	unsigned nextLog2(size_t v)
+	size_t alignUp(size_t offset, size_t align)
 	{
-		unsigned r = 0;
-		v = v - 1;
-		while (v >>= 1) {
-			r++;
-		}
-		return r + 1;
+		return (offset + align - 1) / align * align;
 	}
 }
 
-size_t GraphicsContext::blockSizeFromPoolIndex(unsigned index)
+GLuint allocBufferRaw(GLenum target, size_t size, GLbitfield flags, const void *initialData)
 {
-	return 1ull << (index + kMinBlockSizeLog);
+	return getGraphicsDevice().createBuffer(target, size, flags, initialData);
 }
 
-// buffers[frame_index]: current frame
-// buffers[(frame_index+1)%3]: frame n-1
-// buffers[(frame_index+2)%3]: frame n-2
-
-GLuint allocBufferRaw(GLenum target, size_t size, GLbitfield flags, const void *initialData)
+void updateBufferRaw(GLuint buf, GLenum target, int offset, int size, const void *data)
 {
-	GLuint obj;
-	gl::GenBuffers(1, &obj);
-	gl::BindBuffer(target, obj);
-	// allocate immutable storage
-	gl::BufferStorage(target, size, initialData, flags);
-	gl::BindBuffer(target, 0);
-	return obj;
+	getGraphicsDevice().updateBuffer(buf, target, offset, size, data);
 }
 
-void updateBufferRaw(GLuint buf, GLenum target, int offset, int size, const void *data)
+void copyBufferRaw(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size)
 {
-	if (gl::exts::var_EXT_direct_state_access) {
-		gl::NamedBufferSubDataEXT(buf, offset, size, data);
-	}
-	else {
-		gl::BindBuffer(target, buf);
-		gl::BufferSubData(target, offset, size, data);
-	}
+	getGraphicsDevice().copyBuffer(src, dest, srcOffset, destOffset, size);
 }
 
 Buffer::Ptr GraphicsContext::allocLargeBuffer(GLenum target, size_t size, GLbitfield flags_, const void *initialData)
@@ -57,7 +34,6 @@ Buffer::Ptr GraphicsContext::allocLargeBuffer(GLenum target, size_t size, GLbitf
 	auto &buf = *ptr;
 	buf.target = target;
 	buf.size = size;
-	buf.pool_index = (unsigned)-1;
 	buf.block_index = { (unsigned)-1, (unsigned)-1 };
 	buf.offset = 0;
 	buf.obj = allocBufferRaw(
@@ -68,7 +44,7 @@ Buffer::Ptr GraphicsContext::allocLargeBuffer(GLenum target, size_t size, GLbitf
 		| gl::MAP_PERSISTENT_BIT
 		| gl::MAP_COHERENT_BIT,
 		initialData);
-	buf.ptr = gl::MapNamedBufferRangeEXT(
+	buf.ptr = getGraphicsDevice().mapBuffer(
 		buf.obj, 0, size,
 		gl::MAP_INVALIDATE_BUFFER_BIT | // discard old contents
 		gl::MAP_PERSISTENT_BIT | // persistent mapping
@@ -79,76 +55,254 @@ Buffer::Ptr GraphicsContext::allocLargeBuffer(GLenum target, size_t size, GLbitf
 	return std::move(ptr);
 }
 
-void GraphicsContext::createPool(unsigned pool_index)
+unsigned GraphicsContext::createPoolPage()
 {
-	assert(pool_index < kNumPools);
-	pools[pool_index].push_back(BufferPool());
-	auto &pool = pools[pool_index].back();
-	pool.target = gl::UNIFORM_BUFFER;
+	// reuse the slot of a released page if possible
+	unsigned page_index = 0;
+	while (page_index < pools.size() && pools[page_index].obj)
+		++page_index;
+	if (page_index == pools.size())
+		pools.push_back(BufferPool());
+	auto &pool = pools[page_index];
 	pool.obj = allocBufferRaw(
 		gl::UNIFORM_BUFFER,
 		kPoolPageSize,
-		gl::MAP_WRITE_BIT
+		gl::MAP_READ_BIT
+		| gl::MAP_WRITE_BIT
 		| gl::MAP_PERSISTENT_BIT
 		| gl::MAP_COHERENT_BIT,
 		nullptr);
-	pool.block_size = blockSizeFromPoolIndex(pool_index);
-	pool.num_blocks = kPoolPageSize / pool.block_size;
-	pool.mapped_ptr = gl::MapNamedBufferRangeEXT(
+	pool.mapped_ptr = getGraphicsDevice().mapBuffer(
 		pool.obj, 0, kPoolPageSize,
-		gl::MAP_INVALIDATE_BUFFER_BIT | // discard old contents
 		gl::MAP_PERSISTENT_BIT | // persistent mapping
 		gl::MAP_COHERENT_BIT | // coherent
-		gl::MAP_WRITE_BIT | // write-only (no readback)
+		gl::MAP_READ_BIT | // read back by compactBufferPools
+		gl::MAP_WRITE_BIT |
 		gl::MAP_UNSYNCHRONIZED_BIT // no driver sync (we handle this)
 		);
-	// add new blocks to free list
-	auto page_index = pools[pool_index].size() - 1;
-	for (auto i = 0u; i < pool.num_blocks; ++i)
+	pool.allocator.reset(kPoolPageSize);
+	pool.owners.clear();
+	pool.evacuating = false;
+	pool.free_space = pool_free_space.emplace(pool.allocator.max_alloc_size(), page_index);
+	//LOG << "newPoolPage page_index=" << page_index;
+	return page_index;
+}
+
+void GraphicsContext::releasePoolPage(unsigned page_index)
+{
+	auto &pool = pools[page_index];
+	assert(pool.obj);
+	// the GL keeps the storage alive until pending commands referencing it are done
+	getGraphicsDevice().deleteBuffer(pool.obj);
+	pool_free_space.erase(pool.free_space);
+	pool.obj = 0;
+	pool.mapped_ptr = nullptr;
+	pool.allocator.reset(0);
+	pool.owners.clear();
+	pool.evacuating = false;
+}
+
+void GraphicsContext::updatePoolFreeSpace(unsigned page_index)
+{
+	auto &pool = pools[page_index];
+	auto max_size = pool.allocator.max_alloc_size();
+	if (pool.free_space->first == max_size)
+		return;
+	pool_free_space.erase(pool.free_space);
+	pool.free_space = pool_free_space.emplace(max_size, page_index);
+}
+
+PoolBlockIndex GraphicsContext::allocFromPool(size_t size, size_t align)
+{
+	// the allocator looks for a block with room for the alignment
+	auto search_size = size + align - util::tlsf_allocator::granularity;
+	assert(search_size <= kPoolPageSize);
+	// pages with a free block large enough, smallest first
+	for (auto it = pool_free_space.lower_bound(static_cast<uint32_t>(search_size)); it != pool_free_space.end(); ++it)
 	{
-		PoolBlockIndex pbi;
-		pbi.page_index = page_index;
-		pbi.block_index = i;
-		free_list[pool_index].push_back(pbi);
+		auto i = it->second;
+		auto &pool = pools[i];
+		if (pool.evacuating)
+			continue;
+		auto block = pool.allocator.allocate(size, align);
+		if (block != util::tlsf_allocator::invalid_handle) {
+			updatePoolFreeSpace(i);
+			return PoolBlockIndex{ i, block };
+		}
+	}
+	// no room: create a new page
+	auto page_index = createPoolPage();
+	auto block = pools[page_index].allocator.allocate(size, align);
+	assert(block != util::tlsf_allocator::invalid_handle);
+	updatePoolFreeSpace(page_index);
+	return PoolBlockIndex{ page_index, block };
+}
+
+size_t GraphicsContext::getBufferAlignment(GLenum target)
+{
+	if (target == gl::UNIFORM_BUFFER || target == gl::SHADER_STORAGE_BUFFER) {
+		return std::max<size_t>(getGraphicsDevice().getBufferOffsetAlignment(target), util::tlsf_allocator::granularity);
 	}
-	//LOG << "newPool size=" << pool.block_size << " page_index=" << page_index;
+	// vertex and index data
+	return util::tlsf_allocator::granularity;
 }
 
-PoolBlockIndex GraphicsContext::allocFromPool(unsigned pool_index)
+void GraphicsContext::compactBufferPools(float maxOccupancy)
 {
-	assert(pool_index < kNumPools);
-	auto &free = free_list[pool_index];
-	if (free.empty())
-		createPool(pool_index);
-	auto block = free.back();
-	free.pop_back();
-	return block;
+	// select sparse pages (pages already evacuated wait for their release)
+	std::vector<unsigned> sparse;
+	unsigned numLivePages = 0;
+	size_t evacuatedBytes = 0;
+	size_t freeBytesLeft = 0;
+	for (auto i = 0u; i < pools.size(); ++i) {
+		auto &pool = pools[i];
+		if (!pool.obj || pool.evacuating)
+			continue;
+		++numLivePages;
+		auto pinned = std::any_of(pool.owners.begin(), pool.owners.end(), [](const Buffer *buf) { return buf && buf->pinned; });
+		if (!pinned && pool.allocator.bytes_used() < maxOccupancy * pool.allocator.capacity()) {
+			sparse.push_back(i);
+			evacuatedBytes += pool.allocator.bytes_used();
+		}
+		else
+			freeBytesLeft += pool.allocator.capacity() - pool.allocator.bytes_used();
+	}
+	// nothing to merge: a single sparse page would only move to a new page
+	// unless the other pages have room for its buffers
+	if (sparse.empty() || (sparse.size() == 1 && (numLivePages == 1 || evacuatedBytes > freeBytesLeft)))
+		return;
+	for (auto i : sparse)
+		pools[i].evacuating = true;
+	// move all live blocks out of the sparse pages
+	for (auto i : sparse)
+	{
+		for (auto h = 0u; h < pools[i].owners.size(); ++h)
+		{
+			auto buf = pools[i].owners[h];
+			if (!buf)
+				continue;
+			auto align = getBufferAlignment(buf->target);
+			// may add pages
+			auto block = allocFromPool(buf->size, align);
+			auto &dest = pools[block.page_index];
+			auto offset = dest.allocator.offset_of(block.block_index);
+			// both pages are mapped: the data is moved now, before the owner writes through the new pointer
+			auto ptr = reinterpret_cast<char*>(dest.mapped_ptr) + offset;
+			memcpy(ptr, buf->ptr, buf->size);
+			buf->obj = dest.obj;
+			buf->offset = offset;
+			buf->ptr = ptr;
+			buf->block_index = block;
+			if (dest.owners.size() <= block.block_index)
+				dest.owners.resize(block.block_index + 1, nullptr);
+			dest.owners[block.block_index] = buf;
+		}
+		pools[i].owners.clear();
+		// the draws of the frames in flight may still read the old page
+		deferUntilFrameComplete([this, i] { releasePoolPage(i); });
+	}
+}
+
+void GraphicsContext::createTransientChunk(TransientRing &ring, size_t size)
+{
+	TransientChunk chunk;
+	chunk.size = size;
+	chunk.obj = allocBufferRaw(
+		gl::UNIFORM_BUFFER,
+		size,
+		gl::MAP_WRITE_BIT
+		| gl::MAP_PERSISTENT_BIT
+		| gl::MAP_COHERENT_BIT,
+		nullptr);
+	chunk.mapped_ptr = getGraphicsDevice().mapBuffer(
+		chunk.obj, 0, size,
+		gl::MAP_INVALIDATE_BUFFER_BIT | // discard old contents
+		gl::MAP_PERSISTENT_BIT | // persistent mapping
+		gl::MAP_COHERENT_BIT | // coherent
+		gl::MAP_WRITE_BIT | // write-only (no readback)
+		gl::MAP_UNSYNCHRONIZED_BIT // no driver sync (we handle this)
+		);
+	ring.chunks.push_back(chunk);
+	//LOG << "newTransientChunk size=" << size << " num_chunks=" << ring.chunks.size();
+}
+
+void GraphicsContext::rewindTransientRing(TransientRing &ring)
+{
+	// everything allocated in this ring is free again
+	getGraphicsDevice().deleteSync(ring.sync);
+	ring.sync = 0;
+	ring.cur_chunk = 0;
+	ring.offset = 0;
+	ring.bytes_used = 0;
+	// the frame is done: release what it was still using
+	auto deferred = std::move(ring.deferred);
+	ring.deferred.clear();
+	for (auto &fn : deferred)
+		fn();
+}
+
+void GraphicsContext::deferUntilFrameComplete(std::function<void()> fn)
+{
+	// before the first frame: nothing in flight
+	if (transient_rings.empty()) {
+		fn();
+		return;
+	}
+	transient_rings[cur_ring].deferred.push_back(std::move(fn));
 }
 
 void GraphicsContext::reclaimTransientBuffers()
 {
-	// reclaim buffers from frame N-2
-	auto prev = syncPreviousFrame(sync_cycle, 0);
-	//LOG << "Number of transient buffers on frame N-2: " << transient_buffers[prev].size();
-	if (gl::ClientWaitSync(transient_syncs[prev], gl::SYNC_FLUSH_COMMANDS_BIT, 1000000)
-		== gl::TIMEOUT_EXPIRED)
+	using namespace std::chrono;
+	auto t0 = qpc_clock::now();
+	auto &device = getGraphicsDevice();
+	// reclaim the rings of all frames that the GPU has finished (does not block)
+	while (!transient_in_flight.empty())
 	{
-		//assert(false && "Timeout expired while waiting for frame N-2 to finish");
-		LOG << "Timeout expired while waiting for frame N-2 to finish";
+		auto &ring = transient_rings[transient_in_flight.front()];
+		if (!device.waitSync(ring.sync, 0))
+			break;
+		rewindTransientRing(ring);
+		transient_free_rings.push_back(transient_in_flight.front());
+		transient_in_flight.pop_front();
 	}
-	gl::DeleteSync(transient_syncs[prev]);
-	transient_buffers[prev].clear();
+
+	if (transient_free_rings.empty())
+	{
+		if (transient_rings.size() < max_transient_rings) {
+			// first frames, or the GPU is late and extra rings were requested: another ring rather than a stall
+			if (transient_rings.size() >= num_frames_in_flight)
+				LOG << "All transient rings in flight, allocating ring " << transient_rings.size() + 1;
+			transient_free_rings.push_back(transient_rings.size());
+			transient_rings.push_back(TransientRing());
+		}
+		else {
+			// all the rings queued: wait for the oldest one, the GPU may still read it until its fence signals
+			auto oldest = transient_in_flight.front();
+			while (!device.waitSync(transient_rings[oldest].sync, kFrameFenceTimeout))
+				WARNING << "Timeout expired while waiting for the oldest frame to finish, still waiting";
+			rewindTransientRing(transient_rings[oldest]);
+			transient_free_rings.push_back(oldest);
+			transient_in_flight.pop_front();
+		}
+	}
+
+	cur_ring = transient_free_rings.back();
+	transient_free_rings.pop_back();
+	fence_wait_time = duration_cast<duration<double>>(qpc_clock::now() - t0).count();
 }
 
 void GraphicsContext::showPoolDebugInfo()
 {
-	for (auto i = 0u; i < kNumPools; ++i)
+	for (auto i = 0u; i < pools.size(); ++i)
 	{
-		auto size = blockSizeFromPoolIndex(i);
 		auto &pool = pools[i];
-		auto &free = free_list[i];
+		if (!pool.obj)
+			continue;
 		std::ostringstream os;
-		os << std::left << std::setw(8) << size << std::setw(0) << ": " << free_list[i].size() << "/" << pools[i].size() * (kPoolPageSize / size);
+		os << "POOL " << std::left << std::setw(3) << i << std::setw(0) << ": " 
+			<< pool.allocator.bytes_used() / 1024 << "K/" << pool.allocator.capacity() / 1024 << "K used, " 
+			<< pool.allocator.max_alloc_size() / 1024 << "K max allocation";
 		Logging::screenMessage(os.str());
 	}
 }
@@ -156,57 +310,102 @@ void GraphicsContext::showPoolDebugInfo()
 void GraphicsContext::syncTransientBuffers()
 {
 	// fence current frame
-	auto curFrame = syncPreviousFrame(sync_cycle, 0);
-	//LOG << "Number of transient buffers allocated this frame: " << transient_buffers[curFrame].size();
+	auto &ring = transient_rings[cur_ring];
+	transient_last_bytes_used = ring.bytes_used;
+	transient_high_water_mark = std::max(transient_high_water_mark, ring.bytes_used);
 	GraphicsContext::showPoolDebugInfo();
-	Logging::screenMessage("TBUF    : " 
-		+ std::to_string(transient_buffers[curFrame].size())
-		+ "," + std::to_string(transient_buffers[syncPreviousFrame(sync_cycle, 1)].size())
-		+ "," + std::to_string(transient_buffers[syncPreviousFrame(sync_cycle, 2)].size()));
-	transient_syncs[curFrame] = gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
-	sync_cycle = (sync_cycle + 1) % 3;
+	Logging::screenMessage("TBUF    : "
+		+ std::to_string(ring.bytes_used / 1024) + "K used, "
+		+ std::to_string(transient_high_water_mark / 1024) + "K peak, "
+		+ std::to_string(ring.chunks.size()) + " chunk(s)");
+	Logging::screenMessage("FENCE   : "
+		+ std::to_string(fence_wait_time * 1000.0) + " ms wait, "
+		+ std::to_string(transient_rings.size()) + " ring(s), "
+		+ std::to_string(num_frames_in_flight) + " frames in flight");
+	ring.sync = getGraphicsDevice().fenceSync();
+	transient_in_flight.push_back(cur_ring);
 }
 
 Buffer::Ptr GraphicsContext::createBuffer(GLenum target, size_t size, const void *initialData)
 {
-	unsigned pool_index;
-	if (size < kMinBlockSize)
-		pool_index = 0;
-	else if (size > kMaxBlockSize) {
+	// the pool allocator returns aligned blocks, but needs room for the alignment to find one
+	auto align = getBufferAlignment(target);
+	if (size + align - util::tlsf_allocator::granularity > kPoolPageSize) {
 		return allocLargeBuffer(
 			target,
 			size,
 			gl::DYNAMIC_STORAGE_BIT,
 			initialData);
 	}
-	else
-		pool_index = nextLog2(size) - kMinBlockSizeLog;
-	auto block = allocFromPool(pool_index);
+	auto block = allocFromPool(size, align);
+	auto &pool = pools[block.page_index];
 	auto ptr = std::make_unique<Buffer>(*this);
 	auto &buf = *ptr;
-	buf.obj = pools[pool_index][block.page_index].obj;
-	buf.offset = block.block_index *  blockSizeFromPoolIndex(pool_index);
-	buf.ptr = reinterpret_cast<char*>(pools[pool_index][block.page_index].mapped_ptr) + buf.offset;
+	buf.target = target;
+	buf.obj = pool.obj;
+	buf.offset = pool.allocator.offset_of(block.block_index);
+	buf.ptr = reinterpret_cast<char*>(pool.mapped_ptr) + buf.offset;
 	if (initialData)
 		memcpy(buf.ptr, initialData, size);
 	buf.size = size;
 	buf.block_index = block;
-	buf.pool_index = pool_index;
+	if (pool.owners.size() <= block.block_index)
+		pool.owners.resize(block.block_index + 1, nullptr);
+	pool.owners[block.block_index] = &buf;
 	return std::move(ptr);
 }
 
-Buffer *GraphicsContext::createTransientBuffer(GLenum target, size_t size, const void *initialData)
+BufferSlice GraphicsContext::createTransientBuffer(GLenum target, size_t size, const void *initialData)
 {
-	auto ptr = createBuffer(target, size, initialData);
-	auto buf = ptr.get();
-	transient_buffers[sync_cycle].push_back(std::move(ptr));
-	return buf;
+	assert(cur_ring < transient_rings.size() && "transient buffers must be allocated between beginFrame and endFrame");
+	auto &ring = transient_rings[cur_ring];
+	auto align = getBufferAlignment(target);
+	for (;;)
+	{
+		if (ring.cur_chunk == ring.chunks.size()) {
+			// out of space: grow the ring 
+			createTransientChunk(ring, std::max<size_t>(size, kTransientChunkSize));
+		}
+		auto &chunk = ring.chunks[ring.cur_chunk];
+		auto offset = alignUp(ring.offset, align);
+		if (offset + size > chunk.size) {
+			// does not fit: continue in the next chunk
+			++ring.cur_chunk;
+			ring.offset = 0;
+			continue;
+		}
+		BufferSlice slice;
+		slice.obj = chunk.obj;
+		slice.offset = offset;
+		slice.size = size;
+		slice.ptr = reinterpret_cast<char*>(chunk.mapped_ptr) + offset;
+		if (initialData)
+			memcpy(slice.ptr, initialData, size);
+		ring.bytes_used += offset + size - ring.offset;
+		ring.offset = offset + size;
+		return slice;
+	}
 }
 
 void GraphicsContext::deleteBuffer(Buffer &buf)
 {
-	if (buf.pool_index != (unsigned)-1)
-		free_list[buf.pool_index].push_back(buf.block_index);
+	if (buf.block_index.page_index != (unsigned)-1) {
+		auto &pool = pools[buf.block_index.page_index];
+		// page already released by tearDown
+		if (!pool.obj)
+			return;
+		pool.allocator.deallocate(buf.block_index.block_index);
+		pool.owners[buf.block_index.block_index] = nullptr;
+		updatePoolFreeSpace(buf.block_index.page_index);
+		if (pool.allocator.empty()) {
+			// give the page back to GL, unless it's the last one
+			unsigned numLivePages = 0;
+			for (auto &p : pools)
+				if (p.obj && !p.evacuating) ++numLivePages;
+			if (numLivePages > 1)
+				releasePoolPage(buf.block_index.page_index);
+		}
+	}
 	else
-		gl::DeleteBuffers(1, &buf.obj);
+		getGraphicsDevice().deleteBuffer(buf.obj);
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <rendering/culling.hpp>
+#include <cassert>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define CULLING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+FrustumPlanes FrustumPlanes::fromMatrix(const glm::mat4 &viewProj)
+{
+	// Gribb-Hartmann: planes are sums of the rows of the matrix
+	// (glm matrices are column-major: row i is (m[0][i], m[1][i], m[2][i], m[3][i]))
+	auto row = [&](int i) {
+		return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	};
+	FrustumPlanes f;
+	f.planes[Left] = row(3) + row(0);
+	f.planes[Right] = row(3) - row(0);
+	f.planes[Bottom] = row(3) + row(1);
+	f.planes[Top] = row(3) - row(1);
+	// GL clip space: -w <= z <= w
+	f.planes[Near] = row(3) + row(2);
+	f.planes[Far] = row(3) - row(2);
+	for (auto &p : f.planes)
+		p /= glm::length(glm::vec3(p));
+	return f;
+}
+
+bool FrustumPlanes::intersects(const AABB &aabb) const
+{
+	auto c = aabb.center();
+	auto e = aabb.extent();
+	for (auto &p : planes) {
+		auto n = glm::vec3(p);
+		if (glm::dot(n, c) + p.w + glm::dot(glm::abs(n), e) < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+bool FrustumPlanes::intersects(const Sphere &sphere) const
+{
+	for (auto &p : planes)
+		if (glm::dot(glm::vec3(p), sphere.center) + p.w + sphere.radius < 0.0f)
+			return false;
+	return true;
+}
+
+//=============================================================================
+void CullingBounds::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	extentX.clear();
+	extentY.clear();
+	extentZ.clear();
+	radius.clear();
+}
+
+void CullingBounds::reserve(size_t count)
+{
+	centerX.reserve(count);
+	centerY.reserve(count);
+	centerZ.reserve(count);
+	extentX.reserve(count);
+	extentY.reserve(count);
+	extentZ.reserve(count);
+	radius.reserve(count);
+}
+
+unsigned CullingBounds::push(const glm::vec3 &center, const glm::vec3 &extent, float r)
+{
+	auto index = static_cast<unsigned>(size());
+	centerX.push_back(center.x);
+	centerY.push_back(center.y);
+	centerZ.push_back(center.z);
+	extentX.push_back(extent.x);
+	extentY.push_back(extent.y);
+	extentZ.push_back(extent.z);
+	radius.push_back(r);
+	return index;
+}
+
+unsigned CullingBounds::push(const AABB &aabb, const Sphere &sphere, const glm::mat4 &modelToWorld)
+{
+	auto worldAABB = transformAABB(aabb, modelToWorld);
+	auto worldSphere = transformSphere(sphere, modelToWorld);
+	return push(worldAABB.center(), worldAABB.extent(), worldSphere.radius);
+}
+
+//=============================================================================
+namespace
+{
+	// objects [begin, end)
+	void cullRangeScalar(
+		const FrustumPlanes &frustum,
+		const CullingBounds &bounds,
+		size_t begin,
+		size_t end,
+		std::vector<unsigned> &visible)
+	{
+		for (auto i = begin; i < end; ++i) {
+			bool outside = false;
+			for (auto &p : frustum.planes) {
+				auto d = p.x * bounds.centerX[i] + p.y * bounds.centerY[i] + p.z * bounds.centerZ[i] + p.w;
+				auto r = glm::abs(p.x) * bounds.extentX[i] + glm::abs(p.y) * bounds.extentY[i] + glm::abs(p.z) * bounds.extentZ[i];
+				r = glm::min(bounds.radius[i], r);
+				outside |= d + r < 0.0f;
+			}
+			if (!outside)
+				visible.push_back(static_cast<unsigned>(i));
+		}
+	}
+}
+
+void cullFrustumScalar(const FrustumPlanes &frustum, const CullingBounds &bounds, std::vector<unsigned> &visible)
+{
+	cullRangeScalar(frustum, bounds, 0, bounds.size(), visible);
+}
+
+void cullFrustum(const FrustumPlanes &frustum, const CullingBounds &bounds, std::vector<unsigned> &visible)
+{
+#ifdef CULLING_USE_SSE
+	// splat the planes once
+	__m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+	for (auto i = 0u; i < 6; ++i) {
+		auto &p = frustum.planes[i];
+		px[i] = _mm_set1_ps(p.x);
+		py[i] = _mm_set1_ps(p.y);
+		pz[i] = _mm_set1_ps(p.z);
+		pw[i] = _mm_set1_ps(p.w);
+		ax[i] = _mm_set1_ps(glm::abs(p.x));
+		ay[i] = _mm_set1_ps(glm::abs(p.y));
+		az[i] = _mm_set1_ps(glm::abs(p.z));
+	}
+
+	const auto n = bounds.size();
+	const auto zero = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		auto cx = _mm_loadu_ps(&bounds.centerX[i]);
+		auto cy = _mm_loadu_ps(&bounds.centerY[i]);
+		auto cz = _mm_loadu_ps(&bounds.centerZ[i]);
+		auto ex = _mm_loadu_ps(&bounds.extentX[i]);
+		auto ey = _mm_loadu_ps(&bounds.extentY[i]);
+		auto ez = _mm_loadu_ps(&bounds.extentZ[i]);
+		auto radius = _mm_loadu_ps(&bounds.radius[i]);
+		auto outside = _mm_setzero_ps();
+		for (auto p = 0u; p < 6; ++p) {
+			auto d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(px[p], cx),
+				_mm_mul_ps(py[p], cy)),
+				_mm_mul_ps(pz[p], cz)),
+				pw[p]);
+			auto r = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(ax[p], ex),
+				_mm_mul_ps(ay[p], ey)),
+				_mm_mul_ps(az[p], ez));
+			r = _mm_min_ps(radius, r);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, r), zero));
+		}
+		auto mask = ~_mm_movemask_ps(outside) & 0xF;
+		// common cases: all visible or all culled
+		if (mask == 0xF) {
+			auto base = static_cast<unsigned>(i);
+			visible.insert(visible.end(), { base, base + 1, base + 2, base + 3 });
+		}
+		else if (mask) {
+			for (auto j = 0u; j < 4; ++j)
+				if (mask & (1 << j))
+					visible.push_back(static_cast<unsigned>(i + j));
+		}
+	}
+	// tail
+	cullRangeScalar(frustum, bounds, i, n, visible);
+#else
+	cullFrustumScalar(frustum, bounds, visible);
+#endif
+}
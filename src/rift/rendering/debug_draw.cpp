@@ -0,0 +1,249 @@
+#include <rendering/debug_draw.hpp>
+#include <log.hpp>
+#include <glm/gtc/constants.hpp>
+#include <algorithm>
+
+namespace
+{
+	// see debug_draw.glsl
+	struct DebugDrawParams
+	{
+		glm::mat4 viewProjMatrix;
+	};
+
+	const float kTwoPi = 2.0f * glm::pi<float>();
+
+	// corner i of a box: bit 0 -> x, bit 1 -> y, bit 2 -> z
+	const unsigned kBoxEdges[12][2] = {
+		{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+		{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+		{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 }
+	};
+
+	// any unit vector orthogonal to n
+	glm::vec3 orthogonal(const glm::vec3 &n)
+	{
+		auto axis = glm::abs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		return glm::normalize(glm::cross(n, axis));
+	}
+}
+
+DebugVertex *DebugDraw::allocate(DebugDepthMode mode, unsigned numVertices)
+{
+	auto &stream = streams[static_cast<int>(mode)];
+	auto total = streams[0].size() + streams[1].size();
+	if (total + numVertices > maxVertices) {
+		if (!numDroppedVertices)
+			WARNING << "Debug draw capacity exceeded (" << maxVertices << " vertices)";
+		numDroppedVertices += numVertices;
+		return nullptr;
+	}
+	auto first = stream.size();
+	stream.resize(first + numVertices);
+	return stream.data() + first;
+}
+
+void DebugDraw::addCircle(DebugVertex *&v, const glm::vec3 &center, const glm::vec3 &u, const glm::vec3 &w,
+	float radius, float startAngle, float arc, unsigned numSegments, glm::uint32 color)
+{
+	auto point = [&](unsigned i) {
+		float t = startAngle + arc * float(i) / float(numSegments);
+		return center + radius * (glm::cos(t) * u + glm::sin(t) * w);
+	};
+	auto prev = point(0);
+	for (auto i = 1u; i <= numSegments; ++i) {
+		auto cur = point(i);
+		*v++ = DebugVertex{ prev, color };
+		*v++ = DebugVertex{ cur, color };
+		prev = cur;
+	}
+}
+
+void DebugDraw::drawLine(const glm::vec3 &a, const glm::vec3 &b, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto v = allocate(mode, 2);
+	if (!v)
+		return;
+	auto c = glm::packUnorm4x8(color);
+	v[0] = DebugVertex{ a, c };
+	v[1] = DebugVertex{ b, c };
+}
+
+void DebugDraw::drawBox(const AABB &box, const glm::vec4 &color, DebugDepthMode mode)
+{
+	drawBox(box, glm::mat4(1.0f), color, mode);
+}
+
+void DebugDraw::drawBox(const AABB &box, const glm::mat4 &transform, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto v = allocate(mode, 24);
+	if (!v)
+		return;
+	glm::vec3 corners[8];
+	for (auto i = 0u; i < 8; ++i) {
+		glm::vec3 p((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		corners[i] = glm::vec3(transform * glm::vec4(p, 1.0f));
+	}
+	auto c = glm::packUnorm4x8(color);
+	for (auto &edge : kBoxEdges) {
+		*v++ = DebugVertex{ corners[edge[0]], c };
+		*v++ = DebugVertex{ corners[edge[1]], c };
+	}
+}
+
+void DebugDraw::drawSphere(const glm::vec3 &center, float radius, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto v = allocate(mode, 3 * kCircleSegments * 2);
+	if (!v)
+		return;
+	auto c = glm::packUnorm4x8(color);
+	const glm::vec3 x(1.0f, 0.0f, 0.0f), y(0.0f, 1.0f, 0.0f), z(0.0f, 0.0f, 1.0f);
+	addCircle(v, center, x, y, radius, 0.0f, kTwoPi, kCircleSegments, c);
+	addCircle(v, center, y, z, radius, 0.0f, kTwoPi, kCircleSegments, c);
+	addCircle(v, center, z, x, radius, 0.0f, kTwoPi, kCircleSegments, c);
+}
+
+void DebugDraw::drawCapsule(const glm::vec3 &a, const glm::vec3 &b, float radius, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto axis = b - a;
+	auto length = glm::length(axis);
+	if (length < 1e-6f) {
+		drawSphere(a, radius, color, mode);
+		return;
+	}
+	// circles at both ends, 4 lines along the sides, half circles in two planes at each end
+	const unsigned kHalf = kCircleSegments / 2;
+	auto v = allocate(mode, (2 * kCircleSegments + 4 + 4 * kHalf) * 2);
+	if (!v)
+		return;
+	auto c = glm::packUnorm4x8(color);
+	auto n = axis / length;
+	auto u = orthogonal(n);
+	auto w = glm::cross(n, u);
+	addCircle(v, a, u, w, radius, 0.0f, kTwoPi, kCircleSegments, c);
+	addCircle(v, b, u, w, radius, 0.0f, kTwoPi, kCircleSegments, c);
+	for (auto side : { u, -u, w, -w }) {
+		*v++ = DebugVertex{ a + radius * side, c };
+		*v++ = DebugVertex{ b + radius * side, c };
+	}
+	addCircle(v, b, u, n, radius, 0.0f, glm::pi<float>(), kHalf, c);
+	addCircle(v, b, w, n, radius, 0.0f, glm::pi<float>(), kHalf, c);
+	addCircle(v, a, u, -n, radius, 0.0f, glm::pi<float>(), kHalf, c);
+	addCircle(v, a, w, -n, radius, 0.0f, glm::pi<float>(), kHalf, c);
+}
+
+void DebugDraw::drawFrustum(const glm::mat4 &viewProj, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto v = allocate(mode, 24);
+	if (!v)
+		return;
+	auto invViewProj = glm::inverse(viewProj);
+	glm::vec3 corners[8];
+	for (auto i = 0u; i < 8; ++i) {
+		glm::vec4 p((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f, 1.0f);
+		auto wp = invViewProj * p;
+		corners[i] = glm::vec3(wp) / wp.w;
+	}
+	auto c = glm::packUnorm4x8(color);
+	for (auto &edge : kBoxEdges) {
+		*v++ = DebugVertex{ corners[edge[0]], c };
+		*v++ = DebugVertex{ corners[edge[1]], c };
+	}
+}
+
+void DebugDraw::drawMesh(const glm::mat4 &transform, GLenum primitive, util::array_ref<glm::vec3> vertices,
+	util::array_ref<uint16_t> indices, const glm::vec4 &color, DebugDepthMode mode)
+{
+	auto count = static_cast<unsigned>(indices.size() ? indices.size() : vertices.size());
+	auto index = [&](unsigned i) {
+		return indices.size() ? indices[i] : i;
+	};
+	unsigned numVertices;
+	if (primitive == gl::TRIANGLES)
+		numVertices = count / 3 * 6;
+	else if (primitive == gl::LINES)
+		numVertices = count / 2 * 2;
+	else if (primitive == gl::LINE_STRIP)
+		numVertices = count ? (count - 1) * 2 : 0;
+	else {
+		WARNING << "Unsupported primitive type for debug meshes: " << primitive;
+		return;
+	}
+	auto v = allocate(mode, numVertices);
+	if (!v)
+		return;
+	auto c = glm::packUnorm4x8(color);
+	auto emit = [&](unsigned i) {
+		*v++ = DebugVertex{ glm::vec3(transform * glm::vec4(vertices[index(i)], 1.0f)), c };
+	};
+	if (primitive == gl::TRIANGLES) {
+		for (auto t = 0u; t + 2 < count; t += 3) {
+			emit(t); emit(t + 1);
+			emit(t + 1); emit(t + 2);
+			emit(t + 2); emit(t);
+		}
+	}
+	else if (primitive == gl::LINES) {
+		for (auto i = 0u; i + 1 < count; i += 2) {
+			emit(i); emit(i + 1);
+		}
+	}
+	else {
+		for (auto i = 0u; i + 1 < count; ++i) {
+			emit(i); emit(i + 1);
+		}
+	}
+}
+
+bool DebugDraw::empty() const
+{
+	return streams[0].empty() && streams[1].empty();
+}
+
+void DebugDraw::flush(GraphicsContext &gc, GLuint program, const glm::mat4 &viewProj)
+{
+	lastStats = Stats();
+	lastStats.maxVertices = maxVertices;
+	lastStats.numDroppedVertices = numDroppedVertices;
+	for (auto m = 0; m < static_cast<int>(DebugDepthMode::Max); ++m)
+		lastStats.numVertices[m] = static_cast<unsigned>(streams[m].size());
+	if (empty()) {
+		clear();
+		return;
+	}
+
+	if (!vao.obj)
+		vao.create(1, { { ElementFormat::Float3, 0 }, { ElementFormat::Unorm8x4, 0 } });
+	// both streams in one buffer
+	auto numVertices = streams[0].size() + streams[1].size();
+	auto vb = gc.createTransientBuffer(gl::ARRAY_BUFFER, numVertices * sizeof(DebugVertex));
+	auto dest = static_cast<DebugVertex*>(vb.ptr);
+	std::copy(streams[0].begin(), streams[0].end(), dest);
+	std::copy(streams[1].begin(), streams[1].end(), dest + streams[0].size());
+	DebugDrawParams params{ viewProj };
+	auto cb = gc.createTransientBuffer(gl::UNIFORM_BUFFER, params);
+
+	auto &device = getGraphicsDevice();
+	device.useProgram(program);
+	bindVertexBuffers({ vb }, vao);
+	bindBuffersRangeHelper(0, { cb });
+	unsigned first = 0;
+	for (auto m = 0; m < static_cast<int>(DebugDepthMode::Max); ++m) {
+		auto count = static_cast<unsigned>(streams[m].size());
+		if (!count)
+			continue;
+		device.setEnabled(gl::DEPTH_TEST, static_cast<DebugDepthMode>(m) == DebugDepthMode::Test);
+		device.drawArrays(gl::LINES, first, count);
+		first += count;
+		++lastStats.numDrawCalls;
+	}
+	device.setEnabled(gl::DEPTH_TEST, true);
+	clear();
+}
+
+void DebugDraw::clear()
+{
+	for (auto &stream : streams)
+		stream.clear();
+	numDroppedVertices = 0;
+}
@@ -0,0 +1,146 @@
+#include <rendering/draw_list.hpp>
+#include <rendering/occlusion.hpp>
+#include <rendering/lod.hpp>
+#include <scene/scene.hpp>
+#include <utils/thread_pool.hpp>
+#include <profiler.hpp>
+#include <algorithm>
+
+namespace
+{
+	const unsigned kPartitionsPerThread = 4;
+
+	// depth of the object origin, only used for ordering
+	float getSortDepth(const glm::mat4 &viewProj, const glm::mat4 &modelToWorld)
+	{
+		auto clipPos = viewProj * modelToWorld[3];
+		return clipPos.w > 0.0f ? clipPos.z / clipPos.w * 0.5f + 0.5f : 0.0f;
+	}
+}
+
+void DrawPacketList::push(const DrawItem &item, float depth)
+{
+	DrawPacket packet{ 0, item };
+	if (!RenderQueue::tryMakeSortKey(RenderQueue::Pass::Opaque, *item.material->shader, *item.material, *item.mesh, item.lod, depth, packet.sortKey))
+		pendingKeys.push_back(PendingKey{ static_cast<unsigned>(packets.size()), depth });
+	packets.push_back(packet);
+}
+
+void DrawPacketList::resolveSortKeys()
+{
+	for (auto &pending : pendingKeys) {
+		auto &packet = packets[pending.packet];
+		auto &material = *packet.item.material;
+		packet.sortKey = RenderQueue::makeSortKey(RenderQueue::Pass::Opaque, *material.shader, material, *packet.item.mesh, packet.item.lod, pending.depth);
+	}
+	pendingKeys.clear();
+}
+
+unsigned getNumPartitions(size_t numBuckets, const util::thread_pool *pool)
+{
+	const auto numThreads = pool ? pool->num_threads() : 1u;
+	return static_cast<unsigned>(std::min<size_t>(numBuckets, numThreads * kPartitionsPerThread));
+}
+
+void runPartitions(unsigned numPartitions, util::thread_pool *pool, const std::function<void(unsigned, unsigned)> &fn)
+{
+	if (pool)
+		pool->parallel_for(numPartitions, 1, fn);
+	else
+		fn(0, numPartitions);
+}
+
+void DrawListRecorder::record(
+	Scene &scene,
+	Material &defaultMaterial,
+	const glm::mat4 &viewProj,
+	util::thread_pool *pool,
+	const OcclusionBuffer *occlusion,
+	const LodSelector *lods)
+{
+	splitBuckets(scene.meshNodes.bucket_count(), pool, partitions);
+	auto frustum = FrustumPlanes::fromMatrix(viewProj);
+	runPartitions(static_cast<unsigned>(partitions.size()), pool, [&](unsigned begin, unsigned end) {
+		PROFILE_SCOPE("recordPartitions");
+		for (auto i = begin; i < end; ++i)
+			recordPartition(partitions[i], scene, defaultMaterial, frustum, viewProj, occlusion, lods);
+	});
+
+	// objects seen for the first time get their sort ids here, on the calling thread
+	numCandidates = 0;
+	numVisible = 0;
+	numOccluded = 0;
+	lodStats = LodStats();
+	for (auto &partition : partitions) {
+		partition.packets.resolveSortKeys();
+		numCandidates += static_cast<unsigned>(partition.candidates.size());
+		numVisible += static_cast<unsigned>(partition.packets.size());
+		numOccluded += partition.numOccluded;
+		for (auto lod = 0u; lod < kMaxMeshLods; ++lod) {
+			lodStats.numDraws[lod] += partition.lodStats.numDraws[lod];
+			lodStats.numTriangles[lod] += partition.lodStats.numTriangles[lod];
+		}
+	}
+}
+
+void DrawListRecorder::recordPartition(
+	Partition &partition,
+	Scene &scene,
+	Material &defaultMaterial,
+	const FrustumPlanes &frustum,
+	const glm::mat4 &viewProj,
+	const OcclusionBuffer *occlusion,
+	const LodSelector *lods)
+{
+	partition.candidates.clear();
+	partition.nodes.clear();
+	partition.bounds.clear();
+	partition.visible.clear();
+	partition.packets.clear();
+	partition.numOccluded = 0;
+	partition.lodStats = LodStats();
+
+	auto &meshNodes = scene.meshNodes;
+	for (auto b = partition.firstBucket; b < partition.endBucket; ++b)
+		for (auto it = meshNodes.begin(b); it != meshNodes.end(b); ++it) {
+			auto &meshNode = it->second;
+			auto &transform = scene.transforms.getWorldMatrix(it->first);
+			auto material = meshNode.material ? meshNode.material : &defaultMaterial;
+			partition.candidates.push_back(DrawItem{ meshNode.mesh, material, &transform, 0 });
+			partition.nodes.push_back(&meshNode);
+			partition.bounds.push(meshNode.mesh->aabb, meshNode.mesh->boundingSphere, transform);
+		}
+
+	cullFrustum(frustum, partition.bounds, partition.visible);
+
+	auto &bounds = partition.bounds;
+	for (auto index : partition.visible) {
+		if (occlusion && occlusion->isOccluded(
+			glm::vec3(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]),
+			glm::vec3(bounds.extentX[index], bounds.extentY[index], bounds.extentZ[index]))) {
+			++partition.numOccluded;
+			continue;
+		}
+		auto &item = partition.candidates[index];
+		if (lods) {
+			// mesh nodes belong to a single partition: no other thread touches them
+			auto &node = *partition.nodes[index];
+			node.lod = lods->select(*item.mesh,
+				glm::vec3(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]),
+				bounds.radius[index],
+				node.lod);
+			item.lod = node.lod;
+		}
+		partition.lodStats.numDraws[item.lod]++;
+		partition.lodStats.numTriangles[item.lod] += item.mesh->getNumTriangles(item.lod);
+		partition.packets.push(item, getSortDepth(viewProj, *item.modelToWorld));
+	}
+}
+
+void DrawListRecorder::merge(RenderQueue &queue) const
+{
+	queue.reserve(queue.size() + numVisible);
+	for (auto &partition : partitions)
+		for (auto &packet : partition.packets.getPackets())
+			queue.push(packet.sortKey, packet.item);
+}
@@ -0,0 +1,593 @@
+#include <rendering/opengl4.hpp>
+#include <log.hpp>
+#include <cassert>
+#include <stdexcept>
+
+namespace
+{
+	GLDevice sDefaultDevice;
+	GraphicsDevice *sCurrentDevice = &sDefaultDevice;
+
+	// non-normalized integer vertex formats
+	bool isIntegerFormat(const ElementFormatInfoGL &fmt)
+	{
+		if (fmt.normalize)
+			return false;
+		switch (fmt.type) {
+		case gl::BYTE:
+		case gl::UNSIGNED_BYTE:
+		case gl::SHORT:
+		case gl::UNSIGNED_SHORT:
+		case gl::INT:
+		case gl::UNSIGNED_INT:
+			return true;
+		default:
+			return false;
+		}
+	}
+}
+
+GraphicsDevice &getGraphicsDevice()
+{
+	return *sCurrentDevice;
+}
+
+void setGraphicsDevice(GraphicsDevice *device)
+{
+	sCurrentDevice = device ? device : &sDefaultDevice;
+}
+
+void GLDevice::installDebugCallback()
+{
+	setDebugCallback();
+}
+
+//---------------------------
+// buffers
+GLuint GLDevice::createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData)
+{
+	GLuint obj;
+	gl::GenBuffers(1, &obj);
+	gl::BindBuffer(target, obj);
+	// allocate immutable storage
+	gl::BufferStorage(target, size, initialData, flags);
+	gl::BindBuffer(target, 0);
+	return obj;
+}
+
+void *GLDevice::mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access)
+{
+	return gl::MapNamedBufferRangeEXT(buf, offset, size, access);
+}
+
+void GLDevice::updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data)
+{
+	if (gl::exts::var_EXT_direct_state_access) {
+		gl::NamedBufferSubDataEXT(buf, offset, size, data);
+	}
+	else {
+		gl::BindBuffer(target, buf);
+		gl::BufferSubData(target, offset, size, data);
+	}
+}
+
+void GLDevice::copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size)
+{
+	if (gl::exts::var_EXT_direct_state_access) {
+		gl::NamedCopyBufferSubDataEXT(src, dest, srcOffset, destOffset, size);
+	}
+	else {
+		gl::BindBuffer(gl::COPY_READ_BUFFER, src);
+		gl::BindBuffer(gl::COPY_WRITE_BUFFER, dest);
+		gl::CopyBufferSubData(gl::COPY_READ_BUFFER, gl::COPY_WRITE_BUFFER, srcOffset, destOffset, size);
+	}
+}
+
+void GLDevice::deleteBuffer(GLuint buf)
+{
+	gl::DeleteBuffers(1, &buf);
+}
+
+GLint GLDevice::getBufferOffsetAlignment(GLenum target)
+{
+	if (target == gl::SHADER_STORAGE_BUFFER) {
+		if (!ssbo_offset_alignment)
+			gl::GetIntegerv(gl::SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_offset_alignment);
+		return ssbo_offset_alignment;
+	}
+	assert(target == gl::UNIFORM_BUFFER);
+	if (!ubo_offset_alignment)
+		gl::GetIntegerv(gl::UNIFORM_BUFFER_OFFSET_ALIGNMENT, &ubo_offset_alignment);
+	return ubo_offset_alignment;
+}
+
+//---------------------------
+// fences
+GLsync GLDevice::fenceSync()
+{
+	return gl::FenceSync(gl::SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool GLDevice::waitSync(GLsync sync, uint64_t timeout)
+{
+	// flush only when actually waiting, polling must not stall
+	auto status = gl::ClientWaitSync(sync, timeout ? gl::SYNC_FLUSH_COMMANDS_BIT : 0, timeout);
+	return status == gl::ALREADY_SIGNALED || status == gl::CONDITION_SATISFIED;
+}
+
+void GLDevice::deleteSync(GLsync sync)
+{
+	gl::DeleteSync(sync);
+}
+
+//---------------------------
+// timer queries
+GLuint GLDevice::createQuery()
+{
+	GLuint query;
+	gl::GenQueries(1, &query);
+	return query;
+}
+
+void GLDevice::queryTimestamp(GLuint query)
+{
+	gl::QueryCounter(query, gl::TIMESTAMP);
+}
+
+bool GLDevice::getQueryResult(GLuint query, uint64_t &result)
+{
+	GLint available = 0;
+	gl::GetQueryObjectiv(query, gl::QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+	GLuint64 value = 0;
+	gl::GetQueryObjectui64v(query, gl::QUERY_RESULT, &value);
+	result = value;
+	return true;
+}
+
+void GLDevice::deleteQuery(GLuint query)
+{
+	gl::DeleteQueries(1, &query);
+}
+
+//---------------------------
+// resources
+GLuint GLDevice::createVertexArray(util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors)
+{
+	GLuint obj;
+	int offsets[kMaxVertexBufferBindings] = {};
+	gl::GenVertexArrays(1, &obj);
+	if (!gl::exts::var_EXT_direct_state_access) {
+		gl::BindVertexArray(obj);
+	}
+	for (unsigned attribindex = 0; attribindex < attribs.size(); ++attribindex)
+	{
+		const auto& attrib = attribs[attribindex];
+		const auto& fmt = getElementFormatInfoGL(attrib.format);
+		if (gl::exts::var_EXT_direct_state_access) {
+			gl::EnableVertexArrayAttribEXT(
+				obj,
+				attribindex);
+			if (isIntegerFormat(fmt))
+				gl::VertexArrayVertexAttribIFormatEXT(
+					obj,
+					attribindex,
+					fmt.size,
+					fmt.type,
+					offsets[attrib.inputSlot]);
+			else
+				gl::VertexArrayVertexAttribFormatEXT(
+					obj,
+					attribindex,
+					fmt.size,
+					fmt.type,
+					fmt.normalize,
+					offsets[attrib.inputSlot]);
+			gl::VertexArrayVertexAttribBindingEXT(
+				obj,
+				attribindex,
+				attrib.inputSlot);
+		}
+		else {
+			gl::EnableVertexAttribArray(
+				attribindex);
+			if (isIntegerFormat(fmt))
+				gl::VertexAttribIFormat(
+					attribindex,
+					fmt.size,
+					fmt.type,
+					offsets[attrib.inputSlot]);
+			else
+				gl::VertexAttribFormat(
+					attribindex,
+					fmt.size,
+					fmt.type,
+					fmt.normalize,
+					offsets[attrib.inputSlot]);
+			gl::VertexAttribBinding(
+				attribindex,
+				attrib.inputSlot);
+		}
+		offsets[attrib.inputSlot] += getElementFormatSize(attrib.format);
+	}
+	for (unsigned slot = 0; slot < divisors.size(); ++slot)
+	{
+		if (!divisors[slot])
+			continue;
+		if (gl::exts::var_EXT_direct_state_access)
+			gl::VertexArrayVertexBindingDivisorEXT(obj, slot, divisors[slot]);
+		else
+			gl::VertexBindingDivisor(slot, divisors[slot]);
+	}
+	if (!gl::exts::var_EXT_direct_state_access) {
+		gl::BindVertexArray(0);
+	}
+	return obj;
+}
+
+void GLDevice::deleteVertexArray(GLuint vao)
+{
+	gl::DeleteVertexArrays(1, &vao);
+}
+
+GLuint GLDevice::createTexture(GLenum target, unsigned numMipLevels, GLenum internalFormat, unsigned width, unsigned height)
+{
+	GLuint tex;
+	gl::GenTextures(1, &tex);
+	if (gl::exts::var_EXT_direct_state_access) {
+		gl::TextureStorage2DEXT(tex, target, numMipLevels, internalFormat, width, height);
+	}
+	else {
+		gl::BindTexture(target, tex);
+		gl::TexStorage2D(target, numMipLevels, internalFormat, width, height);
+		gl::BindTexture(target, 0);
+	}
+	return tex;
+}
+
+void GLDevice::updateTexture(GLuint tex, GLenum target, GLenum imageTarget, int mipLevel, glm::ivec2 offset, glm::ivec2 size, GLenum format, GLenum type, const void *data)
+{
+	if (gl::exts::var_EXT_direct_state_access)
+	{
+		gl::TextureSubImage2DEXT(
+			tex,
+			imageTarget,
+			mipLevel,
+			offset.x,
+			offset.y,
+			size.x,
+			size.y,
+			format,
+			type,
+			data);
+	}
+	else
+	{
+		gl::BindTexture(target, tex);
+		gl::TexSubImage2D(
+			imageTarget,
+			mipLevel,
+			offset.x,
+			offset.y,
+			size.x,
+			size.y,
+			format,
+			type,
+			data);
+		gl::BindTexture(target, 0);
+	}
+}
+
+void GLDevice::setUnpackAlignment(int alignment)
+{
+	gl::PixelStorei(gl::UNPACK_ALIGNMENT, alignment);
+}
+
+void GLDevice::deleteTexture(GLuint tex)
+{
+	gl::DeleteTextures(1, &tex);
+}
+
+GLuint GLDevice::createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget)
+{
+	static const GLenum drawBuffers[8] = {
+		gl::COLOR_ATTACHMENT0,
+		gl::COLOR_ATTACHMENT0 + 1,
+		gl::COLOR_ATTACHMENT0 + 2,
+		gl::COLOR_ATTACHMENT0 + 3,
+		gl::COLOR_ATTACHMENT0 + 4,
+		gl::COLOR_ATTACHMENT0 + 5,
+		gl::COLOR_ATTACHMENT0 + 6,
+		gl::COLOR_ATTACHMENT0 + 7
+	};
+	assert(colorTargets.size() <= 8);
+
+	GLuint fbo;
+	gl::GenFramebuffers(1, &fbo);
+	gl::BindFramebuffer(gl::FRAMEBUFFER, fbo);
+	for (unsigned i = 0; i < colorTargets.size(); ++i)
+		gl::FramebufferTexture(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0 + i, colorTargets[i], 0);
+	if (depthTarget)
+		gl::FramebufferTexture(gl::FRAMEBUFFER, gl::DEPTH_ATTACHMENT, depthTarget, 0);
+	gl::DrawBuffers(colorTargets.size(), drawBuffers);
+	// check fb completeness
+	GLenum err;
+	err = gl::CheckFramebufferStatus(gl::FRAMEBUFFER);
+	assert(err == gl::FRAMEBUFFER_COMPLETE);
+	return fbo;
+}
+
+void GLDevice::deleteFramebuffer(GLuint fbo)
+{
+	gl::DeleteFramebuffers(1, &fbo);
+}
+
+GLuint GLDevice::createSampler(GLenum minFilter, GLenum magFilter, GLenum wrapMode)
+{
+	GLuint sampler;
+	gl::GenSamplers(1, &sampler);
+	gl::SamplerParameteri(sampler, gl::TEXTURE_MIN_FILTER, minFilter);
+	gl::SamplerParameteri(sampler, gl::TEXTURE_MAG_FILTER, magFilter);
+	gl::SamplerParameteri(sampler, gl::TEXTURE_WRAP_R, wrapMode);
+	gl::SamplerParameteri(sampler, gl::TEXTURE_WRAP_S, wrapMode);
+	gl::SamplerParameteri(sampler, gl::TEXTURE_WRAP_T, wrapMode);
+	return sampler;
+}
+
+void GLDevice::deleteSampler(GLuint sampler)
+{
+	gl::DeleteSamplers(1, &sampler);
+}
+
+GLuint GLDevice::createShader(GLenum stage, const char *source)
+{
+	GLuint obj = gl::CreateShader(stage);
+	const char *shaderSources[1] = { source };
+	gl::ShaderSource(obj, 1, shaderSources, NULL);
+	gl::CompileShader(obj);
+
+	GLint status = gl::TRUE_;
+	GLint logsize = 0;
+
+	gl::GetShaderiv(obj, gl::COMPILE_STATUS, &status);
+	gl::GetShaderiv(obj, gl::INFO_LOG_LENGTH, &logsize);
+	if (status != gl::TRUE_) {
+		ERROR << "Compile error:";
+		if (logsize != 0) {
+			char *logbuf = new char[logsize];
+			gl::GetShaderInfoLog(obj, logsize, &logsize, logbuf);
+			ERROR << logbuf;
+			delete[] logbuf;
+			gl::DeleteShader(obj);
+		}
+		else {
+			ERROR << "<no log>";
+		}
+		throw std::runtime_error("shader compilation failed");
+	}
+
+	return obj;
+}
+
+void GLDevice::deleteShader(GLuint shader)
+{
+	gl::DeleteShader(shader);
+}
+
+GLuint GLDevice::createProgram(GLuint vs, GLuint gs, GLuint ps)
+{
+	auto program = gl::CreateProgram();
+	assert(vs && ps);
+	gl::AttachShader(program, vs);
+	gl::AttachShader(program, ps);
+	if (gs)
+		gl::AttachShader(program, gs);
+
+	GLint status = gl::TRUE_;
+	GLint logsize = 0;
+
+	// binaries are saved in the program cache
+	gl::ProgramParameteri(program, gl::PROGRAM_BINARY_RETRIEVABLE_HINT, gl::TRUE_);
+	gl::LinkProgram(program);
+	gl::GetProgramiv(program, gl::LINK_STATUS, &status);
+	gl::GetProgramiv(program, gl::INFO_LOG_LENGTH, &logsize);
+	if (status != gl::TRUE_) {
+		ERROR << "Link error:";
+		if (logsize != 0) {
+			char *logbuf = new char[logsize];
+			gl::GetProgramInfoLog(program, logsize, &logsize, logbuf);
+			ERROR << logbuf;
+			delete[] logbuf;
+		}
+		else {
+			ERROR << "<no log>";
+		}
+		throw std::runtime_error("link failed");
+	}
+
+	gl::DetachShader(program, vs);
+	gl::DetachShader(program, ps);
+	if (gs) {
+		gl::DetachShader(program, gs);
+	}
+	return program;
+}
+
+void GLDevice::deleteProgram(GLuint program)
+{
+	gl::DeleteProgram(program);
+}
+
+std::string GLDevice::getDriverString()
+{
+	auto str = [](GLenum name) {
+		auto s = gl::GetString(name);
+		return s ? std::string(reinterpret_cast<const char*>(s)) : std::string();
+	};
+	return str(gl::VENDOR) + " / " + str(gl::RENDERER) + " / " + str(gl::VERSION);
+}
+
+bool GLDevice::getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary)
+{
+	GLint size = 0;
+	gl::GetProgramiv(program, gl::PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0)
+		return false;
+	binary.resize(size);
+	GLsizei length = 0;
+	gl::GetProgramBinary(program, size, &length, &format, binary.data());
+	binary.resize(length);
+	return length > 0;
+}
+
+GLuint GLDevice::createProgramFromBinary(GLenum format, const void *binary, size_t size)
+{
+	auto program = gl::CreateProgram();
+	gl::ProgramBinary(program, format, binary, static_cast<GLsizei>(size));
+	// a driver update or another GPU: not an error, the program is compiled again
+	GLint status = gl::FALSE_;
+	gl::GetProgramiv(program, gl::LINK_STATUS, &status);
+	if (status != gl::TRUE_) {
+		gl::DeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+//---------------------------
+// render state
+void GLDevice::bindFramebuffer(GLuint fbo)
+{
+	gl::BindFramebuffer(gl::FRAMEBUFFER, fbo);
+}
+
+void GLDevice::viewport(int x, int y, int width, int height)
+{
+	gl::Viewport(x, y, width, height);
+}
+
+void GLDevice::clear(GLbitfield mask, const glm::vec4 &color, float depth)
+{
+	if (mask & gl::COLOR_BUFFER_BIT)
+		gl::ClearColor(color.r, color.g, color.b, color.a);
+	if (mask & gl::DEPTH_BUFFER_BIT)
+		gl::ClearDepth(depth);
+	gl::Clear(mask);
+}
+
+void GLDevice::setEnabled(GLenum cap, bool enabled)
+{
+	if (enabled)
+		gl::Enable(cap);
+	else
+		gl::Disable(cap);
+}
+
+void GLDevice::polygonMode(GLenum mode)
+{
+	gl::PolygonMode(gl::FRONT_AND_BACK, mode);
+}
+
+void GLDevice::cullFace(GLenum face)
+{
+	gl::CullFace(face);
+}
+
+void GLDevice::depthFunc(GLenum func)
+{
+	gl::DepthFunc(func);
+}
+
+void GLDevice::depthMask(bool enabled)
+{
+	gl::DepthMask(enabled ? gl::TRUE_ : gl::FALSE_);
+}
+
+void GLDevice::blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha)
+{
+	gl::BlendEquationSeparatei(drawBuffer, modeRGB, modeAlpha);
+}
+
+void GLDevice::blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+	gl::BlendFuncSeparatei(drawBuffer, srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void GLDevice::colorMask(bool enabled)
+{
+	auto v = enabled ? gl::TRUE_ : gl::FALSE_;
+	gl::ColorMask(v, v, v, v);
+}
+
+void GLDevice::stencilFunc(GLenum func, int ref, unsigned mask)
+{
+	gl::StencilFunc(func, ref, mask);
+}
+
+void GLDevice::stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+{
+	gl::StencilOpSeparate(face, stencilFail, depthFail, depthPass);
+}
+
+//---------------------------
+// bindings
+void GLDevice::useProgram(GLuint program)
+{
+	gl::UseProgram(program);
+}
+
+void GLDevice::bindVertexArray(GLuint vao)
+{
+	gl::BindVertexArray(vao);
+}
+
+void GLDevice::bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides)
+{
+	gl::BindVertexBuffers(first, count, buffers, offsets, strides);
+}
+
+void GLDevice::bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes)
+{
+	gl::BindBuffersRange(target, first, count, buffers, offsets, sizes);
+}
+
+void GLDevice::bindTextures(unsigned first, unsigned count, const GLuint *textures)
+{
+	gl::BindTextures(first, count, textures);
+}
+
+void GLDevice::bindSamplers(unsigned first, unsigned count, const GLuint *samplers)
+{
+	gl::BindSamplers(first, count, samplers);
+}
+
+//---------------------------
+// draw calls
+void GLDevice::drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount)
+{
+	gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, indexBuffer);
+	gl::DrawElementsInstancedBaseVertexBaseInstance(
+		mode,
+		indexCount,
+		indexType,
+		reinterpret_cast<void*>(indexOffset),
+		instanceCount, baseVertex, baseInstance);
+}
+
+void GLDevice::drawArrays(GLenum mode, unsigned first, unsigned count)
+{
+	gl::DrawArrays(mode, first, count);
+}
+
+void GLDevice::multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride)
+{
+	gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, indexBuffer);
+	gl::BindBuffer(gl::DRAW_INDIRECT_BUFFER, indirectBuffer);
+	gl::MultiDrawElementsIndirect(
+		mode,
+		indexType,
+		reinterpret_cast<void*>(indirectOffset),
+		drawCount,
+		stride);
+}
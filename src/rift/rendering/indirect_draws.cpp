@@ -0,0 +1,80 @@
+#include <rendering/indirect_draws.hpp>
+
+void IndirectDrawBuilder::build(const RenderQueue &queue, unsigned instancingThreshold)
+{
+	commands.clear();
+	batches.clear();
+	const auto numItems = static_cast<unsigned>(queue.size());
+	for (auto i = 0u; i < numItems;) {
+		auto &item = queue[i];
+		auto &mesh = *item.mesh;
+		// same grouping as SceneRenderer::drawRenderQueue
+		auto end = i + 1;
+		if (instancingThreshold)
+			while (end < numItems
+				&& queue[end].mesh == item.mesh
+				&& queue[end].material == item.material
+				&& queue[end].lod == item.lod)
+				++end;
+
+		if (!mesh.megabuffer) {
+			if (end - i >= instancingThreshold)
+				batches.push_back(Batch{ item.material, item.mesh, i, end - i, item.lod });
+			else
+				for (auto j = i; j < end; ++j)
+					batches.push_back(Batch{ item.material, item.mesh, j, 1, item.lod });
+			i = end;
+			continue;
+		}
+
+		// start a new batch on material change
+		if (batches.empty() || batches.back().mesh || batches.back().material != item.material)
+			batches.push_back(Batch{ item.material, nullptr, static_cast<unsigned>(commands.size()), 0, 0 });
+		auto &batch = batches.back();
+		auto addCommands = [&](unsigned firstInstance, unsigned instanceCount) {
+			for (auto &sm : mesh.submeshes) {
+				auto range = sm.getIndexRange(item.lod);
+				DrawElementsIndirectCommand cmd;
+				cmd.count = range.numIndices;
+				cmd.instanceCount = instanceCount;
+				cmd.firstIndex = mesh.getFirstIndex() + range.startIndex;
+				cmd.baseVertex = mesh.getBaseVertex() + sm.startVertex;
+				cmd.baseInstance = firstInstance;
+				commands.push_back(cmd);
+				batch.count++;
+			}
+		};
+		if (end - i >= instancingThreshold)
+			addCommands(i, end - i);
+		else
+			for (auto j = i; j < end; ++j)
+				addCommands(j, 1);
+		i = end;
+	}
+}
+
+BufferSlice IndirectDrawBuilder::upload(GraphicsContext &gc) const
+{
+	if (commands.empty())
+		return BufferSlice();
+	return gc.createTransientBuffer(
+		gl::DRAW_INDIRECT_BUFFER,
+		commands.size() * sizeof(DrawElementsIndirectCommand),
+		commands.data());
+}
+
+void submitIndirectBatch(
+	const MeshMegabuffer &megabuffer,
+	const BufferSlice &indirectBuffer,
+	unsigned firstCommand,
+	unsigned numCommands)
+{
+	getGraphicsDevice().multiDrawElementsIndirect(
+		gl::TRIANGLES,
+		megabuffer.getIndexBuffer().obj,
+		gl::UNSIGNED_SHORT,
+		indirectBuffer.obj,
+		indirectBuffer.offset + firstCommand * sizeof(DrawElementsIndirectCommand),
+		numCommands,
+		sizeof(DrawElementsIndirectCommand));
+}
@@ -0,0 +1,232 @@
+#include <rendering/light_clustering.hpp>
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define CLUSTERING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	bool operator!=(const ClusterGridParams &a, const ClusterGridParams &b)
+	{
+		return a.tilesX != b.tilesX || a.tilesY != b.tilesY || a.slices != b.slices
+			|| a.maxLightsPerCluster != b.maxLightsPerCluster;
+	}
+
+	// squared distance between a point and a box
+	// (same operations as the SIMD version, so that both give the same results)
+	float distanceSq(float minX, float minY, float minZ, float maxX, float maxY, float maxZ, const glm::vec3 &p)
+	{
+		auto dx = std::max(0.0f, std::max(minX - p.x, p.x - maxX));
+		auto dy = std::max(0.0f, std::max(minY - p.y, p.y - maxY));
+		auto dz = std::max(0.0f, std::max(minZ - p.z, p.z - maxZ));
+		return dx * dx + dy * dy + dz * dz;
+	}
+}
+
+void LightClusterer::setup(const glm::mat4 &projMat_, const ClusterGridParams &params_)
+{
+	if (projMat_ == projMat && !(params_ != params))
+		return;
+	assert(projMat_[2][3] == -1.0f && "perspective projection expected");
+	assert(params_.tilesX && params_.tilesY && params_.slices && params_.maxLightsPerCluster);
+	projMat = projMat_;
+	params = params_;
+	// planes of a GL perspective projection
+	nearPlane = projMat[3][2] / (projMat[2][2] - 1.0f);
+	farPlane = projMat[3][2] / (projMat[2][2] + 1.0f);
+	if (!(farPlane > nearPlane) || !std::isfinite(farPlane))
+		// infinite projection
+		farPlane = nearPlane * 10000.0f;
+	auto logRatio = std::log(farPlane / nearPlane);
+	sliceScale = params.slices / logRatio;
+	sliceBias = -static_cast<float>(params.slices) * std::log(nearPlane) / logRatio;
+	buildClusterBounds();
+}
+
+void LightClusterer::buildClusterBounds()
+{
+	auto tilesPerSlice = params.tilesX * params.tilesY;
+	sliceStride = (tilesPerSlice + 3) & ~3u;
+	auto size = sliceStride * params.slices;
+	// padding clusters are empty boxes: lights never touch them
+	minX.assign(size, FLT_MAX);
+	minY.assign(size, FLT_MAX);
+	minZ.assign(size, FLT_MAX);
+	maxX.assign(size, -FLT_MAX);
+	maxY.assign(size, -FLT_MAX);
+	maxZ.assign(size, -FLT_MAX);
+	scratchIndices.resize(size * params.maxLightsPerCluster);
+	scratchCounts.assign(size, 0);
+	sliceDropped.assign(params.slices, 0);
+
+	// view rays through the tile corners, normalized to z = -1
+	auto invProj = glm::inverse(projMat);
+	std::vector<glm::vec3> rays((params.tilesX + 1) * (params.tilesY + 1));
+	for (auto y = 0u; y <= params.tilesY; ++y)
+		for (auto x = 0u; x <= params.tilesX; ++x) {
+			auto ndc = glm::vec4(
+				-1.0f + 2.0f * x / params.tilesX,
+				-1.0f + 2.0f * y / params.tilesY,
+				-1.0f, 1.0f);
+			auto p = invProj * ndc;
+			rays[y * (params.tilesX + 1) + x] = glm::vec3(p) / -p.z;
+		}
+
+	for (auto s = 0u; s < params.slices; ++s) {
+		float depths[2] = {
+			nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(s) / params.slices),
+			nearPlane * std::pow(farPlane / nearPlane, static_cast<float>(s + 1) / params.slices)
+		};
+		for (auto y = 0u; y < params.tilesY; ++y)
+			for (auto x = 0u; x < params.tilesX; ++x) {
+				auto c = s * sliceStride + y * params.tilesX + x;
+				auto bmin = glm::vec3(FLT_MAX);
+				auto bmax = glm::vec3(-FLT_MAX);
+				for (auto corner = 0u; corner < 4; ++corner) {
+					auto &ray = rays[(y + (corner >> 1)) * (params.tilesX + 1) + x + (corner & 1)];
+					for (auto d : depths) {
+						bmin = glm::min(bmin, ray * d);
+						bmax = glm::max(bmax, ray * d);
+					}
+				}
+				minX[c] = bmin.x;
+				minY[c] = bmin.y;
+				minZ[c] = bmin.z;
+				maxX[c] = bmax.x;
+				maxY[c] = bmax.y;
+				maxZ[c] = bmax.z;
+			}
+	}
+}
+
+unsigned LightClusterer::getSlice(float viewDepth) const
+{
+	if (viewDepth <= nearPlane)
+		return 0;
+	auto s = static_cast<int>(std::floor(std::log(viewDepth) * sliceScale + sliceBias));
+	return static_cast<unsigned>(glm::clamp(s, 0, static_cast<int>(params.slices) - 1));
+}
+
+void LightClusterer::assignSlice(unsigned slice, util::array_ref<ClusterLight> lights)
+{
+	const auto base = slice * sliceStride;
+	const auto maxLights = params.maxLightsPerCluster;
+	auto counts = &scratchCounts[base];
+	auto indices = &scratchIndices[base * maxLights];
+	std::fill(counts, counts + sliceStride, 0);
+	unsigned dropped = 0;
+
+	auto append = [&](unsigned cluster, unsigned light) {
+		if (counts[cluster] < maxLights)
+			indices[cluster * maxLights + counts[cluster]++] = light;
+		else
+			++dropped;
+	};
+
+	for (auto l = 0u; l < lights.size(); ++l) {
+		if (slice < lightSlices[l].x || slice > lightSlices[l].y)
+			continue;
+		auto &light = lights[l];
+#ifdef CLUSTERING_USE_SSE
+		const auto zero = _mm_setzero_ps();
+		const auto px = _mm_set1_ps(light.viewPos.x);
+		const auto py = _mm_set1_ps(light.viewPos.y);
+		const auto pz = _mm_set1_ps(light.viewPos.z);
+		const auto r2 = _mm_set1_ps(light.radius * light.radius);
+		for (auto i = 0u; i < sliceStride; i += 4) {
+			auto c = base + i;
+			auto dx = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[c]), px), _mm_sub_ps(px, _mm_loadu_ps(&maxX[c]))));
+			auto dy = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[c]), py), _mm_sub_ps(py, _mm_loadu_ps(&maxY[c]))));
+			auto dz = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[c]), pz), _mm_sub_ps(pz, _mm_loadu_ps(&maxZ[c]))));
+			auto d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			auto mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+			for (auto j = 0u; mask; ++j, mask >>= 1)
+				if (mask & 1)
+					append(i + j, l);
+		}
+#else
+		auto r2 = light.radius * light.radius;
+		for (auto i = 0u; i < sliceStride; ++i) {
+			auto c = base + i;
+			if (distanceSq(minX[c], minY[c], minZ[c], maxX[c], maxY[c], maxZ[c], light.viewPos) <= r2)
+				append(i, l);
+		}
+#endif
+	}
+	sliceDropped[slice] = dropped;
+}
+
+void LightClusterer::assignLights(util::array_ref<ClusterLight> lights, util::thread_pool *pool)
+{
+	assert(sliceStride && "setup() must be called first");
+	// slice range of each light (one extra slice on each side to be
+	// conservative wrt. rounding at the slice boundaries)
+	lightSlices.resize(lights.size());
+	for (auto l = 0u; l < lights.size(); ++l) {
+		auto depth = -lights[l].viewPos.z;
+		auto first = getSlice(depth - lights[l].radius);
+		auto last = getSlice(depth + lights[l].radius);
+		if (depth + lights[l].radius < nearPlane)
+			// entirely behind the near plane
+			lightSlices[l] = glm::uvec2(1, 0);
+		else
+			lightSlices[l] = glm::uvec2(first ? first - 1 : 0, std::min(last + 1, params.slices - 1));
+	}
+
+	if (pool)
+		pool->parallel_for(params.slices, 1, [&](unsigned begin, unsigned end) {
+			for (auto s = begin; s < end; ++s)
+				assignSlice(s, lights);
+		});
+	else
+		for (auto s = 0u; s < params.slices; ++s)
+			assignSlice(s, lights);
+	compact();
+}
+
+void LightClusterer::assignLightsReference(util::array_ref<ClusterLight> lights)
+{
+	assert(sliceStride && "setup() must be called first");
+	const auto maxLights = params.maxLightsPerCluster;
+	for (auto s = 0u; s < params.slices; ++s) {
+		unsigned dropped = 0;
+		for (auto i = 0u; i < sliceStride; ++i) {
+			auto c = s * sliceStride + i;
+			scratchCounts[c] = 0;
+			for (auto l = 0u; l < lights.size(); ++l) {
+				auto r2 = lights[l].radius * lights[l].radius;
+				if (distanceSq(minX[c], minY[c], minZ[c], maxX[c], maxY[c], maxZ[c], lights[l].viewPos) > r2)
+					continue;
+				if (scratchCounts[c] < maxLights)
+					scratchIndices[c * maxLights + scratchCounts[c]++] = l;
+				else
+					++dropped;
+			}
+		}
+		sliceDropped[s] = dropped;
+	}
+	compact();
+}
+
+void LightClusterer::compact()
+{
+	const auto maxLights = params.maxLightsPerCluster;
+	const auto tilesPerSlice = params.tilesX * params.tilesY;
+	clusters.resize(getNumClusters());
+	lightIndices.clear();
+	numDroppedLights = 0;
+	for (auto s = 0u; s < params.slices; ++s) {
+		numDroppedLights += sliceDropped[s];
+		for (auto t = 0u; t < tilesPerSlice; ++t) {
+			auto c = s * sliceStride + t;
+			auto count = scratchCounts[c];
+			clusters[s * tilesPerSlice + t] = glm::uvec2(lightIndices.size(), count);
+			lightIndices.insert(lightIndices.end(), &scratchIndices[c * maxLights], &scratchIndices[c * maxLights] + count);
+		}
+	}
+}
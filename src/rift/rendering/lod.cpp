@@ -0,0 +1,38 @@
+#include <rendering/lod.hpp>
+#include <rendering/opengl4.hpp>
+
+namespace
+{
+	// objects closer than this are at the finest level
+	const float kMinLodDistance = 1e-3f;
+}
+
+LodSelector::LodSelector(const glm::vec3 &eye_, const glm::mat4 &projMatrix, float viewportHeight, const LodParams &params) :
+	eye(eye_),
+	pixelsPerUnit(projMatrix[1][1] * viewportHeight * 0.5f),
+	allowedError(params.maxPixelError * glm::exp2(params.bias)),
+	hysteresis(params.hysteresis)
+{
+}
+
+float LodSelector::getProjectedError(float error, const glm::vec3 &center, float radius, float scale) const
+{
+	auto distance = glm::max(glm::length(center - eye) - radius, kMinLodDistance);
+	return error * scale * pixelsPerUnit / distance;
+}
+
+unsigned LodSelector::select(const Mesh &mesh, const glm::vec3 &center, float radius, unsigned previous) const
+{
+	if (mesh.numLods == 1)
+		return 0;
+	// world-space radius over object-space radius
+	auto scale = mesh.boundingSphere.radius > 0.0f ? radius / mesh.boundingSphere.radius : 1.0f;
+	auto lod = glm::min(previous, mesh.numLods - 1);
+	// finer while the current level is too coarse
+	while (lod > 0 && getProjectedError(mesh.lodErrors[lod], center, radius, scale) > allowedError)
+		--lod;
+	// coarser while the next level is well within the budget
+	while (lod + 1 < mesh.numLods && getProjectedError(mesh.lodErrors[lod + 1], center, radius, scale) <= allowedError * hysteresis)
+		++lod;
+	return lod;
+}
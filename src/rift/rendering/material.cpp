@@ -1,31 +1,25 @@
 #include <rendering/opengl4.hpp>
 #include <utils/binary_io.hpp>
 #include <log.hpp>
-
-namespace 
-{
-	GLuint compileShaderVariant(
-		const std::string &vs_source, 
-		const std::string &ps_source, 
-		util::array_ref<ShaderKeyword> keywords)
-	{
-		auto vs = compileShader(vs_source.c_str(), "", gl::VERTEX_SHADER, keywords);
-		auto ps = compileShader(ps_source.c_str(), "", gl::FRAGMENT_SHADER, keywords);
-		auto prog = compileProgram(vs, 0, ps);
-		gl::DeleteShader(vs);
-		gl::DeleteShader(ps);
-		return prog;
-	}
-}
+#include <profiler.hpp>
 
 Shader *loadShaderAsset(AssetDatabase &assetDb, GraphicsContext &gc, std::string assetId)
 {
 	return assetDb.loadAsset<Shader>(assetId, [&]{
+		PROFILE_SCOPE("loadShaderAsset");
 		auto src = loadShaderSource(assetId.c_str());
 		auto ptr = std::make_unique<Shader>();
-		ptr->programForwardPointLight = compileShaderVariant(src, src, { { "POINT_LIGHT" } });
-		ptr->programForwardDirectionalLight = compileShaderVariant(src, src, { { "DIRECTIONAL_LIGHT" } });
-		ptr->programForwardSpotLight = compileShaderVariant(src, src, { { "SPOT_LIGHT" } });
+		auto &variants = ptr->variants;
+		variants.setSources(src, assetId, src, assetId);
+		// depth only fragment stage
+		const std::string shadowPath = "resources/shaders/shadow.glsl";
+		variants.setShadowPassSource(loadShaderSource(shadowPath.c_str()), shadowPath);
+		variants.addAxis({ "", "SHADOW_PASS" });
+		// forward passes: one light, or all lights in one pass
+		variants.addAxis({ "", "POINT_LIGHT", "DIRECTIONAL_LIGHT", "SPOT_LIGHT", "CLUSTERED_LIGHTING" });
+		// the others are compiled on first use
+		auto numPrewarmed = variants.prewarm(gc, gc.getShaderVariantUsage().getVariants(assetId));
+		LOG << "Shader " << assetId << ": " << numPrewarmed << " of " << variants.getNumPermutations() << " variants prewarmed";
 		return std::move(ptr);
 	});
 }
\ No newline at end of file
@@ -1,5 +1,8 @@
 #include <rendering/opengl4.hpp>
+#include <rendering/occlusion.hpp>
 #include <mesh_data.hpp>
+#include <mesh_simplify.hpp>
+#include <profiler.hpp>
 #include <glm/gtc/packing.hpp>
 
 namespace 
@@ -12,6 +15,12 @@ namespace
 		glm::uint32 tg; // packSnorm3x10_1x2
 		glm::uint32 uv0;	// packUnorm2x16
 	};
+	static_assert(sizeof(PackedVertex) == kMeshVertexStride, "mesh vertex stride mismatch");
+
+	// triangle budget of the occlusion proxies
+	const unsigned kOccluderMaxTriangles = 256;
+	// meshes loaded without levels of detail get them at load time above this size
+	const unsigned kLoadTimeLodMinTriangles = 1024;
 }
 
 std::unique_ptr<Mesh> createMesh(GraphicsContext &gc, MeshData &data)
@@ -19,30 +28,69 @@ std::unique_ptr<Mesh> createMesh(GraphicsContext &gc, MeshData &data)
 	auto ptr = std::make_unique<Mesh>();
 	auto nv = data.vertices.size();
 	auto ni = data.indices.size();
-	ptr->vbo = gc.createBuffer(gl::ARRAY_BUFFER, nv*sizeof(PackedVertex));
-	ptr->ibo = gc.createBuffer(gl::ELEMENT_ARRAY_BUFFER, ni * 2);
 	ptr->nbvertex = nv;
 	ptr->nbindex = ni;
-	auto vbo_ptr = (PackedVertex*)ptr->vbo->ptr;
+	PackedVertex *vbo_ptr;
+	uint16_t *ibo_ptr;
+	// shared storage if enabled and there is room left
+	auto megabuffer = gc.getMeshMegabuffer();
+	if (megabuffer && megabuffer->getVertexStride() == kMeshVertexStride
+		&& megabuffer->allocate(nv, ni, ptr->megabufferAlloc)) {
+		ptr->megabuffer = megabuffer;
+		vbo_ptr = (PackedVertex*)megabuffer->getVertexData(ptr->megabufferAlloc);
+		ibo_ptr = megabuffer->getIndexData(ptr->megabufferAlloc);
+	}
+	else {
+		ptr->vbo = gc.createBuffer(gl::ARRAY_BUFFER, nv*sizeof(PackedVertex));
+		ptr->ibo = gc.createBuffer(gl::ELEMENT_ARRAY_BUFFER, ni * 2);
+		vbo_ptr = (PackedVertex*)ptr->vbo->ptr;
+		ibo_ptr = (uint16_t*)ptr->ibo->ptr;
+	}
 	for (auto i = 0u; i < nv; ++i) {
 		vbo_ptr[i].pos = data.vertices[i];
 		vbo_ptr[i].norm = glm::packSnorm3x10_1x2(glm::vec4(data.normals[i], 0.0f));
 		vbo_ptr[i].tg = glm::packSnorm3x10_1x2(glm::vec4(data.tangents[i], 0.0f));
 		vbo_ptr[i].uv0 = glm::packUnorm2x16(data.uv[0][i]);
 	}
-	auto ibo_ptr = (uint16_t*)ptr->ibo->ptr;
 	for (auto i = 0u; i < ni; ++i)
 		ibo_ptr[i] = data.indices[i];
 	ptr->submeshes = data.submeshes;
+	ptr->aabb = data.aabb;
+	ptr->boundingSphere = data.boundingSphere;
+	ptr->numLods = data.numLods;
+	std::copy(data.lodErrors, data.lodErrors + kMaxMeshLods, ptr->lodErrors);
+	ptr->occluder = OccluderMesh::fromMeshData(data, kOccluderMaxTriangles);
 	return std::move(ptr);
 }
 
+Mesh::Mesh()
+{
+}
+
+Mesh::~Mesh()
+{
+	if (megabuffer)
+		megabuffer->free(megabufferAlloc);
+}
+
+unsigned Mesh::getNumTriangles(unsigned lod) const
+{
+	unsigned count = 0;
+	for (auto &sm : submeshes)
+		count += sm.getIndexRange(lod).numIndices / 3;
+	return count;
+}
+
 Mesh *loadMeshAsset(AssetDatabase &assetDb, GraphicsContext &gc, std::string assetId)
 {
 	return assetDb.loadAsset<Mesh>(assetId, [&]{
+		PROFILE_SCOPE("loadMeshAsset");
 		std::ifstream fileIn(assetId, std::ios::binary);
 		MeshData data;
 		data.loadFromStream(fileIn); 
+		// older files have no levels of detail (meshlod generates them offline)
+		if (data.numLods == 1 && data.indices.size() / 3 >= kLoadTimeLodMinTriangles)
+			generateMeshLods(data);
 		return std::move(createMesh(gc, data));
 	});
 }
\ No newline at end of file
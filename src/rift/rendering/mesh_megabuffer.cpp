@@ -0,0 +1,72 @@
+#include <rendering/opengl4.hpp>
+#include <log.hpp>
+
+MeshMegabuffer::MeshMegabuffer(GraphicsContext &gc_, unsigned vertexStride_, unsigned maxVertices, unsigned maxIndices) :
+	gc(gc_),
+	vertexStride(vertexStride_),
+	// one granule per vertex: offsets in the allocator are vertex indices << granularity_log2
+	vertexAllocator(maxVertices << util::tlsf_allocator::granularity_log2),
+	indexAllocator(maxIndices * 2)
+{
+	assert(maxVertices < (1u << (32 - util::tlsf_allocator::granularity_log2)));
+	vbo = gc.createBuffer(gl::ARRAY_BUFFER, (size_t)maxVertices * vertexStride);
+	ibo = gc.createBuffer(gl::ELEMENT_ARRAY_BUFFER, (size_t)maxIndices * 2);
+	// the index binding and the first indices of the allocations keep the name and offset of the ibo
+	vbo->pinned = true;
+	ibo->pinned = true;
+	indexBinding.obj = ibo->obj;
+	indexBinding.offset = 0;
+	indexBinding.size = ibo->offset + ibo->size;
+	indexBinding.ptr = nullptr;
+}
+
+bool MeshMegabuffer::allocate(unsigned numVertices, unsigned numIndices, Allocation &out)
+{
+	auto vertexBlock = vertexAllocator.allocate(std::max(numVertices, 1u) << util::tlsf_allocator::granularity_log2);
+	if (vertexBlock == util::tlsf_allocator::invalid_handle)
+		return false;
+	auto indexBlock = indexAllocator.allocate(std::max(numIndices, 1u) * 2);
+	if (indexBlock == util::tlsf_allocator::invalid_handle) {
+		vertexAllocator.deallocate(vertexBlock);
+		return false;
+	}
+	out.vertexBlock = vertexBlock;
+	out.indexBlock = indexBlock;
+	out.baseVertex = vertexAllocator.offset_of(vertexBlock) >> util::tlsf_allocator::granularity_log2;
+	assert((ibo->offset & 1) == 0);
+	out.firstIndex = static_cast<unsigned>((ibo->offset + indexAllocator.offset_of(indexBlock)) / 2);
+	return true;
+}
+
+void MeshMegabuffer::free(Allocation &alloc)
+{
+	// draws of the frames in flight may still read the ranges: a mesh created now must not overwrite them
+	auto vertexBlock = alloc.vertexBlock;
+	auto indexBlock = alloc.indexBlock;
+	gc.deferUntilFrameComplete([this, vertexBlock, indexBlock] {
+		if (vertexBlock != util::tlsf_allocator::invalid_handle)
+			vertexAllocator.deallocate(vertexBlock);
+		if (indexBlock != util::tlsf_allocator::invalid_handle)
+			indexAllocator.deallocate(indexBlock);
+	});
+	alloc = Allocation();
+}
+
+void *MeshMegabuffer::getVertexData(const Allocation &alloc) const
+{
+	return static_cast<char*>(vbo->ptr) + (size_t)alloc.baseVertex * vertexStride;
+}
+
+uint16_t *MeshMegabuffer::getIndexData(const Allocation &alloc) const
+{
+	return static_cast<uint16_t*>(ibo->ptr) + (alloc.firstIndex - ibo->offset / 2);
+}
+
+void GraphicsContext::enableMeshMegabuffer(unsigned vertexStride, unsigned maxVertices, unsigned maxIndices)
+{
+	if (mesh_megabuffer) {
+		WARNING << "Mesh megabuffer already enabled";
+		return;
+	}
+	mesh_megabuffer = std::make_unique<MeshMegabuffer>(*this, vertexStride, maxVertices, maxIndices);
+}
@@ -42,6 +42,7 @@
 #define NVG_INIT_PATHS_SIZE 16
 #define NVG_INIT_VERTS_SIZE 256
 #define NVG_MAX_STATES 32
+#define NVG_RETAINED_CACHE_SIZE 4
 
 #define NVG_KAPPA90 0.5522847493f	// Length proportional to radius of a cubic bezier handle for 90deg arcs.
 
@@ -106,6 +107,43 @@ struct NVGpathCache {
 };
 typedef struct NVGpathCache NVGpathCache;
 
+enum NVGretainedType {
+	NVG_RETAINED_FILL = 0,
+	NVG_RETAINED_STROKE = 1,
+};
+
+// everything the tessellation of a retained path depends on
+struct NVGretainedKey {
+	int type;
+	float linear[4];	// linear part of the transform the path is tessellated in
+	float width;		// expand width
+	int lineCap;
+	int lineJoin;
+	float miterLimit;
+	float fringeWidth;
+	float tessTol;
+};
+typedef struct NVGretainedKey NVGretainedKey;
+
+struct NVGtessellation {
+	NVGretainedKey key;
+	int valid;
+	int lastUse;
+	NVGpath* paths;		// fill and stroke point to verts
+	int npaths;
+	NVGvertex* verts;
+	int nverts;
+	float bounds[4];
+};
+typedef struct NVGtessellation NVGtessellation;
+
+struct NVGretainedPath {
+	float* commands;	// in local space
+	int ncommands;
+	NVGtessellation tessellations[NVG_RETAINED_CACHE_SIZE];
+	int useCounter;
+};
+
 struct NVGcontext {
 	NVGparams params;
 	float* commands;
@@ -126,6 +164,15 @@ struct NVGcontext {
 	int fillTriCount;
 	int strokeTriCount;
 	int textTriCount;
+	// retained paths: scratch memory for tessellation and replay, stats of the frame
+	float* retainedCommands;
+	int cretainedCommands;
+	NVGpath* retainedPaths;
+	int cretainedPaths;
+	NVGvertex* retainedVerts;
+	int cretainedVerts;
+	int retainedHits;
+	int retainedMisses;
 };
 
 static float nvg__sqrtf(float a) { return sqrtf(a); }
@@ -265,6 +312,9 @@ void nvgDeleteInternal(NVGcontext* ctx)
 	if (ctx == NULL) return;
 	if (ctx->commands != NULL) free(ctx->commands);
 	if (ctx->cache != NULL) nvg__deletePathCache(ctx->cache);
+	if (ctx->retainedCommands != NULL) free(ctx->retainedCommands);
+	if (ctx->retainedPaths != NULL) free(ctx->retainedPaths);
+	if (ctx->retainedVerts != NULL) free(ctx->retainedVerts);
 
 	if (ctx->fs)
 		fonsDeleteInternal(ctx->fs);
@@ -300,6 +350,8 @@ void nvgBeginFrame(NVGcontext* ctx, int windowWidth, int windowHeight, float dev
 	ctx->fillTriCount = 0;
 	ctx->strokeTriCount = 0;
 	ctx->textTriCount = 0;
+	ctx->retainedHits = 0;
+	ctx->retainedMisses = 0;
 }
 
 void nvgCancelFrame(NVGcontext* ctx)
@@ -962,42 +1014,24 @@ static float nvg__distPtSeg(float x, float y, float px, float py, float qx, floa
 	return dx*dx + dy*dy;
 }
 
-static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
+static void nvg__transformCommands(float* vals, int nvals, const float* xform)
 {
-	NVGstate* state = nvg__getState(ctx);
-	int i;
-
-	if (ctx->ncommands+nvals > ctx->ccommands) {
-		float* commands;
-		int ccommands = ctx->ncommands+nvals + ctx->ccommands/2;
-		commands = (float*)realloc(ctx->commands, sizeof(float)*ccommands);
-		if (commands == NULL) return;
-		ctx->commands = commands;
-		ctx->ccommands = ccommands;
-	}
-
-	if ((int)vals[0] != NVG_CLOSE && (int)vals[0] != NVG_WINDING) {
-		ctx->commandx = vals[nvals-2];
-		ctx->commandy = vals[nvals-1];
-	}
-
-	// transform commands
-	i = 0;
+	int i = 0;
 	while (i < nvals) {
 		int cmd = (int)vals[i];
 		switch (cmd) {
 		case NVG_MOVETO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
+			nvgTransformPoint(&vals[i+1],&vals[i+2], xform, vals[i+1],vals[i+2]);
 			i += 3;
 			break;
 		case NVG_LINETO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
+			nvgTransformPoint(&vals[i+1],&vals[i+2], xform, vals[i+1],vals[i+2]);
 			i += 3;
 			break;
 		case NVG_BEZIERTO:
-			nvgTransformPoint(&vals[i+1],&vals[i+2], state->xform, vals[i+1],vals[i+2]);
-			nvgTransformPoint(&vals[i+3],&vals[i+4], state->xform, vals[i+3],vals[i+4]);
-			nvgTransformPoint(&vals[i+5],&vals[i+6], state->xform, vals[i+5],vals[i+6]);
+			nvgTransformPoint(&vals[i+1],&vals[i+2], xform, vals[i+1],vals[i+2]);
+			nvgTransformPoint(&vals[i+3],&vals[i+4], xform, vals[i+3],vals[i+4]);
+			nvgTransformPoint(&vals[i+5],&vals[i+6], xform, vals[i+5],vals[i+6]);
 			i += 7;
 			break;
 		case NVG_CLOSE:
@@ -1010,6 +1044,28 @@ static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
 			i++;
 		}
 	}
+}
+
+static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals)
+{
+	NVGstate* state = nvg__getState(ctx);
+
+	if (ctx->ncommands+nvals > ctx->ccommands) {
+		float* commands;
+		int ccommands = ctx->ncommands+nvals + ctx->ccommands/2;
+		commands = (float*)realloc(ctx->commands, sizeof(float)*ccommands);
+		if (commands == NULL) return;
+		ctx->commands = commands;
+		ctx->ccommands = ccommands;
+	}
+
+	if ((int)vals[0] != NVG_CLOSE && (int)vals[0] != NVG_WINDING) {
+		ctx->commandx = vals[nvals-2];
+		ctx->commandy = vals[nvals-1];
+	}
+
+	// transform commands
+	nvg__transformCommands(vals, nvals, state->xform);
 
 	memcpy(&ctx->commands[ctx->ncommands], vals, nvals*sizeof(float));
 
@@ -2115,34 +2171,48 @@ void nvgFill(NVGcontext* ctx)
 	}
 }
 
-void nvgStroke(NVGcontext* ctx)
+// Stroke paint and width in pixels of the current state.
+static float nvg__strokeStyle(NVGcontext* ctx, NVGpaint* strokePaint)
 {
 	NVGstate* state = nvg__getState(ctx);
 	float scale = nvg__getAverageScale(state->xform);
 	float strokeWidth = nvg__clampf(state->strokeWidth * scale, 0.0f, 200.0f);
-	NVGpaint strokePaint = state->stroke;
-	const NVGpath* path;
-	int i;
 
+	*strokePaint = state->stroke;
 	if (strokeWidth < ctx->fringeWidth) {
 		// If the stroke width is less than pixel size, use alpha to emulate coverage.
 		// Since coverage is area, scale by alpha*alpha.
 		float alpha = nvg__clampf(strokeWidth / ctx->fringeWidth, 0.0f, 1.0f);
-		strokePaint.innerColor.a *= alpha*alpha;
-		strokePaint.outerColor.a *= alpha*alpha;
+		strokePaint->innerColor.a *= alpha*alpha;
+		strokePaint->outerColor.a *= alpha*alpha;
 		strokeWidth = ctx->fringeWidth;
 	}
 
 	// Apply global alpha
-	strokePaint.innerColor.a *= state->alpha;
-	strokePaint.outerColor.a *= state->alpha;
+	strokePaint->innerColor.a *= state->alpha;
+	strokePaint->outerColor.a *= state->alpha;
+	return strokeWidth;
+}
+
+// Half width of the stroke geometry, with the antialiased fringe.
+static float nvg__strokeExpandWidth(NVGcontext* ctx, float strokeWidth)
+{
+	if (ctx->params.edgeAntiAlias)
+		return strokeWidth*0.5f + ctx->fringeWidth*0.5f;
+	return strokeWidth*0.5f;
+}
+
+void nvgStroke(NVGcontext* ctx)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGpaint strokePaint;
+	float strokeWidth = nvg__strokeStyle(ctx, &strokePaint);
+	const NVGpath* path;
+	int i;
 
 	nvg__flattenPaths(ctx);
 
-	if (ctx->params.edgeAntiAlias)
-		nvg__expandStroke(ctx, strokeWidth*0.5f + ctx->fringeWidth*0.5f, state->lineCap, state->lineJoin, state->miterLimit);
-	else
-		nvg__expandStroke(ctx, strokeWidth*0.5f, state->lineCap, state->lineJoin, state->miterLimit);
+	nvg__expandStroke(ctx, nvg__strokeExpandWidth(ctx, strokeWidth), state->lineCap, state->lineJoin, state->miterLimit);
 
 	ctx->params.renderStroke(ctx->params.userPtr, &strokePaint, &state->scissor, ctx->fringeWidth,
 							 strokeWidth, ctx->cache->paths, ctx->cache->npaths);
@@ -2155,6 +2225,292 @@ void nvgStroke(NVGcontext* ctx)
 	}
 }
 
+// Retained paths
+
+static void* nvg__reserve(void* ptr, int* capacity, int count, int size)
+{
+	if (count > *capacity) {
+		int c = (count + 0xff) & ~0xff;
+		void* p = realloc(ptr, (size_t)c * size);
+		if (p == NULL) return NULL;
+		*capacity = c;
+		return p;
+	}
+	return ptr;
+}
+
+NVGretainedPath* nvgRetainPath(NVGcontext* ctx)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGretainedPath* path;
+	float inv[6];
+
+	if (ctx->ncommands == 0) return NULL;
+	// the commands are in screen space, back to the local space of the transform
+	if (nvgTransformInverse(inv, state->xform) == 0) return NULL;
+
+	path = (NVGretainedPath*)malloc(sizeof(NVGretainedPath));
+	if (path == NULL) return NULL;
+	memset(path, 0, sizeof(NVGretainedPath));
+	path->commands = (float*)malloc(sizeof(float)*ctx->ncommands);
+	if (path->commands == NULL) {
+		free(path);
+		return NULL;
+	}
+	memcpy(path->commands, ctx->commands, sizeof(float)*ctx->ncommands);
+	path->ncommands = ctx->ncommands;
+	nvg__transformCommands(path->commands, path->ncommands, inv);
+	return path;
+}
+
+void nvgDeleteRetainedPath(NVGcontext* ctx, NVGretainedPath* path)
+{
+	int i;
+	NVG_NOTUSED(ctx);
+	if (path == NULL) return;
+	for (i = 0; i < NVG_RETAINED_CACHE_SIZE; i++) {
+		if (path->tessellations[i].paths != NULL) free(path->tessellations[i].paths);
+		if (path->tessellations[i].verts != NULL) free(path->tessellations[i].verts);
+	}
+	free(path->commands);
+	free(path);
+}
+
+// Key of the current transform. A rotation with uniform scale is tessellated at
+// the scale and rotated at replay, other transforms with their whole linear part.
+static void nvg__retainedKey(NVGcontext* ctx, NVGretainedKey* key, float* rotation, int type, float width,
+							 int lineCap, int lineJoin, float miterLimit)
+{
+	const float* t = nvg__getState(ctx)->xform;
+	float s = nvg__sqrtf(t[0]*t[0] + t[1]*t[1]);
+
+	memset(key, 0, sizeof(NVGretainedKey));
+	key->type = type;
+	if (s > 0.0f && nvg__absf(t[0] - t[3]) <= s*1e-5f && nvg__absf(t[1] + t[2]) <= s*1e-5f) {
+		key->linear[0] = s;
+		key->linear[3] = s;
+		rotation[0] = t[0] / s;
+		rotation[1] = t[1] / s;
+		rotation[2] = t[2] / s;
+		rotation[3] = t[3] / s;
+	} else {
+		memcpy(key->linear, t, sizeof(float)*4);
+		rotation[0] = 1.0f;
+		rotation[1] = 0.0f;
+		rotation[2] = 0.0f;
+		rotation[3] = 1.0f;
+	}
+	key->width = width;
+	key->lineCap = lineCap;
+	key->lineJoin = lineJoin;
+	key->miterLimit = miterLimit;
+	key->fringeWidth = ctx->fringeWidth;
+	key->tessTol = ctx->tessTol;
+}
+
+// Flattens and expands the retained path in place of the current path, and copies the result.
+static int nvg__tessellateRetained(NVGcontext* ctx, NVGretainedPath* path, NVGtessellation* tess)
+{
+	NVGpathCache* cache = ctx->cache;
+	const NVGretainedKey* key = &tess->key;
+	float* commands = ctx->commands;
+	int ncommands = ctx->ncommands;
+	float xform[6];
+	float* retained;
+	int i, nverts, ok;
+
+	retained = (float*)nvg__reserve(ctx->retainedCommands, &ctx->cretainedCommands, path->ncommands, sizeof(float));
+	if (retained == NULL) return 0;
+	ctx->retainedCommands = retained;
+	memcpy(retained, path->commands, sizeof(float)*path->ncommands);
+	memcpy(xform, key->linear, sizeof(float)*4);
+	xform[4] = xform[5] = 0.0f;
+	nvg__transformCommands(retained, path->ncommands, xform);
+
+	ctx->commands = retained;
+	ctx->ncommands = path->ncommands;
+	nvg__clearPathCache(ctx);
+	nvg__flattenPaths(ctx);
+	if (key->type == NVG_RETAINED_FILL)
+		ok = nvg__expandFill(ctx, key->width, key->lineJoin, key->miterLimit);
+	else
+		ok = nvg__expandStroke(ctx, key->width, key->lineCap, key->lineJoin, key->miterLimit);
+	ctx->commands = commands;
+	ctx->ncommands = ncommands;
+
+	tess->valid = 0;
+	if (ok) {
+		nverts = 0;
+		for (i = 0; i < cache->npaths; i++) {
+			const NVGpath* p = &cache->paths[i];
+			if (p->fill != NULL) nverts = nvg__maxi(nverts, (int)(p->fill - cache->verts) + p->nfill);
+			if (p->stroke != NULL) nverts = nvg__maxi(nverts, (int)(p->stroke - cache->verts) + p->nstroke);
+		}
+		free(tess->paths);
+		free(tess->verts);
+		tess->paths = (NVGpath*)malloc(sizeof(NVGpath)*nvg__maxi(cache->npaths, 1));
+		tess->verts = (NVGvertex*)malloc(sizeof(NVGvertex)*nvg__maxi(nverts, 1));
+		if (tess->paths != NULL && tess->verts != NULL) {
+			memcpy(tess->paths, cache->paths, sizeof(NVGpath)*cache->npaths);
+			memcpy(tess->verts, cache->verts, sizeof(NVGvertex)*nverts);
+			for (i = 0; i < cache->npaths; i++) {
+				NVGpath* p = &tess->paths[i];
+				if (p->fill != NULL) p->fill = tess->verts + (p->fill - cache->verts);
+				if (p->stroke != NULL) p->stroke = tess->verts + (p->stroke - cache->verts);
+			}
+			tess->npaths = cache->npaths;
+			tess->nverts = nverts;
+			memcpy(tess->bounds, cache->bounds, sizeof(float)*4);
+			tess->valid = 1;
+		}
+	}
+
+	// the current path is flattened again when it is filled or stroked
+	nvg__clearPathCache(ctx);
+	return tess->valid;
+}
+
+static NVGtessellation* nvg__findTessellation(NVGcontext* ctx, NVGretainedPath* path, const NVGretainedKey* key)
+{
+	NVGtessellation* tess = NULL;
+	int i;
+
+	path->useCounter++;
+	for (i = 0; i < NVG_RETAINED_CACHE_SIZE; i++) {
+		NVGtessellation* t = &path->tessellations[i];
+		if (t->valid && memcmp(&t->key, key, sizeof(NVGretainedKey)) == 0) {
+			t->lastUse = path->useCounter;
+			ctx->retainedHits++;
+			return t;
+		}
+	}
+
+	// replace the least recently used
+	for (i = 0; i < NVG_RETAINED_CACHE_SIZE; i++) {
+		NVGtessellation* t = &path->tessellations[i];
+		if (tess == NULL || !t->valid || (tess->valid && t->lastUse < tess->lastUse))
+			tess = t;
+		if (!tess->valid) break;
+	}
+	ctx->retainedMisses++;
+	tess->key = *key;
+	tess->lastUse = path->useCounter;
+	if (nvg__tessellateRetained(ctx, path, tess) == 0) return NULL;
+	return tess;
+}
+
+// Moves the cached vertices by the rotation and the translation of the current transform.
+static NVGpath* nvg__placeTessellation(NVGcontext* ctx, const NVGtessellation* tess, const float* rotation, float* bounds)
+{
+	const float* t = nvg__getState(ctx)->xform;
+	NVGpath* paths;
+	NVGvertex* verts;
+	int i;
+
+	paths = (NVGpath*)nvg__reserve(ctx->retainedPaths, &ctx->cretainedPaths, tess->npaths, sizeof(NVGpath));
+	if (paths == NULL) return NULL;
+	ctx->retainedPaths = paths;
+	verts = (NVGvertex*)nvg__reserve(ctx->retainedVerts, &ctx->cretainedVerts, tess->nverts, sizeof(NVGvertex));
+	if (verts == NULL) return NULL;
+	ctx->retainedVerts = verts;
+
+	for (i = 0; i < tess->nverts; i++) {
+		const NVGvertex* src = &tess->verts[i];
+		verts[i].x = src->x*rotation[0] + src->y*rotation[2] + t[4];
+		verts[i].y = src->x*rotation[1] + src->y*rotation[3] + t[5];
+		verts[i].u = src->u;
+		verts[i].v = src->v;
+	}
+	memcpy(paths, tess->paths, sizeof(NVGpath)*tess->npaths);
+	for (i = 0; i < tess->npaths; i++) {
+		if (paths[i].fill != NULL) paths[i].fill = verts + (tess->paths[i].fill - tess->verts);
+		if (paths[i].stroke != NULL) paths[i].stroke = verts + (tess->paths[i].stroke - tess->verts);
+	}
+
+	// bounds of the moved corners
+	bounds[0] = bounds[1] = 1e6f;
+	bounds[2] = bounds[3] = -1e6f;
+	for (i = 0; i < 4; i++) {
+		float x = tess->bounds[(i & 1) ? 2 : 0];
+		float y = tess->bounds[(i & 2) ? 3 : 1];
+		float px = x*rotation[0] + y*rotation[2] + t[4];
+		float py = x*rotation[1] + y*rotation[3] + t[5];
+		bounds[0] = nvg__minf(bounds[0], px);
+		bounds[1] = nvg__minf(bounds[1], py);
+		bounds[2] = nvg__maxf(bounds[2], px);
+		bounds[3] = nvg__maxf(bounds[3], py);
+	}
+	return paths;
+}
+
+void nvgFillRetained(NVGcontext* ctx, NVGretainedPath* path)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGpaint fillPaint = state->fill;
+	NVGretainedKey key;
+	NVGtessellation* tess;
+	NVGpath* paths;
+	float rotation[4], bounds[4];
+	int i;
+
+	if (path == NULL) return;
+	nvg__retainedKey(ctx, &key, rotation, NVG_RETAINED_FILL, ctx->params.edgeAntiAlias ? ctx->fringeWidth : 0.0f,
+					 NVG_BUTT, NVG_MITER, 2.4f);
+	tess = nvg__findTessellation(ctx, path, &key);
+	if (tess == NULL) return;
+	paths = nvg__placeTessellation(ctx, tess, rotation, bounds);
+	if (paths == NULL) return;
+
+	// Apply global alpha
+	fillPaint.innerColor.a *= state->alpha;
+	fillPaint.outerColor.a *= state->alpha;
+
+	ctx->params.renderFill(ctx->params.userPtr, &fillPaint, &state->scissor, ctx->fringeWidth,
+						   bounds, paths, tess->npaths);
+
+	// Count triangles
+	for (i = 0; i < tess->npaths; i++) {
+		ctx->fillTriCount += paths[i].nfill-2;
+		ctx->fillTriCount += paths[i].nstroke-2;
+		ctx->drawCallCount += 2;
+	}
+}
+
+void nvgStrokeRetained(NVGcontext* ctx, NVGretainedPath* path)
+{
+	NVGstate* state = nvg__getState(ctx);
+	NVGpaint strokePaint;
+	float strokeWidth = nvg__strokeStyle(ctx, &strokePaint);
+	NVGretainedKey key;
+	NVGtessellation* tess;
+	NVGpath* paths;
+	float rotation[4], bounds[4];
+	int i;
+
+	if (path == NULL) return;
+	nvg__retainedKey(ctx, &key, rotation, NVG_RETAINED_STROKE, nvg__strokeExpandWidth(ctx, strokeWidth),
+					 state->lineCap, state->lineJoin, state->miterLimit);
+	tess = nvg__findTessellation(ctx, path, &key);
+	if (tess == NULL) return;
+	paths = nvg__placeTessellation(ctx, tess, rotation, bounds);
+	if (paths == NULL) return;
+
+	ctx->params.renderStroke(ctx->params.userPtr, &strokePaint, &state->scissor, ctx->fringeWidth,
+							 strokeWidth, paths, tess->npaths);
+
+	// Count triangles
+	for (i = 0; i < tess->npaths; i++) {
+		ctx->strokeTriCount += paths[i].nstroke-2;
+		ctx->drawCallCount++;
+	}
+}
+
+void nvgRetainedStats(NVGcontext* ctx, int* hits, int* misses)
+{
+	if (hits != NULL) *hits = ctx->retainedHits;
+	if (misses != NULL) *misses = ctx->retainedMisses;
+}
+
 // Add fonts
 int nvgCreateFont(NVGcontext* ctx, const char* name, const char* path)
 {
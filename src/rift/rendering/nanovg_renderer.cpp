@@ -0,0 +1,558 @@
+#include <rendering/nanovg_renderer.hpp>
+#include <log.hpp>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	// see nanovg.glsl
+	struct ViewParams
+	{
+		glm::vec2 viewSize;
+		glm::vec2 pad;
+	};
+
+	enum ShaderType
+	{
+		kShaderFillGradient = 0,
+		kShaderFillImage = 1,
+		kShaderSimple = 2,
+		kShaderImage = 3
+	};
+
+	// uniform buffer bindings
+	const unsigned kViewBinding = 0;
+	const unsigned kFragBinding = 1;
+
+	void xformToMat3x4(float *m3, const float *t)
+	{
+		m3[0] = t[0];
+		m3[1] = t[1];
+		m3[2] = 0.0f;
+		m3[3] = 0.0f;
+		m3[4] = t[2];
+		m3[5] = t[3];
+		m3[6] = 0.0f;
+		m3[7] = 0.0f;
+		m3[8] = t[4];
+		m3[9] = t[5];
+		m3[10] = 1.0f;
+		m3[11] = 0.0f;
+	}
+
+	NVGcolor premulColor(NVGcolor c)
+	{
+		c.r *= c.a;
+		c.g *= c.a;
+		c.b *= c.a;
+		return c;
+	}
+
+	unsigned maxVertexCount(const NVGpath *paths, int npaths)
+	{
+		unsigned count = 0;
+		for (auto i = 0; i < npaths; ++i)
+			count += paths[i].nfill + paths[i].nstroke;
+		return count;
+	}
+
+	void setVertex(NVGvertex &v, float x, float y, float u, float t)
+	{
+		v.x = x;
+		v.y = y;
+		v.u = u;
+		v.v = t;
+	}
+}
+
+//---------------------------
+// NVGparams callbacks
+struct NanoVGRenderer::Callbacks
+{
+	static NanoVGRenderer &self(void *uptr) {
+		return *static_cast<NanoVGRenderer*>(uptr);
+	}
+
+	// rows [y, y + h) of the image, data tightly packed
+	// (one byte per pixel for alpha images: rows are not 4-byte aligned)
+	static void uploadRows(const Image &image, int y, int h, const unsigned char *data)
+	{
+		auto &device = getGraphicsDevice();
+		auto alpha = image.type != NVG_TEXTURE_RGBA;
+		if (alpha)
+			device.setUnpackAlignment(1);
+		device.updateTexture(image.texture, gl::TEXTURE_2D, gl::TEXTURE_2D, 0, glm::ivec2(0, y), glm::ivec2(image.size.x, h),
+			alpha ? gl::RED : gl::RGBA, gl::UNSIGNED_BYTE, data);
+		if (alpha)
+			device.setUnpackAlignment(4);
+	}
+
+	static int renderCreate(void * /*uptr*/)
+	{
+		return 1;
+	}
+
+	static int renderCreateTexture(void *uptr, int type, int w, int h, int imageFlags, const unsigned char *data)
+	{
+		auto &r = self(uptr);
+		auto &device = getGraphicsDevice();
+		if (imageFlags & NVG_IMAGE_GENERATE_MIPMAPS)
+			// no mipmap generation through the device: sampled at level 0
+			imageFlags &= ~NVG_IMAGE_GENERATE_MIPMAPS;
+		Image image;
+		image.texture = device.createTexture(gl::TEXTURE_2D, 1, type == NVG_TEXTURE_RGBA ? gl::RGBA8 : gl::R8, w, h);
+		image.size = glm::ivec2(w, h);
+		image.type = type;
+		image.flags = imageFlags;
+		image.owned = true;
+		if (data)
+			uploadRows(image, 0, h, data);
+		auto id = r.nextImageId++;
+		r.images[id] = image;
+		return id;
+	}
+
+	static int renderDeleteTexture(void *uptr, int id)
+	{
+		auto &r = self(uptr);
+		auto it = r.images.find(id);
+		if (it == r.images.end())
+			return 0;
+		if (it->second.owned)
+			getGraphicsDevice().deleteTexture(it->second.texture);
+		r.images.erase(it);
+		return 1;
+	}
+
+	static int renderUpdateTexture(void *uptr, int id, int /*x*/, int y, int /*w*/, int h, const unsigned char *data)
+	{
+		auto &r = self(uptr);
+		auto it = r.images.find(id);
+		if (it == r.images.end())
+			return 0;
+		auto &image = it->second;
+		// data is the whole image: upload full rows, so that no unpack row length is needed
+		auto bytesPerPixel = image.type == NVG_TEXTURE_RGBA ? 4 : 1;
+		data += y * image.size.x * bytesPerPixel;
+		uploadRows(image, y, h, data);
+		return 1;
+	}
+
+	static int renderGetTextureSize(void *uptr, int id, int *w, int *h)
+	{
+		auto &r = self(uptr);
+		auto it = r.images.find(id);
+		if (it == r.images.end())
+			return 0;
+		*w = it->second.size.x;
+		*h = it->second.size.y;
+		return 1;
+	}
+
+	static void renderViewport(void *uptr, int width, int height)
+	{
+		self(uptr).viewSize = glm::vec2(width, height);
+	}
+
+	static void renderCancel(void *uptr)
+	{
+		self(uptr).reset();
+	}
+
+	static void renderFlush(void *uptr)
+	{
+		self(uptr).flush();
+	}
+
+	static void renderFill(void *uptr, NVGpaint *paint, NVGscissor *scissor, float fringe,
+		const float *bounds, const NVGpath *paths, int npaths)
+	{
+		auto &r = self(uptr);
+		Call call;
+		call.type = npaths == 1 && paths[0].convex ? CallType::ConvexFill : CallType::Fill;
+		call.image = paint->image;
+		// fill and fringe vertices, then a quad covering the bounds for the stencil fill
+		auto offset = r.addPaths(call, paths, npaths, true);
+		r.vertices.resize(offset + 6);
+		call.triangleOffset = offset;
+		call.triangleCount = 6;
+		auto quad = &r.vertices[offset];
+		setVertex(quad[0], bounds[0], bounds[3], 0.5f, 1.0f);
+		setVertex(quad[1], bounds[2], bounds[3], 0.5f, 1.0f);
+		setVertex(quad[2], bounds[2], bounds[1], 0.5f, 1.0f);
+		setVertex(quad[3], bounds[0], bounds[3], 0.5f, 1.0f);
+		setVertex(quad[4], bounds[2], bounds[1], 0.5f, 1.0f);
+		setVertex(quad[5], bounds[0], bounds[1], 0.5f, 1.0f);
+
+		call.uniformIndex = static_cast<unsigned>(r.uniforms.size());
+		if (call.type == CallType::Fill) {
+			// simple shader for the stencil, then the fill shader
+			FragUniforms simple;
+			std::memset(&simple, 0, sizeof(simple));
+			simple.strokeThr = -1.0f;
+			simple.type = kShaderSimple;
+			r.uniforms.push_back(simple);
+		}
+		FragUniforms frag;
+		if (!r.convertPaint(frag, *paint, *scissor, fringe, fringe, -1.0f)) {
+			r.uniforms.resize(call.uniformIndex);
+			return;
+		}
+		r.uniforms.push_back(frag);
+		r.calls.push_back(call);
+	}
+
+	static void renderStroke(void *uptr, NVGpaint *paint, NVGscissor *scissor, float fringe,
+		float strokeWidth, const NVGpath *paths, int npaths)
+	{
+		auto &r = self(uptr);
+		Call call;
+		call.type = CallType::Stroke;
+		call.image = paint->image;
+		call.triangleOffset = call.triangleCount = 0;
+		r.addPaths(call, paths, npaths, false);
+
+		call.uniformIndex = static_cast<unsigned>(r.uniforms.size());
+		FragUniforms frag;
+		if (!r.convertPaint(frag, *paint, *scissor, strokeWidth, fringe, -1.0f))
+			return;
+		r.uniforms.push_back(frag);
+		if (r.flags & NVG_STENCIL_STROKES) {
+			r.convertPaint(frag, *paint, *scissor, strokeWidth, fringe, 1.0f - 0.5f / 255.0f);
+			r.uniforms.push_back(frag);
+		}
+		r.calls.push_back(call);
+	}
+
+	static void renderTriangles(void *uptr, NVGpaint *paint, NVGscissor *scissor, const NVGvertex *verts, int nverts)
+	{
+		auto &r = self(uptr);
+		Call call;
+		call.type = CallType::Triangles;
+		call.image = paint->image;
+		call.firstPath = call.numPaths = 0;
+		call.triangleOffset = static_cast<unsigned>(r.vertices.size());
+		call.triangleCount = nverts;
+		r.vertices.insert(r.vertices.end(), verts, verts + nverts);
+
+		call.uniformIndex = static_cast<unsigned>(r.uniforms.size());
+		FragUniforms frag;
+		if (!r.convertPaint(frag, *paint, *scissor, 1.0f, 1.0f, -1.0f))
+			return;
+		frag.type = kShaderImage;
+		r.uniforms.push_back(frag);
+		r.calls.push_back(call);
+	}
+
+	static void renderDelete(void * /*uptr*/)
+	{
+		// owned by the NanoVGRenderer
+	}
+};
+
+NanoVGRenderer::NanoVGRenderer(GraphicsContext &gc_, int flags_) : gc(gc_), flags(flags_)
+{
+	const char *path = "resources/shaders/nanovg.glsl";
+	auto src = loadShaderSource(path);
+	std::vector<ShaderKeyword> keywords;
+	if (flags & NVG_ANTIALIAS)
+		keywords.push_back(ShaderKeyword{ "EDGE_AA", "1" });
+	program = compileProgram(gc, src.c_str(), path, src.c_str(), path, keywords);
+	vao.create(1, { { ElementFormat::Float2, 0 }, { ElementFormat::Float2, 0 } });
+
+	NVGparams params;
+	std::memset(&params, 0, sizeof(params));
+	params.renderCreate = Callbacks::renderCreate;
+	params.renderCreateTexture = Callbacks::renderCreateTexture;
+	params.renderDeleteTexture = Callbacks::renderDeleteTexture;
+	params.renderUpdateTexture = Callbacks::renderUpdateTexture;
+	params.renderGetTextureSize = Callbacks::renderGetTextureSize;
+	params.renderViewport = Callbacks::renderViewport;
+	params.renderCancel = Callbacks::renderCancel;
+	params.renderFlush = Callbacks::renderFlush;
+	params.renderFill = Callbacks::renderFill;
+	params.renderStroke = Callbacks::renderStroke;
+	params.renderTriangles = Callbacks::renderTriangles;
+	params.renderDelete = Callbacks::renderDelete;
+	params.userPtr = this;
+	params.edgeAntiAlias = flags & NVG_ANTIALIAS ? 1 : 0;
+	ctx = nvgCreateInternal(&params);
+	if (!ctx)
+		ERROR << "Could not create the nanovg context";
+}
+
+NanoVGRenderer::~NanoVGRenderer()
+{
+	// deletes the font atlas images
+	if (ctx)
+		nvgDeleteInternal(ctx);
+	auto &device = getGraphicsDevice();
+	for (auto &image : images)
+		if (image.second.owned)
+			device.deleteTexture(image.second.texture);
+	device.deleteProgram(program);
+}
+
+int NanoVGRenderer::createImageFromTexture(GLuint texture, int width, int height, int imageFlags)
+{
+	Image image{ texture, glm::ivec2(width, height), NVG_TEXTURE_RGBA, imageFlags, false };
+	auto id = nextImageId++;
+	images[id] = image;
+	return id;
+}
+
+bool NanoVGRenderer::convertPaint(FragUniforms &frag, const NVGpaint &paint, const NVGscissor &scissor,
+	float width, float fringe, float strokeThr)
+{
+	float invxform[6];
+	std::memset(&frag, 0, sizeof(frag));
+	frag.innerCol = premulColor(paint.innerColor);
+	frag.outerCol = premulColor(paint.outerColor);
+
+	if (scissor.extent[0] < -0.5f || scissor.extent[1] < -0.5f) {
+		frag.scissorExt[0] = 1.0f;
+		frag.scissorExt[1] = 1.0f;
+		frag.scissorScale[0] = 1.0f;
+		frag.scissorScale[1] = 1.0f;
+	}
+	else {
+		nvgTransformInverse(invxform, scissor.xform);
+		xformToMat3x4(frag.scissorMat, invxform);
+		frag.scissorExt[0] = scissor.extent[0];
+		frag.scissorExt[1] = scissor.extent[1];
+		frag.scissorScale[0] = std::sqrt(scissor.xform[0] * scissor.xform[0] + scissor.xform[2] * scissor.xform[2]) / fringe;
+		frag.scissorScale[1] = std::sqrt(scissor.xform[1] * scissor.xform[1] + scissor.xform[3] * scissor.xform[3]) / fringe;
+	}
+
+	frag.extent[0] = paint.extent[0];
+	frag.extent[1] = paint.extent[1];
+	frag.strokeMult = (width * 0.5f + fringe * 0.5f) / fringe;
+	frag.strokeThr = strokeThr;
+
+	if (paint.image) {
+		auto it = images.find(paint.image);
+		if (it == images.end())
+			return false;
+		auto &image = it->second;
+		if (image.flags & NVG_IMAGE_FLIPY) {
+			float flipped[6];
+			nvgTransformScale(flipped, 1.0f, -1.0f);
+			nvgTransformMultiply(flipped, paint.xform);
+			nvgTransformInverse(invxform, flipped);
+		}
+		else {
+			nvgTransformInverse(invxform, paint.xform);
+		}
+		frag.type = kShaderFillImage;
+		if (image.type == NVG_TEXTURE_RGBA)
+			frag.texType = (image.flags & NVG_IMAGE_PREMULTIPLIED) ? 0 : 1;
+		else
+			frag.texType = 2;
+	}
+	else {
+		frag.type = kShaderFillGradient;
+		frag.radius = paint.radius;
+		frag.feather = paint.feather;
+		nvgTransformInverse(invxform, paint.xform);
+	}
+	xformToMat3x4(frag.paintMat, invxform);
+	return true;
+}
+
+unsigned NanoVGRenderer::addPaths(Call &call, const NVGpath *src, int npaths, bool fills)
+{
+	call.firstPath = static_cast<unsigned>(paths.size());
+	call.numPaths = npaths;
+	auto offset = static_cast<unsigned>(vertices.size());
+	vertices.reserve(offset + maxVertexCount(src, npaths) + 6);
+	for (auto i = 0; i < npaths; ++i) {
+		auto &path = src[i];
+		Path copy = {};
+		if (fills && path.nfill > 0) {
+			copy.fillOffset = offset;
+			copy.fillCount = path.nfill;
+			vertices.insert(vertices.end(), path.fill, path.fill + path.nfill);
+			offset += path.nfill;
+		}
+		if (path.nstroke > 0) {
+			copy.strokeOffset = offset;
+			copy.strokeCount = path.nstroke;
+			vertices.insert(vertices.end(), path.stroke, path.stroke + path.nstroke);
+			offset += path.nstroke;
+		}
+		paths.push_back(copy);
+	}
+	return offset;
+}
+
+void NanoVGRenderer::setUniforms(unsigned uniformIndex, int image)
+{
+	auto &device = getGraphicsDevice();
+	GLintptr offset = uniformBuffer.offset + uniformIndex * uniformStride;
+	GLsizeiptr size = sizeof(FragUniforms);
+	device.bindBuffersRange(gl::UNIFORM_BUFFER, kFragBinding, 1, &uniformBuffer.obj, &offset, &size);
+	GLuint texture = 0;
+	GLuint sampler = gc.getSamplerLinearClamp();
+	if (image) {
+		auto it = images.find(image);
+		if (it != images.end()) {
+			texture = it->second.texture;
+			auto repeat = (it->second.flags & (NVG_IMAGE_REPEATX | NVG_IMAGE_REPEATY)) != 0;
+			if (it->second.flags & NVG_IMAGE_NEAREST)
+				sampler = repeat ? gc.getSamplerNearestRepeat() : gc.getSamplerNearestClamp();
+			else if (repeat)
+				sampler = gc.getSamplerLinearRepeat();
+		}
+	}
+	device.bindTextures(0, 1, &texture);
+	device.bindSamplers(0, 1, &sampler);
+}
+
+void NanoVGRenderer::drawArrays(GLenum mode, unsigned first, unsigned count)
+{
+	getGraphicsDevice().drawArrays(mode, first, count);
+	++stats.numDrawCalls;
+}
+
+void NanoVGRenderer::drawFill(const Call &call)
+{
+	auto &device = getGraphicsDevice();
+	// shapes in the stencil
+	device.setEnabled(gl::STENCIL_TEST, true);
+	device.stencilFunc(gl::ALWAYS, 0, 0xff);
+	device.colorMask(false);
+	setUniforms(call.uniformIndex, 0);
+	device.stencilOp(gl::FRONT, gl::KEEP, gl::KEEP, gl::INCR_WRAP);
+	device.stencilOp(gl::BACK, gl::KEEP, gl::KEEP, gl::DECR_WRAP);
+	device.setEnabled(gl::CULL_FACE, false);
+	for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+		drawArrays(gl::TRIANGLE_FAN, paths[i].fillOffset, paths[i].fillCount);
+	device.setEnabled(gl::CULL_FACE, true);
+
+	// antialiased fringes
+	device.colorMask(true);
+	setUniforms(call.uniformIndex + 1, call.image);
+	if (flags & NVG_ANTIALIAS) {
+		device.stencilFunc(gl::EQUAL, 0x00, 0xff);
+		device.stencilOp(gl::FRONT_AND_BACK, gl::KEEP, gl::KEEP, gl::KEEP);
+		for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+			drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+	}
+
+	// fill, clears the stencil
+	device.stencilFunc(gl::NOTEQUAL, 0x00, 0xff);
+	device.stencilOp(gl::FRONT_AND_BACK, gl::ZERO, gl::ZERO, gl::ZERO);
+	drawArrays(gl::TRIANGLES, call.triangleOffset, call.triangleCount);
+	device.setEnabled(gl::STENCIL_TEST, false);
+}
+
+void NanoVGRenderer::drawConvexFill(const Call &call)
+{
+	setUniforms(call.uniformIndex, call.image);
+	for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+		drawArrays(gl::TRIANGLE_FAN, paths[i].fillOffset, paths[i].fillCount);
+	if (flags & NVG_ANTIALIAS)
+		for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+			drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+}
+
+void NanoVGRenderer::drawStroke(const Call &call)
+{
+	auto &device = getGraphicsDevice();
+	if (!(flags & NVG_STENCIL_STROKES)) {
+		setUniforms(call.uniformIndex, call.image);
+		for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+			drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+		return;
+	}
+
+	device.setEnabled(gl::STENCIL_TEST, true);
+	// stroke base without overlap
+	device.stencilFunc(gl::EQUAL, 0x00, 0xff);
+	device.stencilOp(gl::FRONT_AND_BACK, gl::KEEP, gl::KEEP, gl::INCR);
+	setUniforms(call.uniformIndex + 1, call.image);
+	for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+		drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+
+	// antialiased pixels
+	setUniforms(call.uniformIndex, call.image);
+	device.stencilOp(gl::FRONT_AND_BACK, gl::KEEP, gl::KEEP, gl::KEEP);
+	for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+		drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+
+	// clear the stencil
+	device.colorMask(false);
+	device.stencilFunc(gl::ALWAYS, 0x00, 0xff);
+	device.stencilOp(gl::FRONT_AND_BACK, gl::ZERO, gl::ZERO, gl::ZERO);
+	for (auto i = call.firstPath; i < call.firstPath + call.numPaths; ++i)
+		drawArrays(gl::TRIANGLE_STRIP, paths[i].strokeOffset, paths[i].strokeCount);
+	device.colorMask(true);
+	device.setEnabled(gl::STENCIL_TEST, false);
+}
+
+void NanoVGRenderer::drawTriangles(const Call &call)
+{
+	setUniforms(call.uniformIndex, call.image);
+	drawArrays(gl::TRIANGLES, call.triangleOffset, call.triangleCount);
+}
+
+void NanoVGRenderer::flush()
+{
+	if (calls.empty()) {
+		lastStats = Stats();
+		reset();
+		return;
+	}
+
+	// vertices and uniforms of the frame in transient memory
+	auto &device = getGraphicsDevice();
+	auto alignment = static_cast<size_t>(device.getBufferOffsetAlignment(gl::UNIFORM_BUFFER));
+	uniformStride = (sizeof(FragUniforms) + alignment - 1) / alignment * alignment;
+	vertexBuffer = gc.createTransientBuffer(gl::ARRAY_BUFFER, vertices.size() * sizeof(NVGvertex), vertices.data());
+	uniformBuffer = gc.createTransientBuffer(gl::UNIFORM_BUFFER, uniforms.size() * uniformStride);
+	for (auto i = 0u; i < uniforms.size(); ++i)
+		std::memcpy(static_cast<char*>(uniformBuffer.ptr) + i * uniformStride, &uniforms[i], sizeof(FragUniforms));
+	auto viewBuffer = gc.createTransientBuffer(gl::UNIFORM_BUFFER, ViewParams{ viewSize, glm::vec2(0.0f) });
+	stats.numCalls = static_cast<unsigned>(calls.size());
+	stats.numVertices = static_cast<unsigned>(vertices.size());
+	stats.transientBytes = vertexBuffer.size + uniformBuffer.size;
+
+	device.useProgram(program);
+	device.setEnabled(gl::BLEND, true);
+	device.blendEquation(0, gl::FUNC_ADD, gl::FUNC_ADD);
+	device.blendFunc(0, gl::ONE, gl::ONE_MINUS_SRC_ALPHA, gl::ONE, gl::ONE_MINUS_SRC_ALPHA);
+	device.setEnabled(gl::CULL_FACE, true);
+	device.cullFace(gl::BACK);
+	device.setEnabled(gl::DEPTH_TEST, false);
+	device.setEnabled(gl::STENCIL_TEST, false);
+	device.colorMask(true);
+	device.stencilFunc(gl::ALWAYS, 0, 0xffffffff);
+	device.stencilOp(gl::FRONT_AND_BACK, gl::KEEP, gl::KEEP, gl::KEEP);
+	bindVertexBuffers({ vertexBuffer }, vao);
+	bindBuffersRangeHelper(kViewBinding, { viewBuffer });
+
+	for (auto &call : calls) {
+		switch (call.type) {
+		case CallType::Fill: drawFill(call); break;
+		case CallType::ConvexFill: drawConvexFill(call); break;
+		case CallType::Stroke: drawStroke(call); break;
+		case CallType::Triangles: drawTriangles(call); break;
+		}
+	}
+
+	// back to the state of the other overlays
+	device.setEnabled(gl::CULL_FACE, false);
+	device.setEnabled(gl::DEPTH_TEST, true);
+	device.blendFunc(0, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+	lastStats = stats;
+	reset();
+}
+
+void NanoVGRenderer::reset()
+{
+	calls.clear();
+	paths.clear();
+	vertices.clear();
+	uniforms.clear();
+	stats = Stats();
+}
@@ -0,0 +1,775 @@
+#include <rendering/occlusion.hpp>
+#include <rendering/culling.hpp>
+#include <scene/scene.hpp>
+#include <profiler.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <numeric>
+#include <unordered_map>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define OCCLUSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	// pixels per side of the tiles of the coarse test
+	const unsigned kTileSize = 8;
+	// part of the surface of a mesh that its proxy must cover
+	const float kMinProxyArea = 0.5f;
+
+	unsigned roundUp(unsigned value, unsigned multiple)
+	{
+		return (value + multiple - 1) / multiple * multiple;
+	}
+
+	// clip space to pixels and normalized depth
+	glm::vec3 toScreen(const glm::vec4 &clipPos, unsigned width, unsigned height)
+	{
+		auto ndc = glm::vec3(clipPos) / clipPos.w;
+		return glm::vec3(
+			(ndc.x * 0.5f + 0.5f) * width,
+			(ndc.y * 0.5f + 0.5f) * height,
+			ndc.z * 0.5f + 0.5f);
+	}
+
+	// clips a triangle against the near plane (z >= -w), returns the number of vertices (0, 3 or 4)
+	unsigned clipNear(const glm::vec4 (&tri)[3], glm::vec4 (&out)[4])
+	{
+		unsigned n = 0;
+		for (auto i = 0u; i < 3; ++i) {
+			auto &a = tri[i];
+			auto &b = tri[(i + 1) % 3];
+			auto da = a.z + a.w;
+			auto db = b.z + b.w;
+			if (da >= 0.0f)
+				out[n++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				out[n++] = a + (b - a) * (da / (da - db));
+		}
+		return n;
+	}
+
+	// triangles of the triangle-list submeshes, as indices into data.vertices
+	std::vector<unsigned> getTriangles(const MeshData &data)
+	{
+		std::vector<unsigned> triangles;
+		for (auto &sm : data.submeshes) {
+			if (sm.primitiveType != PrimitiveType::Triangle)
+				continue;
+			for (auto i = 0u; i + 3 <= sm.numIndices; i += 3)
+				for (auto k = 0u; k < 3; ++k)
+					triangles.push_back(sm.startVertex + data.indices[sm.startIndex + i + k]);
+		}
+		return triangles;
+	}
+
+	// Triangle ready to rasterize: pixels of its bounding box, edge functions
+	// a*x + b*y + c (>= 0 inside), and depth plane z = dzdx*x + dzdy*y + zc,
+	// capped to zMax
+	struct TriangleSetup
+	{
+		int xBegin;
+		int xEnd;
+		int yBegin;
+		int yEnd;
+		float a[3];
+		float b[3];
+		float c[3];
+		float dzdx;
+		float dzdy;
+		float zc;
+		float zMax;
+	};
+
+	// pixels whose center is in the bounding box (min >= 0, max <= the size of the
+	// screen), false if there are none
+	bool setPixelBounds(float minX, float maxX, float minY, float maxY, unsigned width, unsigned height, TriangleSetup &t)
+	{
+		// bounds off screen clamped to the screen (empty anyway): no overflow
+		t.xBegin = static_cast<int>(std::ceil(glm::min(minX, float(width)) - 0.5f));
+		t.xEnd = static_cast<int>(std::floor(glm::max(maxX, 0.0f) - 0.5f));
+		t.yBegin = static_cast<int>(std::ceil(glm::min(minY, float(height)) - 0.5f));
+		t.yEnd = static_cast<int>(std::floor(glm::max(maxY, 0.0f) - 0.5f));
+		return t.xBegin <= t.xEnd && t.yBegin <= t.yEnd;
+	}
+
+	// false if the triangle covers no pixel center
+	bool setupTriangle(const glm::vec3 &v0, const glm::vec3 &v1_, const glm::vec3 &v2_, unsigned width, unsigned height, TriangleSetup &t)
+	{
+		// oriented so that the inside is where all the edge functions are >= 0
+		auto v1 = v1_;
+		auto v2 = v2_;
+		auto area = (v2.x - v0.x) * (v1.y - v0.y) - (v2.y - v0.y) * (v1.x - v0.x);
+		if (!(area != 0.0f))
+			return false;
+		if (area < 0.0f)
+			std::swap(v1, v2);
+
+		auto minX = glm::max(glm::min(v0.x, glm::min(v1.x, v2.x)), 0.0f);
+		auto maxX = glm::min(glm::max(v0.x, glm::max(v1.x, v2.x)), float(width));
+		auto minY = glm::max(glm::min(v0.y, glm::min(v1.y, v2.y)), 0.0f);
+		auto maxY = glm::min(glm::max(v0.y, glm::max(v1.y, v2.y)), float(height));
+		if (!setPixelBounds(minX, maxX, minY, maxY, width, height, t))
+			return false;
+
+		// depth plane moved back by its slope over half a pixel and capped to the
+		// farthest vertex: never nearer than the triangle within the pixel
+		auto det = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		t.dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / det;
+		t.dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / det;
+		t.zc = v0.z - t.dzdx * v0.x - t.dzdy * v0.y + 0.5f * (glm::abs(t.dzdx) + glm::abs(t.dzdy));
+		t.zMax = glm::max(v0.z, glm::max(v1.z, v2.z));
+		const glm::vec3 *verts[3] = { &v0, &v1, &v2 };
+		for (auto k = 0u; k < 3; ++k) {
+			auto &p = *verts[k];
+			auto &q = *verts[(k + 1) % 3];
+			t.a[k] = q.y - p.y;
+			t.b[k] = p.x - q.x;
+			t.c[k] = -(t.a[k] * p.x + t.b[k] * p.y);
+		}
+		return true;
+	}
+
+	void fillTriangle(const TriangleSetup &t, float *depth, unsigned width)
+	{
+		for (auto y = t.yBegin; y <= t.yEnd; ++y) {
+			auto py = float(y) + 0.5f;
+			float rows[3];
+			for (auto k = 0u; k < 3; ++k)
+				rows[k] = t.b[k] * py + t.c[k];
+			auto rowZ = t.dzdy * py + t.zc;
+			auto row = depth + y * width;
+			for (auto x = t.xBegin; x <= t.xEnd; ++x) {
+				auto px = float(x) + 0.5f;
+				if (t.a[0] * px + rows[0] >= 0.0f && t.a[1] * px + rows[1] >= 0.0f && t.a[2] * px + rows[2] >= 0.0f)
+					row[x] = glm::min(row[x], glm::min(t.dzdx * px + rowZ, t.zMax));
+			}
+		}
+	}
+
+#ifdef OCCLUSION_USE_SSE
+	__m128 select(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	template <int i>
+	__m128 splat(__m128 v)
+	{
+		return _mm_shuffle_ps(v, v, _MM_SHUFFLE(i, i, i, i));
+	}
+
+	// 4 screen-space vertices, one per lane
+	struct Vertices4
+	{
+		__m128 x;
+		__m128 y;
+		__m128 z;
+
+		// from (x, y, z, w) vectors
+		static Vertices4 load(const float *v0, const float *v1, const float *v2, const float *v3)
+		{
+			Vertices4 v{ _mm_loadu_ps(v0), _mm_loadu_ps(v1), _mm_loadu_ps(v2) };
+			auto w = _mm_loadu_ps(v3);
+			_MM_TRANSPOSE4_PS(v.x, v.y, v.z, w);
+			return v;
+		}
+
+		// swaps the lanes of a and b where the mask is set
+		static void swap(__m128 mask, Vertices4 &a, Vertices4 &b)
+		{
+			Vertices4 t{ select(mask, b.x, a.x), select(mask, b.y, a.y), select(mask, b.z, a.z) };
+			b = Vertices4{ select(mask, a.x, b.x), select(mask, a.y, b.y), select(mask, a.z, b.z) };
+			a = t;
+		}
+	};
+
+	// a row of a matrix, each element in all the lanes
+	struct MatrixRow
+	{
+		__m128 x;
+		__m128 y;
+		__m128 z;
+		__m128 w;
+
+		template <int i>
+		static MatrixRow get(__m128 col0, __m128 col1, __m128 col2, __m128 col3)
+		{
+			return MatrixRow{ splat<i>(col0), splat<i>(col1), splat<i>(col2), splat<i>(col3) };
+		}
+
+		// row . (px, py, pz, 1) for 4 points
+		__m128 transform(__m128 px, __m128 py, __m128 pz) const
+		{
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, px), _mm_mul_ps(y, py)), _mm_add_ps(_mm_mul_ps(z, pz), w));
+		}
+	};
+
+	float horizontalMin(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	float horizontalMax(__m128 v)
+	{
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	// std::ceil and std::floor for |v| < 2^31, without SSE4.1
+	__m128i ceilToInt(__m128 v)
+	{
+		auto t = _mm_cvttps_epi32(v);
+		return _mm_sub_epi32(t, _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(t), v)));
+	}
+
+	__m128i floorToInt(__m128 v)
+	{
+		auto t = _mm_cvttps_epi32(v);
+		return _mm_add_epi32(t, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(t), v)));
+	}
+
+	// same pixels and depths as fillTriangle
+	void fillTriangleSse(const TriangleSetup &t, float *depth, unsigned width)
+	{
+		const auto zero = _mm_setzero_ps();
+		const auto laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const auto zMax = _mm_set1_ps(t.zMax);
+		const auto dzdx = _mm_set1_ps(t.dzdx);
+		const auto xMin = _mm_set1_ps(float(t.xBegin) + 0.5f);
+		const auto xMax = _mm_set1_ps(float(t.xEnd) + 0.5f);
+		// edges in registers (spelled out: loops over arrays are not unrolled at -O2)
+		const auto a0 = _mm_set1_ps(t.a[0]);
+		const auto a1 = _mm_set1_ps(t.a[1]);
+		const auto a2 = _mm_set1_ps(t.a[2]);
+		// the width is a multiple of 4: groups never straddle rows
+		const auto xStart = t.xBegin & ~3;
+		for (auto y = t.yBegin; y <= t.yEnd; ++y) {
+			auto py = float(y) + 0.5f;
+			auto row0 = _mm_set1_ps(t.b[0] * py + t.c[0]);
+			auto row1 = _mm_set1_ps(t.b[1] * py + t.c[1]);
+			auto row2 = _mm_set1_ps(t.b[2] * py + t.c[2]);
+			auto rowZ = _mm_set1_ps(t.dzdy * py + t.zc);
+			auto row = depth + y * width;
+			bool entered = false;
+			for (auto x = xStart; x <= t.xEnd; x += 4) {
+				auto px = _mm_add_ps(_mm_set1_ps(float(x)), laneOffsets);
+				auto inside = _mm_and_ps(_mm_cmpge_ps(px, xMin), _mm_cmple_ps(px, xMax));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), row0), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), row1), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), row2), zero));
+				if (!_mm_movemask_ps(inside)) {
+					// the covered pixels of a row are contiguous (convex triangle, monotonic edge functions)
+					if (entered)
+						break;
+					continue;
+				}
+				entered = true;
+				auto old = _mm_loadu_ps(row + x);
+				auto z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(dzdx, px), rowZ), zMax);
+				_mm_storeu_ps(row + x, select(inside, _mm_min_ps(old, z), old));
+			}
+		}
+	}
+#endif
+}
+
+OccluderMesh::Ptr OccluderMesh::fromMeshData(const MeshData &data, unsigned maxTriangles)
+{
+	auto triangles = getTriangles(data);
+	if (triangles.empty())
+		return nullptr;
+
+	auto numTriangles = static_cast<unsigned>(triangles.size() / 3);
+	std::vector<unsigned> kept(numTriangles);
+	std::iota(kept.begin(), kept.end(), 0u);
+	if (numTriangles > maxTriangles) {
+		// the largest triangles, as long as they cover most of the surface
+		std::vector<float> areas(numTriangles);
+		auto totalArea = 0.0f;
+		for (auto t = 0u; t < numTriangles; ++t) {
+			auto &v0 = data.vertices[triangles[t * 3]];
+			auto &v1 = data.vertices[triangles[t * 3 + 1]];
+			auto &v2 = data.vertices[triangles[t * 3 + 2]];
+			areas[t] = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+			totalArea += areas[t];
+		}
+		std::stable_sort(kept.begin(), kept.end(), [&](unsigned a, unsigned b) { return areas[a] > areas[b]; });
+		kept.resize(maxTriangles);
+		auto keptArea = 0.0f;
+		for (auto t : kept)
+			keptArea += areas[t];
+		if (!(keptArea >= kMinProxyArea * totalArea))
+			return nullptr;
+		std::sort(kept.begin(), kept.end());
+	}
+
+	// keeping only the referenced vertices
+	auto ptr = std::make_unique<OccluderMesh>();
+	std::unordered_map<unsigned, unsigned> remap;
+	for (auto t : kept)
+		for (auto k = 0u; k < 3; ++k) {
+			auto v = triangles[t * 3 + k];
+			auto it = remap.emplace(v, static_cast<unsigned>(ptr->vertices.size())).first;
+			if (it->second == ptr->vertices.size())
+				ptr->vertices.push_back(data.vertices[v]);
+			ptr->indices.push_back(it->second);
+		}
+	return ptr;
+}
+
+//=============================================================================
+OcclusionBuffer::OcclusionBuffer(unsigned width_, unsigned height_) :
+	width(roundUp(width_, kTileSize)),
+	height(roundUp(height_, kTileSize)),
+	tilesX(width / kTileSize),
+	tilesY(height / kTileSize),
+	viewProj(1.0f),
+	depth(width * height, 1.0f),
+	tileMaxDepth(tilesX * tilesY, 1.0f)
+{
+	assert(width && height);
+}
+
+void OcclusionBuffer::clear(const glm::mat4 &viewProj_)
+{
+	viewProj = viewProj_;
+	std::fill(depth.begin(), depth.end(), 1.0f);
+	std::fill(tileMaxDepth.begin(), tileMaxDepth.end(), 1.0f);
+	numTriangles = 0;
+}
+
+void OcclusionBuffer::transformVertices(const std::vector<glm::vec3> &vertices, const glm::mat4 &modelToClip)
+{
+	auto numVertices = static_cast<unsigned>(vertices.size());
+	clipVertices.resize(numVertices);
+	screenVertices.resize(numVertices);
+	inFront.resize(numVertices);
+	auto v = 0u;
+#ifdef OCCLUSION_USE_SSE
+	if (simd) {
+		// 4 vertices at a time, in the order of the operations of glm (same results)
+		const auto m0 = _mm_loadu_ps(&modelToClip[0][0]);
+		const auto m1 = _mm_loadu_ps(&modelToClip[1][0]);
+		const auto m2 = _mm_loadu_ps(&modelToClip[2][0]);
+		const auto m3 = _mm_loadu_ps(&modelToClip[3][0]);
+		const auto rowX = MatrixRow::get<0>(m0, m1, m2, m3);
+		const auto rowY = MatrixRow::get<1>(m0, m1, m2, m3);
+		const auto rowZ = MatrixRow::get<2>(m0, m1, m2, m3);
+		const auto rowW = MatrixRow::get<3>(m0, m1, m2, m3);
+		const auto zero = _mm_setzero_ps();
+		const auto half = _mm_set1_ps(0.5f);
+		const auto widthV = _mm_set1_ps(float(width));
+		const auto heightV = _mm_set1_ps(float(height));
+		for (; v + 4 <= numVertices; v += 4) {
+			auto &p = vertices;
+			auto x = _mm_setr_ps(p[v].x, p[v + 1].x, p[v + 2].x, p[v + 3].x);
+			auto y = _mm_setr_ps(p[v].y, p[v + 1].y, p[v + 2].y, p[v + 3].y);
+			auto z = _mm_setr_ps(p[v].z, p[v + 1].z, p[v + 2].z, p[v + 3].z);
+			__m128 clip[4] = { rowX.transform(x, y, z), rowY.transform(x, y, z), rowZ.transform(x, y, z), rowW.transform(x, y, z) };
+			auto front = _mm_movemask_ps(_mm_and_ps(
+				_mm_cmpgt_ps(clip[3], zero),
+				_mm_cmpge_ps(_mm_add_ps(clip[2], clip[3]), zero)));
+			__m128 screen[4] = {
+				_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(clip[0], clip[3]), half), half), widthV),
+				_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(clip[1], clip[3]), half), half), heightV),
+				_mm_add_ps(_mm_mul_ps(_mm_div_ps(clip[2], clip[3]), half), half),
+				zero
+			};
+			_MM_TRANSPOSE4_PS(clip[0], clip[1], clip[2], clip[3]);
+			_MM_TRANSPOSE4_PS(screen[0], screen[1], screen[2], screen[3]);
+			for (auto i = 0u; i < 4; ++i) {
+				_mm_storeu_ps(&clipVertices[v + i].x, clip[i]);
+				_mm_storeu_ps(&screenVertices[v + i].x, screen[i]);
+				inFront[v + i] = (front >> i) & 1;
+			}
+		}
+	}
+#endif
+	for (; v < numVertices; ++v) {
+		auto clip = modelToClip * glm::vec4(vertices[v], 1.0f);
+		clipVertices[v] = clip;
+		// same test as clipNear, and the w > 0 test of the clipped polygons
+		inFront[v] = clip.w > 0.0f && clip.z + clip.w >= 0.0f;
+		if (inFront[v])
+			screenVertices[v] = glm::vec4(toScreen(clip, width, height), 0.0f);
+	}
+}
+
+void OcclusionBuffer::rasterize(const OccluderMesh &occluder, const glm::mat4 &modelToWorld)
+{
+	// vertices shared by several triangles are transformed once
+	transformVertices(occluder.vertices, viewProj * modelToWorld);
+	auto &indices = occluder.indices;
+	unsigned batch[4];
+	auto batchSize = 0u;
+	for (auto i = 0u; i + 3 <= indices.size(); i += 3) {
+		auto i0 = indices[i];
+		auto i1 = indices[i + 1];
+		auto i2 = indices[i + 2];
+		if (!(inFront[i0] && inFront[i1] && inFront[i2])) {
+			rasterizeClipped(i0, i1, i2);
+			continue;
+		}
+		if (!simd) {
+			rasterizeTriangle(glm::vec3(screenVertices[i0]), glm::vec3(screenVertices[i1]), glm::vec3(screenVertices[i2]));
+			continue;
+		}
+		batch[batchSize++] = i;
+		if (batchSize == 4) {
+			rasterizeTriangles4(indices.data(), batch, 4);
+			batchSize = 0;
+		}
+	}
+	if (batchSize)
+		rasterizeTriangles4(indices.data(), batch, batchSize);
+}
+
+void OcclusionBuffer::rasterizeClipped(unsigned i0, unsigned i1, unsigned i2)
+{
+	glm::vec4 tri[3] = { clipVertices[i0], clipVertices[i1], clipVertices[i2] };
+	glm::vec4 poly[4];
+	auto n = clipNear(tri, poly);
+	if (n < 3)
+		return;
+	glm::vec3 s[4];
+	bool valid = true;
+	for (auto k = 0u; k < n; ++k) {
+		valid &= poly[k].w > 0.0f;
+		s[k] = toScreen(poly[k], width, height);
+	}
+	if (!valid)
+		return;
+	rasterizeTriangle(s[0], s[1], s[2]);
+	if (n == 4)
+		rasterizeTriangle(s[0], s[2], s[3]);
+}
+
+void OcclusionBuffer::rasterizeTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+{
+	TriangleSetup t;
+	if (!setupTriangle(v0, v1, v2, width, height, t))
+		return;
+	++numTriangles;
+#ifdef OCCLUSION_USE_SSE
+	if (simd) {
+		fillTriangleSse(t, depth.data(), width);
+		return;
+	}
+#endif
+	fillTriangle(t, depth.data(), width);
+}
+
+void OcclusionBuffer::rasterizeTriangles4(const unsigned *indices, const unsigned *triangles, unsigned count)
+{
+#ifdef OCCLUSION_USE_SSE
+	// the operations of setupTriangle, one triangle per lane (missing ones repeat the first)
+	auto vertex = [&](unsigned k) {
+		auto tri = [&](unsigned lane) { return indices + triangles[lane < count ? lane : 0]; };
+		return Vertices4::load(&screenVertices[tri(0)[k]].x, &screenVertices[tri(1)[k]].x,
+			&screenVertices[tri(2)[k]].x, &screenVertices[tri(3)[k]].x);
+	};
+	auto v0 = vertex(0);
+	auto v1 = vertex(1);
+	auto v2 = vertex(2);
+	const auto zero = _mm_setzero_ps();
+	const auto half = _mm_set1_ps(0.5f);
+	const auto signBit = _mm_set1_ps(-0.0f);
+	auto area = _mm_sub_ps(
+		_mm_mul_ps(_mm_sub_ps(v2.x, v0.x), _mm_sub_ps(v1.y, v0.y)),
+		_mm_mul_ps(_mm_sub_ps(v2.y, v0.y), _mm_sub_ps(v1.x, v0.x)));
+	Vertices4::swap(_mm_cmplt_ps(area, zero), v1, v2);
+
+	// pixel bounds as in setPixelBounds
+	const auto widthV = _mm_set1_ps(float(width));
+	const auto heightV = _mm_set1_ps(float(height));
+	auto minX = _mm_max_ps(_mm_min_ps(v0.x, _mm_min_ps(v1.x, v2.x)), zero);
+	auto maxX = _mm_min_ps(_mm_max_ps(v0.x, _mm_max_ps(v1.x, v2.x)), widthV);
+	auto minY = _mm_max_ps(_mm_min_ps(v0.y, _mm_min_ps(v1.y, v2.y)), zero);
+	auto maxY = _mm_min_ps(_mm_max_ps(v0.y, _mm_max_ps(v1.y, v2.y)), heightV);
+	auto xBegin = ceilToInt(_mm_sub_ps(_mm_min_ps(minX, widthV), half));
+	auto xEnd = floorToInt(_mm_sub_ps(_mm_max_ps(maxX, zero), half));
+	auto yBegin = ceilToInt(_mm_sub_ps(_mm_min_ps(minY, heightV), half));
+	auto yEnd = floorToInt(_mm_sub_ps(_mm_max_ps(maxY, zero), half));
+	auto empty = _mm_or_si128(_mm_cmpgt_epi32(xBegin, xEnd), _mm_cmpgt_epi32(yBegin, yEnd));
+	auto valid = _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(empty), _mm_cmpneq_ps(area, zero)));
+	if (!valid)
+		return;
+	alignas(16) int bounds[4][4];
+	_mm_store_si128(reinterpret_cast<__m128i *>(bounds[0]), xBegin);
+	_mm_store_si128(reinterpret_cast<__m128i *>(bounds[1]), xEnd);
+	_mm_store_si128(reinterpret_cast<__m128i *>(bounds[2]), yBegin);
+	_mm_store_si128(reinterpret_cast<__m128i *>(bounds[3]), yEnd);
+
+	auto det = _mm_sub_ps(
+		_mm_mul_ps(_mm_sub_ps(v1.x, v0.x), _mm_sub_ps(v2.y, v0.y)),
+		_mm_mul_ps(_mm_sub_ps(v2.x, v0.x), _mm_sub_ps(v1.y, v0.y)));
+	auto dzdx = _mm_div_ps(_mm_sub_ps(
+		_mm_mul_ps(_mm_sub_ps(v1.z, v0.z), _mm_sub_ps(v2.y, v0.y)),
+		_mm_mul_ps(_mm_sub_ps(v2.z, v0.z), _mm_sub_ps(v1.y, v0.y))), det);
+	auto dzdy = _mm_div_ps(_mm_sub_ps(
+		_mm_mul_ps(_mm_sub_ps(v2.z, v0.z), _mm_sub_ps(v1.x, v0.x)),
+		_mm_mul_ps(_mm_sub_ps(v1.z, v0.z), _mm_sub_ps(v2.x, v0.x))), det);
+	auto slope = _mm_add_ps(_mm_andnot_ps(signBit, dzdx), _mm_andnot_ps(signBit, dzdy));
+	auto zc = _mm_add_ps(
+		_mm_sub_ps(_mm_sub_ps(v0.z, _mm_mul_ps(dzdx, v0.x)), _mm_mul_ps(dzdy, v0.y)),
+		_mm_mul_ps(half, slope));
+	auto zMax = _mm_max_ps(v0.z, _mm_max_ps(v1.z, v2.z));
+	alignas(16) float a[3][4], b[3][4], c[3][4], planes[4][4];
+	auto edge = [&](const Vertices4 &p, const Vertices4 &q, unsigned k) {
+		auto ak = _mm_sub_ps(q.y, p.y);
+		auto bk = _mm_sub_ps(p.x, q.x);
+		_mm_store_ps(a[k], ak);
+		_mm_store_ps(b[k], bk);
+		_mm_store_ps(c[k], _mm_xor_ps(_mm_add_ps(_mm_mul_ps(ak, p.x), _mm_mul_ps(bk, p.y)), signBit));
+	};
+	edge(v0, v1, 0);
+	edge(v1, v2, 1);
+	edge(v2, v0, 2);
+	_mm_store_ps(planes[0], dzdx);
+	_mm_store_ps(planes[1], dzdy);
+	_mm_store_ps(planes[2], zc);
+	_mm_store_ps(planes[3], zMax);
+
+	for (auto lane = 0u; lane < count; ++lane) {
+		if (!(valid & (1 << lane)))
+			continue;
+		++numTriangles;
+		TriangleSetup t;
+		t.xBegin = bounds[0][lane];
+		t.xEnd = bounds[1][lane];
+		t.yBegin = bounds[2][lane];
+		t.yEnd = bounds[3][lane];
+		for (auto k = 0u; k < 3; ++k) {
+			t.a[k] = a[k][lane];
+			t.b[k] = b[k][lane];
+			t.c[k] = c[k][lane];
+		}
+		t.dzdx = planes[0][lane];
+		t.dzdy = planes[1][lane];
+		t.zc = planes[2][lane];
+		t.zMax = planes[3][lane];
+		fillTriangleSse(t, depth.data(), width);
+	}
+#else
+	for (auto i = 0u; i < count; ++i) {
+		auto tri = indices + triangles[i];
+		rasterizeTriangle(glm::vec3(screenVertices[tri[0]]), glm::vec3(screenVertices[tri[1]]), glm::vec3(screenVertices[tri[2]]));
+	}
+#endif
+}
+
+void OcclusionBuffer::finish()
+{
+	for (auto ty = 0u; ty < tilesY; ++ty)
+		for (auto tx = 0u; tx < tilesX; ++tx) {
+			auto maxDepth = 0.0f;
+			for (auto y = ty * kTileSize; y < (ty + 1) * kTileSize; ++y) {
+				auto row = &depth[y * width + tx * kTileSize];
+				for (auto x = 0u; x < kTileSize; ++x)
+					maxDepth = glm::max(maxDepth, row[x]);
+			}
+			tileMaxDepth[ty * tilesX + tx] = maxDepth;
+		}
+}
+
+bool OcclusionBuffer::projectBox(const glm::vec3 &center, const glm::vec3 &extent, glm::vec3 &smin, glm::vec3 &smax) const
+{
+#ifdef OCCLUSION_USE_SSE
+	if (simd) {
+		// same operations as below: the center and the scaled columns (as glm does),
+		// then corners 0-3 in one register, 4-7 in the other
+		auto m0 = _mm_loadu_ps(&viewProj[0][0]);
+		auto m1 = _mm_loadu_ps(&viewProj[1][0]);
+		auto m2 = _mm_loadu_ps(&viewProj[2][0]);
+		auto m3 = _mm_loadu_ps(&viewProj[3][0]);
+		auto clipCenter = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(center.x)), _mm_mul_ps(m1, _mm_set1_ps(center.y))),
+			_mm_add_ps(_mm_mul_ps(m2, _mm_set1_ps(center.z)), m3));
+		auto dx = _mm_mul_ps(m0, _mm_set1_ps(extent.x));
+		auto dy = _mm_mul_ps(m1, _mm_set1_ps(extent.y));
+		auto dz = _mm_mul_ps(m2, _mm_set1_ps(extent.z));
+		const auto signX = _mm_castsi128_ps(_mm_setr_epi32(0x80000000, 0, 0x80000000, 0));
+		const auto signY = _mm_castsi128_ps(_mm_setr_epi32(0x80000000, 0x80000000, 0, 0));
+		auto base = [&](__m128 c, __m128 x, __m128 y) {
+			return _mm_add_ps(_mm_add_ps(c, _mm_xor_ps(x, signX)), _mm_xor_ps(y, signY));
+		};
+		auto baseX = base(splat<0>(clipCenter), splat<0>(dx), splat<0>(dy));
+		auto baseY = base(splat<1>(clipCenter), splat<1>(dx), splat<1>(dy));
+		auto baseZ = base(splat<2>(clipCenter), splat<2>(dx), splat<2>(dy));
+		auto baseW = base(splat<3>(clipCenter), splat<3>(dx), splat<3>(dy));
+		auto z0 = _mm_sub_ps(baseZ, splat<2>(dz));
+		auto z1 = _mm_add_ps(baseZ, splat<2>(dz));
+		auto w0 = _mm_sub_ps(baseW, splat<3>(dz));
+		auto w1 = _mm_add_ps(baseW, splat<3>(dz));
+		const auto zero = _mm_setzero_ps();
+		const auto signBit = _mm_set1_ps(-0.0f);
+		auto behind = _mm_or_ps(
+			_mm_or_ps(_mm_cmple_ps(w0, zero), _mm_cmplt_ps(z0, _mm_xor_ps(w0, signBit))),
+			_mm_or_ps(_mm_cmple_ps(w1, zero), _mm_cmplt_ps(z1, _mm_xor_ps(w1, signBit))));
+		if (_mm_movemask_ps(behind))
+			return false;
+		const auto half = _mm_set1_ps(0.5f);
+		auto screen = [&](__m128 v, __m128 w) {
+			return _mm_add_ps(_mm_mul_ps(_mm_div_ps(v, w), half), half);
+		};
+		const auto widthV = _mm_set1_ps(float(width));
+		const auto heightV = _mm_set1_ps(float(height));
+		auto x0 = _mm_mul_ps(screen(_mm_sub_ps(baseX, splat<0>(dz)), w0), widthV);
+		auto x1 = _mm_mul_ps(screen(_mm_add_ps(baseX, splat<0>(dz)), w1), widthV);
+		auto y0 = _mm_mul_ps(screen(_mm_sub_ps(baseY, splat<1>(dz)), w0), heightV);
+		auto y1 = _mm_mul_ps(screen(_mm_add_ps(baseY, splat<1>(dz)), w1), heightV);
+		z0 = screen(z0, w0);
+		z1 = screen(z1, w1);
+		smin = glm::vec3(horizontalMin(_mm_min_ps(x0, x1)), horizontalMin(_mm_min_ps(y0, y1)), horizontalMin(_mm_min_ps(z0, z1)));
+		smax = glm::vec3(horizontalMax(_mm_max_ps(x0, x1)), horizontalMax(_mm_max_ps(y0, y1)), horizontalMax(_mm_max_ps(z0, z1)));
+		return true;
+	}
+#endif
+	// corners in clip space: center +/- the scaled matrix columns
+	auto clipCenter = viewProj * glm::vec4(center, 1.0f);
+	auto dx = viewProj[0] * extent.x;
+	auto dy = viewProj[1] * extent.y;
+	auto dz = viewProj[2] * extent.z;
+	smin = glm::vec3(FLT_MAX);
+	smax = glm::vec3(-FLT_MAX);
+	for (auto i = 0u; i < 8; ++i) {
+		auto clipPos = clipCenter + (i & 1 ? dx : -dx) + (i & 2 ? dy : -dy) + (i & 4 ? dz : -dz);
+		if (clipPos.w <= 0.0f || clipPos.z < -clipPos.w)
+			return false;
+		auto s = toScreen(clipPos, width, height);
+		smin = glm::min(smin, s);
+		smax = glm::max(smax, s);
+	}
+	return true;
+}
+
+bool OcclusionBuffer::isOccluded(const glm::vec3 &center, const glm::vec3 &extent) const
+{
+	glm::vec3 smin;
+	glm::vec3 smax;
+	if (!projectBox(center, extent, smin, smax))
+		return false;
+	// off screen: not our business
+	if (smax.x < 0.0f || smax.y < 0.0f || smin.x >= width || smin.y >= height)
+		return false;
+	auto minZ = glm::min(smin.z, 1.0f);
+
+	// pixels touched by the screen rectangle
+	auto x0 = static_cast<unsigned>(glm::max(smin.x, 0.0f));
+	auto y0 = static_cast<unsigned>(glm::max(smin.y, 0.0f));
+	auto x1 = static_cast<unsigned>(glm::min(smax.x, float(width - 1)));
+	auto y1 = static_cast<unsigned>(glm::min(smax.y, float(height - 1)));
+	for (auto ty = y0 / kTileSize; ty <= y1 / kTileSize; ++ty)
+		for (auto tx = x0 / kTileSize; tx <= x1 / kTileSize; ++tx) {
+			// whole tile in front of the box
+			if (minZ > tileMaxDepth[ty * tilesX + tx])
+				continue;
+			auto xb = glm::max(x0, tx * kTileSize);
+			auto xe = glm::min(x1, tx * kTileSize + kTileSize - 1);
+			auto yb = glm::max(y0, ty * kTileSize);
+			auto ye = glm::min(y1, ty * kTileSize + kTileSize - 1);
+#ifdef OCCLUSION_USE_SSE
+			if (simd) {
+				// 4 pixels at a time (the width is a multiple of 4)
+				const auto minZV = _mm_set1_ps(minZ);
+				const auto lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+				const auto xFirst = _mm_set1_ps(float(xb));
+				const auto xLast = _mm_set1_ps(float(xe));
+				for (auto y = yb; y <= ye; ++y) {
+					auto row = &depth[y * width];
+					for (auto x = xb & ~3u; x <= xe; x += 4) {
+						auto px = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+						auto inRange = _mm_and_ps(_mm_cmpge_ps(px, xFirst), _mm_cmple_ps(px, xLast));
+						if (_mm_movemask_ps(_mm_and_ps(inRange, _mm_cmple_ps(minZV, _mm_loadu_ps(row + x)))))
+							return false;
+					}
+				}
+				continue;
+			}
+#endif
+			for (auto y = yb; y <= ye; ++y)
+				for (auto x = xb; x <= xe; ++x)
+					if (minZ <= depth[y * width + x])
+						return false;
+		}
+	return true;
+}
+
+//=============================================================================
+OcclusionCuller::OcclusionCuller(unsigned width, unsigned height) : buffer(width, height)
+{
+	worker = std::thread([this] { workerMain(); });
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		// the scene of a pending frame must outlive it
+		jobDone.wait(lock, [this] { return !jobPending; });
+		quit = true;
+	}
+	jobReady.notify_one();
+	worker.join();
+}
+
+void OcclusionCuller::beginFrame(const Scene &scene, const glm::mat4 &viewProj)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		jobDone.wait(lock, [this] { return !jobPending; });
+		jobScene = &scene;
+		jobViewProj = viewProj;
+		jobPending = true;
+	}
+	jobReady.notify_one();
+}
+
+const OcclusionBuffer &OcclusionCuller::getBuffer()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	jobDone.wait(lock, [this] { return !jobPending; });
+	return buffer;
+}
+
+void OcclusionCuller::workerMain()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		jobReady.wait(lock, [this] { return jobPending || quit; });
+		if (quit)
+			return;
+		auto scene = jobScene;
+		auto viewProj = jobViewProj;
+		lock.unlock();
+		rasterizeOccluders(*scene, viewProj);
+		lock.lock();
+		jobPending = false;
+		jobDone.notify_all();
+	}
+}
+
+void OcclusionCuller::rasterizeOccluders(const Scene &scene, const glm::mat4 &viewProj)
+{
+	PROFILE_SCOPE("rasterizeOccluders");
+	auto frustum = FrustumPlanes::fromMatrix(viewProj);
+	buffer.clear(viewProj);
+	unsigned count = 0;
+	for (auto &it : scene.meshNodes) {
+		auto &meshNode = it.second;
+		if (!meshNode.occluder || !meshNode.mesh->occluder)
+			continue;
+		auto &modelToWorld = scene.transforms.getWorldMatrix(it.first);
+		if (!frustum.intersects(transformAABB(meshNode.mesh->aabb, modelToWorld)))
+			continue;
+		buffer.rasterize(*meshNode.mesh->occluder, modelToWorld);
+		++count;
+	}
+	buffer.finish();
+	numOccluders = count;
+}
@@ -16,7 +16,7 @@ Buffer::~Buffer() {
 }
 
 void bindVertexBuffers(
-	util::array_ref<const Buffer*> vertexBuffers,
+	util::array_ref<BufferSlice> vertexBuffers,
 	const VAO &vao)
 {
 	auto nbufs = vertexBuffers.size();
@@ -26,20 +26,26 @@ void bindVertexBuffers(
 	GLsizei strides[kMaxVertexBufferBindings];
 	for (auto i = 0u; i < nbufs; ++i)
 	{
-		vbufs[i] = vertexBuffers[i]->obj;
-		offsets[i] = vertexBuffers[i]->offset;
+		vbufs[i] = vertexBuffers[i].obj;
+		offsets[i] = vertexBuffers[i].offset;
 		strides[i] = vao.strides[i];
 	}
 
-	gl::BindVertexArray(vao.obj);
-	gl::BindVertexBuffers(0,
+	auto &device = getGraphicsDevice();
+	device.bindVertexArray(vao.obj);
+	device.bindVertexBuffers(0,
 		nbufs,
 		vbufs,
 		offsets,
 		strides);
 }
 
-void bindBuffersRangeHelper(unsigned first, util::array_ref<const Buffer*> buffers)
+void bindBuffersRangeHelper(unsigned first, util::array_ref<BufferSlice> buffers)
+{
+	bindBuffersRangeHelper(gl::UNIFORM_BUFFER, first, buffers);
+}
+
+void bindBuffersRangeHelper(GLenum target, unsigned first, util::array_ref<BufferSlice> buffers)
 {
 	auto nbufs = buffers.size();
 	assert(nbufs <= kMaxUniformBufferBindings);
@@ -48,31 +54,33 @@ void bindBuffersRangeHelper(unsigned first, util::array_ref<const Buffer*> buffe
 	GLsizeiptr sizes[kMaxUniformBufferBindings];
 	for (auto i = 0u; i < nbufs; ++i)
 	{
-		bufs[i] = buffers[i]->obj;
-		offsets[i] = buffers[i]->offset;
-		sizes[i] = buffers[i]->size;
+		bufs[i] = buffers[i].obj;
+		offsets[i] = buffers[i].offset;
+		sizes[i] = buffers[i].size;
 	}
 
-	gl::BindBuffersRange(gl::UNIFORM_BUFFER, 0, nbufs, bufs, offsets, sizes);
+	getGraphicsDevice().bindBuffersRange(target, first, nbufs, bufs, offsets, sizes);
 }
 
 
 void drawIndexed(
 	GLenum mode,
-	const Buffer &ib,
+	const BufferSlice &ib,
 	unsigned firstVertex,
 	unsigned firstIndex,
 	unsigned indexCount,
 	unsigned firstInstance,
 	unsigned instanceCount)
 {
-	gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, ib.obj);
-	gl::DrawElementsInstancedBaseVertexBaseInstance(
+	getGraphicsDevice().drawElements(
 		mode,
-		indexCount,
+		ib.obj,
 		gl::UNSIGNED_SHORT,
-		reinterpret_cast<void*>(ib.offset + firstIndex * 2),
-		instanceCount, firstVertex, firstInstance);
+		ib.offset + firstIndex * 2,
+		indexCount,
+		firstVertex,
+		firstInstance,
+		instanceCount);
 }
 
 void doFullScreenPass(
@@ -148,81 +156,100 @@ bool isSamplerType(GLenum type)
 GLuint GraphicsContext::getSamplerLinearClamp()
 {
 	if (!samLinearClamp)
-	{
-		gl::GenSamplers(1, &samLinearClamp);
-		gl::SamplerParameteri(samLinearClamp, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
-		gl::SamplerParameteri(samLinearClamp, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
-		gl::SamplerParameteri(samLinearClamp, gl::TEXTURE_WRAP_R, gl::CLAMP_TO_EDGE);
-		gl::SamplerParameteri(samLinearClamp, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
-		gl::SamplerParameteri(samLinearClamp, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
-	}
+		samLinearClamp = getGraphicsDevice().createSampler(gl::LINEAR, gl::LINEAR, gl::CLAMP_TO_EDGE);
 	return samLinearClamp;
 }
 
 GLuint GraphicsContext::getSamplerNearestClamp()
 {
 	if (!samNearestClamp)
-	{
-		gl::GenSamplers(1, &samNearestClamp);
-		gl::SamplerParameteri(samNearestClamp, gl::TEXTURE_MIN_FILTER, gl::NEAREST);
-		gl::SamplerParameteri(samNearestClamp, gl::TEXTURE_MAG_FILTER, gl::NEAREST);
-		gl::SamplerParameteri(samNearestClamp, gl::TEXTURE_WRAP_R, gl::CLAMP_TO_EDGE);
-		gl::SamplerParameteri(samNearestClamp, gl::TEXTURE_WRAP_S, gl::CLAMP_TO_EDGE);
-		gl::SamplerParameteri(samNearestClamp, gl::TEXTURE_WRAP_T, gl::CLAMP_TO_EDGE);
-	}
+		samNearestClamp = getGraphicsDevice().createSampler(gl::NEAREST, gl::NEAREST, gl::CLAMP_TO_EDGE);
 	return samNearestClamp;
 }
 
 GLuint GraphicsContext::getSamplerLinearRepeat()
 {
 	if (!samLinearRepeat)
-	{
-		gl::GenSamplers(1, &samLinearRepeat);
-		gl::SamplerParameteri(samLinearRepeat, gl::TEXTURE_MIN_FILTER, gl::LINEAR);
-		gl::SamplerParameteri(samLinearRepeat, gl::TEXTURE_MAG_FILTER, gl::LINEAR);
-		gl::SamplerParameteri(samLinearRepeat, gl::TEXTURE_WRAP_R, gl::REPEAT);
-		gl::SamplerParameteri(samLinearRepeat, gl::TEXTURE_WRAP_S, gl::REPEAT);
-		gl::SamplerParameteri(samLinearRepeat, gl::TEXTURE_WRAP_T, gl::REPEAT);
-	}
-	return samNearestRepeat;
+		samLinearRepeat = getGraphicsDevice().createSampler(gl::LINEAR, gl::LINEAR, gl::REPEAT);
+	return samLinearRepeat;
 }
 
 GLuint GraphicsContext::getSamplerNearestRepeat()
 {
 	if (!samNearestRepeat)
-	{
-		gl::GenSamplers(1, &samNearestRepeat);
-		gl::SamplerParameteri(samNearestRepeat, gl::TEXTURE_MIN_FILTER, gl::NEAREST);
-		gl::SamplerParameteri(samNearestRepeat, gl::TEXTURE_MAG_FILTER, gl::NEAREST);
-		gl::SamplerParameteri(samNearestRepeat, gl::TEXTURE_WRAP_R, gl::REPEAT);
-		gl::SamplerParameteri(samNearestRepeat, gl::TEXTURE_WRAP_S, gl::REPEAT);
-		gl::SamplerParameteri(samNearestRepeat, gl::TEXTURE_WRAP_T, gl::REPEAT);
-	}
+		samNearestRepeat = getGraphicsDevice().createSampler(gl::NEAREST, gl::NEAREST, gl::REPEAT);
 	return samNearestRepeat;
 }
 
+GraphicsContext::GraphicsContext(unsigned framesInFlight, unsigned extraTransientRings) :
+	state_cache(getGraphicsDevice()),
+	num_frames_in_flight(framesInFlight)
+{
+	// all state changes go through the cache from now on
+	setGraphicsDevice(&state_cache);
+	if (num_frames_in_flight < kMinFramesInFlight || num_frames_in_flight > kMaxFramesInFlight) {
+		WARNING << "Unsupported number of frames in flight (" << framesInFlight << "), must be between " 
+			<< unsigned(kMinFramesInFlight) << " and " << unsigned(kMaxFramesInFlight);
+		num_frames_in_flight = glm::clamp(num_frames_in_flight, kMinFramesInFlight, kMaxFramesInFlight);
+	}
+	if (extraTransientRings > kMaxExtraTransientRings) {
+		WARNING << "Unsupported number of extra transient rings (" << extraTransientRings << "), must be at most "
+			<< unsigned(kMaxExtraTransientRings);
+		extraTransientRings = kMaxExtraTransientRings;
+	}
+	max_transient_rings = num_frames_in_flight + extraTransientRings;
+}
+
+GraphicsContext::~GraphicsContext()
+{
+	if (&getGraphicsDevice() == &state_cache)
+		setGraphicsDevice(&state_cache.getDevice());
+}
+
 void GraphicsContext::initialize()
 {
-	gl::GenVertexArrays(1, &dummy_vao); 
-	setDebugCallback();
+	dummy_vao = getGraphicsDevice().createVertexArray({}, {});
+	getGraphicsDevice().installDebugCallback();
 }
 
 void GraphicsContext::tearDown()
 {
-	gl::DeleteVertexArrays(1, &dummy_vao);
+	auto &device = getGraphicsDevice();
+	device.deleteVertexArray(dummy_vao);
 	if (samLinearClamp)
-		gl::DeleteSamplers(1, &samLinearClamp);
+		device.deleteSampler(samLinearClamp);
 	if (samNearestClamp)
-		gl::DeleteSamplers(1, &samNearestClamp);
+		device.deleteSampler(samNearestClamp);
 	if (samLinearRepeat)
-		gl::DeleteSamplers(1, &samLinearRepeat);
+		device.deleteSampler(samLinearRepeat);
 	if (samNearestRepeat)
-		gl::DeleteSamplers(1, &samNearestRepeat);
+		device.deleteSampler(samNearestRepeat);
+	// nothing is drawn anymore: release what the frames in flight were still using
+	for (auto &ring : transient_rings) {
+		auto deferred = std::move(ring.deferred);
+		ring.deferred.clear();
+		for (auto &fn : deferred)
+			fn();
+	}
+	for (auto &ring : transient_rings) {
+		if (ring.sync)
+			device.deleteSync(ring.sync);
+		for (auto &chunk : ring.chunks)
+			device.deleteBuffer(chunk.obj);
+	}
+	transient_rings.clear();
+	transient_in_flight.clear();
+	transient_free_rings.clear();
+	// pool pages (deleting a buffer still allocated in them does nothing afterwards)
+	for (auto i = 0u; i < pools.size(); ++i)
+		if (pools[i].obj)
+			releasePoolPage(i);
 }
 	
 void GraphicsContext::beginFrame()
 {
-	// reclaim transient buffers for frame n-2
+	state_cache.beginFrame();
+	// reclaim transient buffers of the frames that the GPU has finished
 	reclaimTransientBuffers();
 }
 
@@ -56,7 +56,8 @@ namespace
 		/*Depth24*/{ gl::UNSIGNED_INT, 0, gl::DEPTH_COMPONENT24, gl::DEPTH_COMPONENT, false, false },
 		/*Depth16*/{ gl::UNSIGNED_SHORT, 0, gl::DEPTH_COMPONENT16, gl::DEPTH_COMPONENT, false, false },
 		/*Float16*/{ gl::HALF_FLOAT, 1, gl::R16F, gl::RED, false, false },
-		/*Float*/{ gl::FLOAT, 1, gl::R32F, gl::RED, false, false }
+		/*Float*/{ gl::FLOAT, 1, gl::R32F, gl::RED, false, false },
+		/*Depth32F*/{ gl::FLOAT, 0, gl::DEPTH_COMPONENT32F, gl::DEPTH_COMPONENT, false, false }
 	};
 }
 
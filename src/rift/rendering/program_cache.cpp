@@ -0,0 +1,163 @@
+#include <rendering/program_cache.hpp>
+#include <rendering/device.hpp>
+#include <utils/binary_io.hpp>
+#include <utils/hash.hpp>
+#include <log.hpp>
+#include <clock.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	// file header: magic, version, key, format, size of the binary
+	const uint32_t kMagic = 0x42435052;	// "RPCB"
+	const uint32_t kVersion = 1;
+
+	double secondsSince(qpc_clock::time_point t0)
+	{
+		using namespace std::chrono;
+		return duration_cast<duration<double>>(qpc_clock::now() - t0).count();
+	}
+}
+
+void ProgramCache::setDirectory(std::string directory_)
+{
+	directory = std::move(directory_);
+	index.clear();
+	if (directory.empty())
+		return;
+	std::error_code ec;
+	fs::create_directories(directory, ec);
+	if (!fs::is_directory(directory, ec)) {
+		WARNING << "Program cache disabled: could not create " << directory;
+		directory.clear();
+		return;
+	}
+	for (auto &entry : fs::directory_iterator(directory, ec)) {
+		auto name = entry.path().filename().string();
+		if (name.size() != 20 || entry.path().extension() != ".bin")
+			continue;
+		auto hex = name.substr(0, 16);
+		if (hex.find_first_not_of("0123456789abcdef") != std::string::npos)
+			continue;
+		index.insert(std::stoull(hex, nullptr, 16));
+	}
+	LOG << "Program cache: " << directory << " (" << index.size() << " binaries)";
+}
+
+uint64_t ProgramCache::hashProgram(const std::string &vs, const std::string &gs, const std::string &ps, const std::string &driver)
+{
+	auto hash = util::kHashBasis;
+	hash = util::hashString(hash, vs);
+	hash = util::hashString(hash, gs);
+	hash = util::hashString(hash, ps);
+	return util::hashString(hash, driver);
+}
+
+std::string ProgramCache::getFileName(uint64_t key)
+{
+	std::ostringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+	return name.str();
+}
+
+std::string ProgramCache::getPath(uint64_t key) const
+{
+	return (fs::path(directory) / getFileName(key)).string();
+}
+
+bool ProgramCache::readBinary(uint64_t key, Binary &binary) const
+{
+	if (!contains(key))
+		return false;
+	std::ifstream fileIn(getPath(key), std::ios::binary);
+	uint32_t magic = 0, version = 0, keyLow = 0, keyHigh = 0, format = 0, size = 0;
+	util::read_u32le(fileIn, magic);
+	util::read_u32le(fileIn, version);
+	util::read_u32le(fileIn, keyLow);
+	util::read_u32le(fileIn, keyHigh);
+	util::read_u32le(fileIn, format);
+	util::read_u32le(fileIn, size);
+	if (!fileIn || magic != kMagic || version != kVersion || (uint64_t(keyHigh) << 32 | keyLow) != key)
+		return false;
+	binary.format = format;
+	binary.data.resize(size);
+	fileIn.read(binary.data.data(), size);
+	return static_cast<bool>(fileIn);
+}
+
+bool ProgramCache::writeBinary(uint64_t key, const Binary &binary)
+{
+	if (!isEnabled())
+		return false;
+	// written next to the final file, then renamed: no truncated binary if the program stops
+	auto path = getPath(key);
+	auto tmpPath = path + ".tmp";
+	{
+		std::ofstream fileOut(tmpPath, std::ios::binary | std::ios::trunc);
+		util::write_u32le(fileOut, kMagic);
+		util::write_u32le(fileOut, kVersion);
+		util::write_u32le(fileOut, static_cast<uint32_t>(key));
+		util::write_u32le(fileOut, static_cast<uint32_t>(key >> 32));
+		util::write_u32le(fileOut, binary.format);
+		util::write_u32le(fileOut, static_cast<uint32_t>(binary.data.size()));
+		fileOut.write(binary.data.data(), binary.data.size());
+		if (!fileOut) {
+			WARNING << "Could not write program binary " << tmpPath;
+			return false;
+		}
+	}
+	std::error_code ec;
+	fs::rename(tmpPath, path, ec);
+	if (ec) {
+		WARNING << "Could not write program binary " << path << ": " << ec.message();
+		fs::remove(tmpPath, ec);
+		return false;
+	}
+	index.insert(key);
+	return true;
+}
+
+GLuint ProgramCache::getProgram(const std::string &vs, const std::string &gs, const std::string &ps)
+{
+	auto &device = getGraphicsDevice();
+	auto t0 = qpc_clock::now();
+	uint64_t key = 0;
+	if (isEnabled()) {
+		key = hashProgram(vs, gs, ps, device.getDriverString());
+		Binary binary;
+		if (readBinary(key, binary)) {
+			auto program = device.createProgramFromBinary(binary.format, binary.data.data(), binary.data.size());
+			if (program) {
+				++stats.numLoaded;
+				stats.loadTime += secondsSince(t0);
+				return program;
+			}
+			LOG << "Program binary " << getFileName(key) << " rejected by the driver, compiling";
+			++stats.numRejected;
+		}
+	}
+
+	t0 = qpc_clock::now();
+	auto vsObj = device.createShader(gl::VERTEX_SHADER, vs.c_str());
+	GLuint gsObj = gs.empty() ? 0 : device.createShader(gl::GEOMETRY_SHADER, gs.c_str());
+	auto psObj = device.createShader(gl::FRAGMENT_SHADER, ps.c_str());
+	auto program = device.createProgram(vsObj, gsObj, psObj);
+	device.deleteShader(vsObj);
+	if (gsObj)
+		device.deleteShader(gsObj);
+	device.deleteShader(psObj);
+	++stats.numCompiled;
+
+	if (isEnabled()) {
+		Binary binary;
+		if (device.getProgramBinary(program, binary.format, binary.data))
+			writeBinary(key, binary);
+	}
+	stats.compileTime += secondsSince(t0);
+	return program;
+}
@@ -0,0 +1,358 @@
+#include <rendering/opengl4.hpp>
+#include <clock.hpp>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+//---------------------------
+// buffers
+GLuint RecordingDevice::createBuffer(GLenum /*target*/, size_t size, GLbitfield /*flags*/, const void *initialData)
+{
+	auto obj = newName();
+	auto &storage = buffers[obj];
+	storage.resize(size);
+	if (initialData)
+		std::memcpy(storage.data(), initialData, size);
+	buffer_memory_used += size;
+	return obj;
+}
+
+void *RecordingDevice::mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield /*access*/)
+{
+	auto &storage = buffers.at(buf);
+	assert(offset + size <= storage.size());
+	return storage.data() + offset;
+}
+
+void RecordingDevice::updateBuffer(GLuint buf, GLenum /*target*/, size_t offset, size_t size, const void *data)
+{
+	auto &storage = buffers.at(buf);
+	assert(offset + size <= storage.size());
+	std::memcpy(storage.data() + offset, data, size);
+}
+
+void RecordingDevice::copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size)
+{
+	auto &srcStorage = buffers.at(src);
+	auto &destStorage = buffers.at(dest);
+	assert(srcOffset + size <= srcStorage.size());
+	assert(destOffset + size <= destStorage.size());
+	std::memmove(destStorage.data() + destOffset, srcStorage.data() + srcOffset, size);
+}
+
+void RecordingDevice::deleteBuffer(GLuint buf)
+{
+	auto it = buffers.find(buf);
+	if (it == buffers.end())
+		return;
+	buffer_memory_used -= it->second.size();
+	buffers.erase(it);
+}
+
+GLsync RecordingDevice::fenceSync()
+{
+	// never dereferenced, only needs to be non-null
+	return reinterpret_cast<GLsync>(next_sync++);
+}
+
+//---------------------------
+// timer queries
+void RecordingDevice::queryTimestamp(GLuint query)
+{
+	// no GPU: the commands are done when they are recorded
+	query_results[query] = static_cast<uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(qpc_clock::now().time_since_epoch()).count());
+}
+
+bool RecordingDevice::getQueryResult(GLuint query, uint64_t &result)
+{
+	auto it = query_results.find(query);
+	if (it == query_results.end())
+		return false;
+	result = it->second;
+	return true;
+}
+
+void RecordingDevice::deleteQuery(GLuint query)
+{
+	query_results.erase(query);
+}
+
+//---------------------------
+// shaders
+namespace
+{
+	// binary: magic, driver string, source hash
+	const char kBinaryMagic[] = "RDPB";
+	const GLenum kBinaryFormat = 1;
+}
+
+GLuint RecordingDevice::createShader(GLenum stage, const char *source)
+{
+	auto obj = newName();
+	shader_hashes[obj] = std::hash<std::string>()(source) ^ stage;
+	++shaders_compiled;
+	return obj;
+}
+
+void RecordingDevice::deleteShader(GLuint shader)
+{
+	shader_hashes.erase(shader);
+}
+
+GLuint RecordingDevice::createProgram(GLuint vs, GLuint gs, GLuint ps)
+{
+	auto obj = newName();
+	size_t hash = 0;
+	for (auto shader : { vs, gs, ps }) {
+		auto it = shader_hashes.find(shader);
+		hash = hash * 31 + (it != shader_hashes.end() ? it->second : 0);
+	}
+	program_hashes[obj] = hash;
+	++programs_linked;
+	return obj;
+}
+
+void RecordingDevice::deleteProgram(GLuint program)
+{
+	program_hashes.erase(program);
+}
+
+bool RecordingDevice::getProgramBinary(GLuint program, GLenum &format, std::vector<char> &binary)
+{
+	auto it = program_hashes.find(program);
+	if (it == program_hashes.end())
+		return false;
+	format = kBinaryFormat;
+	binary.assign(kBinaryMagic, kBinaryMagic + 4);
+	binary.insert(binary.end(), driver_string.begin(), driver_string.end());
+	binary.push_back('\0');
+	auto hash = reinterpret_cast<const char*>(&it->second);
+	binary.insert(binary.end(), hash, hash + sizeof(size_t));
+	return true;
+}
+
+GLuint RecordingDevice::createProgramFromBinary(GLenum format, const void *binary, size_t size)
+{
+	// same checks as a driver: format, and binaries of the same driver only
+	auto bytes = static_cast<const char*>(binary);
+	auto headerSize = 4 + driver_string.size() + 1;
+	if (format != kBinaryFormat || size != headerSize + sizeof(size_t)
+		|| std::memcmp(bytes, kBinaryMagic, 4) != 0
+		|| std::memcmp(bytes + 4, driver_string.c_str(), driver_string.size() + 1) != 0)
+		return 0;
+	auto obj = newName();
+	size_t hash;
+	std::memcpy(&hash, bytes + headerSize, sizeof(size_t));
+	program_hashes[obj] = hash;
+	++programs_from_binary;
+	return obj;
+}
+
+//---------------------------
+// commands
+RecordingDevice::Command &RecordingDevice::record(CommandType type)
+{
+	counters[static_cast<int>(type)]++;
+	Command *cmd = &scratch;
+	if (store_commands) {
+		commands.push_back(Command());
+		cmd = &commands.back();
+	}
+	*cmd = Command();
+	cmd->type = type;
+	return *cmd;
+}
+
+unsigned RecordingDevice::recordObjects(unsigned count, const GLuint *objects)
+{
+	auto begin = static_cast<unsigned>(object_names.size());
+	if (store_commands)
+		object_names.insert(object_names.end(), objects, objects + count);
+	return begin;
+}
+
+void RecordingDevice::bindFramebuffer(GLuint fbo)
+{
+	record(CommandType::BindFramebuffer).obj = fbo;
+}
+
+void RecordingDevice::viewport(int x, int y, int width, int height)
+{
+	auto &cmd = record(CommandType::Viewport);
+	cmd.first = x;
+	cmd.baseVertex = y;
+	cmd.count = width;
+	cmd.instanceCount = height;
+}
+
+void RecordingDevice::clear(GLbitfield mask, const glm::vec4 & /*color*/, float /*depth*/)
+{
+	record(CommandType::Clear).param = mask;
+}
+
+void RecordingDevice::setEnabled(GLenum cap, bool enabled)
+{
+	auto &cmd = record(CommandType::SetEnabled);
+	cmd.param = cap;
+	cmd.count = enabled ? 1 : 0;
+}
+
+void RecordingDevice::polygonMode(GLenum mode)
+{
+	record(CommandType::PolygonMode).param = mode;
+}
+
+void RecordingDevice::cullFace(GLenum face)
+{
+	record(CommandType::CullFace).param = face;
+}
+
+void RecordingDevice::depthFunc(GLenum func)
+{
+	record(CommandType::DepthFunc).param = func;
+}
+
+void RecordingDevice::depthMask(bool enabled)
+{
+	record(CommandType::DepthMask).count = enabled ? 1 : 0;
+}
+
+void RecordingDevice::blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum /*modeAlpha*/)
+{
+	auto &cmd = record(CommandType::BlendEquation);
+	cmd.first = drawBuffer;
+	cmd.param = modeRGB;
+}
+
+void RecordingDevice::blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum /*dstRGB*/, GLenum /*srcAlpha*/, GLenum /*dstAlpha*/)
+{
+	auto &cmd = record(CommandType::BlendFunc);
+	cmd.first = drawBuffer;
+	cmd.param = srcRGB;
+}
+
+void RecordingDevice::colorMask(bool enabled)
+{
+	record(CommandType::ColorMask).count = enabled ? 1 : 0;
+}
+
+void RecordingDevice::stencilFunc(GLenum func, int ref, unsigned mask)
+{
+	auto &cmd = record(CommandType::StencilFunc);
+	cmd.param = func;
+	cmd.first = ref;
+	cmd.count = mask;
+}
+
+void RecordingDevice::stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+{
+	auto &cmd = record(CommandType::StencilOp);
+	cmd.param = face;
+	cmd.first = stencilFail;
+	cmd.obj = depthFail;
+	cmd.count = depthPass;
+}
+
+void RecordingDevice::useProgram(GLuint program)
+{
+	record(CommandType::UseProgram).obj = program;
+}
+
+void RecordingDevice::bindVertexArray(GLuint vao)
+{
+	record(CommandType::BindVertexArray).obj = vao;
+}
+
+void RecordingDevice::bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr * /*offsets*/, const GLsizei * /*strides*/)
+{
+	auto objects = recordObjects(count, buffers);
+	auto &cmd = record(CommandType::BindVertexBuffers);
+	cmd.first = first;
+	cmd.count = count;
+	cmd.objects_begin = objects;
+}
+
+void RecordingDevice::bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr * /*offsets*/, const GLsizeiptr * /*sizes*/)
+{
+	auto objects = recordObjects(count, buffers);
+	auto &cmd = record(CommandType::BindBuffersRange);
+	cmd.param = target;
+	cmd.first = first;
+	cmd.count = count;
+	cmd.objects_begin = objects;
+}
+
+void RecordingDevice::bindTextures(unsigned first, unsigned count, const GLuint *textures)
+{
+	auto objects = recordObjects(count, textures);
+	auto &cmd = record(CommandType::BindTextures);
+	cmd.first = first;
+	cmd.count = count;
+	cmd.objects_begin = objects;
+}
+
+void RecordingDevice::bindSamplers(unsigned first, unsigned count, const GLuint *samplers)
+{
+	auto objects = recordObjects(count, samplers);
+	auto &cmd = record(CommandType::BindSamplers);
+	cmd.first = first;
+	cmd.count = count;
+	cmd.objects_begin = objects;
+}
+
+void RecordingDevice::drawElements(GLenum mode, GLuint indexBuffer, GLenum /*indexType*/, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount)
+{
+	auto &cmd = record(CommandType::DrawElements);
+	cmd.param = mode;
+	cmd.obj = indexBuffer;
+	cmd.offset = indexOffset;
+	cmd.count = indexCount;
+	cmd.baseVertex = baseVertex;
+	cmd.baseInstance = baseInstance;
+	cmd.instanceCount = instanceCount;
+}
+
+void RecordingDevice::drawArrays(GLenum mode, unsigned first, unsigned count)
+{
+	auto &cmd = record(CommandType::DrawArrays);
+	cmd.param = mode;
+	cmd.first = first;
+	cmd.count = count;
+	cmd.instanceCount = 1;
+}
+
+void RecordingDevice::multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum /*indexType*/, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride)
+{
+	auto objects = recordObjects(1, &indirectBuffer);
+	auto &cmd = record(CommandType::MultiDrawElementsIndirect);
+	cmd.param = mode;
+	cmd.obj = indexBuffer;
+	cmd.offset = indirectOffset;
+	cmd.count = drawCount;
+	cmd.first = stride;
+	cmd.objects_begin = objects;
+}
+
+unsigned RecordingDevice::getDrawCount() const
+{
+	return getCommandCount(CommandType::DrawElements)
+		+ getCommandCount(CommandType::DrawArrays)
+		+ getCommandCount(CommandType::MultiDrawElementsIndirect);
+}
+
+unsigned RecordingDevice::getStateChangeCount() const
+{
+	unsigned count = 0;
+	for (int i = 0; i < static_cast<int>(CommandType::Max); ++i)
+		count += counters[i];
+	return count - getDrawCount() - getCommandCount(CommandType::Clear);
+}
+
+void RecordingDevice::reset()
+{
+	commands.clear();
+	object_names.clear();
+	std::fill(std::begin(counters), std::end(counters), 0);
+}
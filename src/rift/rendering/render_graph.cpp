@@ -0,0 +1,443 @@
+#include <rendering/render_graph.hpp>
+#include <rendering/device.hpp>
+#include <rendering/opengl4.hpp>
+#include <log/log.hpp>
+#include <profiler.hpp>
+#include <algorithm>
+#include <cassert>
+
+namespace
+{
+	// pooled textures not used for this many frames are deleted
+	const unsigned kPoolRetireFrames = 4;
+}
+
+bool isDepthFormat(ElementFormat format)
+{
+	return format == ElementFormat::Depth32 || format == ElementFormat::Depth24 || format == ElementFormat::Depth16
+		|| format == ElementFormat::Depth32F;
+}
+
+size_t getRenderTargetMemorySize(const RenderTargetDesc &desc)
+{
+	return static_cast<size_t>(desc.size.x) * desc.size.y * getElementFormatSize(desc.format);
+}
+
+//---------------------------
+// declaration
+RenderResource RenderGraph::PassBuilder::create(const char *name, const RenderTargetDesc &desc)
+{
+	Resource res;
+	res.name = name;
+	res.desc = desc;
+	res.imported = false;
+	res.texture = 0;
+	graph.resources.push_back(res);
+	unsigned v = graph.addVersion(static_cast<unsigned>(graph.resources.size() - 1), pass, -1);
+	graph.passes[pass].writes.push_back(v);
+	return RenderResource{ v };
+}
+
+RenderResource RenderGraph::PassBuilder::read(RenderResource resource)
+{
+	assert(resource.id < graph.versions.size());
+	graph.versions[resource.id].readers.push_back(pass);
+	graph.passes[pass].reads.push_back(resource.id);
+	return resource;
+}
+
+RenderResource RenderGraph::PassBuilder::write(RenderResource resource)
+{
+	assert(resource.id < graph.versions.size());
+	unsigned res = graph.versions[resource.id].resource;
+	// a version is written once: the writes of a resource form a chain
+	assert(graph.resources[res].lastVersion == resource.id);
+	unsigned v = graph.addVersion(res, pass, resource.id);
+	graph.passes[pass].writes.push_back(v);
+	return RenderResource{ v };
+}
+
+void RenderGraph::PassBuilder::setSideEffects()
+{
+	graph.passes[pass].sideEffects = true;
+}
+
+RenderGraph::~RenderGraph()
+{
+	auto &device = getGraphicsDevice();
+	for (auto &fb : framebuffers)
+		device.deleteFramebuffer(fb.fbo);
+	for (auto &tex : pool)
+		device.deleteTexture(tex.texture);
+}
+
+void RenderGraph::reset()
+{
+	resources.clear();
+	versions.clear();
+	passes.clear();
+	order.clear();
+	textureDescs.clear();
+	textures.clear();
+	memoryStats = MemoryStats();
+	compiled = false;
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const char *name, ExecuteFn execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = std::move(execute);
+	passes.push_back(std::move(pass));
+	compiled = false;
+	return PassBuilder(*this, static_cast<unsigned>(passes.size() - 1));
+}
+
+RenderResource RenderGraph::importTexture(const char *name, const RenderTargetDesc &desc, GLuint texture)
+{
+	Resource res;
+	res.name = name;
+	res.desc = desc;
+	res.imported = true;
+	res.texture = texture;
+	resources.push_back(res);
+	return RenderResource{ addVersion(static_cast<unsigned>(resources.size() - 1), -1, -1) };
+}
+
+unsigned RenderGraph::addVersion(unsigned resource, int writer, int previous)
+{
+	Version v;
+	v.resource = resource;
+	v.writer = writer;
+	v.previous = previous;
+	versions.push_back(std::move(v));
+	unsigned id = static_cast<unsigned>(versions.size() - 1);
+	resources[resource].lastVersion = id;
+	compiled = false;
+	return id;
+}
+
+//---------------------------
+// compilation
+bool RenderGraph::compile()
+{
+	order.clear();
+	compiled = false;
+
+	// culling: walk back from the passes with visible results
+	std::vector<unsigned> stack;
+	for (unsigned i = 0; i < passes.size(); ++i) {
+		auto &pass = passes[i];
+		pass.culled = true;
+		bool root = pass.sideEffects;
+		for (auto v : pass.writes)
+			root |= resources[versions[v].resource].imported;
+		if (root)
+			stack.push_back(i);
+	}
+	for (auto i : stack)
+		passes[i].culled = false;
+	while (!stack.empty()) {
+		unsigned i = stack.back();
+		stack.pop_back();
+		auto mark = [&](unsigned v) {
+			int writer = versions[v].writer;
+			if (writer >= 0 && passes[writer].culled) {
+				passes[writer].culled = false;
+				stack.push_back(writer);
+			}
+		};
+		for (auto v : passes[i].reads)
+			mark(v);
+		// the previous content of a written resource is kept
+		for (auto v : passes[i].writes)
+			if (versions[v].previous >= 0)
+				mark(versions[v].previous);
+	}
+
+	for (auto &pass : passes) {
+		if (pass.culled)
+			continue;
+		bool backbuffer = false;
+		for (auto v : pass.writes) {
+			auto &res = resources[versions[v].resource];
+			backbuffer |= res.imported && res.texture == 0;
+		}
+		if (backbuffer && pass.writes.size() > 1) {
+			ERROR << "Render pass " << pass.name << " writes the default framebuffer and other render targets";
+			return false;
+		}
+	}
+
+	if (!sortPasses())
+		return false;
+	planTextures();
+	compiled = true;
+	return true;
+}
+
+bool RenderGraph::sortPasses()
+{
+	// edges: the writer of a version runs before its readers, and before the
+	// pass that writes the next version, which also runs after the readers
+	unsigned numPasses = static_cast<unsigned>(passes.size());
+	std::vector<std::vector<unsigned> > successors(numPasses);
+	std::vector<unsigned> numPredecessors(numPasses, 0);
+	auto addEdge = [&](int from, unsigned to) {
+		if (from < 0 || static_cast<unsigned>(from) == to || passes[from].culled)
+			return;
+		successors[from].push_back(to);
+		++numPredecessors[to];
+	};
+	for (unsigned i = 0; i < numPasses; ++i) {
+		if (passes[i].culled)
+			continue;
+		for (auto v : passes[i].reads)
+			addEdge(versions[v].writer, i);
+		for (auto v : passes[i].writes) {
+			int prev = versions[v].previous;
+			if (prev < 0)
+				continue;
+			addEdge(versions[prev].writer, i);
+			for (auto reader : versions[prev].readers)
+				addEdge(reader, i);
+		}
+	}
+
+	// Kahn's algorithm, the ready pass declared first goes first
+	std::vector<unsigned> ready;
+	unsigned numAlive = 0;
+	for (unsigned i = 0; i < numPasses; ++i) {
+		if (passes[i].culled)
+			continue;
+		++numAlive;
+		if (!numPredecessors[i])
+			ready.push_back(i);
+	}
+	while (!ready.empty()) {
+		auto it = std::min_element(ready.begin(), ready.end());
+		unsigned i = *it;
+		ready.erase(it);
+		order.push_back(i);
+		for (auto next : successors[i])
+			if (!--numPredecessors[next])
+				ready.push_back(next);
+	}
+	if (order.size() != numAlive) {
+		ERROR << "Render graph has a dependency cycle";
+		order.clear();
+		return false;
+	}
+	return true;
+}
+
+void RenderGraph::planTextures()
+{
+	textureDescs.clear();
+	memoryStats = MemoryStats();
+
+	// lifetimes, as positions in the pass order
+	for (auto &res : resources) {
+		res.firstUse = -1;
+		res.lastUse = -1;
+		res.textureIndex = -1;
+	}
+	auto use = [&](unsigned v, int pos) {
+		auto &res = resources[versions[v].resource];
+		if (res.firstUse < 0)
+			res.firstUse = pos;
+		res.lastUse = pos;
+	};
+	for (int pos = 0; pos < static_cast<int>(order.size()); ++pos) {
+		auto &pass = passes[order[pos]];
+		for (auto v : pass.reads)
+			use(v, pos);
+		for (auto v : pass.writes)
+			use(v, pos);
+	}
+
+	std::vector<unsigned> transients;
+	for (unsigned i = 0; i < resources.size(); ++i)
+		if (!resources[i].imported && resources[i].firstUse >= 0)
+			transients.push_back(i);
+	std::stable_sort(transients.begin(), transients.end(), [&](unsigned a, unsigned b) {
+		return resources[a].firstUse < resources[b].firstUse;
+	});
+
+	// greedy interval assignment: a resource takes the texture of the same
+	// size and format that was released first (GL cannot place textures of
+	// different formats in the same memory)
+	std::vector<int> textureLastUse;
+	for (auto i : transients) {
+		auto &res = resources[i];
+		int best = -1;
+		for (unsigned t = 0; t < textureDescs.size(); ++t) {
+			if (!(textureDescs[t] == res.desc) || textureLastUse[t] >= res.firstUse)
+				continue;
+			if (best < 0 || textureLastUse[t] < textureLastUse[best])
+				best = static_cast<int>(t);
+		}
+		if (best < 0) {
+			best = static_cast<int>(textureDescs.size());
+			textureDescs.push_back(res.desc);
+			textureLastUse.push_back(-1);
+			memoryStats.allocatedBytes += getRenderTargetMemorySize(res.desc);
+		}
+		textureLastUse[best] = res.lastUse;
+		res.textureIndex = best;
+		memoryStats.unaliasedBytes += getRenderTargetMemorySize(res.desc);
+	}
+	memoryStats.numTransientResources = static_cast<unsigned>(transients.size());
+	memoryStats.numTextures = static_cast<unsigned>(textureDescs.size());
+
+	for (int pos = 0; pos < static_cast<int>(order.size()); ++pos) {
+		size_t live = 0;
+		for (auto i : transients)
+			if (resources[i].firstUse <= pos && pos <= resources[i].lastUse)
+				live += getRenderTargetMemorySize(resources[i].desc);
+		memoryStats.peakLiveBytes = std::max(memoryStats.peakLiveBytes, live);
+	}
+}
+
+int RenderGraph::getTextureIndex(RenderResource resource) const
+{
+	assert(resource.id < versions.size());
+	return resources[versions[resource.id].resource].textureIndex;
+}
+
+//---------------------------
+// execution
+void RenderGraph::execute()
+{
+	assert(compiled);
+	acquireTextures();
+
+	auto &device = getGraphicsDevice();
+	for (auto i : order) {
+		auto &pass = passes[i];
+		PROFILE_GPU_SCOPE(pass.name);
+		bindRenderTargets(pass);
+		currentPass = &pass;
+		pass.execute(*this);
+		currentPass = nullptr;
+	}
+	device.bindFramebuffer(0);
+}
+
+void RenderGraph::acquireTextures()
+{
+	for (auto &tex : pool)
+		tex.claimed = false;
+	textures.assign(textureDescs.size(), 0);
+	for (unsigned t = 0; t < textureDescs.size(); ++t) {
+		for (auto &tex : pool) {
+			if (!tex.claimed && tex.desc == textureDescs[t]) {
+				tex.claimed = true;
+				textures[t] = tex.texture;
+				break;
+			}
+		}
+		if (textures[t])
+			continue;
+		auto &desc = textureDescs[t];
+		PooledTexture tex;
+		tex.desc = desc;
+		tex.texture = getGraphicsDevice().createTexture(gl::TEXTURE_2D, 1, getElementFormatInfoGL(desc.format).internalFormat, desc.size.x, desc.size.y);
+		tex.unusedFrames = 0;
+		tex.claimed = true;
+		pool.push_back(tex);
+		textures[t] = tex.texture;
+	}
+
+	// retire the textures not used for a few frames (e.g. after a resize)
+	for (unsigned i = 0; i < pool.size();) {
+		auto &tex = pool[i];
+		if (tex.claimed)
+			tex.unusedFrames = 0;
+		else if (++tex.unusedFrames > kPoolRetireFrames) {
+			releaseTexture(tex.texture);
+			pool.erase(pool.begin() + i);
+			continue;
+		}
+		++i;
+	}
+}
+
+void RenderGraph::releaseTexture(GLuint texture)
+{
+	auto &device = getGraphicsDevice();
+	for (unsigned i = 0; i < framebuffers.size();) {
+		auto &fb = framebuffers[i];
+		if (fb.depth == texture || std::find(fb.colors.begin(), fb.colors.end(), texture) != fb.colors.end()) {
+			device.deleteFramebuffer(fb.fbo);
+			framebuffers.erase(framebuffers.begin() + i);
+			continue;
+		}
+		++i;
+	}
+	device.deleteTexture(texture);
+}
+
+void RenderGraph::bindRenderTargets(const Pass &pass)
+{
+	if (pass.writes.empty())
+		return;
+	auto &device = getGraphicsDevice();
+	std::vector<GLuint> colors;
+	GLuint depth = 0;
+	glm::ivec2 size;
+	for (auto v : pass.writes) {
+		auto &res = resources[versions[v].resource];
+		size = res.desc.size;
+		if (res.imported && !res.texture) {
+			device.bindFramebuffer(0);
+			device.viewport(0, 0, size.x, size.y);
+			return;
+		}
+		GLuint tex = res.imported ? res.texture : textures[res.textureIndex];
+		if (isDepthFormat(res.desc.format))
+			depth = tex;
+		else
+			colors.push_back(tex);
+	}
+
+	auto it = std::find_if(framebuffers.begin(), framebuffers.end(), [&](const Framebuffer &fb) {
+		return fb.depth == depth && fb.colors == colors;
+	});
+	if (it == framebuffers.end()) {
+		Framebuffer fb;
+		fb.fbo = device.createFramebuffer(colors, depth);
+		fb.colors = std::move(colors);
+		fb.depth = depth;
+		framebuffers.push_back(std::move(fb));
+		it = framebuffers.end() - 1;
+	}
+	device.bindFramebuffer(it->fbo);
+	device.viewport(0, 0, size.x, size.y);
+}
+
+bool RenderGraph::usesResource(const Pass &pass, unsigned resource) const
+{
+	for (auto v : pass.reads)
+		if (versions[v].resource == resource)
+			return true;
+	for (auto v : pass.writes)
+		if (versions[v].resource == resource)
+			return true;
+	return false;
+}
+
+GLuint RenderGraph::getTexture(RenderResource resource) const
+{
+	assert(resource.id < versions.size());
+	unsigned i = versions[resource.id].resource;
+	assert(currentPass && usesResource(*currentPass, i));
+	auto &res = resources[i];
+	return res.imported ? res.texture : textures[res.textureIndex];
+}
+
+const RenderTargetDesc &RenderGraph::getDesc(RenderResource resource) const
+{
+	assert(resource.id < versions.size());
+	return resources[versions[resource.id].resource].desc;
+}
@@ -0,0 +1,127 @@
+#include <rendering/render_queue.hpp>
+#include <cassert>
+#include <algorithm>
+
+namespace
+{
+	const unsigned kShaderBits = 12;
+	const unsigned kMaterialBits = 16;
+	const unsigned kMeshBits = 16;
+	const unsigned kLodBits = 2;
+	const unsigned kDepthBits = 14;
+	static_assert(kMaxMeshLods <= (1u << kLodBits), "not enough bits for the levels of detail");
+
+	unsigned sNextShaderSortId = 1;
+	unsigned sNextMaterialSortId = 1;
+	unsigned sNextMeshSortId = 1;
+
+	// sort ids are dense and assigned on first use, so that they fit in the key
+	// (they wrap around with more than 2^bits objects: the order is only an optimization)
+	uint64_t getSortId(unsigned &sortId, unsigned &nextSortId, unsigned bits)
+	{
+		if (!sortId)
+			sortId = nextSortId++;
+		return sortId & ((1u << bits) - 1);
+	}
+
+	uint64_t composeKey(RenderQueue::Pass pass, uint64_t shaderId, uint64_t materialId, uint64_t meshId, uint64_t lod, float normalizedDepth)
+	{
+		auto depth = static_cast<uint64_t>(glm::clamp(normalizedDepth, 0.0f, 1.0f) * ((1u << kDepthBits) - 1));
+		if (pass == RenderQueue::Pass::Transparent)
+			// back to front
+			depth = ((1u << kDepthBits) - 1) - depth;
+		return (static_cast<uint64_t>(pass) << (kShaderBits + kMaterialBits + kMeshBits + kLodBits + kDepthBits))
+			| (shaderId << (kMaterialBits + kMeshBits + kLodBits + kDepthBits))
+			| (materialId << (kMeshBits + kLodBits + kDepthBits))
+			| (meshId << (kLodBits + kDepthBits))
+			| (lod << kDepthBits)
+			| depth;
+	}
+}
+
+uint64_t RenderQueue::makeSortKey(
+	Pass pass,
+	Shader &shader,
+	Material &material,
+	Mesh &mesh,
+	unsigned lod,
+	float normalizedDepth)
+{
+	auto shaderId = getSortId(shader.sortId, sNextShaderSortId, kShaderBits);
+	auto materialId = getSortId(material.sortId, sNextMaterialSortId, kMaterialBits);
+	auto meshId = getSortId(mesh.sortId, sNextMeshSortId, kMeshBits);
+	return composeKey(pass, shaderId, materialId, meshId, lod, normalizedDepth);
+}
+
+bool RenderQueue::tryMakeSortKey(
+	Pass pass,
+	const Shader &shader,
+	const Material &material,
+	const Mesh &mesh,
+	unsigned lod,
+	float normalizedDepth,
+	uint64_t &sortKey)
+{
+	if (!shader.sortId || !material.sortId || !mesh.sortId)
+		return false;
+	sortKey = composeKey(pass,
+		shader.sortId & ((1u << kShaderBits) - 1),
+		material.sortId & ((1u << kMaterialBits) - 1),
+		mesh.sortId & ((1u << kMeshBits) - 1),
+		lod,
+		normalizedDepth);
+	return true;
+}
+
+void RenderQueue::clear()
+{
+	items.clear();
+	entries.clear();
+}
+
+void RenderQueue::push(uint64_t sortKey, const DrawItem &item)
+{
+	entries.push_back(Entry{ sortKey, static_cast<unsigned>(items.size()) });
+	items.push_back(item);
+}
+
+void RenderQueue::reserve(size_t count)
+{
+	entries.reserve(count);
+	items.reserve(count);
+}
+
+void RenderQueue::sort()
+{
+	// LSD radix sort, 8 bits per pass
+	// all histograms are built in a single pass over the keys
+	const auto n = entries.size();
+	if (n < 2)
+		return;
+	unsigned counts[8][256] = {};
+	for (const auto &e : entries)
+		for (auto d = 0u; d < 8; ++d)
+			counts[d][(e.key >> (d * 8)) & 0xFF]++;
+
+	tmp_entries.resize(n);
+	auto src = &entries;
+	auto dst = &tmp_entries;
+	for (auto d = 0u; d < 8; ++d)
+	{
+		// skip digits that are the same for all keys (most of them with few objects)
+		auto first_digit = ((*src)[0].key >> (d * 8)) & 0xFF;
+		if (counts[d][first_digit] == n)
+			continue;
+		unsigned offsets[256];
+		unsigned sum = 0;
+		for (auto i = 0u; i < 256; ++i) {
+			offsets[i] = sum;
+			sum += counts[d][i];
+		}
+		for (const auto &e : *src)
+			(*dst)[offsets[(e.key >> (d * 8)) & 0xFF]++] = e;
+		std::swap(src, dst);
+	}
+	if (src != &entries)
+		entries.swap(tmp_entries);
+}
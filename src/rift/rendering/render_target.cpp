@@ -54,57 +54,19 @@ RenderTarget::Ptr RenderTarget::createNoDepth(
 
 void RenderTarget::init()
 {
-	gl::GenFramebuffers(1, &fbo);
-	gl::BindFramebuffer(gl::FRAMEBUFFER, fbo);
-
+	GLuint colorIds[kMaxColorRenderTargets];
 	for (int i = 0; i < color_targets.size(); ++i)
-	{
-		auto &&target = color_targets[i];
-		gl::FramebufferTexture(
-			gl::FRAMEBUFFER,
-			gl::COLOR_ATTACHMENT0 + i,
-			target->id,
-			0);
-	}
-	gl::FramebufferTexture(
-		gl::FRAMEBUFFER,
-		gl::DEPTH_ATTACHMENT,
-		depth_target->id,
-		0);
-
-	// check fb completeness
-	// enable draw buffers
-	static const GLenum drawBuffers[8] = {
-		gl::COLOR_ATTACHMENT0,
-		gl::COLOR_ATTACHMENT0 + 1,
-		gl::COLOR_ATTACHMENT0 + 2,
-		gl::COLOR_ATTACHMENT0 + 3,
-		gl::COLOR_ATTACHMENT0 + 4,
-		gl::COLOR_ATTACHMENT0 + 5,
-		gl::COLOR_ATTACHMENT0 + 6,
-		gl::COLOR_ATTACHMENT0 + 7
-	};
-
-	gl::DrawBuffers(color_targets.size(), drawBuffers);
-
-	GLenum err;
-	err = gl::CheckFramebufferStatus(gl::FRAMEBUFFER);
-	assert(err == gl::FRAMEBUFFER_COMPLETE);
+		colorIds[i] = color_targets[i]->id;
+	fbo = getGraphicsDevice().createFramebuffer(
+		util::array_ref<GLuint>(colorIds, color_targets.size()),
+		depth_target ? depth_target->id : 0);
 }
 
 // create two textures (color + depth), create a new FBO and bind the textures as attachements to the FBO
 void createRenderTarget(ElementFormat colorFormat, ElementFormat depthFormat, unsigned width, unsigned height, GLuint &colorTex, GLuint &depthTex, GLuint &fbo)
 {
-	gl::GenFramebuffers(1, &fbo);
-	gl::BindFramebuffer(gl::FRAMEBUFFER, fbo);
 	checkForUnusualColorFormats(colorFormat);
 	colorTex = createTexture2D(colorFormat, 1, width, height, nullptr);
 	depthTex = createTexture2D(depthFormat, 1, width, height, nullptr);
-	gl::FramebufferTexture(gl::FRAMEBUFFER, gl::COLOR_ATTACHMENT0, colorTex, 0);
-	gl::FramebufferTexture(gl::FRAMEBUFFER, gl::DEPTH_ATTACHMENT, depthTex, 0);
-	GLenum drawbuf[] = { gl::COLOR_ATTACHMENT0 };
-	gl::DrawBuffers(1, drawbuf);
-	GLenum err;
-	err = gl::CheckFramebufferStatus(gl::FRAMEBUFFER);
-	assert(err == gl::FRAMEBUFFER_COMPLETE);
+	fbo = getGraphicsDevice().createFramebuffer({ colorTex }, depthTex);
 }
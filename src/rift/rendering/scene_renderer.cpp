@@ -1,20 +1,84 @@
 #include <rendering/scene_renderer.hpp>
 #include <rendering/opengl4.hpp>
-#include <rendering/nanovg/nanovg.h>
-#define NANOVG_GL3_IMPLEMENTATION
-#include <rendering/nanovg/nanovg_gl.h>
 #include <image.hpp>
 #include <log.hpp>
+#include <profiler.hpp>
+#include <utils/thread_pool.hpp>
+#include <glm/gtc/matrix_inverse.hpp>
 
 
 namespace
 {
-	struct PerObject
+	// per-draw data (std430 layout, see instance.glsl)
+	struct InstanceData
 	{
-		glm::mat4 modelToWorld;
+		glm::mat4 modelMatrix;
+		glm::mat4 normalMatrix;
+	};
+
+	// instances per job when filling the instance data
+	const unsigned kInstanceDataGrain = 1024;
+
+	// material shader variants of the passes
+	const ShaderVariant kShadowPass({ { "SHADOW_PASS", "" } });
+	const ShaderVariant kForwardPointLight({ { "POINT_LIGHT", "" } });
+	const ShaderVariant kForwardDirectionalLight({ { "DIRECTIONAL_LIGHT", "" } });
+	const ShaderVariant kForwardSpotLight({ { "SPOT_LIGHT", "" } });
+	const ShaderVariant kForwardClustered({ { "CLUSTERED_LIGHTING", "" } });
+
+	// transforms of the draws of a queue, in queue order
+	void writeInstanceTransforms(util::thread_pool &pool, const RenderQueue &queue, InstanceData *instances)
+	{
+		pool.parallel_for(static_cast<unsigned>(queue.size()), kInstanceDataGrain, [&](unsigned begin, unsigned end) {
+			for (auto i = begin; i < end; ++i) {
+				auto &modelToWorld = *queue[i].modelToWorld;
+				instances[i].modelMatrix = modelToWorld;
+				instances[i].normalMatrix = glm::mat4(glm::inverseTranspose(glm::mat3(modelToWorld)));
+			}
+		});
+	}
+
+	// cascaded shadow map parameters (see ShadowData in scene.glsl)
+	struct ShadowData
+	{
+		glm::mat4 matrices[kMaxShadowCascades];
+		glm::vec4 splits;
+		glm::vec4 texelSizes;
+		glm::vec4 params;	// number of cascades, normal offset, depth bias, atlas size
 	};
+	static_assert(kMaxShadowCascades == 4, "ShadowData holds 4 cascades");
+
+	// clustered lighting (see ClusterParams, LightData in scene.glsl)
+	struct ClusterParams
+	{
+		glm::uvec4 gridSize;	// tiles x, tiles y, slices, number of directional lights
+		glm::vec4 sliceParams;	// slice scale, slice bias
+	};
+
+	struct GPULight
+	{
+		glm::vec4 position;	// w: range
+		glm::vec4 intensity;	// w: type
+		glm::vec4 direction;	// w: cos(spot angle)
+	};
+
+	// directional lights shine along the -Y axis of their frame
+	glm::vec3 getDirectionTowardsLight(const glm::mat4 &transform)
+	{
+		return glm::normalize(glm::vec3(transform[1]));
+	}
 
-	Buffer *createSceneViewUBO(GraphicsContext &gc, const SceneView &sv)
+	int getGPULightType(LightMode mode)
+	{
+		switch (mode) {
+		case LightMode::Directional: return 0;
+		case LightMode::Point: return 1;
+		case LightMode::Spot: return 2;
+		}
+		return 0;
+	}
+
+	BufferSlice createSceneViewUBO(GraphicsContext &gc, const SceneView &sv)
 	{
 		return gc.createTransientBuffer<SceneView>(gl::UNIFORM_BUFFER, sv);
 	}
@@ -27,17 +91,8 @@ namespace
 			float center[4]; 
 			float direction[4];
 		} u;
-	};
-
-	struct ImmediateModeParams
-	{
-		glm::mat4 viewMatrix;
-		glm::mat4 projMatrix;
-		glm::mat4 viewProjMatrix;
-		glm::mat4 modelMatrix;
-		glm::vec4 wEye;	// in world space
-		glm::vec4 lineColor;
-		glm::vec2 viewportSize;
+		// spot lights: cone axis, cos(cone angle)
+		glm::vec4 spotAxis;
 	};
 
 	struct PostprocParams
@@ -45,15 +100,10 @@ namespace
 		glm::vec2 viewportSize;
 	};
 	
-	GLuint loadProgram(const char *combinedSourcePath)
+	GLuint loadProgram(GraphicsContext &gc, const char *combinedSourcePath)
 	{
 		auto src = loadShaderSource(combinedSourcePath);
-		auto vs = compileShader(src.c_str(), "", gl::VERTEX_SHADER, {});
-		auto ps = compileShader(src.c_str(), "", gl::FRAGMENT_SHADER, {});
-		auto prog = compileProgram(vs, 0, ps);
-		gl::DeleteShader(vs);
-		gl::DeleteShader(ps);
-		return prog;
+		return compileProgram(gc, src.c_str(), combinedSourcePath, src.c_str(), combinedSourcePath, {});
 	}
 }
 
@@ -63,7 +113,7 @@ SceneRenderer::SceneRenderer(glm::ivec2 viewportSize_, GraphicsContext &gc, Asse
 	graphicsContext(gc)
 {
 	// dummy VAO (need it for things)
-	gl::GenVertexArrays(1, &dummy_vao);
+	dummy_vao = getGraphicsDevice().createVertexArray({}, {});
 
 	// default material
 	defaultMaterial = std::make_unique<Material>();
@@ -75,37 +125,35 @@ SceneRenderer::SceneRenderer(glm::ivec2 viewportSize_, GraphicsContext &gc, Asse
 	// default font
 	defaultFont = Font::loadFromFile("resources/img/fonts/debug.fnt");
 
-	// init nanovg context
-	nvgContext = nvgCreateGL3(NVG_ANTIALIAS);
+	// nanovg context, drawn with the transient buffers of the graphics context
+	nanovgRenderer = std::make_unique<NanoVGRenderer>(gc, NVG_ANTIALIAS);
+	nvgContext = nanovgRenderer->getContext();
 
 	// text 
-	textVao.create(1, { Attribute{ ElementFormat::Float4 } });
-	textProgram = loadProgram("resources/shaders/text.glsl");
+	textProgram = loadProgram(gc, "resources/shaders/text.glsl");
 
 	// Meshes
-	meshVao.create(1, { 
+	// slot 1: per-instance index in the instance data buffer
+	meshVao.create(2, { 
 		{ ElementFormat::Float3, 0 },
 		{ ElementFormat::Snorm10x3_1x2, 0 },
 		{ ElementFormat::Snorm10x3_1x2, 0 },
 		{ ElementFormat::Unorm16x2, 0 },
-	});
+		{ ElementFormat::Uint32, 1 },
+	}, { 0, 1 });
 
 	// terrain setup
 	terrainVao.create(1, { { ElementFormat::Float2, 0 } });
-	terrainProgram = loadProgram("resources/shaders/terrain.glsl");
+	terrainProgram = loadProgram(gc, "resources/shaders/terrain.glsl");
 
-	// immediate mode rendering
-	immediateProgram = loadProgram("resources/shaders/immediate.glsl");
-	immediateVao.create(1, { Attribute{ ElementFormat::Float3 } });	// pos only
+	// debug lines and wire meshes
+	debugDrawProgram = loadProgram(gc, "resources/shaders/debug_draw.glsl");
 
 	// setup opengl debug extension
-	setDebugCallback();
-
-	// create a render target 
-	createRenderTarget(ElementFormat::Float16x4, ElementFormat::Depth32, viewportSize.x, viewportSize.y, rt0_color, rt0_depth, rt0_fb);
+	getGraphicsDevice().installDebugCallback();
 
 	// load postproc shader
-	postprocProgram = loadProgram("resources/shaders/postproc_passthrough.glsl");
+	postprocProgram = loadProgram(gc, "resources/shaders/passthrough.glsl");
 
 }
 
@@ -115,56 +163,6 @@ void SceneRenderer::setSceneCamera(const Camera &camera_)
 	camera = camera_;
 }
 
-void SceneRenderer::drawWireMesh(
-	const Transform &transform,
-	GLenum mode,
-	Buffer *vertices,
-	unsigned nbvertices,
-	Buffer *indices,
-	unsigned nbindices,
-	const glm::vec4 lineColor,
-	bool noDepthTest)
-{
-	// wireframe mode
-	gl::PolygonMode(gl::FRONT_AND_BACK, gl::LINE);
-	// setup depth testing
-	if (noDepthTest)
-		gl::Disable(gl::DEPTH_TEST);
-	else
-		gl::Enable(gl::DEPTH_TEST);
-
-	// allocate buffer for uniforms
-	ImmediateModeParams params;
-	params.wEye = glm::vec4(camera.wEye, 1.0f);
-	params.projMatrix = camera.projMat;
-	params.viewMatrix = camera.viewMat;
-	params.viewProjMatrix = camera.projMat * camera.viewMat;
-	params.viewportSize = viewportSize;
-	params.lineColor = lineColor;
-	params.modelMatrix = transform.toMatrix();
-	auto params_buf = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, params);
-
-	// setup shader
-	gl::UseProgram(immediateProgram);
-	// setup buffers
-	bindVertexBuffers({ vertices }, immediateVao);
-	bindBuffersRangeHelper(0, { params_buf });
-	if (indices) {
-		gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, indices->obj);
-		gl::DrawElements(
-			mode,
-			nbindices,
-			gl::UNSIGNED_SHORT,
-			reinterpret_cast<void*>(indices->offset));
-	}
-	else
-		gl::DrawArrays(mode, 0, nbvertices);
-
-	// reset fill mode & depth test
-	gl::PolygonMode(gl::FRONT_AND_BACK, gl::FILL);
-	gl::Enable(gl::DEPTH_TEST);
-}
-
 void SceneRenderer::drawWireMesh(
 	const Transform &transform, 
 	GLenum mode,
@@ -173,21 +171,24 @@ void SceneRenderer::drawWireMesh(
 	const glm::vec4 lineColor, 
 	bool noDepthTest)
 {
-	// allocate buffer for geometry
-	auto geom_buf = graphicsContext.createTransientBuffer(gl::ARRAY_BUFFER, vertices.size() * 3 * sizeof(float), vertices.data());
-	// allocate buffer for indices if needed
-	Buffer *index_buf = nullptr;
-	auto nbindex = indices.size();
-	if (nbindex)
-		index_buf = graphicsContext.createTransientBuffer(gl::ELEMENT_ARRAY_BUFFER, nbindex * 2, indices.data());
-	drawWireMesh(transform, mode, geom_buf, vertices.size(), index_buf, indices.size(), lineColor, noDepthTest);
+	debugDraw.drawMesh(transform.toMatrix(), mode, vertices, indices, lineColor,
+		noDepthTest ? DebugDepthMode::NoTest : DebugDepthMode::Test);
 }
 
 void SceneRenderer::renderScene(Scene &scene, float dt)
 {
+	PROFILE_SCOPE("renderScene");
 	if (scene.lightNodes.empty())
 		WARNING << "no lights!";
 	scene.lastFrameTimes[scene.lastFrameIndex] = dt;
+	lastFrameStats = SceneRenderStats();
+
+	// world matrices of the entities that moved (no-op if already up to date)
+	auto &threadPool = util::get_thread_pool();
+	{
+		PROFILE_SCOPE("updateTransforms");
+		scene.transforms.update(&threadPool);
+	}
 
 	// update scene data buffer
 	SceneView sceneView;
@@ -197,50 +198,300 @@ void SceneRenderer::renderScene(Scene &scene, float dt)
 	sceneView.viewMatrix = camera.viewMat;
 	sceneView.viewProjMatrix = camera.projMat * camera.viewMat;
 	sceneView.viewportSize = viewportSize;
+	// the occluders are rasterized on the culler thread until getBuffer()
+	if (occlusionCulling)
+		occlusionCuller.beginFrame(scene, sceneView.viewProjMatrix);
 
+	// meanwhile, what does not depend on the visibility of the view
 	ForwardPass pass;
 	pass.sceneView = &sceneView;
 	pass.sceneViewUBO = createSceneViewUBO(graphicsContext, sceneView);
+	// shadow casters (with the levels of detail of the last frame)
+	bool shadowMaps = prepareShadowMaps(scene, pass);
+	if (lightingMode == LightingMode::Clustered)
+		prepareClusteredLights(scene, pass);
+
+	// visible draws are recorded by the worker threads, then sorted and
+	// submitted on this thread
+	{
+		PROFILE_SCOPE("recordDrawLists");
+		LodSelector lodSelector(camera.wEye, camera.projMat, float(viewportSize.y), lodParams);
+		drawLists.record(scene, *defaultMaterial, sceneView.viewProjMatrix, &threadPool,
+			occlusionCulling ? &occlusionCuller.getBuffer() : nullptr,
+			&lodSelector);
+	}
+	{
+		PROFILE_SCOPE("sortRenderQueue");
+		renderQueue.clear();
+		drawLists.merge(renderQueue);
+		renderQueue.sort();
+	}
+
+	// passes of the frame: the scene is drawn in a floating-point target,
+	// copied to the default framebuffer by the post-processing pass
+	renderGraph.reset();
+	auto backbuffer = renderGraph.importTexture("backbuffer", RenderTargetDesc{ viewportSize, ElementFormat::Unorm8x4 }, 0);
+	RenderResource shadowAtlas;
+	if (shadowMaps) {
+		auto builder = renderGraph.addPass("shadowMaps", [this](RenderGraph &) {
+			drawShadowMaps();
+		});
+		auto size = static_cast<int>(kShadowAtlasTiles * shadowParams.resolution);
+		shadowAtlas = builder.create("shadowAtlas", RenderTargetDesc{ glm::ivec2(size), ElementFormat::Depth32F });
+	}
+
+	RenderResource sceneColor;
+	RenderResource sceneDepth;
+	{
+		auto builder = renderGraph.addPass("forwardPass", [&](RenderGraph &graph) {
+			auto &device = getGraphicsDevice();
+			// stencil test
+			device.setEnabled(gl::STENCIL_TEST, false);
+			device.setEnabled(gl::CULL_FACE, true);
+			device.cullFace(gl::BACK);
+			device.polygonMode(gl::FILL);
+			device.setEnabled(gl::DEPTH_TEST, true);
+			device.depthFunc(gl::LEQUAL);
+			device.depthMask(true);
+			// alpha blending ON
+			device.setEnabled(gl::BLEND, true);
+			device.blendEquation(0, gl::FUNC_ADD, gl::FUNC_ADD);
+			device.blendFunc(0, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+			device.clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT, glm::vec4(0.1f, 0.1f, 0.1f, 1.0f), 1.0f);
+
+			// the atlas stays bound to unit 4 for the forward passes (materials use 0 and 1)
+			if (shadowAtlas.valid()) {
+				GLuint atlas = graph.getTexture(shadowAtlas);
+				GLuint sampler = graphicsContext.getSamplerNearestClamp();
+				device.bindTextures(4, 1, &atlas);
+				device.bindSamplers(4, 1, &sampler);
+			}
+
+			// render terrain
+			if (scene.terrain) {
+				PROFILE_GPU_SCOPE("terrain");
+				drawTerrain(pass, *scene.terrain);
+			}
+
+			// per-draw data for the whole frame, in queue order (draw i uses base instance i)
+			auto numDraws = static_cast<unsigned>(renderQueue.size());
+			if (numDraws) {
+				PROFILE_SCOPE("instanceData");
+				auto instanceBuf = graphicsContext.createTransientBuffer(gl::SHADER_STORAGE_BUFFER, numDraws * sizeof(InstanceData));
+				auto instances = static_cast<InstanceData*>(instanceBuf.ptr);
+				writeInstanceTransforms(threadPool, renderQueue, instances);
+				bindBuffersRangeHelper(gl::SHADER_STORAGE_BUFFER, 0, { instanceBuf });
+				updateInstanceIndexBuffer(numDraws);
+			}
+
+			// indirect commands, shared by all the passes of the frame
+			indirectBuffer = BufferSlice();
+			if (multiDrawIndirect && graphicsContext.getMeshMegabuffer()) {
+				PROFILE_SCOPE("indirectDraws");
+				indirectDraws.build(renderQueue, instancingThreshold);
+				indirectBuffer = indirectDraws.upload(graphicsContext);
+			}
+
+			if (lightingMode == LightingMode::Clustered)
+				drawForwardPassClustered(scene, pass);
+			else
+				drawForwardPassPerLight(scene, pass);
+			lastFrameStats.numProgramChanges = pass.numProgramChanges;
+			lastFrameStats.numMaterialChanges = pass.numMaterialChanges;
+			lastFrameStats.numVertexBufferChanges = pass.numVertexBufferChanges;
+			lastFrameStats.numDrawCalls = pass.numDrawCalls;
+			lastFrameStats.numInstancedDrawCalls = pass.numInstancedDrawCalls;
+			lastFrameStats.numInstances = pass.numInstances;
+			lastFrameStats.numMultiDrawCommands = pass.numMultiDrawCommands;
+			showRenderStats(pass);
+		});
+		sceneColor = builder.create("sceneColor", RenderTargetDesc{ viewportSize, ElementFormat::Float16x4 });
+		sceneDepth = builder.create("sceneDepth", RenderTargetDesc{ viewportSize, ElementFormat::Depth32 });
+		if (shadowAtlas.valid())
+			builder.read(shadowAtlas);
+	}
+
+	// do postproc pass
+	{
+		auto builder = renderGraph.addPass("postproc", [&](RenderGraph &graph) {
+			auto &device = getGraphicsDevice();
+			PostprocParams pp_params{ viewportSize };
+			auto pp_param_buf = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, pp_params);
+			bindBuffersRangeHelper(0, { pp_param_buf });
+			GLuint textures[2] = { graph.getTexture(sceneColor), graph.getTexture(sceneDepth) };
+			GLuint samplers[2] = { graphicsContext.getSamplerNearestClamp(), graphicsContext.getSamplerNearestClamp() };
+			device.bindTextures(0, 2, textures);
+			device.bindSamplers(0, 2, samplers);
+			device.useProgram(postprocProgram);
+			// the scene depth is copied too, for the debug draws made after the frame
+			device.setEnabled(gl::BLEND, false);
+			device.depthFunc(gl::ALWAYS);
+			// HACK: draw a screen-covering triangle without binding a buffer 
+			device.bindVertexArray(dummy_vao);
+			device.drawArrays(gl::TRIANGLES, 0, 3);
+			device.depthFunc(gl::LEQUAL);
+			device.setEnabled(gl::BLEND, true);
+		});
+		builder.read(sceneColor);
+		builder.read(sceneDepth);
+		backbuffer = builder.write(backbuffer);
+	}
+
+	// EXTRAS/DEBUG
+	// debug lines test against the scene depth copied by the postproc pass
+	{
+		auto builder = renderGraph.addPass("debugDraw", [&](RenderGraph &) {
+			debugDraw.flush(graphicsContext, debugDrawProgram, sceneView.viewProjMatrix);
+		});
+		backbuffer = builder.write(backbuffer);
+	}
+	auto &debugStats = debugDraw.getStats();
+	if (debugStats.numDrawCalls || debugStats.numDroppedVertices)
+		Logging::screenMessage("DEBUG   : "
+			+ std::to_string((debugStats.numVertices[0] + debugStats.numVertices[1]) / 2) + " lines ("
+			+ std::to_string(debugStats.numVertices[1] / 2) + " on top), "
+			+ std::to_string(debugStats.numVertices[0] + debugStats.numVertices[1]) + "/"
+			+ std::to_string(debugStats.maxVertices) + " vertices, "
+			+ std::to_string(debugStats.numDroppedVertices) + " dropped, "
+			+ std::to_string(debugStats.numDrawCalls) + " draw calls (last frame)");
+	auto &nvgStats = nanovgRenderer->getStats();
+	Logging::screenMessage("NANOVG  : "
+		+ std::to_string(nvgStats.numCalls) + " paths, "
+		+ std::to_string(nvgStats.numDrawCalls) + " draw calls, "
+		+ std::to_string(nvgStats.numVertices) + " vertices, "
+		+ std::to_string(nvgStats.transientBytes >> 10) + " KB transient (last frame)");
+	{
+		auto builder = renderGraph.addPass("screenMessages", [&](RenderGraph &) {
+			nvgBeginFrame(nvgContext, viewportSize.x, viewportSize.y, 1.0f);
+			drawFrameTimeGraph(scene);
+			nvgEndFrame(nvgContext);
+			drawScreenMessages();
+		});
+		backbuffer = builder.write(backbuffer);
+	}
+
+	if (renderGraph.compile()) {
+		auto &graphStats = renderGraph.getMemoryStats();
+		Logging::screenMessage("GRAPH   : "
+			+ std::to_string(renderGraph.getPassOrder().size()) + "/"
+			+ std::to_string(renderGraph.getNumPasses()) + " passes, "
+			+ std::to_string(graphStats.numTransientResources) + " targets in "
+			+ std::to_string(graphStats.numTextures) + " textures, "
+			+ std::to_string(graphStats.allocatedBytes >> 10) + " KB ("
+			+ std::to_string(graphStats.peakLiveBytes >> 10) + " KB peak, "
+			+ std::to_string(graphStats.unaliasedBytes >> 10) + " KB unaliased)");
+		renderGraph.execute();
+	}
+	lastFrameStats.numQueued = static_cast<unsigned>(renderQueue.size());
+	lastFrameStats.numShadowDrawCalls = numShadowDrawCalls;
+	scene.lastFrameIndex = (scene.lastFrameIndex + 1) % scene.lastFrameTimes.size();
+}
+
+void SceneRenderer::showRenderStats(const ForwardPass &pass)
+{
+	Logging::screenMessage("CULLING : "
+		+ std::to_string(drawLists.getNumVisible()) + "/"
+		+ std::to_string(drawLists.getNumCandidates()) + " visible");
+	if (occlusionCulling)
+		Logging::screenMessage("OCCLUDE : "
+			+ std::to_string(drawLists.getNumOccluded()) + " culled by "
+			+ std::to_string(occlusionCuller.getNumOccluders()) + " occluders ("
+			+ std::to_string(occlusionCuller.getBuffer().getNumTrianglesRasterized()) + " triangles)");
+	auto &lodStats = drawLists.getLodStats();
+	std::string lodMessage = "LOD     :";
+	for (auto lod = 0u; lod < kMaxMeshLods; ++lod)
+		lodMessage += " L" + std::to_string(lod) + " "
+			+ std::to_string(lodStats.numDraws[lod]) + " draws/"
+			+ std::to_string(lodStats.numTriangles[lod]) + " tris"
+			+ (lod + 1 < kMaxMeshLods ? "," : "");
+	Logging::screenMessage(lodMessage);
+	Logging::screenMessage("QUEUE   : "
+		+ std::to_string(renderQueue.size()) + " draws, "
+		+ std::to_string(pass.numProgramChanges) + " program, "
+		+ std::to_string(pass.numMaterialChanges) + " material, "
+		+ std::to_string(pass.numVertexBufferChanges) + " vertex buffer changes");
+	Logging::screenMessage("DRAWS   : "
+		+ std::to_string(pass.numDrawCalls) + " draw calls ("
+		+ std::to_string(pass.numInstancedDrawCalls) + " instanced, "
+		+ std::to_string(pass.numMultiDrawCommands) + " indirect commands), "
+		+ std::to_string(pass.numInstances) + " instances");
+	if (numShadowCascades) {
+		std::string casters;
+		for (auto c = 0u; c < numShadowCascades; ++c)
+			casters += (c ? "/" : "") + std::to_string(shadowCasters.getNumCasters(c));
+		Logging::screenMessage("SHADOWS : "
+			+ std::to_string(numShadowCascades) + " cascades, "
+			+ casters + " casters of "
+			+ std::to_string(shadowCasters.getNumCandidates()) + ", "
+			+ std::to_string(numShadowDrawCalls) + " draw calls");
+	}
+	auto &stateStats = graphicsContext.getStateCache().getLastFrameStats();
+	Logging::screenMessage("STATE   : "
+		+ std::to_string(stateStats.getTotalIssued()) + " changes issued, "
+		+ std::to_string(stateStats.getTotalFiltered()) + " redundant filtered (last frame)");
+}
 
-	// flatten entity hierarchy
-	for (auto &t : scene.transforms) {
-		EntityID ent = t.second.parent;
-		glm::mat4 flatTransform = t.second.transform.toMatrix();
-		while (ent != -1) {
-			flatTransform = scene.transforms[ent].transform.toMatrix() * flatTransform;
-			ent = scene.transforms[ent].parent;
+
+void SceneRenderer::drawRenderQueue(ForwardPass &pass)
+{
+	if (indirectBuffer.obj) {
+		drawRenderQueueIndirect(pass);
+		return;
+	}
+	const auto numItems = static_cast<unsigned>(renderQueue.size());
+	for (auto i = 0u; i < numItems;) {
+		auto &item = renderQueue[i];
+		// draws sharing the mesh and the material are contiguous in the queue, and so are
+		// their instance data: a run of them is drawn with a single instanced draw per submesh
+		auto end = i + 1;
+		if (instancingThreshold)
+			while (end < numItems
+				&& renderQueue[end].mesh == item.mesh
+				&& renderQueue[end].material == item.material
+				&& renderQueue[end].lod == item.lod)
+				++end;
+		if (end - i >= instancingThreshold) {
+			drawMeshForwardPass(pass, *item.mesh, *item.material, item.lod, i, end - i);
+		}
+		else {
+			for (auto j = i; j < end; ++j)
+				drawMeshForwardPass(pass, *item.mesh, *item.material, item.lod, j, 1);
 		}
-		scene.flattenedTransforms[t.first] = flatTransform;
-	}
-
-	// begin render commands
-	gl::BindFramebuffer(gl::FRAMEBUFFER, 0);
-	gl::Viewport(0, 0, viewportSize.x, viewportSize.y);
-	gl::ClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-	gl::ClearDepth(1.0f);
-	gl::Clear(gl::COLOR_BUFFER_BIT | gl::DEPTH_BUFFER_BIT);
-	// stencil test
-	gl::Disable(gl::STENCIL_TEST);
-	gl::Enable(gl::CULL_FACE);
-	gl::CullFace(gl::BACK);
-	gl::PolygonMode(gl::FRONT_AND_BACK, gl::FILL);
-	gl::Enable(gl::DEPTH_TEST);
-	gl::DepthFunc(gl::LEQUAL);
-	gl::DepthMask(gl::TRUE_);
-	// alpha blending ON
-	gl::Enable(gl::BLEND);
-	gl::BlendEquationSeparatei(0,gl::FUNC_ADD, gl::FUNC_ADD);
-	gl::BlendFuncSeparatei(0, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
-
-	// render terrain
-	if (scene.terrain)
-		drawTerrain(pass, *scene.terrain);
-
-	// Fwd pass for each light
+		i = end;
+	}
+}
+
+void SceneRenderer::drawRenderQueueIndirect(ForwardPass &pass)
+{
+	auto &megabuffer = *graphicsContext.getMeshMegabuffer();
+	auto &commands = indirectDraws.getCommands();
+	for (auto &batch : indirectDraws.getBatches()) {
+		if (batch.mesh) {
+			drawMeshForwardPass(pass, *batch.mesh, *batch.material, batch.lod, batch.first, batch.count);
+			continue;
+		}
+		prepareMaterialForwardPass(*batch.material, pass);
+		auto &vertexBuffer = megabuffer.getVertexBuffer();
+		if (&vertexBuffer != pass.lastVertexBuffer) {
+			bindVertexBuffers({ vertexBuffer, *instanceIndexBuffer }, meshVao);
+			pass.lastVertexBuffer = &vertexBuffer;
+			pass.numVertexBufferChanges++;
+		}
+		submitIndirectBatch(megabuffer, indirectBuffer, batch.first, batch.count);
+		pass.numDrawCalls++;
+		pass.numMultiDrawCommands += batch.count;
+		for (auto c = batch.first; c < batch.first + batch.count; ++c)
+			pass.numInstances += commands[c].instanceCount;
+	}
+}
+
+void SceneRenderer::drawForwardPassPerLight(Scene &scene, ForwardPass &pass)
+{
+	// one pass for each light
 	for (auto &l : scene.lightNodes)
 	{
 		auto &lightNode = l.second;
-		auto &lightTransform = scene.transforms[l.first].transform;
+		auto lightPos = glm::vec3(scene.transforms.getWorldMatrix(l.first)[3]);
 		auto lightbuf = graphicsContext.createTransientBuffer<LightParams>();
 		auto plight = lightbuf.map();
 		plight->intensity = glm::vec4(lightNode.light.intensity, 1.0f);
@@ -251,74 +502,134 @@ void SceneRenderer::renderScene(Scene &scene, float dt)
 		// Buffer for light parameters
 		if (lightNode.light.mode == LightMode::Directional)
 		{
-			plight->u.direction[0] = 0.0f;
-			plight->u.direction[1] = 1.0f;
-			plight->u.direction[2] = 0.0f;
+			auto dir = getDirectionTowardsLight(scene.transforms.getWorldMatrix(l.first));
+			plight->u.direction[0] = dir.x;
+			plight->u.direction[1] = dir.y;
+			plight->u.direction[2] = dir.z;
 			plight->u.direction[3] = 1.0f;
 		}
 		else if (lightNode.light.mode == LightMode::Point)
 		{
-			plight->u.direction[0] = lightTransform.position.x;
-			plight->u.direction[1] = lightTransform.position.y;
-			plight->u.direction[2] = lightTransform.position.z;
+			plight->u.direction[0] = lightPos.x;
+			plight->u.direction[1] = lightPos.y;
+			plight->u.direction[2] = lightPos.z;
 			plight->u.direction[3] = 1.0f;
 		}
 		else if (lightNode.light.mode == LightMode::Spot)
 		{
-			// TODO
+			// range in w, as in the clustered light list
+			plight->u.center[0] = lightPos.x;
+			plight->u.center[1] = lightPos.y;
+			plight->u.center[2] = lightPos.z;
+			plight->u.center[3] = lightNode.light.range;
+			auto axis = glm::normalize(glm::vec3(scene.transforms.getWorldMatrix(l.first)[2]));
+			plight->spotAxis = glm::vec4(axis, glm::cos(lightNode.light.spotAngle));
 		}
 
-		// main pass
-		for (auto &meshEntity : scene.meshNodes) {
-			auto &meshNode = meshEntity.second;
-			auto &transform = scene.flattenedTransforms[meshEntity.first];
-			drawMeshForwardPass(
-				pass,
-				*meshNode.mesh,
-				meshNode.material ? *meshNode.material : *defaultMaterial,
-				transform);
-		}
+		// main pass: the program may change with the light mode
+		pass.lastMaterial = nullptr;
+		pass.lastVertexBuffer = nullptr;
+		bindBuffersRangeHelper(0, { pass.sceneViewUBO, pass.lightParamsUBO,
+			pass.light == pass.shadowedLight ? pass.shadowUBO : pass.noShadowUBO });
+		drawRenderQueue(pass);
 	}
+}
 
-	// do postproc pass
-	PostprocParams pp_params{ viewportSize };
-	auto pp_param_buf = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, pp_params);
-	bindBuffersRangeHelper(0, { pp_param_buf });
-	// HACK: draw a screen-covering triangle without binding a buffer 
-	gl::BindVertexArray(dummy_vao);
-	gl::DrawArrays(gl::TRIANGLES, 0, 3);
+void SceneRenderer::prepareClusteredLights(Scene &scene, ForwardPass &pass)
+{
+	PROFILE_SCOPE("prepareClusteredLights");
+	// directional lights first (not clustered), then point and spot lights
+	auto numLights = static_cast<unsigned>(scene.lightNodes.size());
+	// (empty bindings are not allowed)
+	auto lightsBuf = graphicsContext.createTransientBuffer(gl::SHADER_STORAGE_BUFFER, std::max(numLights, 1u) * sizeof(GPULight));
+	auto gpuLights = static_cast<GPULight*>(lightsBuf.ptr);
+	clusterLights.clear();
+	unsigned lightIndex = 0;
+	unsigned numDirectionalLights = 0;
+	for (auto directional : { true, false })
+		for (auto &l : scene.lightNodes) {
+			auto &light = l.second.light;
+			if ((light.mode == LightMode::Directional) != directional)
+				continue;
+			auto &transform = scene.transforms.getWorldMatrix(l.first);
+			auto &gpuLight = gpuLights[lightIndex++];
+			gpuLight.position = glm::vec4(glm::vec3(transform[3]), light.range);
+			gpuLight.intensity = glm::vec4(light.intensity, static_cast<float>(getGPULightType(light.mode)));
+			if (light.mode == LightMode::Directional) {
+				// the first one is the shadowed light
+				gpuLight.direction = glm::vec4(getDirectionTowardsLight(transform), 0.0f);
+				++numDirectionalLights;
+			}
+			else {
+				auto axis = glm::normalize(glm::vec3(transform[2]));
+				gpuLight.direction = glm::vec4(axis, glm::cos(light.spotAngle));
+				clusterLights.push_back(ClusterLight{ glm::vec3(camera.viewMat * transform[3]), light.range });
+			}
+		}
 
-	// EXTRAS/DEBUG
-	//nvgBeginFrame(nvgContext, viewportSize.x, viewportSize.y, 1.0f);
-	drawScreenMessages();
-	//drawFrameTimeGraph(scene);
-	//nvgEndFrame(nvgContext);
-	scene.lastFrameIndex = (scene.lastFrameIndex + 1) % scene.lastFrameTimes.size();
+	lightClusterer.setup(camera.projMat, clusterGridParams);
+	lightClusterer.assignLights(clusterLights, &util::get_thread_pool());
+
+	// upload
+	auto &clusters = lightClusterer.getClusters();
+	auto &lightIndices = lightClusterer.getLightIndices();
+	ClusterParams params;
+	params.gridSize = glm::uvec4(clusterGridParams.tilesX, clusterGridParams.tilesY, clusterGridParams.slices, numDirectionalLights);
+	params.sliceParams = glm::vec4(lightClusterer.getSliceScale(), lightClusterer.getSliceBias(), 0.0f, 0.0f);
+	pass.clusterParamsUBO = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, params);
+	pass.lightsSSBO = lightsBuf;
+	pass.clustersSSBO = graphicsContext.createTransientBuffer(gl::SHADER_STORAGE_BUFFER,
+		clusters.size() * sizeof(glm::uvec2), clusters.data());
+	pass.lightIndicesSSBO = graphicsContext.createTransientBuffer(gl::SHADER_STORAGE_BUFFER,
+		std::max<size_t>(lightIndices.size(), 1) * sizeof(uint32_t), lightIndices.empty() ? nullptr : lightIndices.data());
+}
+
+void SceneRenderer::drawForwardPassClustered(Scene &scene, ForwardPass &pass)
+{
+	bindBuffersRangeHelper(gl::SHADER_STORAGE_BUFFER, 1, { pass.lightsSSBO, pass.clustersSSBO, pass.lightIndicesSSBO });
+	bindBuffersRangeHelper(0, { pass.sceneViewUBO, pass.clusterParamsUBO, pass.shadowUBO });
+
+	// single pass
+	pass.light = nullptr;
+	pass.clustered = true;
+	pass.lastMaterial = nullptr;
+	pass.lastVertexBuffer = nullptr;
+	drawRenderQueue(pass);
+
+	Logging::screenMessage("LIGHTS  : "
+		+ std::to_string(scene.lightNodes.size()) + " lights, "
+		+ std::to_string(lightClusterer.getLightIndices().size()) + " cluster refs, "
+		+ std::to_string(lightClusterer.getNumDroppedLights()) + " dropped");
 }
 
 
 void SceneRenderer::prepareMaterialForwardPass(
 	Material &mat,
-	ForwardPass &pass, 
-	const glm::mat4 &modelToWorld)
+	ForwardPass &pass)
 {
 	if (&mat == pass.lastMaterial)
 		return;
 	pass.lastMaterial = &mat;
+	pass.numMaterialChanges++;
 	// XXX replace with direct OpenGL calls
-	GLuint program;
-	if (pass.light->mode == LightMode::Directional)
-		program = mat.shader->programForwardDirectionalLight;
+	const ShaderVariant *variant = nullptr;
+	if (pass.clustered)
+		variant = &kForwardClustered;
+	else if (pass.light->mode == LightMode::Directional)
+		variant = &kForwardDirectionalLight;
 	else if (pass.light->mode == LightMode::Point)
-		program = mat.shader->programForwardPointLight;
+		variant = &kForwardPointLight;
 	else if (pass.light->mode == LightMode::Spot)
-		program = mat.shader->programForwardSpotLight;
+		variant = &kForwardSpotLight;
 	else
 		assert(!"Unsupported light mode");
+	auto program = mat.shader->variants.getProgram(graphicsContext, *variant);
 
+	auto &device = getGraphicsDevice();
 	if (pass.lastProgram != program) {
-		gl::UseProgram(program);
+		device.useProgram(program);
 		pass.lastProgram = program;
+		pass.numProgramChanges++;
 	}
 
 	GLuint textures[2];
@@ -329,20 +640,16 @@ void SceneRenderer::prepareMaterialForwardPass(
 	if (mat.normalMap) {
 		textures[1] = mat.normalMap->getGL();
 		samplers[1] = samplers[0];
-		gl::BindTextures(0, 2, textures);
-		gl::BindSamplers(0, 2, samplers);
+		device.bindTextures(0, 2, textures);
+		device.bindSamplers(0, 2, samplers);
 	} else {
-		gl::BindTextures(0, 1, textures);
-		gl::BindSamplers(0, 1, samplers);
+		device.bindTextures(0, 1, textures);
+		device.bindSamplers(0, 1, samplers);
 	}
-	
-	// Per-object uniforms
-	auto perObjBuf = graphicsContext.createTransientBuffer<PerObject>();
-	perObjBuf.map()->modelToWorld = modelToWorld;
-	if (!mat.userParams)
-		bindBuffersRangeHelper(0, { pass.sceneViewUBO, pass.lightParamsUBO, perObjBuf.buf });
-	else
-		bindBuffersRangeHelper(0, { pass.sceneViewUBO, pass.lightParamsUBO, perObjBuf.buf, mat.userParams });
+
+	// material parameters
+	if (mat.userParams)
+		bindBuffersRangeHelper(3, { *mat.userParams });
 }
 
 
@@ -350,63 +657,251 @@ void SceneRenderer::drawMeshForwardPass(
 	ForwardPass &pass,
 	Mesh &mesh, 
 	Material &material,
-	const glm::mat4 &modelToWorld)
+	unsigned lod,
+	unsigned firstInstance,
+	unsigned instanceCount)
+{
+	prepareMaterialForwardPass(material, pass);
+	// meshes in the megabuffer share the same vertex buffer
+	auto &vertexBuffer = mesh.getVertexBuffer();
+	if (&vertexBuffer != pass.lastVertexBuffer) {
+		bindVertexBuffers({ vertexBuffer, *instanceIndexBuffer }, meshVao);
+		pass.lastVertexBuffer = &vertexBuffer;
+		pass.numVertexBufferChanges++;
+	}
+	for (auto &sm : mesh.submeshes) {
+		auto range = sm.getIndexRange(lod);
+		drawIndexed(
+			gl::TRIANGLES,
+			mesh.getIndexBuffer(),
+			mesh.getBaseVertex() + sm.startVertex,
+			mesh.getFirstIndex() + range.startIndex,
+			range.numIndices,
+			firstInstance,
+			instanceCount);
+	}
+	auto numSubmeshes = static_cast<unsigned>(mesh.submeshes.size());
+	pass.numDrawCalls += numSubmeshes;
+	pass.numInstances += numSubmeshes * instanceCount;
+	if (instanceCount > 1)
+		pass.numInstancedDrawCalls += numSubmeshes;
+}
+
+void SceneRenderer::updateInstanceIndexBuffer(unsigned numInstances)
+{
+	if (numInstances <= instanceIndexBufferSize)
+		return;
+	// 0,1,2... fetched with a divisor of 1, so that the base instance selects the instance data
+	auto size = std::max(instanceIndexBufferSize * 2, numInstances);
+	std::vector<glm::uint32> indices(size);
+	for (auto i = 0u; i < size; ++i)
+		indices[i] = i;
+	if (instanceIndexBuffer) {
+		// the draws of the frames in flight may still fetch from the old buffer
+		std::shared_ptr<Buffer> old = std::move(instanceIndexBuffer);
+		graphicsContext.deferUntilFrameComplete([old]() mutable { old.reset(); });
+	}
+	instanceIndexBuffer = graphicsContext.createBuffer(gl::ARRAY_BUFFER, size * sizeof(glm::uint32), indices.data());
+	instanceIndexBufferSize = size;
+}
+
+bool SceneRenderer::prepareShadowMaps(Scene &scene, ForwardPass &forwardPass)
+{
+	PROFILE_SCOPE("prepareShadowMaps");
+	// the first directional light casts shadows (index 0 in the clustered light list)
+	const glm::mat4 *lightTransform = nullptr;
+	forwardPass.shadowedLight = nullptr;
+	for (auto &l : scene.lightNodes)
+		if (l.second.light.mode == LightMode::Directional) {
+			lightTransform = &scene.transforms.getWorldMatrix(l.first);
+			forwardPass.shadowedLight = &l.second.light;
+			break;
+		}
+
+	ShadowData data = {};
+	numShadowDrawCalls = 0;
+	numShadowInstances = 0;
+	forwardPass.noShadowUBO = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, data);
+	numShadowCascades = 0;
+	if (!shadows || !lightTransform) {
+		forwardPass.shadowUBO = forwardPass.noShadowUBO;
+		return false;
+	}
+
+	// caster lists of all the cascades, on the worker threads
+	auto &threadPool = util::get_thread_pool();
+	shadowCasters.gather(scene, *defaultMaterial, &threadPool);
+	shadowLightDir = -getDirectionTowardsLight(*lightTransform);
+	numShadowCascades = computeShadowCascades(camera.viewMat, camera.projMat, shadowLightDir,
+		shadowCasters.getCasterBounds(), shadowParams, shadowCascades);
+	shadowCasters.cull(util::make_array_ref(shadowCascades, numShadowCascades), shadowParams, &threadPool);
+
+	// instance data of the casters of all the cascades, one range per cascade
+	for (auto c = 0u; c < numShadowCascades; ++c) {
+		shadowQueues[c].clear();
+		shadowCasters.merge(c, shadowQueues[c]);
+		shadowQueues[c].sort();
+		shadowFirstInstance[c] = numShadowInstances;
+		numShadowInstances += static_cast<unsigned>(shadowQueues[c].size());
+	}
+
+	auto size = static_cast<int>(kShadowAtlasTiles * shadowParams.resolution);
+	for (auto c = 0u; c < numShadowCascades; ++c) {
+		data.matrices[c] = getShadowAtlasMatrix(shadowCascades[c], c);
+		data.splits[c] = shadowCascades[c].splitFar;
+		data.texelSizes[c] = shadowCascades[c].texelSize;
+	}
+	data.params = glm::vec4(float(numShadowCascades), shadowParams.normalOffset, shadowParams.depthBias, float(size));
+	forwardPass.shadowUBO = graphicsContext.createTransientBuffer(gl::UNIFORM_BUFFER, data);
+	return numShadowCascades != 0;
+}
+
+void SceneRenderer::drawShadowMaps()
+{
+	auto &device = getGraphicsDevice();
+	device.depthMask(true);
+	device.clear(gl::DEPTH_BUFFER_BIT, glm::vec4(0.0f), 1.0f);
+	if (!numShadowInstances)
+		return;
+
+	auto instanceBuf = graphicsContext.createTransientBuffer(gl::SHADER_STORAGE_BUFFER, numShadowInstances * sizeof(InstanceData));
+	auto instances = static_cast<InstanceData*>(instanceBuf.ptr);
+	auto &threadPool = util::get_thread_pool();
+	for (auto c = 0u; c < numShadowCascades; ++c)
+		writeInstanceTransforms(threadPool, shadowQueues[c], instances + shadowFirstInstance[c]);
+	bindBuffersRangeHelper(gl::SHADER_STORAGE_BUFFER, 0, { instanceBuf });
+	updateInstanceIndexBuffer(numShadowInstances);
+
+	ShadowPass pass;
+	for (auto c = 0u; c < numShadowCascades; ++c) {
+		auto &cascade = shadowCascades[c];
+		auto viewport = getShadowAtlasViewport(c, shadowParams.resolution);
+		device.viewport(viewport.x, viewport.y, viewport.z, viewport.w);
+		SceneView cascadeView;
+		cascadeView.viewMatrix = cascade.viewMatrix;
+		cascadeView.projMatrix = cascade.projMatrix;
+		cascadeView.viewProjMatrix = cascade.viewProjMatrix;
+		cascadeView.lightDir = glm::vec4(shadowLightDir, 0.0f);
+		cascadeView.wEye = glm::vec4(camera.wEye, 1.0f);
+		cascadeView.viewportSize = glm::vec2(viewport.z, viewport.w);
+		pass.sceneView = &cascadeView;
+		pass.sceneViewUBO = createSceneViewUBO(graphicsContext, cascadeView);
+		bindBuffersRangeHelper(0, { pass.sceneViewUBO });
+		drawShadowQueue(pass, shadowQueues[c], shadowFirstInstance[c]);
+	}
+	numShadowDrawCalls = pass.numDrawCalls;
+}
+
+void SceneRenderer::drawShadowQueue(ShadowPass &pass, const RenderQueue &queue, unsigned firstInstance)
+{
+	// same instanced runs as drawRenderQueue
+	const auto numItems = static_cast<unsigned>(queue.size());
+	for (auto i = 0u; i < numItems;) {
+		auto &item = queue[i];
+		auto end = i + 1;
+		if (instancingThreshold)
+			while (end < numItems
+				&& queue[end].mesh == item.mesh
+				&& queue[end].material == item.material
+				&& queue[end].lod == item.lod)
+				++end;
+		if (end - i >= instancingThreshold) {
+			drawMeshShadowPass(pass, *item.mesh, *item.material, item.lod, firstInstance + i, end - i);
+		}
+		else {
+			for (auto j = i; j < end; ++j)
+				drawMeshShadowPass(pass, *item.mesh, *item.material, item.lod, firstInstance + j, 1);
+		}
+		i = end;
+	}
+}
+
+void SceneRenderer::drawMeshShadowPass(
+	ShadowPass &pass,
+	Mesh &mesh,
+	Material &material,
+	unsigned lod,
+	unsigned firstInstance,
+	unsigned instanceCount)
 {
-	prepareMaterialForwardPass(material, pass, modelToWorld);
-	bindVertexBuffers({ mesh.vbo.get() }, meshVao);
-	for (auto &sm : mesh.submeshes)
-		drawIndexed(gl::TRIANGLES, *mesh.ibo, sm.startVertex, sm.startIndex, sm.numIndices, 0, 1);
+	auto &device = getGraphicsDevice();
+	auto program = material.shader->variants.getProgram(graphicsContext, kShadowPass);
+	if (program != pass.lastProgram) {
+		device.useProgram(program);
+		pass.lastProgram = program;
+	}
+	auto &vertexBuffer = mesh.getVertexBuffer();
+	if (&vertexBuffer != pass.lastVertexBuffer) {
+		bindVertexBuffers({ vertexBuffer, *instanceIndexBuffer }, meshVao);
+		pass.lastVertexBuffer = &vertexBuffer;
+	}
+	for (auto &sm : mesh.submeshes) {
+		auto range = sm.getIndexRange(lod);
+		drawIndexed(
+			gl::TRIANGLES,
+			mesh.getIndexBuffer(),
+			mesh.getBaseVertex() + sm.startVertex,
+			mesh.getFirstIndex() + range.startIndex,
+			range.numIndices,
+			firstInstance,
+			instanceCount);
+	}
+	pass.numDrawCalls += static_cast<unsigned>(mesh.submeshes.size());
 }
 
 void SceneRenderer::drawScreenMessages()
 {
 	auto lines = Logging::clearScreenMessages();
-	unsigned ypos = 5;
-	unsigned xpos = 5;
-	unsigned yinc = defaultFont->getMetrics().height;
+	int ypos = 5;
+	int xpos = 5;
+	int yinc = defaultFont->getMetrics().height;
 	for (auto &&line : lines) {
-		drawTextShadow(
-			glm::vec2(xpos, ypos),
-			line.c_str());
+		textBatcher.addTextShadow(*defaultFont, glm::ivec2(xpos, ypos), line.c_str(),
+			glm::vec4(1.0f), glm::ivec2(2, 2), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
 		ypos += yinc;
 	}
+	textBatcher.flush(graphicsContext, textProgram, viewportSize);
+	textBatcher.endFrame();
 }
 
 void SceneRenderer::drawFrameTimeGraph(Scene &scene)
 {
+	// bars from the bottom of the screen
 	float posX = 0.0f;
-	float posY = 0.0f;
-	float curX = posX;
+	float posY = float(viewportSize.y);
 	const float barWidth = 3.0f;
 	const float barHeightScale = 1000.f;
 	auto numPoints = scene.lastFrameTimes.size();
+	// one path for all the bars, one for the current frame
+	nvgBeginPath(nvgContext);
 	for (unsigned ii = 0; ii < numPoints; ++ii)
 	{
-		nvgBeginPath(nvgContext);
-		const float barHeight = barHeightScale * scene.lastFrameTimes[ii];
-		nvgRect(nvgContext, curX, posY - barHeight, barWidth, barHeight);
-		curX += barWidth;
 		if (ii == scene.lastFrameIndex)
-			nvgFillColor(nvgContext, nvgRGBA(255, 70, 70, 255));
-		else
-			nvgFillColor(nvgContext, nvgRGBA(70, 70, 255, 255));
-		nvgFill(nvgContext);
+			continue;
+		const float barHeight = barHeightScale * scene.lastFrameTimes[ii];
+		nvgRect(nvgContext, posX + ii * barWidth, posY - barHeight, barWidth, barHeight);
 	}
+	nvgFillColor(nvgContext, nvgRGBA(70, 70, 255, 255));
+	nvgFill(nvgContext);
+	nvgBeginPath(nvgContext);
+	const float barHeight = barHeightScale * scene.lastFrameTimes[scene.lastFrameIndex];
+	nvgRect(nvgContext, posX + scene.lastFrameIndex * barWidth, posY - barHeight, barWidth, barHeight);
+	nvgFillColor(nvgContext, nvgRGBA(255, 70, 70, 255));
+	nvgFill(nvgContext);
 }
 
 void SceneRenderer::drawTerrain(ForwardPass &pass, Terrain &terrain)
 {
-	bindVertexBuffers({ terrain.gridVb.get() }, terrainVao);
+	bindVertexBuffers({ *terrain.gridVb }, terrainVao);
 	TerrainPatchParams patchParams;
 	patchParams.lodLevel = 0;
 	patchParams.patchOffset = glm::vec2();
 	patchParams.patchScale = 1.0f;
-	bindBuffersRangeHelper(0, { pass.sceneViewUBO, terrain.terrainParams.get() });
-	gl::BindBuffer(gl::ELEMENT_ARRAY_BUFFER, terrain.gridIb->obj);
+	bindBuffersRangeHelper(0, { pass.sceneViewUBO, *terrain.terrainParams });
 	GLuint textures[3];
 	textures[0] = terrain.heightTexture->id;
 	textures[1] = terrain.flatTexture->id;
 	textures[2] = terrain.slopeTexture->id;
-	gl::BindTextures(0, 3, textures);
-	gl::DrawElements(gl::TRIANGLES, terrain.patchNumIndices, gl::UNSIGNED_SHORT, (void*)terrain.gridIb->offset);
+	getGraphicsDevice().bindTextures(0, 3, textures);
+	drawIndexed(gl::TRIANGLES, *terrain.gridIb, 0, 0, terrain.patchNumIndices, 0, 1);
 }
\ No newline at end of file
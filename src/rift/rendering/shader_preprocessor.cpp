@@ -0,0 +1,403 @@
+#include <rendering/shader_preprocessor.hpp>
+#include <log.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	const char *kSystemIncludePath = "resources/shaders/include";
+	const int kMaxIncludeDepth = 20;
+
+	std::locale cloc("C");
+
+	template <typename Fn>
+	void skip(const std::string &line, size_t &pos, Fn pred)
+	{
+		// skip whitespace
+		while (pos < line.size() && pred(line[pos])) { pos++; }
+	}
+
+	bool is_space(char ch)
+	{
+		return std::isspace(ch, cloc);
+	}
+
+	bool is_alnum(char ch)
+	{
+		return std::isalnum(ch, cloc);
+	}
+
+	bool is_digit(char ch)
+	{
+		return std::isdigit(ch, cloc);
+	}
+
+	bool path_character(char ch)
+	{
+		return ch != '>';
+	}
+
+	std::string next_word(const std::string &line, size_t &pos)
+	{
+		// skip whitespace
+		skip(line, pos, is_space);
+		auto beg = pos;
+		// get word
+		skip(line, pos, is_alnum);
+		return line.substr(beg, pos - beg);
+	}
+
+	int parse_glsl_version(const std::string &line, size_t &pos)
+	{
+		auto end = line.size();
+		// skip whitespace
+		skip(line, pos, is_space);
+		// version number
+		auto beg = pos;
+		skip(line, pos, is_digit);
+		auto version = line.substr(beg, pos - beg);
+		// skip whitespace
+		skip(line, pos, is_space);
+		// must reach end of line
+		if (pos != end) return 0;
+		return std::stoi(version);
+	}
+
+	std::string parse_include_path(const std::string &line, size_t &pos)
+	{
+		auto end = line.size();
+		// skip whitespace
+		skip(line, pos, is_space);
+		if (pos == end || line[pos++] != '<') return "";
+		auto beg = pos;
+		skip(line, pos, path_character);
+		auto path = line.substr(beg, pos - beg);
+		// closing '>'
+		if (pos == end || line[pos++] != '>') return "";
+		// skip whitespace
+		skip(line, pos, is_space);
+		// must reach end of line
+		if (pos != end) return "";
+		return path;
+	}
+
+	// before GLSL 3.30, the line after '#line n' is line n + 1
+	void appendLineDirective(std::string &out, int line, int sourceStringNumber, int glslVersion)
+	{
+		out += "#line ";
+		out += std::to_string(glslVersion < 330 ? line - 1 : line);
+		out += ' ';
+		out += std::to_string(sourceStringNumber);
+		out += '\n';
+	}
+}
+
+ShaderPreprocessor &getShaderPreprocessor()
+{
+	static ShaderPreprocessor preprocessor;
+	return preprocessor;
+}
+
+int ShaderPreprocessor::getFileIndex(const std::string &path)
+{
+	auto it = file_indices.find(path);
+	if (it != file_indices.end())
+		return it->second;
+	auto index = static_cast<int>(files.size());
+	files.emplace_back();
+	files.back().path = path;
+	file_indices[path] = index;
+	return index;
+}
+
+std::vector<ShaderPreprocessor::Item> ShaderPreprocessor::parse(const std::string &path, std::istream &in)
+{
+	std::vector<Item> items;
+	auto directory = fs::path(path).parent_path().string();
+	std::string line;
+	std::string text;
+	int lineNumber = 0;
+	int textLine = 1;
+	auto flush = [&] {
+		if (!text.empty())
+			items.push_back(Item{ Item::Kind::Text, std::move(text), textLine, 0 });
+		text.clear();
+	};
+
+	while (std::getline(in, line)) {
+		++lineNumber;
+		// if the first character of the line is a '#', then it is a preprocessing directive
+		if (line[0] == '#') {
+			size_t pos = 1;
+			std::string directive = next_word(line, pos);
+			if (directive == "version") {
+				flush();
+				items.push_back(Item{ Item::Kind::Version, "", lineNumber, parse_glsl_version(line, pos) });
+				continue;
+			}
+			if (directive == "pragma" && next_word(line, pos) == "include") {
+				auto include = parse_include_path(line, pos);
+				if (include.size() != 0) {
+					flush();
+					auto index = resolveInclude(directory, include);
+					items.push_back(Item{ Item::Kind::Include, include, lineNumber, index });
+					continue;
+				}
+				WARNING << "Parse error in #pragma include (" << path << ":" << lineNumber << ")";
+			}
+		}
+		if (text.empty())
+			textLine = lineNumber;
+		text += line;
+		text += '\n';
+	}
+	flush();
+	return items;
+}
+
+int ShaderPreprocessor::resolveInclude(const std::string &directory, const std::string &name)
+{
+	auto key = directory + '\n' + name;
+	auto it = resolved_includes.find(key);
+	if (it != resolved_includes.end())
+		return it->second;
+
+	// look for include file in source path, then in the system include dir
+	auto path = fs::path(directory) / name;
+	if (!fs::exists(path)) {
+		path = fs::path(kSystemIncludePath) / name;
+		if (!fs::exists(path)) {
+			ERROR << "Include file <" << name << "> not found.";
+			resolved_includes[key] = -1;
+			return -1;
+		}
+	}
+	auto index = getFileIndex(path.string());
+	// before loading: circular includes stop here
+	resolved_includes[key] = index;
+	loadFile(index);
+	return index;
+}
+
+int ShaderPreprocessor::loadFile(int index)
+{
+	if (files[index].loaded)
+		return index;
+	files[index].loaded = true;
+	auto path = files[index].path;
+	std::ifstream fileIn(path.c_str(), std::ios::in);
+	if (!fileIn.is_open())
+		ERROR << "Could not open shader file " << path;
+	++stats.numFilesRead;
+	auto items = parse(path, fileIn);
+	files[index].items = std::move(items);
+	return index;
+}
+
+int ShaderPreprocessor::loadSource(const std::string &source, const std::string &path)
+{
+	auto index = getFileIndex(path);
+	if (files[index].loaded && files[index].source == source)
+		return index;
+	files[index].loaded = true;
+	files[index].source = source;
+	++stats.numSourcesParsed;
+	std::istringstream sourceIn(source);
+	auto items = parse(path, sourceIn);
+	files[index].items = std::move(items);
+	return index;
+}
+
+void ShaderPreprocessor::reloadInvalidated(int index, std::vector<bool> &visited)
+{
+	if (visited[index])
+		return;
+	visited[index] = true;
+	for (size_t i = 0; i < files[index].items.size(); ++i) {
+		auto &item = files[index].items[i];
+		if (item.kind != Item::Kind::Include || item.value < 0)
+			continue;
+		auto include = item.value;
+		loadFile(include);
+		// loading can add files
+		visited.resize(files.size(), false);
+		reloadInvalidated(include, visited);
+	}
+}
+
+int ShaderPreprocessor::findVersion(int index, int depth, int version) const
+{
+	if (depth > kMaxIncludeDepth)
+		return version;
+	for (auto &item : files[index].items) {
+		if (item.kind == Item::Kind::Version)
+			version = item.value;
+		else if (item.kind == Item::Kind::Include && item.value >= 0)
+			version = findVersion(item.value, depth + 1, version);
+	}
+	return version;
+}
+
+void ShaderPreprocessor::emit(int index, int depth, int glslVersion, std::string &out, std::vector<int> &sourceFiles) const
+{
+	if (depth > kMaxIncludeDepth) {
+		ERROR << "Maximum include depth reached (circular include?)";
+		return;
+	}
+	// source string number: order of first appearance in this program, not the file index
+	// (the text must not depend on the other sources preprocessed before: it keys the program cache)
+	auto it = std::find(sourceFiles.begin(), sourceFiles.end(), index);
+	auto sourceStringNumber = static_cast<int>(it - sourceFiles.begin());
+	if (it == sourceFiles.end())
+		sourceFiles.push_back(index);
+	auto &file = files[index];
+	for (auto &item : file.items) {
+		if (item.kind == Item::Kind::Text) {
+			appendLineDirective(out, item.line, sourceStringNumber, glslVersion);
+			out += item.text;
+		}
+		else if (item.kind == Item::Kind::Include && item.value >= 0) {
+			// put marker in processed source
+			out += "// Include file " + files[item.value].path + " from " + file.path + '\n';
+			emit(item.value, depth + 1, glslVersion, out, sourceFiles);
+		}
+	}
+}
+
+std::string ShaderPreprocessor::preprocess(
+	const std::string &source,
+	const std::string &sourcePath,
+	GLenum stage,
+	util::array_ref<ShaderKeyword> keywords)
+{
+	auto root = loadSource(source, sourcePath);
+	std::vector<bool> visited(files.size(), false);
+	reloadInvalidated(root, visited);
+	++stats.numPreprocessed;
+
+	auto glslVersion = findVersion(root, 0, 110);
+	std::string out;
+	out += "#version " + std::to_string(glslVersion) + '\n';
+	switch (stage) {
+	case gl::VERTEX_SHADER:
+		out += "#define _VERTEX_\n";
+		break;
+	case gl::FRAGMENT_SHADER:
+		out += "#define _FRAGMENT_\n";
+		break;
+	case gl::GEOMETRY_SHADER:
+		out += "#define _GEOMETRY_\n";
+		break;
+	}
+	for (auto &k : keywords) {
+		out += "#define " + k.define + " " + k.value + '\n';
+	}
+	auto &sourceFiles = files[root].sourceFiles;
+	sourceFiles.clear();
+	emit(root, 0, glslVersion, out, sourceFiles);
+	return out;
+}
+
+const std::string &ShaderPreprocessor::getSourceName(const std::string &sourcePath, int sourceStringNumber) const
+{
+	static const std::string unknown = "<unknown>";
+	auto it = file_indices.find(sourcePath);
+	if (it == file_indices.end())
+		return unknown;
+	auto &sourceFiles = files[it->second].sourceFiles;
+	if (sourceStringNumber < 0 || sourceStringNumber >= static_cast<int>(sourceFiles.size()))
+		return unknown;
+	return files[sourceFiles[sourceStringNumber]].path;
+}
+
+void ShaderPreprocessor::collectIncludes(int index, std::vector<bool> &visited) const
+{
+	for (auto &item : files[index].items) {
+		if (item.kind != Item::Kind::Include || item.value < 0 || visited[item.value])
+			continue;
+		visited[item.value] = true;
+		collectIncludes(item.value, visited);
+	}
+}
+
+std::vector<std::string> ShaderPreprocessor::getIncludes(const std::string &path) const
+{
+	std::vector<std::string> includes;
+	auto it = file_indices.find(path);
+	if (it == file_indices.end())
+		return includes;
+	std::vector<bool> visited(files.size(), false);
+	collectIncludes(it->second, visited);
+	for (size_t i = 0; i < files.size(); ++i)
+		if (visited[i] && static_cast<int>(i) != it->second)
+			includes.push_back(files[i].path);
+	return includes;
+}
+
+std::vector<std::string> ShaderPreprocessor::getDependents(const std::string &path) const
+{
+	std::vector<std::string> dependents;
+	auto it = file_indices.find(path);
+	if (it == file_indices.end())
+		return dependents;
+	// reverse edges, then everything that reaches the file
+	std::vector<std::vector<int>> includedBy(files.size());
+	for (size_t i = 0; i < files.size(); ++i)
+		for (auto &item : files[i].items)
+			if (item.kind == Item::Kind::Include && item.value >= 0)
+				includedBy[item.value].push_back(static_cast<int>(i));
+	std::vector<bool> visited(files.size(), false);
+	std::vector<int> stack = { it->second };
+	visited[it->second] = true;
+	while (!stack.empty()) {
+		auto index = stack.back();
+		stack.pop_back();
+		for (auto parent : includedBy[index]) {
+			if (visited[parent])
+				continue;
+			visited[parent] = true;
+			dependents.push_back(files[parent].path);
+			stack.push_back(parent);
+		}
+	}
+	return dependents;
+}
+
+void ShaderPreprocessor::invalidate(const std::string &path)
+{
+	auto it = file_indices.find(path);
+	if (it != file_indices.end()) {
+		auto &file = files[it->second];
+		file.loaded = false;
+		file.source.clear();
+		file.items.clear();
+	}
+	// a missing include may exist now: look it up again, and scan again the files that include it
+	for (auto it = resolved_includes.begin(); it != resolved_includes.end();) {
+		if (it->second < 0)
+			it = resolved_includes.erase(it);
+		else
+			++it;
+	}
+	for (auto &file : files) {
+		auto missing = std::any_of(file.items.begin(), file.items.end(), [](const Item &item) {
+			return item.kind == Item::Kind::Include && item.value < 0;
+		});
+		if (missing) {
+			file.loaded = false;
+			file.source.clear();
+			file.items.clear();
+		}
+	}
+}
+
+void ShaderPreprocessor::clear()
+{
+	files.clear();
+	file_indices.clear();
+	resolved_includes.clear();
+}
@@ -0,0 +1,249 @@
+#include <rendering/shader_variants.hpp>
+#include <rendering/opengl4.hpp>
+#include <utils/hash.hpp>
+#include <log.hpp>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	const char *kShadowPassKeyword = "SHADOW_PASS";
+
+	bool keywordLess(const ShaderKeyword &a, const ShaderKeyword &b)
+	{
+		return a.define < b.define || (a.define == b.define && a.value < b.value);
+	}
+
+	const std::vector<ShaderVariant> kNoVariants;
+}
+
+uint64_t hashShaderKeywords(util::array_ref<ShaderKeyword> keywords)
+{
+	std::vector<const ShaderKeyword*> sorted;
+	for (auto &k : keywords)
+		sorted.push_back(&k);
+	std::sort(sorted.begin(), sorted.end(), [](const ShaderKeyword *a, const ShaderKeyword *b) {
+		return keywordLess(*a, *b);
+	});
+	auto hash = util::kHashBasis;
+	for (auto k : sorted) {
+		hash = util::hashString(hash, k->define);
+		hash = util::hashString(hash, k->value);
+	}
+	return hash;
+}
+
+ShaderVariant::ShaderVariant() : key(hashShaderKeywords({}))
+{
+}
+
+ShaderVariant::ShaderVariant(util::array_ref<ShaderKeyword> keywords_) : keywords(keywords_.begin(), keywords_.end())
+{
+	// same defines in the same order: same preprocessed sources, same program binaries
+	std::sort(keywords.begin(), keywords.end(), keywordLess);
+	key = hashShaderKeywords(keywords);
+}
+
+//=============================================================================
+void ProgramTable::insert(uint64_t key, GLuint program)
+{
+	if ((count + 1) * 2 > slots.size()) {
+		std::vector<Slot> old(std::max<size_t>(16, slots.size() * 2), Slot{ 0, 0 });
+		old.swap(slots);
+		count = 0;
+		for (auto &slot : old)
+			if (slot.program)
+				insert(slot.key, slot.program);
+	}
+	auto mask = slots.size() - 1;
+	for (auto i = mix(key) & mask;; i = (i + 1) & mask) {
+		auto &slot = slots[i];
+		if (!slot.program) {
+			slot = Slot{ key, program };
+			++count;
+			return;
+		}
+		if (slot.key == key) {
+			slot.program = program;
+			return;
+		}
+	}
+}
+
+void ProgramTable::clear()
+{
+	slots.clear();
+	count = 0;
+}
+
+//=============================================================================
+void ShaderVariants::setSources(std::string vsSource, std::string vsPath, std::string psSource, std::string psPath)
+{
+	vs_source = std::move(vsSource);
+	vs_path = std::move(vsPath);
+	ps_source = std::move(psSource);
+	ps_path = std::move(psPath);
+}
+
+void ShaderVariants::setShadowPassSource(std::string psSource, std::string psPath)
+{
+	shadow_ps_source = std::move(psSource);
+	shadow_ps_path = std::move(psPath);
+}
+
+void ShaderVariants::addAxis(std::vector<std::string> keywords)
+{
+	axes.push_back(std::move(keywords));
+}
+
+size_t ShaderVariants::getNumPermutations() const
+{
+	size_t n = 1;
+	for (auto &axis : axes)
+		n *= axis.size();
+	return n;
+}
+
+bool ShaderVariants::isValid(const ShaderVariant &variant) const
+{
+	std::vector<int> used(axes.size(), 0);
+	for (auto &k : variant.keywords) {
+		bool found = false;
+		for (size_t i = 0; i < axes.size() && !found; ++i) {
+			if (std::find(axes[i].begin(), axes[i].end(), k.define) != axes[i].end()) {
+				found = true;
+				if (used[i]++)
+					return false;
+			}
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+GLuint ShaderVariants::compileVariant(GraphicsContext &gc, const ShaderVariant &variant)
+{
+	if (!isValid(variant)) {
+		std::string defines;
+		for (auto &k : variant.keywords)
+			defines += " " + k.define;
+		WARNING << "Shader " << vs_path << ": variant" << defines << " does not match the keyword axes";
+	}
+	auto shadowPass = !shadow_ps_source.empty() && std::any_of(variant.keywords.begin(), variant.keywords.end(),
+		[](const ShaderKeyword &k) { return k.define == kShadowPassKeyword; });
+	auto &psSource = shadowPass ? shadow_ps_source : ps_source;
+	auto &psPath = shadowPass ? shadow_ps_path : ps_path;
+	auto program = compileProgram(gc, vs_source.c_str(), vs_path.c_str(), psSource.c_str(), psPath.c_str(), variant.keywords);
+	programs.insert(variant.key, program);
+	compiled.push_back(variant);
+	gc.getShaderVariantUsage().record(vs_path, variant);
+	return program;
+}
+
+unsigned ShaderVariants::prewarm(GraphicsContext &gc, util::array_ref<ShaderVariant> variants)
+{
+	unsigned n = 0;
+	for (auto &variant : variants) {
+		if (programs.find(variant.key))
+			continue;
+		compileVariant(gc, variant);
+		++n;
+	}
+	return n;
+}
+
+unsigned ShaderVariants::prewarmAll(GraphicsContext &gc)
+{
+	std::vector<ShaderVariant> variants;
+	std::vector<size_t> choice(axes.size(), 0);
+	for (size_t n = getNumPermutations(), p = 0; p < n; ++p) {
+		std::vector<ShaderKeyword> keywords;
+		for (size_t i = 0; i < axes.size(); ++i)
+			if (!axes[i][choice[i]].empty())
+				keywords.push_back(ShaderKeyword{ axes[i][choice[i]], "" });
+		variants.emplace_back(keywords);
+		// next permutation (mixed radix)
+		for (size_t i = 0; i < axes.size() && ++choice[i] == axes[i].size(); ++i)
+			choice[i] = 0;
+	}
+	return prewarm(gc, variants);
+}
+
+//=============================================================================
+bool ShaderVariantUsage::load(const std::string &path)
+{
+	std::ifstream fileIn(path, std::ios::in);
+	if (!fileIn.is_open())
+		return false;
+	variants.clear();
+	std::string line;
+	while (std::getline(fileIn, line)) {
+		std::istringstream lineIn(line);
+		std::string shader, token;
+		if (!(lineIn >> shader))
+			continue;
+		std::vector<ShaderKeyword> keywords;
+		while (lineIn >> token) {
+			auto eq = token.find('=');
+			if (eq == std::string::npos)
+				keywords.push_back(ShaderKeyword{ token, "" });
+			else
+				keywords.push_back(ShaderKeyword{ token.substr(0, eq), token.substr(eq + 1) });
+		}
+		record(shader, ShaderVariant(keywords));
+	}
+	dirty = false;
+	return true;
+}
+
+bool ShaderVariantUsage::save(const std::string &path)
+{
+	std::ofstream fileOut(path, std::ios::out | std::ios::trunc);
+	if (!fileOut.is_open()) {
+		WARNING << "Could not write shader variant usage " << path;
+		return false;
+	}
+	std::vector<std::string> shaders;
+	for (auto &entry : variants)
+		shaders.push_back(entry.first);
+	std::sort(shaders.begin(), shaders.end());
+	for (auto &shader : shaders) {
+		for (auto &variant : variants.at(shader)) {
+			fileOut << shader;
+			for (auto &k : variant.keywords) {
+				fileOut << ' ' << k.define;
+				if (!k.value.empty())
+					fileOut << '=' << k.value;
+			}
+			fileOut << '\n';
+		}
+	}
+	dirty = false;
+	return static_cast<bool>(fileOut);
+}
+
+void ShaderVariantUsage::record(const std::string &shader, const ShaderVariant &variant)
+{
+	auto &list = variants[shader];
+	for (auto &v : list)
+		if (v.key == variant.key)
+			return;
+	list.push_back(variant);
+	dirty = true;
+}
+
+const std::vector<ShaderVariant> &ShaderVariantUsage::getVariants(const std::string &shader) const
+{
+	auto it = variants.find(shader);
+	return it != variants.end() ? it->second : kNoVariants;
+}
+
+size_t ShaderVariantUsage::size() const
+{
+	size_t n = 0;
+	for (auto &entry : variants)
+		n += entry.second.size();
+	return n;
+}
@@ -0,0 +1,254 @@
+#include <rendering/shadows.hpp>
+#include <scene/scene.hpp>
+#include <utils/thread_pool.hpp>
+#include <profiler.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+	const AABB kEmptyBounds = AABB{ glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+
+	bool isEmpty(const AABB &aabb)
+	{
+		return aabb.min.x > aabb.max.x;
+	}
+
+	void extend(AABB &aabb, const AABB &other)
+	{
+		aabb.min = glm::min(aabb.min, other.min);
+		aabb.max = glm::max(aabb.max, other.max);
+	}
+}
+
+void computeCascadeSplits(float nearPlane, float farPlane, unsigned numCascades, float lambda, float *splits)
+{
+	for (auto i = 1u; i <= numCascades; ++i) {
+		auto t = float(i) / float(numCascades);
+		auto logSplit = nearPlane * glm::pow(farPlane / nearPlane, t);
+		auto uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+		splits[i - 1] = glm::mix(uniformSplit, logSplit, lambda);
+	}
+	// exact, despite rounding
+	splits[numCascades - 1] = farPlane;
+}
+
+ShadowCascade fitShadowCascade(
+	const glm::mat4 &viewMatrix,
+	const glm::mat4 &projMatrix,
+	float splitNear,
+	float splitFar,
+	const glm::vec3 &lightDir,
+	const AABB &casterBounds,
+	const ShadowParams &params)
+{
+	assert(projMatrix[2][3] == -1.0f && "perspective projection expected");
+	ShadowCascade cascade;
+	cascade.splitNear = splitNear;
+	cascade.splitFar = splitFar;
+	auto dir = glm::normalize(lightDir);
+	auto up = glm::abs(dir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	cascade.viewMatrix = glm::lookAt(glm::vec3(0.0f), dir, up);
+
+	// corners of the slice in light space, along the rays through the corners of the near plane
+	auto invProj = glm::inverse(projMatrix);
+	auto viewToLight = cascade.viewMatrix * glm::inverse(viewMatrix);
+	glm::vec3 corners[8];
+	glm::vec3 lo(FLT_MAX);
+	glm::vec3 hi(-FLT_MAX);
+	for (auto i = 0u; i < 4; ++i) {
+		auto p = invProj * glm::vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, -1.0f, 1.0f);
+		auto ray = glm::vec3(p) / p.w;
+		ray /= -ray.z;
+		corners[i] = glm::vec3(viewToLight * glm::vec4(ray * splitNear, 1.0f));
+		corners[i + 4] = glm::vec3(viewToLight * glm::vec4(ray * splitFar, 1.0f));
+	}
+	for (auto &c : corners) {
+		lo = glm::min(lo, c);
+		hi = glm::max(hi, c);
+	}
+
+	auto hasCasters = !isEmpty(casterBounds);
+	auto casters = hasCasters ? transformAABB(casterBounds, cascade.viewMatrix) : kEmptyBounds;
+	if (params.stabilize) {
+		// the sphere does not change with the orientation of the camera, and its
+		// center moves by whole texels
+		glm::vec3 center(0.0f);
+		for (auto &c : corners)
+			center += c;
+		center /= 8.0f;
+		float radius = 0.0f;
+		for (auto &c : corners)
+			radius = glm::max(radius, glm::length(c - center));
+		radius = glm::ceil(radius * 16.0f) / 16.0f;
+		cascade.texelSize = 2.0f * radius / float(params.resolution);
+		auto snapped = glm::floor(glm::vec2(center) / cascade.texelSize) * cascade.texelSize;
+		lo = glm::vec3(snapped - radius, lo.z);
+		hi = glm::vec3(snapped + radius, hi.z);
+	}
+	else {
+		// nothing casts shadows outside of the casters
+		if (hasCasters) {
+			auto clippedLo = glm::max(glm::vec2(lo), glm::vec2(casters.min));
+			auto clippedHi = glm::min(glm::vec2(hi), glm::vec2(casters.max));
+			if (clippedLo.x < clippedHi.x && clippedLo.y < clippedHi.y) {
+				lo = glm::vec3(clippedLo, lo.z);
+				hi = glm::vec3(clippedHi, hi.z);
+			}
+		}
+		cascade.texelSize = glm::max(hi.x - lo.x, hi.y - lo.y) / float(params.resolution);
+	}
+
+	// the light looks down -Z: depth goes from the casters nearest to the light
+	// to the end of the slice (or of the casters)
+	auto zNear = hasCasters ? -casters.max.z : -hi.z;
+	auto zFar = -lo.z;
+	if (hasCasters)
+		zFar = glm::min(zFar, -casters.min.z);
+	zFar = glm::max(zFar, zNear + 0.01f);
+	cascade.projMatrix = glm::ortho(lo.x, hi.x, lo.y, hi.y, zNear, zFar);
+	cascade.viewProjMatrix = cascade.projMatrix * cascade.viewMatrix;
+	cascade.frustum = FrustumPlanes::fromMatrix(cascade.viewProjMatrix);
+	return cascade;
+}
+
+unsigned computeShadowCascades(
+	const glm::mat4 &viewMatrix,
+	const glm::mat4 &projMatrix,
+	const glm::vec3 &lightDir,
+	const AABB &casterBounds,
+	const ShadowParams &params,
+	ShadowCascade *cascades)
+{
+	// planes of a GL perspective projection (see LightClusterer::setup)
+	auto nearPlane = projMatrix[3][2] / (projMatrix[2][2] - 1.0f);
+	auto farPlane = projMatrix[3][2] / (projMatrix[2][2] + 1.0f);
+	if (!(farPlane > nearPlane) || !std::isfinite(farPlane))
+		// infinite projection
+		farPlane = params.maxDistance;
+	farPlane = glm::min(farPlane, params.maxDistance);
+
+	auto numCascades = glm::clamp(params.numCascades, 1u, kMaxShadowCascades);
+	float splits[kMaxShadowCascades];
+	computeCascadeSplits(nearPlane, farPlane, numCascades, params.splitLambda, splits);
+	auto splitNear = nearPlane;
+	for (auto i = 0u; i < numCascades; ++i) {
+		cascades[i] = fitShadowCascade(viewMatrix, projMatrix, splitNear, splits[i], lightDir, casterBounds, params);
+		splitNear = splits[i];
+	}
+	return numCascades;
+}
+
+glm::mat4 getShadowAtlasMatrix(const ShadowCascade &cascade, unsigned index)
+{
+	// clip space to the tile of the cascade, depth to [0,1]
+	auto tile = glm::vec2(float(index % kShadowAtlasTiles), float(index / kShadowAtlasTiles));
+	auto scale = 0.5f / float(kShadowAtlasTiles);
+	glm::mat4 toAtlas(1.0f);
+	toAtlas[0][0] = scale;
+	toAtlas[1][1] = scale;
+	toAtlas[2][2] = 0.5f;
+	toAtlas[3] = glm::vec4(tile / float(kShadowAtlasTiles) + scale, 0.5f, 1.0f);
+	return toAtlas * cascade.viewProjMatrix;
+}
+
+glm::ivec4 getShadowAtlasViewport(unsigned index, unsigned resolution)
+{
+	return glm::ivec4(
+		(index % kShadowAtlasTiles) * resolution,
+		(index / kShadowAtlasTiles) * resolution,
+		resolution,
+		resolution);
+}
+
+//=============================================================================
+void ShadowCasterCuller::gather(Scene &scene, Material &defaultMaterial, util::thread_pool *pool)
+{
+	splitBuckets(scene.meshNodes.bucket_count(), pool, partitions);
+	runPartitions(static_cast<unsigned>(partitions.size()), pool, [&](unsigned begin, unsigned end) {
+		PROFILE_SCOPE("gatherCasters");
+		for (auto i = begin; i < end; ++i)
+			gatherPartition(partitions[i], scene, defaultMaterial);
+	});
+
+	casterBounds = kEmptyBounds;
+	numCandidates = 0;
+	for (auto &partition : partitions) {
+		extend(casterBounds, partition.casterBounds);
+		numCandidates += static_cast<unsigned>(partition.candidates.size());
+	}
+}
+
+void ShadowCasterCuller::gatherPartition(Partition &partition, Scene &scene, Material &defaultMaterial)
+{
+	partition.candidates.clear();
+	partition.bounds.clear();
+	partition.casterBounds = kEmptyBounds;
+
+	auto &meshNodes = scene.meshNodes;
+	for (auto b = partition.firstBucket; b < partition.endBucket; ++b)
+		for (auto it = meshNodes.begin(b); it != meshNodes.end(b); ++it) {
+			auto &meshNode = it->second;
+			auto &transform = scene.transforms.getWorldMatrix(it->first);
+			auto material = meshNode.material ? meshNode.material : &defaultMaterial;
+			// level of detail picked for the view (when the node was last visible)
+			partition.candidates.push_back(DrawItem{ meshNode.mesh, material, &transform, meshNode.lod });
+			auto aabb = transformAABB(meshNode.mesh->aabb, transform);
+			auto sphere = transformSphere(meshNode.mesh->boundingSphere, transform);
+			partition.bounds.push(aabb.center(), aabb.extent(), sphere.radius);
+			extend(partition.casterBounds, aabb);
+		}
+}
+
+void ShadowCasterCuller::cull(util::array_ref<ShadowCascade> cascades, const ShadowParams &params, util::thread_pool *pool)
+{
+	assert(cascades.size() <= kMaxShadowCascades);
+	numCascades = static_cast<unsigned>(cascades.size());
+	runPartitions(static_cast<unsigned>(partitions.size()), pool, [&](unsigned begin, unsigned end) {
+		PROFILE_SCOPE("cullCasters");
+		for (auto i = begin; i < end; ++i)
+			cullPartition(partitions[i], cascades, params);
+	});
+
+	// objects seen for the first time get their sort ids here, on the calling thread
+	for (auto c = 0u; c < kMaxShadowCascades; ++c)
+		numCasters[c] = 0;
+	for (auto &partition : partitions)
+		for (auto c = 0u; c < numCascades; ++c) {
+			partition.packets[c].resolveSortKeys();
+			numCasters[c] += static_cast<unsigned>(partition.packets[c].size());
+		}
+}
+
+void ShadowCasterCuller::cullPartition(Partition &partition, util::array_ref<ShadowCascade> cascades, const ShadowParams &params)
+{
+	auto &bounds = partition.bounds;
+	for (auto c = 0u; c < cascades.size(); ++c) {
+		auto &cascade = cascades[c];
+		auto &packets = partition.packets[c];
+		packets.clear();
+		partition.visible.clear();
+		cullFrustum(cascade.frustum, bounds, partition.visible);
+
+		auto minRadius = 0.5f * params.minCasterTexels * cascade.texelSize;
+		for (auto index : partition.visible) {
+			if (bounds.radius[index] < minRadius)
+				continue;
+			auto &item = partition.candidates[index];
+			// front to back from the light (orthographic: no divide)
+			auto clipZ = cascade.viewProjMatrix * glm::vec4(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index], 1.0f);
+			packets.push(item, clipZ.z * 0.5f + 0.5f);
+		}
+	}
+}
+
+void ShadowCasterCuller::merge(unsigned cascade, RenderQueue &queue) const
+{
+	queue.reserve(queue.size() + numCasters[cascade]);
+	for (auto &partition : partitions)
+		for (auto &packet : partition.packets[cascade].getPackets())
+			queue.push(packet.sortKey, packet.item);
+}
@@ -0,0 +1,563 @@
+#include <rendering/state_cache.hpp>
+#include <algorithm>
+
+namespace
+{
+	// [lo, hi): slots of [first, first + count) that differ from the shadow state
+	// (all of them if some slots are not tracked)
+	template <typename Same>
+	void findChangedRange(unsigned first, unsigned count, unsigned numTracked, bool filtering, Same same, unsigned &lo, unsigned &hi)
+	{
+		lo = first;
+		hi = first + count;
+		if (!filtering || hi > numTracked)
+			return;
+		while (lo < hi && same(lo))
+			++lo;
+		while (hi > lo && same(hi - 1))
+			--hi;
+	}
+}
+
+const unsigned StateCache::kNumBufferSlots;
+const unsigned StateCache::kNumTextureUnits;
+const unsigned StateCache::kNumDrawBuffers;
+const GLuint StateCache::kUnknown;
+
+unsigned StateCacheStats::getTotalIssued() const
+{
+	unsigned total = 0;
+	for (auto n : issued)
+		total += n;
+	return total;
+}
+
+unsigned StateCacheStats::getTotalFiltered() const
+{
+	unsigned total = 0;
+	for (auto n : filtered)
+		total += n;
+	return total;
+}
+
+const char *getStateCategoryName(StateCategory category)
+{
+	switch (category) {
+	case StateCategory::Program: return "program";
+	case StateCategory::VertexArray: return "vertex array";
+	case StateCategory::VertexBuffers: return "vertex buffers";
+	case StateCategory::BufferRanges: return "buffer ranges";
+	case StateCategory::Textures: return "textures";
+	case StateCategory::Samplers: return "samplers";
+	case StateCategory::Blend: return "blend";
+	case StateCategory::Depth: return "depth";
+	case StateCategory::Raster: return "raster";
+	default: return "?";
+	}
+}
+
+StateCache::StateCache(GraphicsDevice &device_) : device(device_)
+{
+	invalidate();
+}
+
+void StateCache::invalidate()
+{
+	program = kUnknown;
+	vertex_array = kUnknown;
+	invalidateVertexBuffers();
+	for (auto i = 0u; i < kNumBufferSlots; ++i) {
+		uniform_buffers[i] = BufferBinding{ kUnknown, 0, 0 };
+		storage_buffers[i] = BufferBinding{ kUnknown, 0, 0 };
+	}
+	std::fill(std::begin(textures), std::end(textures), kUnknown);
+	std::fill(std::begin(samplers), std::end(samplers), kUnknown);
+	for (auto &b : blend)
+		b = Blend{ kUnknown, kUnknown, kUnknown, kUnknown, kUnknown, kUnknown };
+	caps[0] = Capability{ gl::DEPTH_TEST, StateCategory::Depth, -1 };
+	caps[1] = Capability{ gl::BLEND, StateCategory::Blend, -1 };
+	caps[2] = Capability{ gl::CULL_FACE, StateCategory::Raster, -1 };
+	caps[3] = Capability{ gl::STENCIL_TEST, StateCategory::Raster, -1 };
+	depth_func = kUnknown;
+	depth_mask = -1;
+	polygon_mode = kUnknown;
+	cull_face = kUnknown;
+	color_mask = -1;
+	stencil_func = kUnknown;
+	stencil_ref = -1;
+	stencil_mask = 0;
+	for (auto &op : stencil_op)
+		op = StencilOp{ kUnknown, kUnknown, kUnknown };
+	viewport_rect = glm::ivec4(-1);
+	unpack_alignment = -1;
+}
+
+void StateCache::invalidateVertexBuffers()
+{
+	for (auto &b : vertex_buffers)
+		b = BufferBinding{ kUnknown, 0, 0 };
+}
+
+void StateCache::setFilteringEnabled(bool enabled)
+{
+	filtering = enabled;
+	// the shadow state is not maintained while disabled
+	invalidate();
+}
+
+void StateCache::beginFrame()
+{
+	last_frame_stats = frame_stats;
+	frame_stats = StateCacheStats();
+}
+
+bool StateCache::update(StateCategory category, bool changed)
+{
+	if (filtering && !changed) {
+		frame_stats.filtered[static_cast<int>(category)]++;
+		return false;
+	}
+	frame_stats.issued[static_cast<int>(category)]++;
+	return true;
+}
+
+StateCache::BufferBinding *StateCache::getBufferBindings(GLenum target)
+{
+	if (target == gl::UNIFORM_BUFFER)
+		return uniform_buffers;
+	if (target == gl::SHADER_STORAGE_BUFFER)
+		return storage_buffers;
+	return nullptr;
+}
+
+void StateCache::forgetBuffer(GLuint buf)
+{
+	// GL unbinds deleted buffers, and the name can be reused
+	for (auto i = 0u; i < kNumBufferSlots; ++i) {
+		if (vertex_buffers[i].obj == buf)
+			vertex_buffers[i].obj = kUnknown;
+		if (uniform_buffers[i].obj == buf)
+			uniform_buffers[i].obj = kUnknown;
+		if (storage_buffers[i].obj == buf)
+			storage_buffers[i].obj = kUnknown;
+	}
+}
+
+//---------------------------
+// resources
+GLuint StateCache::createBuffer(GLenum target, size_t size, GLbitfield flags, const void *initialData)
+{
+	return device.createBuffer(target, size, flags, initialData);
+}
+
+void *StateCache::mapBuffer(GLuint buf, size_t offset, size_t size, GLbitfield access)
+{
+	return device.mapBuffer(buf, offset, size, access);
+}
+
+void StateCache::updateBuffer(GLuint buf, GLenum target, size_t offset, size_t size, const void *data)
+{
+	device.updateBuffer(buf, target, offset, size, data);
+}
+
+void StateCache::copyBuffer(GLuint src, GLuint dest, size_t srcOffset, size_t destOffset, size_t size)
+{
+	device.copyBuffer(src, dest, srcOffset, destOffset, size);
+}
+
+void StateCache::deleteBuffer(GLuint buf)
+{
+	forgetBuffer(buf);
+	device.deleteBuffer(buf);
+}
+
+GLint StateCache::getBufferOffsetAlignment(GLenum target)
+{
+	return device.getBufferOffsetAlignment(target);
+}
+
+GLsync StateCache::fenceSync()
+{
+	return device.fenceSync();
+}
+
+bool StateCache::waitSync(GLsync sync, uint64_t timeout)
+{
+	return device.waitSync(sync, timeout);
+}
+
+void StateCache::deleteSync(GLsync sync)
+{
+	device.deleteSync(sync);
+}
+
+GLuint StateCache::createQuery()
+{
+	return device.createQuery();
+}
+
+void StateCache::queryTimestamp(GLuint query)
+{
+	device.queryTimestamp(query);
+}
+
+bool StateCache::getQueryResult(GLuint query, uint64_t &result)
+{
+	return device.getQueryResult(query, result);
+}
+
+void StateCache::deleteQuery(GLuint query)
+{
+	device.deleteQuery(query);
+}
+
+GLuint StateCache::createVertexArray(util::array_ref<Attribute> attribs, util::array_ref<unsigned> divisors)
+{
+	// binds the new VAO without direct state access
+	vertex_array = kUnknown;
+	invalidateVertexBuffers();
+	return device.createVertexArray(attribs, divisors);
+}
+
+void StateCache::deleteVertexArray(GLuint vao)
+{
+	if (vertex_array == vao) {
+		vertex_array = kUnknown;
+		invalidateVertexBuffers();
+	}
+	device.deleteVertexArray(vao);
+}
+
+GLuint StateCache::createTexture(GLenum target, unsigned numMipLevels, GLenum internalFormat, unsigned width, unsigned height)
+{
+	// binds the texture on the active unit (0) without direct state access
+	textures[0] = kUnknown;
+	return device.createTexture(target, numMipLevels, internalFormat, width, height);
+}
+
+void StateCache::updateTexture(GLuint tex, GLenum target, GLenum imageTarget, int mipLevel, glm::ivec2 offset, glm::ivec2 size, GLenum format, GLenum type, const void *data)
+{
+	textures[0] = kUnknown;
+	device.updateTexture(tex, target, imageTarget, mipLevel, offset, size, format, type, data);
+}
+
+void StateCache::setUnpackAlignment(int alignment)
+{
+	if (update(StateCategory::Raster, alignment != unpack_alignment)) {
+		unpack_alignment = alignment;
+		device.setUnpackAlignment(alignment);
+	}
+}
+
+void StateCache::deleteTexture(GLuint tex)
+{
+	for (auto &t : textures)
+		if (t == tex)
+			t = kUnknown;
+	device.deleteTexture(tex);
+}
+
+GLuint StateCache::createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget)
+{
+	return device.createFramebuffer(colorTargets, depthTarget);
+}
+
+void StateCache::deleteFramebuffer(GLuint fbo)
+{
+	device.deleteFramebuffer(fbo);
+}
+
+GLuint StateCache::createSampler(GLenum minFilter, GLenum magFilter, GLenum wrapMode)
+{
+	return device.createSampler(minFilter, magFilter, wrapMode);
+}
+
+void StateCache::deleteSampler(GLuint sampler)
+{
+	for (auto &s : samplers)
+		if (s == sampler)
+			s = kUnknown;
+	device.deleteSampler(sampler);
+}
+
+GLuint StateCache::createShader(GLenum stage, const char *source)
+{
+	return device.createShader(stage, source);
+}
+
+void StateCache::deleteShader(GLuint shader)
+{
+	device.deleteShader(shader);
+}
+
+GLuint StateCache::createProgram(GLuint vs, GLuint gs, GLuint ps)
+{
+	return device.createProgram(vs, gs, ps);
+}
+
+void StateCache::deleteProgram(GLuint prog)
+{
+	if (program == prog)
+		program = kUnknown;
+	device.deleteProgram(prog);
+}
+
+bool StateCache::getProgramBinary(GLuint prog, GLenum &format, std::vector<char> &binary)
+{
+	return device.getProgramBinary(prog, format, binary);
+}
+
+GLuint StateCache::createProgramFromBinary(GLenum format, const void *binary, size_t size)
+{
+	return device.createProgramFromBinary(format, binary, size);
+}
+
+//---------------------------
+// render state
+void StateCache::bindFramebuffer(GLuint fbo)
+{
+	device.bindFramebuffer(fbo);
+}
+
+void StateCache::viewport(int x, int y, int width, int height)
+{
+	auto rect = glm::ivec4(x, y, width, height);
+	if (update(StateCategory::Raster, rect != viewport_rect)) {
+		viewport_rect = rect;
+		device.viewport(x, y, width, height);
+	}
+}
+
+void StateCache::clear(GLbitfield mask, const glm::vec4 &color, float depth)
+{
+	device.clear(mask, color, depth);
+}
+
+void StateCache::setEnabled(GLenum cap, bool enabled)
+{
+	for (auto &c : caps)
+		if (c.cap == cap) {
+			if (update(c.category, c.enabled != static_cast<int>(enabled))) {
+				c.enabled = enabled;
+				device.setEnabled(cap, enabled);
+			}
+			return;
+		}
+	// not tracked
+	update(StateCategory::Raster, true);
+	device.setEnabled(cap, enabled);
+}
+
+void StateCache::polygonMode(GLenum mode)
+{
+	if (update(StateCategory::Raster, mode != polygon_mode)) {
+		polygon_mode = mode;
+		device.polygonMode(mode);
+	}
+}
+
+void StateCache::cullFace(GLenum face)
+{
+	if (update(StateCategory::Raster, face != cull_face)) {
+		cull_face = face;
+		device.cullFace(face);
+	}
+}
+
+void StateCache::depthFunc(GLenum func)
+{
+	if (update(StateCategory::Depth, func != depth_func)) {
+		depth_func = func;
+		device.depthFunc(func);
+	}
+}
+
+void StateCache::depthMask(bool enabled)
+{
+	if (update(StateCategory::Depth, depth_mask != static_cast<int>(enabled))) {
+		depth_mask = enabled;
+		device.depthMask(enabled);
+	}
+}
+
+void StateCache::blendEquation(unsigned drawBuffer, GLenum modeRGB, GLenum modeAlpha)
+{
+	if (drawBuffer >= kNumDrawBuffers) {
+		update(StateCategory::Blend, true);
+		device.blendEquation(drawBuffer, modeRGB, modeAlpha);
+		return;
+	}
+	auto &b = blend[drawBuffer];
+	if (update(StateCategory::Blend, b.modeRGB != modeRGB || b.modeAlpha != modeAlpha)) {
+		b.modeRGB = modeRGB;
+		b.modeAlpha = modeAlpha;
+		device.blendEquation(drawBuffer, modeRGB, modeAlpha);
+	}
+}
+
+void StateCache::blendFunc(unsigned drawBuffer, GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+	if (drawBuffer >= kNumDrawBuffers) {
+		update(StateCategory::Blend, true);
+		device.blendFunc(drawBuffer, srcRGB, dstRGB, srcAlpha, dstAlpha);
+		return;
+	}
+	auto &b = blend[drawBuffer];
+	if (update(StateCategory::Blend, b.srcRGB != srcRGB || b.dstRGB != dstRGB || b.srcAlpha != srcAlpha || b.dstAlpha != dstAlpha)) {
+		b.srcRGB = srcRGB;
+		b.dstRGB = dstRGB;
+		b.srcAlpha = srcAlpha;
+		b.dstAlpha = dstAlpha;
+		device.blendFunc(drawBuffer, srcRGB, dstRGB, srcAlpha, dstAlpha);
+	}
+}
+
+void StateCache::colorMask(bool enabled)
+{
+	if (update(StateCategory::Raster, color_mask != static_cast<int>(enabled))) {
+		color_mask = enabled;
+		device.colorMask(enabled);
+	}
+}
+
+void StateCache::stencilFunc(GLenum func, int ref, unsigned mask)
+{
+	if (update(StateCategory::Raster, func != stencil_func || ref != stencil_ref || mask != stencil_mask)) {
+		stencil_func = func;
+		stencil_ref = ref;
+		stencil_mask = mask;
+		device.stencilFunc(func, ref, mask);
+	}
+}
+
+void StateCache::stencilOp(GLenum face, GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+{
+	StencilOp op{ stencilFail, depthFail, depthPass };
+	auto same = [&](const StencilOp &cur) {
+		return cur.stencilFail == op.stencilFail && cur.depthFail == op.depthFail && cur.depthPass == op.depthPass;
+	};
+	bool front = face != gl::BACK;
+	bool back = face != gl::FRONT;
+	if (update(StateCategory::Raster, (front && !same(stencil_op[0])) || (back && !same(stencil_op[1])))) {
+		if (front)
+			stencil_op[0] = op;
+		if (back)
+			stencil_op[1] = op;
+		device.stencilOp(face, stencilFail, depthFail, depthPass);
+	}
+}
+
+//---------------------------
+// bindings
+void StateCache::useProgram(GLuint prog)
+{
+	if (update(StateCategory::Program, prog != program)) {
+		program = prog;
+		device.useProgram(prog);
+	}
+}
+
+void StateCache::bindVertexArray(GLuint vao)
+{
+	if (update(StateCategory::VertexArray, vao != vertex_array)) {
+		vertex_array = vao;
+		invalidateVertexBuffers();
+		device.bindVertexArray(vao);
+	}
+}
+
+void StateCache::bindVertexBuffers(unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides)
+{
+	// null buffers: unbind all
+	auto binding = [&](unsigned i) {
+		return buffers ? BufferBinding{ buffers[i - first], offsets[i - first], strides[i - first] } : BufferBinding{ 0, 0, 0 };
+	};
+	unsigned lo, hi;
+	findChangedRange(first, count, kNumBufferSlots, filtering, [&](unsigned i) {
+		auto b = binding(i);
+		auto &cur = vertex_buffers[i];
+		return cur.obj == b.obj && (!b.obj || (cur.offset == b.offset && cur.size == b.size));
+	}, lo, hi);
+	if (!update(StateCategory::VertexBuffers, lo != hi))
+		return;
+	for (auto i = lo; i < std::min(hi, kNumBufferSlots); ++i)
+		vertex_buffers[i] = binding(i);
+	auto skip = lo - first;
+	device.bindVertexBuffers(lo, hi - lo,
+		buffers ? buffers + skip : nullptr,
+		buffers ? offsets + skip : nullptr,
+		buffers ? strides + skip : nullptr);
+}
+
+void StateCache::bindBuffersRange(GLenum target, unsigned first, unsigned count, const GLuint *buffers, const GLintptr *offsets, const GLsizeiptr *sizes)
+{
+	auto shadow = getBufferBindings(target);
+	if (!shadow) {
+		update(StateCategory::BufferRanges, true);
+		device.bindBuffersRange(target, first, count, buffers, offsets, sizes);
+		return;
+	}
+	auto binding = [&](unsigned i) {
+		return buffers ? BufferBinding{ buffers[i - first], offsets[i - first], sizes[i - first] } : BufferBinding{ 0, 0, 0 };
+	};
+	unsigned lo, hi;
+	findChangedRange(first, count, kNumBufferSlots, filtering, [&](unsigned i) {
+		auto b = binding(i);
+		auto &cur = shadow[i];
+		return cur.obj == b.obj && (!b.obj || (cur.offset == b.offset && cur.size == b.size));
+	}, lo, hi);
+	if (!update(StateCategory::BufferRanges, lo != hi))
+		return;
+	for (auto i = lo; i < std::min(hi, kNumBufferSlots); ++i)
+		shadow[i] = binding(i);
+	auto skip = lo - first;
+	device.bindBuffersRange(target, lo, hi - lo,
+		buffers ? buffers + skip : nullptr,
+		buffers ? offsets + skip : nullptr,
+		buffers ? sizes + skip : nullptr);
+}
+
+void StateCache::bindTextures(unsigned first, unsigned count, const GLuint *texs)
+{
+	auto name = [&](unsigned i) { return texs ? texs[i - first] : 0; };
+	unsigned lo, hi;
+	findChangedRange(first, count, kNumTextureUnits, filtering, [&](unsigned i) {
+		return textures[i] == name(i);
+	}, lo, hi);
+	if (!update(StateCategory::Textures, lo != hi))
+		return;
+	for (auto i = lo; i < std::min(hi, kNumTextureUnits); ++i)
+		textures[i] = name(i);
+	device.bindTextures(lo, hi - lo, texs ? texs + (lo - first) : nullptr);
+}
+
+void StateCache::bindSamplers(unsigned first, unsigned count, const GLuint *samps)
+{
+	auto name = [&](unsigned i) { return samps ? samps[i - first] : 0; };
+	unsigned lo, hi;
+	findChangedRange(first, count, kNumTextureUnits, filtering, [&](unsigned i) {
+		return samplers[i] == name(i);
+	}, lo, hi);
+	if (!update(StateCategory::Samplers, lo != hi))
+		return;
+	for (auto i = lo; i < std::min(hi, kNumTextureUnits); ++i)
+		samplers[i] = name(i);
+	device.bindSamplers(lo, hi - lo, samps ? samps + (lo - first) : nullptr);
+}
+
+//---------------------------
+// draw calls
+void StateCache::drawElements(GLenum mode, GLuint indexBuffer, GLenum indexType, size_t indexOffset, unsigned indexCount, int baseVertex, unsigned baseInstance, unsigned instanceCount)
+{
+	device.drawElements(mode, indexBuffer, indexType, indexOffset, indexCount, baseVertex, baseInstance, instanceCount);
+}
+
+void StateCache::drawArrays(GLenum mode, unsigned first, unsigned count)
+{
+	device.drawArrays(mode, first, count);
+}
+
+void StateCache::multiDrawElementsIndirect(GLenum mode, GLuint indexBuffer, GLenum indexType, GLuint indirectBuffer, size_t indirectOffset, unsigned drawCount, unsigned stride)
+{
+	device.multiDrawElementsIndirect(mode, indexBuffer, indexType, indirectBuffer, indirectOffset, drawCount, stride);
+}
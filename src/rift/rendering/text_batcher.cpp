@@ -0,0 +1,173 @@
+#include <rendering/text_batcher.hpp>
+#include <log.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+
+namespace
+{
+	// see text.glsl
+	struct TextParams
+	{
+		glm::mat4 transform;
+		glm::vec4 outlineColor;
+	};
+
+	const std::vector<TextVertex> kNoVertices;
+}
+
+const std::vector<GlyphQuad> &TextBatcher::layout(const Font &font, const char *str)
+{
+	lookupKey.font = &font;
+	lookupKey.str.assign(str);
+	auto it = runs.find(lookupKey);
+	if (it != runs.end()) {
+		++stats.numCacheHits;
+		it->second.lastFrame = frame;
+		return it->second.quads;
+	}
+
+	++stats.numCacheMisses;
+	GlyphRun run;
+	run.lastFrame = frame;
+	auto &metrics = font.getMetrics();
+	glm::vec2 texScale(1.0f / metrics.scaleW, 1.0f / metrics.scaleH);
+	int x = 0;
+	for (auto p = str; *p; ++p) {
+		const Font::Glyph *g = nullptr;
+		// TODO: real utf-8
+		if (!font.getGlyph(static_cast<char32_t>(*p), g)) {
+			WARNING << "No glyph for character " << *p;
+			continue;
+		}
+		if (g->width && g->height) {
+			GlyphQuad q;
+			q.min = glm::vec2(x + g->xOffset, g->yOffset);
+			q.max = q.min + glm::vec2(g->width, g->height);
+			q.texMin = glm::vec2(g->x, g->y) * texScale;
+			q.texMax = glm::vec2(g->x + g->width, g->y + g->height) * texScale;
+			run.quads.push_back(q);
+		}
+		x += g->xAdvance;
+	}
+	return runs.emplace(lookupKey, std::move(run)).first->second.quads;
+}
+
+TextBatcher::Batch &TextBatcher::getBatch(const Font &font)
+{
+	for (auto &batch : batches)
+		if (batch.font == &font)
+			return batch;
+	batches.push_back(Batch{ &font, {} });
+	return batches.back();
+}
+
+void TextBatcher::addQuads(Batch &batch, const std::vector<GlyphQuad> &quads, glm::vec2 offset, glm::uint32 color)
+{
+	auto first = batch.vertices.size();
+	batch.vertices.resize(first + quads.size() * 4);
+	auto v = batch.vertices.data() + first;
+	for (auto &q : quads) {
+		auto min = q.min + offset;
+		auto max = q.max + offset;
+		v[0] = TextVertex{ min.x, min.y, q.texMin.x, q.texMin.y, color };
+		v[1] = TextVertex{ max.x, min.y, q.texMax.x, q.texMin.y, color };
+		v[2] = TextVertex{ min.x, max.y, q.texMin.x, q.texMax.y, color };
+		v[3] = TextVertex{ max.x, max.y, q.texMax.x, q.texMax.y, color };
+		v += 4;
+	}
+	stats.numQuads += static_cast<unsigned>(quads.size());
+}
+
+void TextBatcher::addText(const Font &font, glm::ivec2 pos, const char *str, const glm::vec4 &color)
+{
+	auto &quads = layout(font, str);
+	addQuads(getBatch(font), quads, glm::vec2(pos), glm::packUnorm4x8(color));
+	++stats.numStrings;
+}
+
+void TextBatcher::addTextShadow(const Font &font, glm::ivec2 pos, const char *str, const glm::vec4 &color,
+	glm::ivec2 shadowOffset, const glm::vec4 &shadowColor)
+{
+	auto &quads = layout(font, str);
+	auto &batch = getBatch(font);
+	addQuads(batch, quads, glm::vec2(pos + shadowOffset), glm::packUnorm4x8(shadowColor));
+	addQuads(batch, quads, glm::vec2(pos), glm::packUnorm4x8(color));
+	++stats.numStrings;
+}
+
+const std::vector<TextVertex> &TextBatcher::getVertices(const Font &font) const
+{
+	for (auto &batch : batches)
+		if (batch.font == &font)
+			return batch.vertices;
+	return kNoVertices;
+}
+
+void TextBatcher::flush(GraphicsContext &gc, GLuint program, glm::ivec2 viewportSize)
+{
+	bool empty = std::all_of(batches.begin(), batches.end(), [](const Batch &batch) {
+		return batch.vertices.empty();
+	});
+	if (empty)
+		return;
+
+	if (!vao.obj) {
+		vao.create(1, { { ElementFormat::Float4, 0 }, { ElementFormat::Unorm8x4, 0 } });
+		std::vector<uint16_t> indices(kMaxQuadsPerDraw * 6);
+		for (auto i = 0u; i < kMaxQuadsPerDraw; ++i) {
+			indices[i * 6] = i * 4;
+			indices[i * 6 + 1] = i * 4 + 1;
+			indices[i * 6 + 2] = i * 4 + 3;
+			indices[i * 6 + 3] = i * 4;
+			indices[i * 6 + 4] = i * 4 + 3;
+			indices[i * 6 + 5] = i * 4 + 2;
+		}
+		indexBuffer = gc.createBuffer(gl::ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data());
+	}
+
+	TextParams params;
+	params.transform = glm::ortho(0.0f, float(viewportSize.x), float(viewportSize.y), 0.0f);
+	params.outlineColor = glm::vec4(0.0f);
+	auto cb = gc.createTransientBuffer(gl::UNIFORM_BUFFER, params);
+	auto &device = getGraphicsDevice();
+	device.useProgram(program);
+	device.setEnabled(gl::CULL_FACE, false);
+	device.setEnabled(gl::DEPTH_TEST, false);
+	bindBuffersRangeHelper(0, { cb });
+	GLuint sampler = gc.getSamplerLinearClamp();
+	device.bindSamplers(0, 1, &sampler);
+	for (auto &batch : batches) {
+		if (batch.vertices.empty())
+			continue;
+		auto vb = gc.createTransientBuffer(gl::ARRAY_BUFFER, batch.vertices.size() * sizeof(TextVertex), batch.vertices.data());
+		bindVertexBuffers({ vb }, vao);
+		GLuint texture = batch.font->getTexture().getGL();
+		device.bindTextures(0, 1, &texture);
+		auto numQuads = static_cast<unsigned>(batch.vertices.size() / 4);
+		for (auto first = 0u; first < numQuads; first += kMaxQuadsPerDraw) {
+			auto count = std::min(numQuads - first, unsigned(kMaxQuadsPerDraw));
+			drawIndexed(gl::TRIANGLES, *indexBuffer, first * 4, 0, count * 6, 0, 1);
+			++stats.numDrawCalls;
+		}
+		batch.vertices.clear();
+	}
+	device.setEnabled(gl::DEPTH_TEST, true);
+}
+
+void TextBatcher::endFrame()
+{
+	for (auto it = runs.begin(); it != runs.end();) {
+		if (frame - it->second.lastFrame >= kRunCacheFrames)
+			it = runs.erase(it);
+		else
+			++it;
+	}
+	++frame;
+	stats = Stats();
+}
+
+void TextBatcher::clearCache()
+{
+	runs.clear();
+	batches.clear();
+}
@@ -1,15 +1,13 @@
 #include <rendering/opengl4.hpp>
+#include <profiler.hpp>
 
 GLuint createTexture2D(ElementFormat pixelFormat, unsigned numMipLevels, unsigned width, unsigned height, const void *initialData)
 {
-	GLuint tex;
+	auto &device = getGraphicsDevice();
 	const auto &pf = getElementFormatInfoGL(pixelFormat);
-	gl::GenTextures(1, &tex);
-	gl::BindTexture(gl::TEXTURE_2D, tex);
-	gl::TexStorage2D(gl::TEXTURE_2D, numMipLevels, pf.internalFormat, width, height);
-	gl::BindTexture(gl::TEXTURE_2D, 0);
+	auto tex = device.createTexture(gl::TEXTURE_2D, numMipLevels, pf.internalFormat, width, height);
 	if (initialData)
-		gl::TexSubImage2D(gl::TEXTURE_2D, 0, 0, 0, width, height, pf.externalFormat, pf.type, initialData);
+		device.updateTexture(tex, gl::TEXTURE_2D, gl::TEXTURE_2D, 0, glm::ivec2(0, 0), glm::ivec2(width, height), pf.externalFormat, pf.type, initialData);
 	return tex;
 }
 
@@ -24,15 +22,7 @@ TextureCubeMap::TextureCubeMap(
 	format(pixelFormat_),
 	glformat(getElementFormatInfoGL(pixelFormat_).internalFormat)
 {
-	gl::GenTextures(1, &id);
-	const auto &pf = getElementFormatInfoGL(pixelFormat_);
-	if (gl::exts::var_EXT_direct_state_access) {
-		gl::TextureStorage2DEXT(id, gl::TEXTURE_CUBE_MAP, numMipLevels_, glformat, size.x, size.y);
-	}
-	else {
-		gl::BindTexture(gl::TEXTURE_CUBE_MAP, id);
-		gl::TexStorage2D(gl::TEXTURE_CUBE_MAP, numMipLevels_, glformat, size.x, size.y);
-	}
+	id = getGraphicsDevice().createTexture(gl::TEXTURE_CUBE_MAP, numMipLevels_, glformat, size.x, size.y);
 
 	for (int i = 0; i < 6; ++i) {
 		if (faceData[i])
@@ -49,34 +39,16 @@ void TextureCubeMap::update(
 	)
 {
 	const auto &pf = getElementFormatInfoGL(format);
-	if (gl::exts::var_EXT_direct_state_access)
-	{
-		gl::TextureSubImage2DEXT(
-			id,
-			gl::TEXTURE_CUBE_MAP_POSITIVE_X + face,
-			mipLevel,
-			offset.x,
-			offset.y,
-			size.x,
-			size.y,
-			pf.externalFormat,
-			pf.type,
-			data);
-	}
-	else
-	{
-		gl::BindTexture(gl::TEXTURE_CUBE_MAP, id);
-		gl::TexSubImage2D(gl::TEXTURE_CUBE_MAP_POSITIVE_X + face,
-			mipLevel,
-			offset.x,
-			offset.y,
-			size.x,
-			size.y,
-			pf.externalFormat,
-			pf.type,
-			data);
-		gl::BindTexture(gl::TEXTURE_CUBE_MAP, 0);
-	}
+	getGraphicsDevice().updateTexture(
+		id,
+		gl::TEXTURE_CUBE_MAP,
+		gl::TEXTURE_CUBE_MAP_POSITIVE_X + face,
+		mipLevel,
+		offset,
+		size,
+		pf.externalFormat,
+		pf.type,
+		data);
 }
 
 Texture2D::Texture2D(
@@ -90,19 +62,7 @@ Texture2D::Texture2D(
 	format(pixelFormat_),
 	glformat(getElementFormatInfoGL(pixelFormat_).internalFormat)
 {
-	GLuint tex;
-	gl::GenTextures(1, &tex);
-	const auto &pf = getElementFormatInfoGL(pixelFormat_);
-	if (gl::exts::var_EXT_direct_state_access) {
-		gl::TextureStorage2DEXT(tex, gl::TEXTURE_2D, numMipLevels_, glformat, size.x, size.y);
-	}
-	else {
-		gl::BindTexture(gl::TEXTURE_2D, tex);
-		gl::TexStorage2D(gl::TEXTURE_2D, numMipLevels_, glformat, size.x, size.y);
-		gl::BindTexture(gl::TEXTURE_2D, 0);
-	}
-
-	id = tex;
+	id = getGraphicsDevice().createTexture(gl::TEXTURE_2D, numMipLevels_, glformat, size.x, size.y);
 
 	if (data_)
 		update(0, { 0, 0 }, size, data_);
@@ -117,35 +77,16 @@ void Texture2D::update(
 	)
 {
 	const auto &pf = getElementFormatInfoGL(format);
-	if (gl::exts::var_EXT_direct_state_access)
-	{
-		gl::TextureSubImage2DEXT(
-			id,
-			gl::TEXTURE_2D,
-			mipLevel,
-			offset.x,
-			offset.y,
-			size.x,
-			size.y,
-			pf.externalFormat,
-			pf.type,
-			data);
-	}
-	else
-	{
-		gl::BindTexture(gl::TEXTURE_2D, id);
-		gl::TexSubImage2D(
-			gl::TEXTURE_2D,
-			mipLevel,
-			offset.x,
-			offset.y,
-			size.x,
-			size.y,
-			pf.externalFormat,
-			pf.type,
-			data);
-		gl::BindTexture(gl::TEXTURE_2D, 0);
-	}
+	getGraphicsDevice().updateTexture(
+		id,
+		gl::TEXTURE_2D,
+		gl::TEXTURE_2D,
+		mipLevel,
+		offset,
+		size,
+		pf.externalFormat,
+		pf.type,
+		data);
 }
 
 Texture2D::Ptr Texture2D::createFromImage(const Image &image)
@@ -179,6 +120,7 @@ TextureCubeMap::Ptr TextureCubeMap::createFromImage(const Image &image)
 Texture2D *loadTexture2DAsset(AssetDatabase &assetDb, GraphicsContext &gc, std::string assetId)
 {
 	return assetDb.loadAsset<Texture2D>(assetId, [&]{
+		PROFILE_SCOPE("loadTexture2DAsset");
 		Image img = Image::loadFromFile(assetId.c_str());
 		return Texture2D::createFromImage(img);
 	});
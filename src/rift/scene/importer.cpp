@@ -3,6 +3,7 @@
 #include <utils/binary_io.hpp>
 #include <rendering/opengl4.hpp>
 #include <asset_database.hpp>
+#include <profiler.hpp>
 
 namespace fs = std::experimental::filesystem;
 
@@ -63,6 +64,7 @@ namespace
 
 void Scene::loadFromFile(GraphicsContext &gc, const char *path)
 {
+	PROFILE_SCOPE("Scene::loadFromFile");
 	auto dir = fs::path(path).parent_path();
 
 	AssetMap asset_map;
@@ -124,17 +126,18 @@ void Scene::loadFromFile(GraphicsContext &gc, const char *path)
 					unsigned parent_id;
 					bin >> parent_id;
 					entityToParentFileId[id] = parent_id;
-					auto t = getTransformNode(id);
-					bin >> t->transform.position.x;
-					bin >> t->transform.position.y;
-					bin >> t->transform.position.z;
-					bin >> t->transform.rotation.x;
-					bin >> t->transform.rotation.y;
-					bin >> t->transform.rotation.z;
-					bin >> t->transform.rotation.w;
-					bin >> t->transform.scaling.x;
-					bin >> t->transform.scaling.y;
-					bin >> t->transform.scaling.z;
+					Transform t;
+					bin >> t.position.x;
+					bin >> t.position.y;
+					bin >> t.position.z;
+					bin >> t.rotation.x;
+					bin >> t.rotation.y;
+					bin >> t.rotation.z;
+					bin >> t.rotation.w;
+					bin >> t.scaling.x;
+					bin >> t.scaling.y;
+					bin >> t.scaling.z;
+					transforms.setLocalTransform(id, t);
 				}
 				else if (c == CC_Mesh)
 				{
@@ -163,10 +166,9 @@ void Scene::loadFromFile(GraphicsContext &gc, const char *path)
 	// fix parent relations
 	for (auto &ent : entityToParentFileId)
 	{
-		auto &t = transforms[ent.first];
 		if (ent.second != -1)
-			t.parent = fileIdToEntity[ent.second];
+			transforms.setParent(ent.first, fileIdToEntity[ent.second]);
 		else
-			t.parent = -1;
+			transforms.setParent(ent.first, -1);
 	}
 }
@@ -18,15 +18,14 @@ EntityID Scene::createEntity()
 {
 	auto id = lastEntityID++;
 	entities.push_back(id);
-	transforms.insert(std::make_pair(id, TransformNode()));
+	transforms.add(id);
 	return id;
 }
 
 EntityID Scene::createLightPrefab(const Transform &transform, LightMode lightMode, const glm::vec3 &intensity)
 {
 	auto id = createEntity();
-	auto t = getTransformNode(id);
-	t->transform = transform;
+	transforms.setLocalTransform(id, transform);
 	auto light = CreateComponent(lightNodes, id);
 	light->light.intensity = intensity;
 	light->light.mode = lightMode;
@@ -36,8 +35,7 @@ EntityID Scene::createLightPrefab(const Transform &transform, LightMode lightMod
 EntityID Scene::createMeshPrefab(const Transform &transform, Mesh &mesh, Material &material)
 {
 	auto id = createEntity();
-	auto t = getTransformNode(id);
-	t->transform = transform;
+	transforms.setLocalTransform(id, transform);
 	auto meshNode = CreateComponent(meshNodes, id);
 	meshNode->entity = id;
 	meshNode->material = &material;
@@ -45,11 +43,6 @@ EntityID Scene::createMeshPrefab(const Transform &transform, Mesh &mesh, Materia
 	return id;
 }
 
-TransformNode *Scene::getTransformNode(EntityID id)
-{
-	return &transforms[id];
-}
-
 MeshNode *Scene::createMeshNode(EntityID id, Mesh &mesh, Material &material)
 {
 	auto m = CreateComponent(meshNodes, id);
@@ -80,6 +73,18 @@ util::array_ref<EntityID> Scene::getEntities() const
 	return util::make_array_ref(entities);
 }
 
+unsigned Scene::markOccluders(float minRadius)
+{
+	unsigned count = 0;
+	for (auto &it : meshNodes) {
+		auto &meshNode = it.second;
+		auto sphere = transformSphere(meshNode.mesh->boundingSphere, transforms.getWorldMatrix(it.first));
+		meshNode.occluder = sphere.radius > minRadius;
+		count += meshNode.occluder;
+	}
+	return count;
+}
+
 void Scene::deleteEntity(EntityID id)
 {
 	LOG << "deleteEntity: TODO";
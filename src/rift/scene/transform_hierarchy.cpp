@@ -0,0 +1,237 @@
+#include <scene/transform_hierarchy.hpp>
+#include <utils/thread_pool.hpp>
+#include <atomic>
+#include <cassert>
+#include <type_traits>
+
+namespace
+{
+	const unsigned kNoParent = ~0u;
+	// root subtrees per job
+	const unsigned kRootsPerJob = 64;
+}
+
+unsigned TransformHierarchy::getIndex(EntityID id) const
+{
+	auto it = indices.find(id);
+	assert(it != indices.end() && "entity not in the transform hierarchy");
+	return it->second;
+}
+
+bool TransformHierarchy::contains(EntityID id) const
+{
+	return indices.count(id) != 0;
+}
+
+void TransformHierarchy::add(EntityID id, const Transform &local)
+{
+	assert(!contains(id));
+	indices[id] = static_cast<unsigned>(entities.size());
+	entities.push_back(id);
+	parents.push_back(kNoParent);
+	positions.push_back(local.position);
+	rotations.push_back(local.rotation);
+	scalings.push_back(local.scaling);
+	localMatrices.push_back(glm::mat4(1.0f));
+	worldMatrices.push_back(glm::mat4(1.0f));
+	dirty.push_back(1);
+	changed.push_back(0);
+	// a new root at the end keeps the order valid
+	if (!orderDirty) {
+		if (rootRanges.empty())
+			rootRanges.push_back(0);
+		rootRanges.push_back(static_cast<unsigned>(entities.size()));
+	}
+}
+
+void TransformHierarchy::remove(EntityID id)
+{
+	auto index = getIndex(id);
+	auto last = static_cast<unsigned>(entities.size() - 1);
+	for (auto i = 0u; i <= last; ++i) {
+		if (parents[i] == index) {
+			// children become roots
+			parents[i] = kNoParent;
+			dirty[i] = 1;
+		}
+		else if (parents[i] == last)
+			parents[i] = index;
+	}
+	// move the last node in place of the removed one
+	entities[index] = entities[last];
+	parents[index] = parents[last] == index ? kNoParent : parents[last];
+	positions[index] = positions[last];
+	rotations[index] = rotations[last];
+	scalings[index] = scalings[last];
+	localMatrices[index] = localMatrices[last];
+	worldMatrices[index] = worldMatrices[last];
+	dirty[index] = dirty[last];
+	indices[entities[index]] = index;
+	indices.erase(id);
+	entities.pop_back();
+	parents.pop_back();
+	positions.pop_back();
+	rotations.pop_back();
+	scalings.pop_back();
+	localMatrices.pop_back();
+	worldMatrices.pop_back();
+	dirty.pop_back();
+	changed.pop_back();
+	orderDirty = true;
+}
+
+void TransformHierarchy::setParent(EntityID id, EntityID parent)
+{
+	auto index = getIndex(id);
+	auto parentIndex = parent == static_cast<EntityID>(-1) ? kNoParent : getIndex(parent);
+	if (parents[index] == parentIndex)
+		return;
+#ifndef NDEBUG
+	for (auto p = parentIndex; p != kNoParent; p = parents[p])
+		assert(p != index && "cycle in the transform hierarchy");
+#endif
+	parents[index] = parentIndex;
+	dirty[index] = 1;
+	orderDirty = true;
+}
+
+EntityID TransformHierarchy::getParent(EntityID id) const
+{
+	auto parent = parents[getIndex(id)];
+	return parent == kNoParent ? static_cast<EntityID>(-1) : entities[parent];
+}
+
+void TransformHierarchy::setLocalTransform(EntityID id, const Transform &local)
+{
+	auto index = getIndex(id);
+	positions[index] = local.position;
+	rotations[index] = local.rotation;
+	scalings[index] = local.scaling;
+	dirty[index] = 1;
+}
+
+Transform TransformHierarchy::getLocalTransform(EntityID id) const
+{
+	auto index = getIndex(id);
+	Transform t;
+	t.position = positions[index];
+	t.rotation = rotations[index];
+	t.scaling = scalings[index];
+	return t;
+}
+
+const glm::mat4 &TransformHierarchy::getWorldMatrix(EntityID id) const
+{
+	return worldMatrices[getIndex(id)];
+}
+
+void TransformHierarchy::rebuildOrder()
+{
+	const auto n = static_cast<unsigned>(entities.size());
+	// children of each node (CSR)
+	std::vector<unsigned> childStart(n + 1, 0);
+	for (auto i = 0u; i < n; ++i)
+		if (parents[i] != kNoParent)
+			childStart[parents[i] + 1]++;
+	for (auto i = 0u; i < n; ++i)
+		childStart[i + 1] += childStart[i];
+	std::vector<unsigned> children(childStart[n]);
+	std::vector<unsigned> fill(childStart.begin(), childStart.end() - 1);
+	for (auto i = 0u; i < n; ++i)
+		if (parents[i] != kNoParent)
+			children[fill[parents[i]]++] = i;
+
+	// depth-first order (new index -> old index)
+	std::vector<unsigned> order;
+	order.reserve(n);
+	std::vector<unsigned> stack;
+	rootRanges.clear();
+	for (auto root = 0u; root < n; ++root) {
+		if (parents[root] != kNoParent)
+			continue;
+		rootRanges.push_back(static_cast<unsigned>(order.size()));
+		stack.push_back(root);
+		while (!stack.empty()) {
+			auto node = stack.back();
+			stack.pop_back();
+			order.push_back(node);
+			// reversed, so that children keep their relative order
+			for (auto c = childStart[node + 1]; c > childStart[node]; --c)
+				stack.push_back(children[c - 1]);
+		}
+	}
+	rootRanges.push_back(n);
+	assert(order.size() == n && "cycle in the transform hierarchy");
+
+	std::vector<unsigned> newIndex(n);
+	for (auto i = 0u; i < n; ++i)
+		newIndex[order[i]] = i;
+	auto permute = [&](auto &v) {
+		std::remove_reference_t<decltype(v)> tmp(n);
+		for (auto i = 0u; i < n; ++i)
+			tmp[i] = v[order[i]];
+		v.swap(tmp);
+	};
+	permute(entities);
+	permute(parents);
+	permute(positions);
+	permute(rotations);
+	permute(scalings);
+	permute(localMatrices);
+	permute(worldMatrices);
+	permute(dirty);
+	for (auto &p : parents)
+		if (p != kNoParent)
+			p = newIndex[p];
+	for (auto i = 0u; i < n; ++i)
+		indices[entities[i]] = i;
+	orderDirty = false;
+}
+
+unsigned TransformHierarchy::updateRange(unsigned begin, unsigned end)
+{
+	unsigned count = 0;
+	for (auto i = begin; i < end; ++i) {
+		auto parent = parents[i];
+		// parents come first: their flag is already set for this update
+		auto parentChanged = parent != kNoParent && changed[parent];
+		if (dirty[i]) {
+			Transform t;
+			t.position = positions[i];
+			t.rotation = rotations[i];
+			t.scaling = scalings[i];
+			localMatrices[i] = t.toMatrix();
+		}
+		if (dirty[i] || parentChanged) {
+			worldMatrices[i] = parent != kNoParent ? worldMatrices[parent] * localMatrices[i] : localMatrices[i];
+			changed[i] = 1;
+			++count;
+		}
+		else
+			changed[i] = 0;
+		dirty[i] = 0;
+	}
+	return count;
+}
+
+void TransformHierarchy::update(util::thread_pool *pool)
+{
+	if (orderDirty)
+		rebuildOrder();
+	// empty: no root ranges either
+	if (entities.empty()) {
+		numUpdated = 0;
+		return;
+	}
+	const auto numRoots = static_cast<unsigned>(rootRanges.size()) - 1;
+	if (!pool || numRoots <= kRootsPerJob) {
+		numUpdated = updateRange(0, static_cast<unsigned>(entities.size()));
+		return;
+	}
+	// subtrees are contiguous: each job gets a range of root subtrees
+	std::atomic<unsigned> count{ 0 };
+	pool->parallel_for(numRoots, kRootsPerJob, [&](unsigned begin, unsigned end) {
+		count += updateRange(rootRanges[begin], rootRanges[end]);
+	});
+	numUpdated = count;
+}
@@ -0,0 +1,91 @@
+#include <utils/thread_pool.hpp>
+#include <algorithm>
+
+namespace util
+{
+	thread_pool::thread_pool(int num_workers) : next_chunk(0), chunks_done(0)
+	{
+		if (num_workers < 0)
+			num_workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency())) - 1;
+		for (auto i = 0; i < num_workers; ++i)
+			workers.emplace_back([this] { worker_main(); });
+	}
+
+	thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		job_cv.notify_all();
+		for (auto &t : workers)
+			t.join();
+	}
+
+	void thread_pool::parallel_for(unsigned count, unsigned grain, const std::function<void(unsigned, unsigned)> &fn)
+	{
+		if (!count)
+			return;
+		grain = std::max(grain, 1u);
+		auto chunks = (count + grain - 1) / grain;
+		if (workers.empty() || chunks == 1) {
+			fn(0, count);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job_fn = &fn;
+			job_count = count;
+			job_grain = grain;
+			num_chunks = chunks;
+			next_chunk = 0;
+			chunks_done = 0;
+			++job_id;
+		}
+		job_cv.notify_all();
+		run_chunks();
+		// also wait for the workers to leave the job before it goes out of scope
+		std::unique_lock<std::mutex> lock(mutex);
+		done_cv.wait(lock, [&] { return chunks_done == num_chunks && !active_workers; });
+		job_fn = nullptr;
+	}
+
+	void thread_pool::run_chunks()
+	{
+		for (;;) {
+			auto chunk = next_chunk++;
+			if (chunk >= num_chunks)
+				return;
+			auto begin = chunk * job_grain;
+			(*job_fn)(begin, std::min(begin + job_grain, job_count));
+			++chunks_done;
+		}
+	}
+
+	void thread_pool::worker_main()
+	{
+		unsigned last_job = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				job_cv.wait(lock, [&] { return stop || (job_id != last_job && job_fn); });
+				if (stop)
+					return;
+				last_job = job_id;
+				++active_workers;
+			}
+			run_chunks();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				--active_workers;
+			}
+			done_cv.notify_all();
+		}
+	}
+
+	thread_pool &get_thread_pool()
+	{
+		static thread_pool pool;
+		return pool;
+	}
+}
@@ -0,0 +1,277 @@
+#include <utils/tlsf_allocator.hpp>
+#include <cassert>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace util
+{
+	namespace
+	{
+		const uint32_t kNull = tlsf_allocator::invalid_handle;
+
+		// index of the lowest set bit (v != 0)
+		uint32_t bitScanForward(uint32_t v)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, v);
+			return index;
+#else
+			return __builtin_ctz(v);
+#endif
+		}
+
+		// index of the highest set bit (v != 0)
+		uint32_t bitScanReverse(uint32_t v)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanReverse(&index, v);
+			return index;
+#else
+			return 31 - __builtin_clz(v);
+#endif
+		}
+	}
+
+	tlsf_allocator::tlsf_allocator(uint32_t capacity)
+	{
+		reset(capacity);
+	}
+
+	void tlsf_allocator::reset(uint32_t capacity)
+	{
+		capacity_ = capacity & ~(granularity - 1);
+		bytes_used_ = 0;
+		fl_bitmap = 0;
+		std::fill(std::begin(sl_bitmap), std::end(sl_bitmap), 0);
+		for (auto &fl : free_heads)
+			std::fill(std::begin(fl), std::end(fl), kNull);
+		blocks.clear();
+		unused_blocks.clear();
+		if (capacity_) {
+			// one big free block
+			auto b = new_block();
+			blocks[b].offset = 0;
+			blocks[b].size = capacity_;
+			insert_free(b);
+		}
+	}
+
+	void tlsf_allocator::mapping_insert(uint32_t size, uint32_t &fl, uint32_t &sl)
+	{
+		auto units = size >> granularity_log2;
+		if (units < sl_count) {
+			// small blocks: linear bins
+			fl = 0;
+			sl = units;
+		}
+		else {
+			auto f = bitScanReverse(units);
+			sl = (units >> (f - sl_count_log2)) - sl_count;
+			fl = f - sl_count_log2 + 1;
+		}
+	}
+
+	void tlsf_allocator::mapping_search(uint32_t size, uint32_t &fl, uint32_t &sl)
+	{
+		// round up to the next bin so that any block in the bin is large enough
+		auto units = size >> granularity_log2;
+		if (units >= sl_count) {
+			auto round = (1u << (bitScanReverse(units) - sl_count_log2)) - 1;
+			size += round << granularity_log2;
+		}
+		mapping_insert(size, fl, sl);
+	}
+
+	uint32_t tlsf_allocator::bin_size(uint32_t fl, uint32_t sl)
+	{
+		// inverse of mapping_insert: smallest size in the bin
+		if (fl == 0)
+			return sl << granularity_log2;
+		return ((sl_count + sl) << (fl - 1)) << granularity_log2;
+	}
+
+	uint32_t tlsf_allocator::find_free(uint32_t &fl, uint32_t &sl) const
+	{
+		auto sl_map = sl < 32 ? sl_bitmap[fl] & (~0u << sl) : 0;
+		if (!sl_map) {
+			// nothing in this first-level bin, look in larger ones
+			auto fl_map = fl + 1 < 32 ? fl_bitmap & (~0u << (fl + 1)) : 0;
+			if (!fl_map)
+				return kNull;
+			fl = bitScanForward(fl_map);
+			sl_map = sl_bitmap[fl];
+		}
+		sl = bitScanForward(sl_map);
+		return free_heads[fl][sl];
+	}
+
+	uint32_t tlsf_allocator::new_block()
+	{
+		uint32_t b;
+		if (!unused_blocks.empty()) {
+			b = unused_blocks.back();
+			unused_blocks.pop_back();
+		}
+		else {
+			b = static_cast<uint32_t>(blocks.size());
+			blocks.push_back(block());
+		}
+		auto &blk = blocks[b];
+		blk.offset = 0;
+		blk.size = 0;
+		blk.prev_phys = kNull;
+		blk.next_phys = kNull;
+		blk.prev_free = kNull;
+		blk.next_free = kNull;
+		blk.free = false;
+		blk.allocated = false;
+		return b;
+	}
+
+	void tlsf_allocator::release_block(uint32_t b)
+	{
+		blocks[b].allocated = false;
+		blocks[b].free = false;
+		unused_blocks.push_back(b);
+	}
+
+	void tlsf_allocator::insert_free(uint32_t b)
+	{
+		uint32_t fl, sl;
+		mapping_insert(blocks[b].size, fl, sl);
+		auto head = free_heads[fl][sl];
+		blocks[b].free = true;
+		blocks[b].prev_free = kNull;
+		blocks[b].next_free = head;
+		if (head != kNull)
+			blocks[head].prev_free = b;
+		free_heads[fl][sl] = b;
+		fl_bitmap |= 1u << fl;
+		sl_bitmap[fl] |= 1u << sl;
+	}
+
+	void tlsf_allocator::remove_free(uint32_t b)
+	{
+		uint32_t fl, sl;
+		mapping_insert(blocks[b].size, fl, sl);
+		auto prev = blocks[b].prev_free;
+		auto next = blocks[b].next_free;
+		if (prev != kNull)
+			blocks[prev].next_free = next;
+		else
+			free_heads[fl][sl] = next;
+		if (next != kNull)
+			blocks[next].prev_free = prev;
+		if (free_heads[fl][sl] == kNull) {
+			sl_bitmap[fl] &= ~(1u << sl);
+			if (!sl_bitmap[fl])
+				fl_bitmap &= ~(1u << fl);
+		}
+		blocks[b].free = false;
+		blocks[b].prev_free = kNull;
+		blocks[b].next_free = kNull;
+	}
+
+	uint32_t tlsf_allocator::allocate(uint32_t size, uint32_t align)
+	{
+		assert(align >= granularity && (align & (align - 1)) == 0);
+		if (size == 0 || size > capacity_ || align > capacity_)
+			return kNull;
+		size = (size + granularity - 1) & ~(granularity - 1);
+		// any block in the bin has room for the size and the alignment
+		uint32_t fl, sl;
+		mapping_search(size + align - granularity, fl, sl);
+		if (fl >= fl_count)
+			return kNull;
+		auto b = find_free(fl, sl);
+		if (b == kNull)
+			return kNull;
+		remove_free(b);
+		// split: return the space in front of the aligned offset to the free lists
+		// (the previous block is not free, or it would have been coalesced with this one)
+		auto gap = ((blocks[b].offset + align - 1) & ~(align - 1)) - blocks[b].offset;
+		if (gap) {
+			auto g = new_block();
+			// new_block may have reallocated the block array
+			auto &blk = blocks[b];
+			auto &pad = blocks[g];
+			pad.offset = blk.offset;
+			pad.size = gap;
+			pad.prev_phys = blk.prev_phys;
+			pad.next_phys = b;
+			if (blk.prev_phys != kNull)
+				blocks[blk.prev_phys].next_phys = g;
+			blk.prev_phys = g;
+			blk.offset += gap;
+			blk.size -= gap;
+			insert_free(g);
+		}
+		assert(blocks[b].size >= size);
+		// split: return the remainder to the free lists
+		auto remaining = blocks[b].size - size;
+		if (remaining >= granularity) {
+			auto r = new_block();
+			// new_block may have reallocated the block array
+			auto &blk = blocks[b];
+			auto &rem = blocks[r];
+			rem.offset = blk.offset + size;
+			rem.size = remaining;
+			rem.prev_phys = b;
+			rem.next_phys = blk.next_phys;
+			if (blk.next_phys != kNull)
+				blocks[blk.next_phys].prev_phys = r;
+			blk.next_phys = r;
+			blk.size = size;
+			insert_free(r);
+		}
+		blocks[b].allocated = true;
+		bytes_used_ += blocks[b].size;
+		return b;
+	}
+
+	void tlsf_allocator::deallocate(uint32_t handle)
+	{
+		assert(is_allocated(handle));
+		auto b = handle;
+		blocks[b].allocated = false;
+		bytes_used_ -= blocks[b].size;
+		// coalesce with the next block
+		auto next = blocks[b].next_phys;
+		if (next != kNull && blocks[next].free) {
+			remove_free(next);
+			blocks[b].size += blocks[next].size;
+			blocks[b].next_phys = blocks[next].next_phys;
+			if (blocks[b].next_phys != kNull)
+				blocks[blocks[b].next_phys].prev_phys = b;
+			release_block(next);
+		}
+		// coalesce with the previous block
+		auto prev = blocks[b].prev_phys;
+		if (prev != kNull && blocks[prev].free) {
+			remove_free(prev);
+			blocks[prev].size += blocks[b].size;
+			blocks[prev].next_phys = blocks[b].next_phys;
+			if (blocks[prev].next_phys != kNull)
+				blocks[blocks[prev].next_phys].prev_phys = prev;
+			release_block(b);
+			b = prev;
+		}
+		insert_free(b);
+	}
+
+	uint32_t tlsf_allocator::max_alloc_size() const
+	{
+		if (!fl_bitmap)
+			return 0;
+		// mapping_search rounds sizes up to the next bin: anything larger
+		// than the lower bound of the largest non-empty bin does not fit
+		auto fl = bitScanReverse(fl_bitmap);
+		auto sl = bitScanReverse(sl_bitmap[fl]);
+		return bin_size(fl, sl);
+	}
+}
@@ -0,0 +1,156 @@
+// Buffer pool test: sub-allocation of buffers in pool pages on a recording
+// device, pages left sparse by deleted buffers merged on request with the
+// contents of the moved buffers kept and the old pages released once the frame
+// is done, pinned buffers never moved, no moves when there is nothing to merge,
+// uniform buffers aligned without padding, the time to allocate from many pages,
+// and no buffer left after tearDown
+#include <rendering/opengl4.hpp>
+#include <rendering/device.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const size_t kPageSize = 16 * 1024 * 1024;
+
+	void fill(Buffer &buf, unsigned value)
+	{
+		auto words = static_cast<unsigned*>(buf.ptr);
+		for (size_t i = 0; i < buf.size / sizeof(unsigned); ++i)
+			words[i] = value;
+	}
+
+	bool holds(const Buffer &buf, unsigned value)
+	{
+		auto words = static_cast<const unsigned*>(buf.ptr);
+		for (size_t i = 0; i < buf.size / sizeof(unsigned); ++i)
+			if (words[i] != value)
+				return false;
+		return true;
+	}
+
+	void frame(GraphicsContext &gc)
+	{
+		gc.beginFrame();
+		gc.endFrame();
+	}
+
+	void compactionFrame(GraphicsContext &gc)
+	{
+		gc.beginFrame();
+		gc.compactBufferPools();
+		gc.endFrame();
+	}
+
+	bool testCompaction(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		auto memory = device.getBufferMemoryUsed();
+		// 3 pages of vertex data
+		std::vector<Buffer::Ptr> buffers;
+		for (unsigned i = 0; i < 3000; ++i) {
+			buffers.push_back(gc.createBuffer(gl::ARRAY_BUFFER, 16 * 1024));
+			fill(*buffers.back(), i);
+		}
+		ok &= check(device.getBufferMemoryUsed() == memory + 3 * kPageSize, "buffers sub-allocated from pages");
+
+		// unload most of them: every page sparse, the first one holds a pinned buffer
+		for (unsigned i = 0; i < buffers.size(); ++i)
+			if (i % 10)
+				buffers[i].reset();
+		auto pinned = buffers[10].get();
+		pinned->pinned = true;
+		auto pinnedObj = pinned->obj;
+		frame(gc);
+		ok &= check(device.getBufferMemoryUsed() == memory + 3 * kPageSize, "no compaction unless requested");
+		compactionFrame(gc);
+		ok &= check(device.getBufferMemoryUsed() == memory + 3 * kPageSize, "old pages kept while the frame is in flight");
+		frame(gc);
+		ok &= check(device.getBufferMemoryUsed() == memory + kPageSize, "sparse pages merged, released after the frame");
+		ok &= check(pinned->obj == pinnedObj && holds(*pinned, 10), "page of a pinned buffer left alone");
+		pinned->pinned = false;
+		bool kept = true;
+		for (unsigned i = 0; i < buffers.size(); i += 10)
+			kept &= holds(*buffers[i], i);
+		ok &= check(kept, "contents of the moved buffers kept");
+
+		// one sparse page, nowhere else to go: stays
+		auto obj = buffers[0]->obj;
+		for (int i = 0; i < 3; ++i)
+			compactionFrame(gc);
+		ok &= check(buffers[0]->obj == obj && device.getBufferMemoryUsed() == memory + kPageSize, "single sparse page left alone");
+
+		// a full page next to it: the sparse one moves in once, then nothing moves
+		std::vector<Buffer::Ptr> full;
+		for (unsigned i = 0; i < 700; ++i)
+			full.push_back(gc.createBuffer(gl::ARRAY_BUFFER, 16 * 1024));
+		for (unsigned i = 0; i < full.size(); i += 2)
+			full[i].reset();
+		compactionFrame(gc);
+		auto moved = buffers[0]->obj;
+		compactionFrame(gc);
+		ok &= check(buffers[0]->obj == moved && holds(*buffers[0], 0), "no moves once merged");
+		return ok;
+	}
+
+	bool testAlignment(GraphicsContext &gc)
+	{
+		// fresh page: the space skipped to align a uniform buffer is reused
+		auto vertices = gc.createBuffer(gl::ARRAY_BUFFER, 16);
+		auto uniforms = gc.createBuffer(gl::UNIFORM_BUFFER, 257);
+		auto gap = gc.createBuffer(gl::ARRAY_BUFFER, 16);
+		auto rest = gc.createBuffer(gl::ARRAY_BUFFER, 224);
+		return check(uniforms->offset == 256 && gap->offset == 16 && rest->offset == 32, "alignment padding reused");
+	}
+
+	bool testAllocation(GraphicsContext &gc, RecordingDevice &device)
+	{
+		// many pages with little room left, then small allocations
+		std::mt19937 rng(7);
+		std::uniform_int_distribution<size_t> sizes(256, 64 * 1024);
+		std::vector<Buffer::Ptr> buffers;
+		while (device.getBufferMemoryUsed() < 40 * kPageSize)
+			buffers.push_back(gc.createBuffer(gl::ARRAY_BUFFER, sizes(rng)));
+		for (size_t i = 0; i < buffers.size(); i += 3)
+			buffers[i].reset();
+		const unsigned n = 20000;
+		std::vector<Buffer::Ptr> small;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (unsigned i = 0; i < n; ++i)
+			small.push_back(gc.createBuffer(gl::UNIFORM_BUFFER, 256));
+		std::chrono::duration<double, std::micro> t = std::chrono::high_resolution_clock::now() - t0;
+		std::printf("    %u allocations in %.0f pages: %.3f us each\n", n,
+			double(device.getBufferMemoryUsed()) / kPageSize, t.count() / n);
+		bool distinct = true;
+		for (unsigned i = 1; i < n; ++i)
+			distinct &= small[i]->obj != small[i - 1]->obj || small[i]->offset != small[i - 1]->offset;
+		return check(distinct, "allocations in the free space of the pages");
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testAlignment(gc);
+		gc.tearDown();
+	}
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testCompaction(gc, device);
+		ok &= testAllocation(gc, device);
+		gc.tearDown();
+	}
+	ok &= check(device.getBufferMemoryUsed() == 0, "pages and transient rings released by tearDown");
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_buffer_pool"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_buffer_pool"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,20 @@
+#ifndef TEST_COMMON_CHECK_HPP
+#define TEST_COMMON_CHECK_HPP
+
+// Shared by the test projects: one line per check, one summary line
+#include <cstdio>
+
+inline bool check(bool ok, const char *what)
+{
+	std::printf("%-52s: %s\n", what, ok ? "OK" : "FAILED");
+	return ok;
+}
+
+// prints the summary, returns the exit code of the test
+inline int reportTestResults(bool ok)
+{
+	std::printf("%s\n", ok ? "all tests passed" : "SOME TESTS FAILED");
+	return ok ? 0 : 1;
+}
+
+#endif /* end of include guard: TEST_COMMON_CHECK_HPP */
@@ -0,0 +1,179 @@
+// Debug draw test: shapes of the primitives (spheres, capsules, boxes,
+// frustums, mesh edges), capacity limit, and flush of a frame full of
+// physics volumes in at most two draws on a recording device
+#include <rendering/debug_draw.hpp>
+#include <rendering/device.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cstdio>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const glm::vec4 kRed(1.0f, 0.0f, 0.0f, 1.0f);
+	const glm::vec4 kGreen(0.0f, 1.0f, 0.0f, 1.0f);
+
+	float distanceToSegment(const glm::vec3 &p, const glm::vec3 &a, const glm::vec3 &b)
+	{
+		auto ab = b - a;
+		auto t = glm::clamp(glm::dot(p - a, ab) / glm::dot(ab, ab), 0.0f, 1.0f);
+		return glm::length(p - (a + t * ab));
+	}
+
+	bool testShapes()
+	{
+		bool ok = true;
+		DebugDraw dd;
+		const glm::vec3 center(1.0f, 2.0f, 3.0f);
+		dd.drawSphere(center, 2.5f, kRed);
+		auto &sphere = dd.getVertices(DebugDepthMode::Test);
+		bool onSphere = sphere.size() == 3 * DebugDraw::kCircleSegments * 2;
+		for (auto &v : sphere)
+			onSphere &= glm::abs(glm::length(v.position - center) - 2.5f) < 1e-4f && v.color == glm::packUnorm4x8(kRed);
+		ok &= check(onSphere, "sphere: three great circles");
+		dd.clear();
+
+		const glm::vec3 a(-1.0f, 0.0f, 2.0f), b(3.0f, 4.0f, -1.0f);
+		dd.drawCapsule(a, b, 0.5f, kGreen, DebugDepthMode::NoTest);
+		auto &capsule = dd.getVertices(DebugDepthMode::NoTest);
+		bool onCapsule = !capsule.empty() && dd.getVertices(DebugDepthMode::Test).empty();
+		for (auto &v : capsule)
+			onCapsule &= glm::abs(distanceToSegment(v.position, a, b) - 0.5f) < 1e-4f;
+		ok &= check(onCapsule, "capsule: lines on the surface");
+		dd.clear();
+
+		dd.drawBox(AABB{ glm::vec3(-1.0f, -2.0f, -3.0f), glm::vec3(1.0f, 2.0f, 3.0f) }, kRed);
+		auto &box = dd.getVertices(DebugDepthMode::Test);
+		bool edges = box.size() == 24;
+		for (auto i = 0u; i + 1 < box.size(); i += 2) {
+			// an edge changes one coordinate
+			auto d = glm::notEqual(box[i].position, box[i + 1].position);
+			edges &= int(d.x) + int(d.y) + int(d.z) == 1;
+			edges &= glm::abs(box[i].position.z) == 3.0f;
+		}
+		ok &= check(edges, "box: 12 edges between corners");
+		dd.clear();
+
+		auto viewProj = glm::perspective(glm::radians(60.0f), 1.5f, 0.5f, 50.0f)
+			* glm::lookAt(glm::vec3(2.0f, 3.0f, 4.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		dd.drawFrustum(viewProj, kRed);
+		bool corners = dd.getVertices(DebugDepthMode::Test).size() == 24;
+		for (auto &v : dd.getVertices(DebugDepthMode::Test)) {
+			auto clip = viewProj * glm::vec4(v.position, 1.0f);
+			auto ndc = glm::vec3(clip) / clip.w;
+			corners &= glm::all(glm::lessThan(glm::abs(glm::abs(ndc) - 1.0f), glm::vec3(1e-3f)));
+		}
+		ok &= check(corners, "frustum: corners on the clip volume");
+		dd.clear();
+
+		// two triangles sharing an edge, moved by the transform
+		std::vector<glm::vec3> vertices = { { 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 } };
+		std::vector<uint16_t> indices = { 0, 1, 2, 2, 1, 3 };
+		dd.drawMesh(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 5.0f)), gl::TRIANGLES, vertices, indices, kRed);
+		auto &mesh = dd.getVertices(DebugDepthMode::Test);
+		ok &= check(mesh.size() == 12 && mesh[0].position == glm::vec3(0, 0, 5) && mesh[1].position == glm::vec3(1, 0, 5)
+			&& mesh[11].position == glm::vec3(0, 1, 5), "mesh: triangle edges, transformed");
+		dd.clear();
+		dd.drawMesh(glm::mat4(1.0f), gl::LINE_STRIP, vertices, {}, kRed);
+		ok &= check(dd.getVertices(DebugDepthMode::Test).size() == 6, "mesh: line strip without indices");
+		return ok;
+	}
+
+	bool testFlush(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		DebugDraw dd;
+		// physics volumes of a scene
+		const unsigned kBoxes = 300, kSpheres = 200, kCapsules = 100;
+		device.reset();
+		gc.beginFrame();
+		for (auto i = 0u; i < kBoxes; ++i) {
+			glm::vec3 p(float(i % 20), 0.0f, float(i / 20));
+			dd.drawBox(AABB{ p, p + glm::vec3(0.5f) }, kRed);
+		}
+		for (auto i = 0u; i < kSpheres; ++i)
+			dd.drawSphere(glm::vec3(float(i), 1.0f, 0.0f), 0.3f, glm::vec4(float(i) / kSpheres, 0.5f, 0.0f, 1.0f));
+		for (auto i = 0u; i < kCapsules; ++i)
+			dd.drawCapsule(glm::vec3(float(i), 0.0f, 0.0f), glm::vec3(float(i), 2.0f, 0.0f), 0.25f, kGreen, DebugDepthMode::NoTest);
+		dd.drawLine(glm::vec3(0.0f), glm::vec3(10.0f), kGreen, DebugDepthMode::NoTest);
+		auto numTested = static_cast<unsigned>(dd.getVertices(DebugDepthMode::Test).size());
+		auto numOnTop = static_cast<unsigned>(dd.getVertices(DebugDepthMode::NoTest).size());
+		dd.flush(gc, 1, glm::mat4(1.0f));
+		gc.endFrame();
+
+		std::vector<RecordingDevice::Command> draws;
+		bool depthOffBeforeSecond = false;
+		for (auto &cmd : device.getCommands()) {
+			if (cmd.type == RecordingDevice::CommandType::DrawArrays)
+				draws.push_back(cmd);
+			if (cmd.type == RecordingDevice::CommandType::SetEnabled && cmd.param == gl::DEPTH_TEST && !cmd.count && draws.size() == 1)
+				depthOffBeforeSecond = true;
+		}
+		ok &= check(draws.size() == 2, "two draws for the whole frame");
+		ok &= check(draws.size() == 2 && draws[0].param == gl::LINES && draws[0].first == 0 && draws[0].count == numTested
+			&& draws[1].first == numTested && draws[1].count == numOnTop, "depth-tested lines, then lines on top");
+		ok &= check(depthOffBeforeSecond, "depth test disabled for the lines on top");
+		auto &stats = dd.getStats();
+		ok &= check(stats.numVertices[0] == numTested && stats.numVertices[1] == numOnTop && stats.numDrawCalls == 2
+			&& stats.numDroppedVertices == 0, "frame stats");
+		ok &= check(dd.empty(), "streams emptied by the flush");
+		std::printf("    %u volumes: %u line vertices, %u draw calls\n", kBoxes + kSpheres + kCapsules,
+			numTested + numOnTop, unsigned(draws.size()));
+
+		// one depth mode only
+		device.reset();
+		gc.beginFrame();
+		dd.drawLine(glm::vec3(0.0f), glm::vec3(1.0f), kRed);
+		dd.flush(gc, 1, glm::mat4(1.0f));
+		gc.endFrame();
+		ok &= check(device.getCommandCount(RecordingDevice::CommandType::DrawArrays) == 1, "one draw for a single depth mode");
+
+		// nothing to draw
+		device.reset();
+		gc.beginFrame();
+		dd.flush(gc, 1, glm::mat4(1.0f));
+		gc.endFrame();
+		ok &= check(device.getDrawCount() == 0 && dd.getStats().numDrawCalls == 0, "empty frame draws nothing");
+		return ok;
+	}
+
+	bool testCapacity(GraphicsContext &gc)
+	{
+		bool ok = true;
+		DebugDraw dd;
+		dd.setMaxVertices(100);
+		gc.beginFrame();
+		dd.drawBox(AABB{ glm::vec3(0.0f), glm::vec3(1.0f) }, kRed);
+		dd.drawBox(AABB{ glm::vec3(0.0f), glm::vec3(1.0f) }, kRed, DebugDepthMode::NoTest);
+		// over capacity: dropped as a whole
+		dd.drawSphere(glm::vec3(0.0f), 1.0f, kRed);
+		dd.drawLine(glm::vec3(0.0f), glm::vec3(1.0f), kRed);
+		dd.flush(gc, 1, glm::mat4(1.0f));
+		gc.endFrame();
+		auto &stats = dd.getStats();
+		ok &= check(stats.numVertices[0] == 26 && stats.numVertices[1] == 24, "primitives within capacity kept");
+		ok &= check(stats.numDroppedVertices == 3 * DebugDraw::kCircleSegments * 2 && stats.maxVertices == 100, "dropped vertices counted");
+		gc.beginFrame();
+		dd.flush(gc, 1, glm::mat4(1.0f));
+		gc.endFrame();
+		ok &= check(dd.getStats().numDroppedVertices == 0, "drop count reset every frame");
+		return ok;
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	ok &= testShapes();
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testFlush(gc, device);
+		ok &= testCapacity(gc);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
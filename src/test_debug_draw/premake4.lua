@@ -0,0 +1,10 @@
+project "test_debug_draw"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_debug_draw"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
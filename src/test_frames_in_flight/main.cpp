@@ -0,0 +1,156 @@
+// Frames in flight test: transient rings of the context on a recording device
+// whose GPU lags behind: no more rings than frames in flight by default, the
+// extra rings requested are created before the CPU waits for the oldest frame,
+// a fence timeout never adds a ring nor reuses the ring before its fence
+// signals, and the ranges of freed meshes are not reused before the frame is done
+#include <rendering/opengl4.hpp>
+#include <rendering/device.hpp>
+#include <cstdint>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	// extra rings requested (at most GraphicsContext::kMaxExtraTransientRings)
+	const unsigned kExtraRings = 2;
+
+	// fences complete only when the CPU blocks on them (the GPU is always late)
+	class LaggingDevice : public RecordingDevice
+	{
+	public:
+		GLsync fenceSync() override {
+			return reinterpret_cast<GLsync>(++last_fence);
+		}
+
+		bool waitSync(GLsync sync, uint64_t timeout) override {
+			auto fence = reinterpret_cast<uintptr_t>(sync);
+			if (timeout == 0)
+				return fence <= completed;
+			++numBlockingWaits;
+			if (timeoutNextWait) {
+				timeoutNextWait = false;
+				++numTimeouts;
+				return false;
+			}
+			if (fence > completed)
+				completed = fence;
+			return true;
+		}
+
+		// GPU catches up
+		void finish() {
+			completed = last_fence;
+		}
+
+		unsigned numBlockingWaits = 0;
+		unsigned numTimeouts = 0;
+		bool timeoutNextWait = false;
+
+	private:
+		uintptr_t last_fence = 0;
+		uintptr_t completed = 0;
+	};
+
+	BufferSlice frame(GraphicsContext &gc)
+	{
+		gc.beginFrame();
+		auto slice = gc.createTransientBuffer(gl::UNIFORM_BUFFER, 256);
+		gc.endFrame();
+		return slice;
+	}
+
+	bool testDefaultRings(LaggingDevice &device)
+	{
+		GraphicsContext gc(3);
+		gc.initialize();
+		auto waits = device.numBlockingWaits;
+		for (int i = 0; i < 8; ++i)
+			frame(gc);
+		auto ok = check(gc.getNumTransientRings() == 3 && device.numBlockingWaits == waits + 5, "no extra rings unless requested");
+		gc.tearDown();
+		return ok;
+	}
+
+	bool testLaggingGPU(LaggingDevice &device)
+	{
+		bool ok = true;
+		GraphicsContext gc(3, kExtraRings);
+		gc.initialize();
+		auto waits = device.numBlockingWaits;
+		BufferSlice slices[10];
+		for (auto &slice : slices)
+			slice = frame(gc);
+		const auto numRings = 3 + kExtraRings;
+		ok &= check(gc.getNumTransientRings() == numRings, "extra rings before waiting");
+		ok &= check(device.numBlockingWaits == waits + 10 - numRings && device.numTimeouts == 0, "then waits for the oldest frame");
+		ok &= check(slices[numRings].obj == slices[0].obj && slices[9].obj == slices[9 - numRings].obj
+			&& slices[0].obj != slices[1].obj && slices[1].obj != slices[numRings - 1].obj, "rings reused in order");
+
+		// fence of the oldest frame times out: waits on it again
+		device.timeoutNextWait = true;
+		waits = device.numBlockingWaits;
+		auto inFlight = slices[10 - numRings].obj;
+		auto late = frame(gc);
+		ok &= check(device.numTimeouts == 1 && gc.getNumTransientRings() == numRings, "timeout: no more rings");
+		ok &= check(device.numBlockingWaits == waits + 2 && late.obj == inFlight, "timed out ring reused once its fence signaled");
+
+		// GPU caught up: no blocking wait
+		device.finish();
+		waits = device.numBlockingWaits;
+		for (int i = 0; i < 4; ++i)
+			frame(gc);
+		ok &= check(device.numBlockingWaits == waits && gc.getNumTransientRings() == numRings, "no wait when the GPU is done");
+		gc.tearDown();
+		return ok;
+	}
+
+	bool testMegabufferFree(LaggingDevice &device)
+	{
+		bool ok = true;
+		GraphicsContext gc(2, kExtraRings);
+		gc.initialize();
+		gc.enableMeshMegabuffer(kMeshVertexStride, 1024, 4096);
+		auto &megabuffer = *gc.getMeshMegabuffer();
+		MeshMegabuffer::Allocation before;
+		megabuffer.free(before);
+		ok &= check(megabuffer.getBytesUsed() == 0, "free before the first frame: immediate");
+
+		// unloaded while the frame that draws it is recorded
+		gc.beginFrame();
+		MeshMegabuffer::Allocation mesh, next;
+		megabuffer.allocate(1024, 4096, mesh);
+		megabuffer.free(mesh);
+		ok &= check(!megabuffer.allocate(16, 16, next), "range still in use by the frame");
+		gc.endFrame();
+		// next frames (extra rings): the fence of the first one has not signaled
+		bool inUse = true;
+		for (auto i = 0u; i < 1 + kExtraRings; ++i) {
+			gc.beginFrame();
+			inUse &= !megabuffer.allocate(16, 16, next);
+			gc.endFrame();
+		}
+		ok &= check(inUse, "not reused while the frame is in flight");
+		// all the rings in flight: waits for the first frame
+		gc.beginFrame();
+		ok &= check(megabuffer.allocate(1024, 4096, next) && next.baseVertex == 0, "reused once the frame is done");
+		megabuffer.free(next);
+		gc.endFrame();
+		device.finish();
+		for (int i = 0; i < 2; ++i)
+			frame(gc);
+		ok &= check(megabuffer.getBytesUsed() == 0, "all released");
+		gc.tearDown();
+		return ok;
+	}
+}
+
+int main()
+{
+	LaggingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	ok &= testDefaultRings(device);
+	ok &= testLaggingGPU(device);
+	ok &= testMegabufferFree(device);
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
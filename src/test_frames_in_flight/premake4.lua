@@ -0,0 +1,10 @@
+project "test_frames_in_flight"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_frames_in_flight"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
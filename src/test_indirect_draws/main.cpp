@@ -0,0 +1,162 @@
+// Indirect draw building test: runs on the recording device (no GPU) and checks
+// the commands read back from the indirect buffer, and that the number of
+// submitted multi-draws does not depend on the number of draws
+#include <rendering/indirect_draws.hpp>
+#include <mesh_data.hpp>
+#include <cstdio>
+#include <random>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	// a quad per submesh
+	MeshData makeMeshData(unsigned numSubmeshes)
+	{
+		MeshData data;
+		data.uv.push_back(std::vector<glm::vec2>());
+		for (auto s = 0u; s < numSubmeshes; ++s) {
+			Submesh sm;
+			sm.primitiveType = PrimitiveType::Triangle;
+			sm.startVertex = static_cast<unsigned>(data.vertices.size());
+			sm.startIndex = static_cast<unsigned>(data.indices.size());
+			sm.numVertices = 4;
+			sm.numIndices = 6;
+			for (auto v = 0u; v < 4; ++v) {
+				data.vertices.push_back(glm::vec3(v & 1, v >> 1, s));
+				data.normals.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
+				data.tangents.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
+				data.uv[0].push_back(glm::vec2(v & 1, v >> 1));
+			}
+			for (auto i : { 0, 1, 2, 2, 1, 3 })
+				data.indices.push_back(i);
+			data.submeshes.push_back(sm);
+		}
+		data.computeBounds();
+		return data;
+	}
+
+	struct TestScene
+	{
+		std::vector<Mesh::Ptr> meshes;
+		std::vector<Shader> shaders;
+		std::vector<Material> materials;
+		std::vector<glm::mat4> transforms;
+	};
+
+	// expected commands for a sorted queue, computed without the builder
+	std::vector<DrawElementsIndirectCommand> expectedCommands(const RenderQueue &queue, unsigned threshold)
+	{
+		std::vector<DrawElementsIndirectCommand> out;
+		for (auto i = 0u; i < queue.size();) {
+			auto end = i + 1;
+			while (threshold && end < queue.size() && queue[end].mesh == queue[i].mesh && queue[end].material == queue[i].material)
+				++end;
+			auto instanced = end - i >= threshold;
+			for (auto j = i; j < end; ++j) {
+				if (instanced && j != i)
+					break;
+				auto &mesh = *queue[j].mesh;
+				for (auto &sm : mesh.submeshes)
+					out.push_back(DrawElementsIndirectCommand{
+						sm.numIndices,
+						instanced ? end - i : 1,
+						mesh.megabufferAlloc.firstIndex + sm.startIndex,
+						static_cast<GLint>(mesh.megabufferAlloc.baseVertex + sm.startVertex),
+						j });
+			}
+			i = end;
+		}
+		return out;
+	}
+
+	bool runTest(GraphicsContext &gc, RecordingDevice &device, unsigned numDraws, unsigned numMeshes, unsigned numMaterials, unsigned threshold)
+	{
+		std::mt19937 rng(numDraws);
+		TestScene scene;
+		for (auto i = 0u; i < numMeshes; ++i) {
+			auto data = makeMeshData(1 + i % 3);
+			scene.meshes.push_back(createMesh(gc, data));
+		}
+		scene.shaders.resize(1);
+		scene.materials.resize(numMaterials);
+		for (auto &m : scene.materials)
+			m.shader = &scene.shaders[0];
+		scene.transforms.resize(numDraws);
+
+		RenderQueue queue;
+		for (auto i = 0u; i < numDraws; ++i) {
+			auto &mesh = *scene.meshes[rng() % numMeshes];
+			auto &material = scene.materials[rng() % numMaterials];
+			queue.push(
+				RenderQueue::makeSortKey(RenderQueue::Pass::Opaque, *material.shader, material, mesh, 0, 0.5f),
+				DrawItem{ &mesh, &material, &scene.transforms[i], 0 });
+		}
+		queue.sort();
+
+		gc.beginFrame();
+		IndirectDrawBuilder builder;
+		builder.build(queue, threshold);
+		auto indirectBuffer = builder.upload(gc);
+
+		device.reset();
+		for (auto &batch : builder.getBatches())
+			submitIndirectBatch(*gc.getMeshMegabuffer(), indirectBuffer, batch.first, batch.count);
+		gc.endFrame();
+
+		bool ok = true;
+		// read back the commands through the recorded draws
+		auto expected = expectedCommands(queue, threshold);
+		std::vector<DrawElementsIndirectCommand> submitted;
+		for (auto &cmd : device.getCommands()) {
+			if (cmd.type != RecordingDevice::CommandType::MultiDrawElementsIndirect)
+				continue;
+			auto indirectObj = device.getObjectNames()[cmd.objects_begin];
+			auto data = static_cast<const DrawElementsIndirectCommand*>(device.mapBuffer(
+				indirectObj, cmd.offset, cmd.count * sizeof(DrawElementsIndirectCommand), gl::MAP_READ_BIT));
+			submitted.insert(submitted.end(), data, data + cmd.count);
+		}
+		bool same = submitted.size() == expected.size();
+		for (auto i = 0u; same && i < expected.size(); ++i) {
+			auto &a = submitted[i];
+			auto &b = expected[i];
+			same = a.count == b.count && a.instanceCount == b.instanceCount && a.firstIndex == b.firstIndex
+				&& a.baseVertex == b.baseVertex && a.baseInstance == b.baseInstance;
+		}
+		ok &= check(same, "commands match the reference");
+
+		// one multi-draw per material run
+		auto numMultiDraws = device.getCommandCount(RecordingDevice::CommandType::MultiDrawElementsIndirect);
+		unsigned materialRuns = 0;
+		for (auto i = 0u; i < queue.size(); ++i)
+			if (!i || queue[i].material != queue[i - 1].material)
+				++materialRuns;
+		ok &= check(numMultiDraws == materialRuns, "one multi-draw per material");
+		ok &= check(device.getCommandCount(RecordingDevice::CommandType::DrawElements) == 0, "no direct draws");
+
+		std::printf("%6u draws, %3u meshes, %2u materials, threshold %u: %5u commands, %2u multi-draws | %s\n",
+			numDraws, numMeshes, numMaterials, threshold,
+			static_cast<unsigned>(submitted.size()), numMultiDraws, ok ? "OK" : "FAILED");
+		return ok;
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	device.setStoreCommands(true);
+	setGraphicsDevice(&device);
+	bool ok = true;
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		gc.enableMeshMegabuffer(kMeshVertexStride, 1024 * 1024, 1024 * 1024);
+		ok &= runTest(gc, device, 1, 1, 1, 2);
+		ok &= runTest(gc, device, 100, 10, 1, 2);
+		ok &= runTest(gc, device, 10000, 50, 1, 2);
+		ok &= runTest(gc, device, 10000, 50, 1, 0);
+		ok &= runTest(gc, device, 10000, 200, 4, 8);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_indirect_draws"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_indirect_draws"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
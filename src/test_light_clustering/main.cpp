@@ -0,0 +1,83 @@
+// Light clustering test: the SIMD/multithreaded assignment must give the same
+// clusters as the brute-force reference (runs on the CPU only)
+#include <rendering/light_clustering.hpp>
+#include <utils/thread_pool.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	using Clock = std::chrono::high_resolution_clock;
+
+	double elapsedMs(Clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	std::vector<ClusterLight> makeLights(unsigned count, std::mt19937 &rng)
+	{
+		// around and behind the camera, some crossing the near plane
+		std::uniform_real_distribution<float> xy(-60.0f, 60.0f);
+		std::uniform_real_distribution<float> z(-120.0f, 5.0f);
+		std::uniform_real_distribution<float> radius(0.5f, 15.0f);
+		std::vector<ClusterLight> lights(count);
+		for (auto &l : lights)
+			l = ClusterLight{ glm::vec3(xy(rng), xy(rng), z(rng)), radius(rng) };
+		return lights;
+	}
+
+	bool runTest(const char *name, const ClusterGridParams &params, const glm::mat4 &proj, unsigned numLights, std::mt19937 &rng)
+	{
+		auto lights = makeLights(numLights, rng);
+		LightClusterer reference;
+		reference.setup(proj, params);
+		auto start = Clock::now();
+		reference.assignLightsReference(lights);
+		auto referenceTime = elapsedMs(start);
+
+		LightClusterer clusterer;
+		clusterer.setup(proj, params);
+		start = Clock::now();
+		clusterer.assignLights(lights, &util::get_thread_pool());
+		auto simdTime = elapsedMs(start);
+
+		bool ok = clusterer.getClusters() == reference.getClusters()
+			&& clusterer.getLightIndices() == reference.getLightIndices()
+			&& clusterer.getNumDroppedLights() == reference.getNumDroppedLights();
+		std::printf("%-24s %5u lights, %7u refs, %5u dropped | reference %8.3f ms, SIMD %6.3f ms | %s\n",
+			name,
+			numLights,
+			static_cast<unsigned>(clusterer.getLightIndices().size()),
+			clusterer.getNumDroppedLights(),
+			referenceTime,
+			simdTime,
+			ok ? "OK" : "FAILED");
+		return ok;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1234);
+	auto proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	auto wideProj = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 0.5f, 1000.0f);
+
+	ClusterGridParams defaults;
+	ClusterGridParams odd;
+	odd.tilesX = 7;
+	odd.tilesY = 5;
+	odd.slices = 13;
+	ClusterGridParams small;
+	small.maxLightsPerCluster = 8;
+
+	bool ok = true;
+	ok &= runTest("no lights", defaults, proj, 0, rng);
+	ok &= runTest("default grid", defaults, proj, 256, rng);
+	ok &= runTest("default grid, wide", defaults, wideProj, 1024, rng);
+	ok &= runTest("odd grid", odd, proj, 300, rng);
+	ok &= runTest("cluster overflow", small, proj, 512, rng);
+	return reportTestResults(ok);
+}
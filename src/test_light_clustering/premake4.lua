@@ -0,0 +1,10 @@
+project "test_light_clustering"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_light_clustering"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
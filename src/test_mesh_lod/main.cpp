@@ -0,0 +1,314 @@
+// Mesh level of detail test: simplification of a height field (error bounds,
+// borders and seams), .mesh round trip, selection with hysteresis, and LOD
+// selection in draw recording
+#include <mesh_simplify.hpp>
+#include <rendering/draw_list.hpp>
+#include <rendering/indirect_draws.hpp>
+#include <rendering/lod.hpp>
+#include <scene/scene.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include <set>
+#include <sstream>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	// size x size cells over [-1,1]^2, z = height(x, y); with seam, the vertices
+	// of the middle column are duplicated (as for a texture seam)
+	template <typename Fn>
+	MeshData makeHeightField(unsigned size, Fn height, bool seam = false)
+	{
+		MeshData data;
+		data.uv.push_back(std::vector<glm::vec2>());
+		const auto row = size + 1 + (seam ? 1 : 0);
+		for (auto y = 0u; y <= size; ++y)
+			for (auto x = 0u; x <= size; ++x) {
+				auto fx = float(x) / size * 2.0f - 1.0f;
+				auto fy = float(y) / size * 2.0f - 1.0f;
+				auto copies = seam && x == size / 2 ? 2 : 1;
+				for (auto c = 0; c < copies; ++c) {
+					data.vertices.push_back(glm::vec3(fx, fy, height(fx, fy)));
+					data.normals.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
+					data.tangents.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
+					data.uv[0].push_back(glm::vec2(fx, fy + c));
+				}
+			}
+		// index of the vertex at (x, y) seen from the cell on the left (side 0) or right (side 1)
+		auto vertex = [&](unsigned x, unsigned y, unsigned side) {
+			auto i = y * row + x;
+			if (seam && x > size / 2)
+				++i;
+			if (seam && x == size / 2 && side == 1)
+				++i;
+			return static_cast<uint16_t>(i);
+		};
+		for (auto y = 0u; y < size; ++y)
+			for (auto x = 0u; x < size; ++x) {
+				// left column of the cell seen from the cell (x is the right neighbor of the seam)
+				auto side = x >= size / 2 ? 1u : 0u;
+				auto a = vertex(x, y, side);
+				auto b = vertex(x + 1, y, side == 0 && x + 1 == size / 2 ? 0u : side);
+				auto c = vertex(x + 1, y + 1, side == 0 && x + 1 == size / 2 ? 0u : side);
+				auto d = vertex(x, y + 1, side);
+				data.indices.insert(data.indices.end(), { a, b, c, a, c, d });
+			}
+		Submesh sm{};
+		sm.primitiveType = PrimitiveType::Triangle;
+		sm.numVertices = static_cast<unsigned>(data.vertices.size());
+		sm.numIndices = static_cast<unsigned>(data.indices.size());
+		data.submeshes.push_back(sm);
+		data.computeBounds();
+		return data;
+	}
+
+	float bumps(float x, float y)
+	{
+		return 0.1f * glm::sin(3.0f * x) * glm::cos(2.0f * y) + 0.05f * x * y;
+	}
+
+	// height of the simplified surface above (x, y), false if no triangle covers it
+	bool sampleHeight(const MeshData &data, IndexRange range, glm::vec2 p, float &z)
+	{
+		for (auto i = range.startIndex; i < range.startIndex + range.numIndices; i += 3) {
+			auto &a = data.vertices[data.indices[i]];
+			auto &b = data.vertices[data.indices[i + 1]];
+			auto &c = data.vertices[data.indices[i + 2]];
+			auto det = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+			if (det == 0.0f)
+				continue;
+			auto u = ((p.x - a.x) * (c.y - a.y) - (c.x - a.x) * (p.y - a.y)) / det;
+			auto v = ((b.x - a.x) * (p.y - a.y) - (p.x - a.x) * (b.y - a.y)) / det;
+			const float eps = 1e-5f;
+			if (u >= -eps && v >= -eps && u + v <= 1.0f + eps) {
+				z = a.z + u * (b.z - a.z) + v * (c.z - a.z);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool testSimplification()
+	{
+		auto data = makeHeightField(64, bumps);
+		auto original = data;
+		auto start = std::chrono::high_resolution_clock::now();
+		generateMeshLods(data);
+		auto end = std::chrono::high_resolution_clock::now();
+		std::printf("    -> %u levels generated in %.2f ms\n", data.numLods, std::chrono::duration<double, std::milli>(end - start).count());
+
+		bool ok = check(data.numLods == kMaxMeshLods, "all levels generated");
+		bool decreasing = true;
+		bool bounded = true;
+		bool covered = true;
+		for (auto lod = 0u; lod < data.numLods; ++lod) {
+			auto range = data.submeshes[0].getIndexRange(lod);
+			// deviation of the original vertices from the simplified surface
+			float maxDeviation = 0.0f;
+			for (auto &v : original.vertices) {
+				float z;
+				if (!sampleHeight(data, range, glm::vec2(v), z)) {
+					covered = false;
+					continue;
+				}
+				maxDeviation = glm::max(maxDeviation, glm::abs(z - v.z));
+			}
+			std::printf("    -> level %u: %5u triangles, error %.5f, max deviation %.5f\n",
+				lod, range.numIndices / 3, data.lodErrors[lod], maxDeviation);
+			if (lod) {
+				auto previous = data.submeshes[0].getIndexRange(lod - 1);
+				decreasing &= range.numIndices < previous.numIndices && data.lodErrors[lod] >= data.lodErrors[lod - 1];
+			}
+			bounded &= maxDeviation <= data.lodErrors[lod] + 1e-4f;
+		}
+		ok &= check(decreasing, "fewer triangles and more error at each level");
+		ok &= check(covered, "simplified levels cover the whole height field");
+		ok &= check(bounded, "deviation within the reported error");
+
+		// a flat grid collapses to its border, without error
+		auto flat = makeHeightField(32, [](float, float) { return 0.0f; });
+		generateMeshLods(flat, 2, 0.0f);
+		auto flatRange = flat.submeshes[0].getIndexRange(1);
+		std::printf("    -> flat grid: %u -> %u triangles\n", flat.submeshes[0].numIndices / 3, flatRange.numIndices / 3);
+		ok &= check(flat.numLods == 2 && flat.lodErrors[1] == 0.0f && flatRange.numIndices / 3 <= 4 * 32, "flat grid reduced to its border");
+
+		// seam vertices stay
+		auto seamed = makeHeightField(32, bumps, true);
+		generateMeshLods(seamed);
+		bool seamKept = seamed.numLods > 1;
+		for (auto lod = 1u; lod < seamed.numLods; ++lod) {
+			auto range = seamed.submeshes[0].getIndexRange(lod);
+			std::set<unsigned> used(seamed.indices.begin() + range.startIndex, seamed.indices.begin() + range.startIndex + range.numIndices);
+			for (auto i = 0u; i < seamed.vertices.size(); ++i)
+				if (glm::abs(seamed.vertices[i].x) < 1e-6f)
+					seamKept &= used.count(i) != 0;
+		}
+		ok &= check(seamKept, "seam vertices kept at all levels");
+		return ok;
+	}
+
+	bool testRoundTrip()
+	{
+		auto data = makeHeightField(16, bumps);
+		generateMeshLods(data);
+		std::stringstream stream;
+		data.saveToStream(stream);
+		MeshData loaded;
+		loaded.loadFromStream(stream);
+		bool same = loaded.numLods == data.numLods
+			&& loaded.indices == data.indices
+			&& loaded.vertices == data.vertices
+			&& loaded.submeshes.size() == data.submeshes.size();
+		for (auto lod = 0u; same && lod < data.numLods; ++lod) {
+			same &= loaded.lodErrors[lod] == data.lodErrors[lod];
+			auto a = loaded.submeshes[0].getIndexRange(lod);
+			auto b = data.submeshes[0].getIndexRange(lod);
+			same &= a.startIndex == b.startIndex && a.numIndices == b.numIndices;
+		}
+		return check(same, "version 4 .mesh round trip");
+	}
+
+	void setupLodMesh(Mesh &mesh)
+	{
+		mesh.aabb = AABB{ glm::vec3(-1.0f), glm::vec3(1.0f) };
+		mesh.boundingSphere = Sphere{ glm::vec3(0.0f), glm::sqrt(3.0f) };
+		Submesh sm{};
+		sm.primitiveType = PrimitiveType::Triangle;
+		sm.numIndices = 3000;
+		for (auto lod = 1u; lod < kMaxMeshLods; ++lod)
+			sm.lodRanges[lod - 1] = IndexRange{ 0, 3000u >> lod };
+		mesh.submeshes.push_back(sm);
+		mesh.numLods = kMaxMeshLods;
+		mesh.lodErrors[0] = 0.0f;
+		mesh.lodErrors[1] = 0.001f;
+		mesh.lodErrors[2] = 0.004f;
+		mesh.lodErrors[3] = 0.016f;
+	}
+
+	bool testSelection()
+	{
+		Mesh mesh;
+		setupLodMesh(mesh);
+		auto proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+		LodSelector selector(glm::vec3(0.0f), proj, 720.0f, LodParams());
+		auto radius = mesh.boundingSphere.radius;
+
+		// distance at which each level is first picked, going away then coming back
+		float away[kMaxMeshLods] = {};
+		float back[kMaxMeshLods] = {};
+		unsigned lod = 0;
+		bool monotonic = true;
+		for (auto d = 2.0f; d < 500.0f; d *= 1.01f) {
+			auto next = selector.select(mesh, glm::vec3(0.0f, 0.0f, -d), radius, lod);
+			monotonic &= next >= lod;
+			if (next != lod)
+				away[next] = d;
+			lod = next;
+		}
+		for (auto d = 500.0f; d > 2.0f; d /= 1.01f) {
+			auto next = selector.select(mesh, glm::vec3(0.0f, 0.0f, -d), radius, lod);
+			monotonic &= next <= lod;
+			if (next != lod)
+				back[lod] = d;
+			lod = next;
+		}
+		bool hysteresis = true;
+		for (auto l = 1u; l < kMaxMeshLods; ++l) {
+			std::printf("    -> level %u: from %.1f going away, until %.1f coming back\n", l, away[l], back[l]);
+			hysteresis &= away[l] > back[l] && back[l] > 0.0f;
+		}
+		bool ok = check(monotonic && lod == 0, "coarser going away, finer coming back");
+		ok &= check(hysteresis, "levels switch back closer than they switched");
+
+		// jitter around the distance of a switch
+		unsigned switches = 0;
+		lod = selector.select(mesh, glm::vec3(0.0f, 0.0f, -away[2]), radius, 1);
+		for (auto i = 0u; i < 100; ++i) {
+			auto d = away[2] * (i & 1 ? 1.02f : 0.98f);
+			auto next = selector.select(mesh, glm::vec3(0.0f, 0.0f, -d), radius, lod);
+			switches += next != lod;
+			lod = next;
+		}
+		ok &= check(switches == 0, "no popping when jittering at a threshold");
+
+		LodParams biased;
+		biased.bias = 1.0f;
+		LodSelector coarser(glm::vec3(0.0f), proj, 720.0f, biased);
+		auto at = glm::vec3(0.0f, 0.0f, -(away[2] + back[2]) * 0.5f);
+		ok &= check(coarser.select(mesh, at, radius, 0) > selector.select(mesh, at, radius, 0), "positive bias selects coarser levels");
+		return ok;
+	}
+
+	bool testDrawRecording()
+	{
+		Shader shader;
+		Material material;
+		material.shader = &shader;
+		Mesh mesh;
+		setupLodMesh(mesh);
+
+		// a line of objects going away from the camera
+		Scene scene;
+		const unsigned numObjects = 400;
+		for (auto i = 0u; i < numObjects; ++i)
+			scene.createMeshPrefab(Transform().move({ 0.0f, 0.0f, -2.0f - 0.1f * float(i) }), mesh, material);
+		scene.transforms.update();
+
+		auto proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+		auto viewProj = proj * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		LodSelector selector(glm::vec3(0.0f), proj, 720.0f, LodParams());
+		DrawListRecorder recorder;
+		recorder.record(scene, material, viewProj, nullptr, nullptr, &selector);
+		RenderQueue queue;
+		recorder.merge(queue);
+		queue.sort();
+
+		auto &stats = recorder.getLodStats();
+		unsigned draws = 0;
+		bool trianglesOk = true;
+		for (auto lod = 0u; lod < kMaxMeshLods; ++lod) {
+			std::printf("    -> level %u: %3u draws, %6u triangles\n", lod, stats.numDraws[lod], stats.numTriangles[lod]);
+			draws += stats.numDraws[lod];
+			trianglesOk &= stats.numTriangles[lod] == stats.numDraws[lod] * mesh.getNumTriangles(lod);
+		}
+		bool ok = check(draws == recorder.getNumVisible() && trianglesOk, "LOD stats add up");
+		bool allLevels = true;
+		for (auto lod = 0u; lod < kMaxMeshLods; ++lod)
+			allLevels &= stats.numDraws[lod] > 0;
+		ok &= check(allLevels, "all levels drawn along the line");
+
+		// levels follow the distance, and the queue groups them
+		bool consistent = true;
+		for (auto &it : scene.meshNodes) {
+			auto distance = -scene.transforms.getWorldMatrix(it.first)[3].z;
+			for (auto &other : scene.meshNodes)
+				if (-scene.transforms.getWorldMatrix(other.first)[3].z > distance)
+					consistent &= other.second.lod >= it.second.lod;
+		}
+		bool grouped = true;
+		for (auto i = 1u; i < queue.size(); ++i)
+			grouped &= queue[i].lod >= queue[i - 1].lod;
+		ok &= check(consistent && grouped, "farther objects never finer, queue sorted by level");
+
+		// instanced runs do not mix levels
+		IndirectDrawBuilder builder;
+		builder.build(queue, 2);
+		bool split = builder.getBatches().size() == kMaxMeshLods;
+		for (auto &batch : builder.getBatches())
+			for (auto i = batch.first; i < batch.first + batch.count; ++i)
+				split &= queue[i].lod == batch.lod;
+		ok &= check(split, "one instanced batch per level");
+		return ok;
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= testSimplification();
+	ok &= testRoundTrip();
+	ok &= testSelection();
+	ok &= testDrawRecording();
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_mesh_lod"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_mesh_lod"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,195 @@
+// nanovg renderer test: a frame of UI paths (non-convex fill, convex fill,
+// stroke, image pattern) drawn through the device with the vertices and
+// uniforms in transient memory, no buffer allocation in later frames, the
+// stats of the flush, alpha image uploads and nearest filtering
+// (run from the repository root: loads resources/shaders/nanovg.glsl)
+#include <rendering/nanovg_renderer.hpp>
+#include <rendering/device.hpp>
+#include <cstdio>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	// unpack alignment of each texture upload
+	class UploadDevice : public RecordingDevice
+	{
+	public:
+		void updateTexture(GLuint /*tex*/, GLenum /*target*/, GLenum /*imageTarget*/, int /*mipLevel*/, glm::ivec2 /*offset*/, glm::ivec2 size, GLenum format, GLenum /*type*/, const void * /*data*/) override {
+			uploads.push_back(Upload{ format, size.x, getUnpackAlignment() });
+		}
+
+		struct Upload
+		{
+			GLenum format;
+			int width;
+			int alignment;
+		};
+		std::vector<Upload> uploads;
+	};
+
+	// frame time graph of the scene renderer: many bars in one path
+	void drawBars(NVGcontext *vg, unsigned numBars)
+	{
+		nvgBeginPath(vg);
+		for (auto i = 0u; i < numBars; ++i)
+			nvgRect(vg, i * 3.0f, 700.0f - float(i % 17), 3.0f, float(i % 17) + 1.0f);
+		nvgFillColor(vg, nvgRGBA(70, 70, 255, 255));
+		nvgFill(vg);
+	}
+
+	void drawFrame(NVGcontext *vg, int image)
+	{
+		nvgBeginFrame(vg, 1280, 720, 1.0f);
+		drawBars(vg, 200);
+		// convex
+		nvgBeginPath(vg);
+		nvgRoundedRect(vg, 10.0f, 10.0f, 200.0f, 100.0f, 8.0f);
+		nvgFillColor(vg, nvgRGBA(255, 70, 70, 128));
+		nvgFill(vg);
+		nvgBeginPath(vg);
+		nvgMoveTo(vg, 10.0f, 200.0f);
+		nvgLineTo(vg, 300.0f, 250.0f);
+		nvgLineTo(vg, 50.0f, 300.0f);
+		nvgStrokeColor(vg, nvgRGBA(255, 255, 255, 255));
+		nvgStrokeWidth(vg, 2.0f);
+		nvgStroke(vg);
+		nvgBeginPath(vg);
+		nvgRect(vg, 400.0f, 400.0f, 64.0f, 64.0f);
+		nvgFillPaint(vg, nvgImagePattern(vg, 400.0f, 400.0f, 16.0f, 16.0f, 0.0f, image, 1.0f));
+		nvgFill(vg);
+		nvgEndFrame(vg);
+	}
+
+	bool testFrame(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		NanoVGRenderer renderer(gc, NVG_ANTIALIAS);
+		auto vg = renderer.getContext();
+		ok &= check(vg != nullptr, "context created on a headless device");
+		std::vector<unsigned char> pixels(16 * 16 * 4, 255);
+		auto image = nvgCreateImageRGBA(vg, 16, 16, NVG_IMAGE_REPEATX | NVG_IMAGE_REPEATY, pixels.data());
+
+		device.reset();
+		gc.beginFrame();
+		drawFrame(vg, image);
+		gc.endFrame();
+		auto &stats = renderer.getStats();
+		ok &= check(stats.numCalls == 4, "one call per fill and stroke");
+		ok &= check(stats.numDrawCalls == device.getCommandCount(RecordingDevice::CommandType::DrawArrays)
+			&& stats.numDrawCalls > 0, "draws through the device");
+		ok &= check(stats.numVertices > 200 * 4 && stats.transientBytes >= stats.numVertices * sizeof(NVGvertex), "vertices in transient memory");
+		ok &= check(device.getCommandCount(RecordingDevice::CommandType::StencilFunc) > 0
+			&& device.getCommandCount(RecordingDevice::CommandType::ColorMask) > 0, "stencil fill for the bars");
+		ok &= check(device.getCommandCount(RecordingDevice::CommandType::BindVertexBuffers) == 1, "one vertex buffer binding per frame");
+		std::printf("    %u draw calls, %u vertices per frame\n", stats.numDrawCalls, stats.numVertices);
+
+		// the image pattern: its texture, with the shared repeat sampler
+		bool sampler = false;
+		for (auto &cmd : device.getCommands())
+			if (cmd.type == RecordingDevice::CommandType::BindSamplers
+				&& device.getObjectNames()[cmd.objects_begin] == gc.getSamplerLinearRepeat())
+				sampler = true;
+		ok &= check(sampler, "shared repeat sampler for the image");
+
+		// steady state: no new buffer storage
+		gc.beginFrame();
+		drawFrame(vg, image);
+		gc.endFrame();
+		auto memory = device.getBufferMemoryUsed();
+		for (auto frame = 0u; frame < 10; ++frame) {
+			gc.beginFrame();
+			drawFrame(vg, image);
+			gc.endFrame();
+		}
+		ok &= check(device.getBufferMemoryUsed() == memory, "no buffer allocation in later frames");
+
+		// nothing drawn
+		gc.beginFrame();
+		nvgBeginFrame(vg, 1280, 720, 1.0f);
+		nvgEndFrame(vg);
+		gc.endFrame();
+		ok &= check(renderer.getStats().numCalls == 0 && renderer.getStats().numDrawCalls == 0, "empty frame");
+		nvgDeleteImage(vg, image);
+		return ok;
+	}
+
+	bool testStencilStrokes(GraphicsContext &gc, RecordingDevice &device)
+	{
+		NanoVGRenderer renderer(gc, NVG_ANTIALIAS | NVG_STENCIL_STROKES);
+		auto vg = renderer.getContext();
+		device.reset();
+		gc.beginFrame();
+		nvgBeginFrame(vg, 1280, 720, 1.0f);
+		nvgBeginPath(vg);
+		nvgMoveTo(vg, 10.0f, 10.0f);
+		nvgLineTo(vg, 100.0f, 100.0f);
+		nvgLineTo(vg, 10.0f, 100.0f);
+		nvgStroke(vg);
+		nvgEndFrame(vg);
+		gc.endFrame();
+		// base, antialiased pixels, stencil clear
+		return check(renderer.getStats().numDrawCalls == 3 && device.getCommandCount(RecordingDevice::CommandType::StencilOp) > 0,
+			"stencil strokes in three passes");
+	}
+
+	bool testImages(GraphicsContext &gc, UploadDevice &device)
+	{
+		bool ok = true;
+		NanoVGRenderer renderer(gc, NVG_ANTIALIAS);
+		auto vg = renderer.getContext();
+		// like the font atlas: one byte per pixel, rows not a multiple of 4 bytes
+		auto params = nvgInternalParams(vg);
+		std::vector<unsigned char> alpha(13 * 7, 255);
+		device.uploads.clear();
+		auto atlas = params->renderCreateTexture(params->userPtr, NVG_TEXTURE_ALPHA, 13, 7, 0, alpha.data());
+		params->renderUpdateTexture(params->userPtr, atlas, 2, 3, 4, 2, alpha.data());
+		std::vector<unsigned char> pixels(13 * 7 * 4, 255);
+		auto image = nvgCreateImageRGBA(vg, 13, 7, NVG_IMAGE_NEAREST, pixels.data());
+		auto &uploads = device.uploads;
+		ok &= check(uploads.size() == 3 && uploads[0].format == gl::RED && uploads[0].alignment == 1
+			&& uploads[1].alignment == 1 && uploads[1].width == 13 && uploads[2].format == gl::RGBA,
+			"alpha images uploaded with byte alignment");
+		ok &= check(device.getUnpackAlignment() == 4 && uploads[2].alignment == 4, "default alignment restored");
+
+		// nearest filtering: the shared nearest samplers
+		auto sampled = [&](GLuint sampler) {
+			for (auto &cmd : device.getCommands())
+				if (cmd.type == RecordingDevice::CommandType::BindSamplers && device.getObjectNames()[cmd.objects_begin] == sampler)
+					return true;
+			return false;
+		};
+		auto repeat = nvgCreateImageRGBA(vg, 13, 7, NVG_IMAGE_NEAREST | NVG_IMAGE_REPEATX, pixels.data());
+		device.reset();
+		gc.beginFrame();
+		drawFrame(vg, image);
+		gc.endFrame();
+		ok &= check(sampled(gc.getSamplerNearestClamp()) && !sampled(gc.getSamplerLinearRepeat()), "nearest image: nearest sampler");
+		device.reset();
+		gc.beginFrame();
+		drawFrame(vg, repeat);
+		gc.endFrame();
+		ok &= check(sampled(gc.getSamplerNearestRepeat()), "nearest repeating image: nearest repeat sampler");
+		nvgDeleteImage(vg, repeat);
+		nvgDeleteImage(vg, image);
+		params->renderDeleteTexture(params->userPtr, atlas);
+		return ok;
+	}
+}
+
+int main()
+{
+	UploadDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testFrame(gc, device);
+		ok &= testStencilStrokes(gc, device);
+		ok &= testImages(gc, device);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_nanovg_renderer"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_nanovg_renderer"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,303 @@
+// nanovg retained path test: fills and strokes of a retained path match the
+// immediate path under translation, rotation and scale, the tessellation is
+// reused while only the translation or rotation changes, the current path is
+// kept, and the CPU time of a static HUD drawn both ways
+#include <rendering/nanovg/nanovg.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	// backend keeping the vertices of the last fill or stroke
+	struct Capture
+	{
+		std::vector<std::vector<NVGvertex>> fills;
+		std::vector<std::vector<NVGvertex>> strokes;
+		float bounds[4];
+		float strokeWidth;
+		unsigned numCalls = 0;
+
+		void capture(const NVGpath *paths, int npaths)
+		{
+			fills.clear();
+			strokes.clear();
+			for (int i = 0; i < npaths; ++i) {
+				fills.emplace_back(paths[i].fill, paths[i].fill + paths[i].nfill);
+				strokes.emplace_back(paths[i].stroke, paths[i].stroke + paths[i].nstroke);
+			}
+			++numCalls;
+		}
+	};
+
+	int renderCreate(void *) { return 1; }
+	int renderCreateTexture(void *, int, int, int, int, const unsigned char *) { return 1; }
+	int renderDeleteTexture(void *, int) { return 1; }
+	int renderUpdateTexture(void *, int, int, int, int, int, const unsigned char *) { return 1; }
+	int renderGetTextureSize(void *, int, int *w, int *h) { *w = *h = 512; return 1; }
+	void renderViewport(void *, int, int) {}
+	void renderCancel(void *) {}
+	void renderFlush(void *) {}
+	void renderTriangles(void *, NVGpaint *, NVGscissor *, const NVGvertex *, int) {}
+	void renderDelete(void *) {}
+
+	void renderFill(void *uptr, NVGpaint *, NVGscissor *, float, const float *bounds, const NVGpath *paths, int npaths)
+	{
+		auto capture = static_cast<Capture*>(uptr);
+		capture->capture(paths, npaths);
+		for (int i = 0; i < 4; ++i)
+			capture->bounds[i] = bounds[i];
+	}
+
+	void renderStroke(void *uptr, NVGpaint *, NVGscissor *, float, float strokeWidth, const NVGpath *paths, int npaths)
+	{
+		auto capture = static_cast<Capture*>(uptr);
+		capture->capture(paths, npaths);
+		capture->strokeWidth = strokeWidth;
+	}
+
+	NVGcontext *createContext(Capture &capture)
+	{
+		NVGparams params = {};
+		params.userPtr = &capture;
+		params.edgeAntiAlias = 1;
+		params.renderCreate = renderCreate;
+		params.renderCreateTexture = renderCreateTexture;
+		params.renderDeleteTexture = renderDeleteTexture;
+		params.renderUpdateTexture = renderUpdateTexture;
+		params.renderGetTextureSize = renderGetTextureSize;
+		params.renderViewport = renderViewport;
+		params.renderCancel = renderCancel;
+		params.renderFlush = renderFlush;
+		params.renderFill = renderFill;
+		params.renderStroke = renderStroke;
+		params.renderTriangles = renderTriangles;
+		params.renderDelete = renderDelete;
+		return nvgCreateInternal(&params);
+	}
+
+	// a panel: rounded frame with a hole, and a curve
+	void panelPath(NVGcontext *vg)
+	{
+		nvgBeginPath(vg);
+		nvgRoundedRect(vg, 0.0f, 0.0f, 300.0f, 200.0f, 12.0f);
+		nvgCircle(vg, 150.0f, 100.0f, 40.0f);
+		nvgPathWinding(vg, NVG_HOLE);
+		nvgMoveTo(vg, 10.0f, 190.0f);
+		nvgBezierTo(vg, 80.0f, 120.0f, 200.0f, 260.0f, 290.0f, 150.0f);
+	}
+
+	bool sameVertices(const std::vector<std::vector<NVGvertex>> &a, const std::vector<std::vector<NVGvertex>> &b, float tolerance)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); ++i) {
+			if (a[i].size() != b[i].size())
+				return false;
+			for (size_t j = 0; j < a[i].size(); ++j)
+				if (std::fabs(a[i][j].x - b[i][j].x) > tolerance || std::fabs(a[i][j].y - b[i][j].y) > tolerance
+					|| std::fabs(a[i][j].u - b[i][j].u) > 1e-5f || std::fabs(a[i][j].v - b[i][j].v) > 1e-5f)
+					return false;
+		}
+		return true;
+	}
+
+	// immediate and retained fill and stroke of the panel at the transform of the state
+	bool matchesImmediate(NVGcontext *vg, Capture &capture, NVGretainedPath *panel, float tolerance)
+	{
+		bool ok = true;
+		panelPath(vg);
+		nvgFill(vg);
+		auto fills = capture.fills;
+		auto strokes = capture.strokes;
+		float bounds[4] = { capture.bounds[0], capture.bounds[1], capture.bounds[2], capture.bounds[3] };
+		nvgFillRetained(vg, panel);
+		ok &= sameVertices(fills, capture.fills, tolerance) && sameVertices(strokes, capture.strokes, tolerance);
+		// the retained bounds hold the path
+		ok &= capture.bounds[0] <= bounds[0] + tolerance && capture.bounds[1] <= bounds[1] + tolerance
+			&& capture.bounds[2] >= bounds[2] - tolerance && capture.bounds[3] >= bounds[3] - tolerance;
+
+		panelPath(vg);
+		nvgStroke(vg);
+		strokes = capture.strokes;
+		auto width = capture.strokeWidth;
+		nvgStrokeRetained(vg, panel);
+		ok &= sameVertices(strokes, capture.strokes, tolerance) && width == capture.strokeWidth;
+		return ok;
+	}
+
+	NVGretainedPath *retainPanel(NVGcontext *vg)
+	{
+		nvgSave(vg);
+		nvgResetTransform(vg);
+		panelPath(vg);
+		auto panel = nvgRetainPath(vg);
+		nvgRestore(vg);
+		return panel;
+	}
+
+	bool testMatches(NVGcontext *vg, Capture &capture)
+	{
+		bool ok = true;
+		nvgBeginFrame(vg, 1920, 1080, 1.0f);
+		auto panel = retainPanel(vg);
+		ok &= check(panel != nullptr, "path retained");
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-4f), "same vertices as the immediate path");
+		nvgTranslate(vg, 500.5f, 320.25f);
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-3f), "translated");
+		nvgRotate(vg, 0.7f);
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-3f), "rotated");
+		nvgScale(vg, 1.5f, 1.5f);
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-3f), "scaled");
+		nvgScale(vg, 1.0f, 0.5f);
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-3f), "non-uniform scale");
+		nvgReset(vg);
+		nvgStrokeWidth(vg, 0.3f);
+		nvgLineCap(vg, NVG_ROUND);
+		nvgLineJoin(vg, NVG_ROUND);
+		ok &= check(matchesImmediate(vg, capture, panel, 1e-4f), "thin stroke, round caps and joins");
+
+		// retained in the local space of a transform
+		nvgReset(vg);
+		nvgTranslate(vg, 40.0f, 60.0f);
+		panelPath(vg);
+		auto local = nvgRetainPath(vg);
+		nvgFillRetained(vg, panel);
+		auto fills = capture.fills;
+		nvgFillRetained(vg, local);
+		ok &= check(sameVertices(fills, capture.fills, 1e-3f), "recorded in the local space of the transform");
+		nvgDeleteRetainedPath(vg, local);
+
+		nvgBeginPath(vg);
+		ok &= check(nvgRetainPath(vg) == nullptr, "empty path not retained");
+		nvgEndFrame(vg);
+		nvgDeleteRetainedPath(vg, panel);
+		return ok;
+	}
+
+	bool testCache(NVGcontext *vg, Capture &capture)
+	{
+		bool ok = true;
+		int hits, misses;
+		nvgBeginFrame(vg, 1920, 1080, 1.0f);
+		auto panel = retainPanel(vg);
+		nvgFillRetained(vg, panel);
+		nvgStrokeRetained(vg, panel);
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 0 && misses == 2, "first fill and stroke tessellated");
+
+		// moving and rotating the panel reuses the tessellation
+		for (int i = 0; i < 10; ++i) {
+			nvgSave(vg);
+			nvgTranslate(vg, float(i) * 37.0f, float(i) * 11.0f);
+			nvgRotate(vg, float(i) * 0.3f);
+			nvgFillRetained(vg, panel);
+			nvgStrokeRetained(vg, panel);
+			nvgRestore(vg);
+		}
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 20 && misses == 2, "translation and rotation: cached");
+
+		// new scale and stroke width: tessellated, then cached
+		nvgSave(vg);
+		nvgScale(vg, 2.0f, 2.0f);
+		nvgFillRetained(vg, panel);
+		nvgFillRetained(vg, panel);
+		nvgRestore(vg);
+		nvgStrokeWidth(vg, 3.0f);
+		nvgStrokeRetained(vg, panel);
+		nvgStrokeRetained(vg, panel);
+		nvgStrokeWidth(vg, 1.0f);
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 22 && misses == 4, "scale and stroke width: new tessellation");
+		// the earlier ones are kept
+		nvgFillRetained(vg, panel);
+		nvgStrokeRetained(vg, panel);
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 24 && misses == 4, "earlier tessellations kept");
+		nvgEndFrame(vg);
+
+		// next frame: stats reset, tessellations kept
+		nvgBeginFrame(vg, 1920, 1080, 1.0f);
+		nvgFillRetained(vg, panel);
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 1 && misses == 0, "cached across frames");
+		// device pixel ratio changes the fringe
+		nvgEndFrame(vg);
+		nvgBeginFrame(vg, 1920, 1080, 2.0f);
+		nvgFillRetained(vg, panel);
+		nvgRetainedStats(vg, &hits, &misses);
+		ok &= check(hits == 0 && misses == 1, "device pixel ratio: new tessellation");
+
+		// the current path is not changed by retained fills
+		nvgBeginPath(vg);
+		nvgRect(vg, 10.0f, 10.0f, 20.0f, 20.0f);
+		nvgFill(vg);
+		auto rect = capture.fills;
+		nvgFillRetained(vg, panel);
+		nvgScale(vg, 3.0f, 3.0f);
+		nvgFillRetained(vg, panel);
+		nvgResetTransform(vg);
+		nvgFill(vg);
+		ok &= check(sameVertices(rect, capture.fills, 0.0f), "current path kept");
+		nvgEndFrame(vg);
+		nvgDeleteRetainedPath(vg, panel);
+		return ok;
+	}
+
+	// HUD of many static panels, immediate or retained
+	void timeHud(NVGcontext *vg)
+	{
+		const int kPanels = 200, kFrames = 50;
+		std::vector<NVGretainedPath*> panels;
+		nvgBeginFrame(vg, 1920, 1080, 1.0f);
+		for (int i = 0; i < kPanels; ++i)
+			panels.push_back(retainPanel(vg));
+		nvgEndFrame(vg);
+
+		auto draw = [&](bool retained) {
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int frame = 0; frame < kFrames; ++frame) {
+				nvgBeginFrame(vg, 1920, 1080, 1.0f);
+				for (int i = 0; i < kPanels; ++i) {
+					nvgSave(vg);
+					nvgTranslate(vg, float(i % 20) * 90.0f, float(i / 20) * 100.0f);
+					if (retained) {
+						nvgFillRetained(vg, panels[i]);
+						nvgStrokeRetained(vg, panels[i]);
+					}
+					else {
+						panelPath(vg);
+						nvgFill(vg);
+						nvgStroke(vg);
+					}
+					nvgRestore(vg);
+				}
+				nvgEndFrame(vg);
+			}
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+			return elapsed.count() / kFrames;
+		};
+		auto immediate = draw(false);
+		auto retained = draw(true);
+		std::printf("    %d panels: %.3f ms immediate, %.3f ms retained per frame\n", kPanels, immediate, retained);
+		for (auto panel : panels)
+			nvgDeleteRetainedPath(vg, panel);
+	}
+}
+
+int main()
+{
+	Capture capture;
+	auto vg = createContext(capture);
+	bool ok = check(vg != nullptr, "context created");
+	if (vg) {
+		ok &= testMatches(vg, capture);
+		ok &= testCache(vg, capture);
+		timeHud(vg);
+		nvgDeleteInternal(vg);
+	}
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_nanovg_retained"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_nanovg_retained"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
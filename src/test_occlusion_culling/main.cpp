@@ -0,0 +1,375 @@
+// Occlusion culling test: occluder proxies, SSE against scalar rasterization
+// and box tests, simple cases, occluded boxes against a screen-space reference
+// (no box seen through the occluders is culled), and the culler and its worker
+// thread in the draw recording of a scene
+#include <rendering/occlusion.hpp>
+#include <rendering/draw_list.hpp>
+#include <scene/scene.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const unsigned kWidth = 256;
+	const unsigned kHeight = 128;
+
+	// quad in the XY plane, split in size x size cells
+	MeshData makeGrid(float halfSize, unsigned size)
+	{
+		MeshData data;
+		for (auto y = 0u; y <= size; ++y)
+			for (auto x = 0u; x <= size; ++x)
+				data.vertices.push_back(glm::vec3(
+					(float(x) / size * 2.0f - 1.0f) * halfSize,
+					(float(y) / size * 2.0f - 1.0f) * halfSize,
+					0.0f));
+		for (auto y = 0u; y < size; ++y)
+			for (auto x = 0u; x < size; ++x) {
+				uint16_t i = static_cast<uint16_t>(y * (size + 1) + x);
+				uint16_t row = static_cast<uint16_t>(size + 1);
+				data.indices.insert(data.indices.end(), { i, uint16_t(i + 1), uint16_t(i + row + 1), i, uint16_t(i + row + 1), uint16_t(i + row) });
+			}
+		Submesh sm{};
+		sm.primitiveType = PrimitiveType::Triangle;
+		sm.numVertices = static_cast<unsigned>(data.vertices.size());
+		sm.numIndices = static_cast<unsigned>(data.indices.size());
+		data.submeshes.push_back(sm);
+		data.computeBounds();
+		return data;
+	}
+
+	glm::mat4 makeViewProj()
+	{
+		auto proj = glm::perspective(glm::radians(60.0f), float(kWidth) / kHeight, 0.1f, 500.0f);
+		auto view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		return proj * view;
+	}
+
+	bool testProxies()
+	{
+		bool ok = true;
+		auto quad = makeGrid(1.0f, 1);
+		auto proxy = OccluderMesh::fromMeshData(quad, 256);
+		ok &= check(proxy && proxy->getNumTriangles() == 2 && proxy->vertices.size() == 4, "small mesh kept as is");
+
+		// no triangle stands out: dropping most of them would leave holes
+		ok &= check(OccluderMesh::fromMeshData(makeGrid(10.0f, 64), 256) == nullptr, "finely tessellated mesh: no proxy");
+
+		// large faces and small details (8192 triangles): the large faces are kept
+		auto detailed = makeGrid(10.0f, 1);
+		auto details = makeGrid(0.5f, 64);
+		auto base = static_cast<uint16_t>(detailed.vertices.size());
+		for (auto &v : details.vertices)
+			detailed.vertices.push_back(v + glm::vec3(0.0f, 0.0f, 1.0f));
+		for (auto i : details.indices)
+			detailed.indices.push_back(uint16_t(base + i));
+		detailed.submeshes[0].numVertices = static_cast<unsigned>(detailed.vertices.size());
+		detailed.submeshes[0].numIndices = static_cast<unsigned>(detailed.indices.size());
+		proxy = OccluderMesh::fromMeshData(detailed, 256);
+		auto getTriangle = [](const std::vector<glm::vec3> &vertices, const uint16_t *indices) {
+			return std::array<glm::vec3, 3>{ { vertices[indices[0]], vertices[indices[1]], vertices[indices[2]] } };
+		};
+		std::vector<std::array<glm::vec3, 3>> meshTriangles;
+		for (auto i = 0u; i + 3 <= detailed.indices.size(); i += 3)
+			meshTriangles.push_back(getTriangle(detailed.vertices, &detailed.indices[i]));
+		bool fromMesh = proxy != nullptr;
+		unsigned numLarge = 0;
+		for (auto t = 0u; proxy && t < proxy->getNumTriangles(); ++t) {
+			std::array<glm::vec3, 3> tri{ { proxy->vertices[proxy->indices[t * 3]], proxy->vertices[proxy->indices[t * 3 + 1]], proxy->vertices[proxy->indices[t * 3 + 2]] } };
+			fromMesh &= std::find(meshTriangles.begin(), meshTriangles.end(), tri) != meshTriangles.end();
+			numLarge += tri[0].z == 0.0f;
+		}
+		ok &= check(fromMesh && proxy->getNumTriangles() <= 256 && numLarge == 2, "large faces kept under budget");
+		ok &= check(fromMesh, "proxy triangles are triangles of the mesh");
+		std::printf("    -> %u triangles, %u vertices\n", proxy ? proxy->getNumTriangles() : 0, proxy ? unsigned(proxy->vertices.size()) : 0);
+
+		MeshData lines = quad;
+		lines.submeshes[0].primitiveType = PrimitiveType::Line;
+		ok &= check(OccluderMesh::fromMeshData(lines, 256) == nullptr, "no proxy without triangles");
+		return ok;
+	}
+
+	bool testSimdMatchesScalar()
+	{
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> pos(-30.0f, 30.0f);
+		std::uniform_real_distribution<float> depth(-60.0f, 5.0f);
+		OccluderMesh soup;
+		for (auto i = 0u; i < 3000; ++i) {
+			soup.vertices.push_back(glm::vec3(pos(rng), pos(rng), depth(rng)));
+			soup.indices.push_back(i);
+		}
+		OcclusionBuffer simd(kWidth, kHeight);
+		OcclusionBuffer scalar(kWidth, kHeight);
+		scalar.setSimdEnabled(false);
+		// shared vertices, not a multiple of 4
+		auto gridData = makeGrid(20.0f, 8);
+		auto grid = OccluderMesh::fromMeshData(gridData, 256);
+		auto viewProj = makeViewProj();
+		for (auto buffer : { &simd, &scalar }) {
+			buffer->clear(viewProj);
+			buffer->rasterize(soup, glm::mat4(1.0f));
+			buffer->rasterize(*grid, glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -25.0f)), 0.7f, glm::vec3(1.0f, 0.5f, 0.0f)));
+			buffer->finish();
+		}
+		bool same = simd.getNumTrianglesRasterized() == scalar.getNumTrianglesRasterized();
+		unsigned covered = 0;
+		for (auto y = 0u; y < kHeight; ++y)
+			for (auto x = 0u; x < kWidth; ++x) {
+				auto a = simd.getDepth(x, y);
+				auto b = scalar.getDepth(x, y);
+				same &= std::memcmp(&a, &b, sizeof(float)) == 0;
+				covered += a < 1.0f;
+			}
+		std::printf("    -> %u triangles rasterized (some clipped), %u/%u pixels covered\n",
+			simd.getNumTrianglesRasterized(), covered, kWidth * kHeight);
+		bool ok = check(same && covered > 0, "SSE and scalar depth buffers identical");
+
+		// same box test results, some boxes crossing the near plane
+		unsigned numOccluded = 0;
+		unsigned numDifferent = 0;
+		for (auto i = 0u; i < 20000; ++i) {
+			auto center = glm::vec3(pos(rng), pos(rng) * 0.5f, depth(rng) - 10.0f);
+			auto extent = glm::vec3(0.1f) + glm::abs(glm::vec3(pos(rng), pos(rng), pos(rng))) * 0.05f;
+			auto occluded = simd.isOccluded(center, extent);
+			numOccluded += occluded;
+			numDifferent += occluded != scalar.isOccluded(center, extent);
+		}
+		std::printf("    -> %u/20000 boxes occluded, %u different\n", numOccluded, numDifferent);
+		ok &= check(numOccluded > 0 && numDifferent == 0, "SSE and scalar box tests identical");
+		return ok;
+	}
+
+	bool testSimpleCases()
+	{
+		auto wallData = makeGrid(5.0f, 1);
+		auto wall = OccluderMesh::fromMeshData(wallData, 256);
+		OcclusionBuffer buffer(kWidth, kHeight);
+		buffer.clear(makeViewProj());
+		// 10x10 wall, 10 units in front of the camera
+		buffer.rasterize(*wall, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -10.0f)));
+		buffer.finish();
+
+		bool ok = true;
+		auto extent = glm::vec3(0.5f);
+		ok &= check(buffer.isOccluded(glm::vec3(0.0f, 0.0f, -20.0f), extent), "box behind the wall culled");
+		ok &= check(buffer.isOccluded(glm::vec3(2.0f, -1.0f, -100.0f), extent), "far box behind the wall culled");
+		ok &= check(!buffer.isOccluded(glm::vec3(0.0f, 0.0f, -5.0f), extent), "box in front of the wall visible");
+		ok &= check(!buffer.isOccluded(glm::vec3(0.0f, 0.0f, -10.0f), extent), "box through the wall visible");
+		ok &= check(!buffer.isOccluded(glm::vec3(12.0f, 0.0f, -20.0f), extent), "box beside the wall visible");
+		ok &= check(!buffer.isOccluded(glm::vec3(9.9f, 0.0f, -20.0f), extent), "box behind the edge of the wall visible");
+		ok &= check(!buffer.isOccluded(glm::vec3(0.0f, 0.0f, 0.0f), extent), "box around the camera visible");
+
+		// a wall crossing the near plane is clipped, not dropped
+		auto floorData = makeGrid(50.0f, 1);
+		auto floor = OccluderMesh::fromMeshData(floorData, 256);
+		buffer.clear(makeViewProj());
+		buffer.rasterize(*floor, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+		buffer.finish();
+		ok &= check(buffer.isOccluded(glm::vec3(0.0f, -3.0f, -10.0f), extent), "box under a floor through the near plane culled");
+		ok &= check(!buffer.isOccluded(glm::vec3(0.0f, 0.0f, -10.0f), extent), "box above the floor visible");
+		return ok;
+	}
+
+	// screen-space triangle for the reference
+	struct RefTriangle
+	{
+		glm::vec3 v[3];
+	};
+
+	glm::vec3 project(const glm::mat4 &viewProj, const glm::vec3 &p)
+	{
+		auto c = viewProj * glm::vec4(p, 1.0f);
+		auto ndc = glm::vec3(c) / c.w;
+		return glm::vec3((ndc.x * 0.5f + 0.5f) * kWidth, (ndc.y * 0.5f + 0.5f) * kHeight, ndc.z * 0.5f + 0.5f);
+	}
+
+	// the point is visible for sure: not under any occluder grown by margin pixels
+	bool isClearlyVisible(const std::vector<RefTriangle> &occluders, const glm::vec3 &s, float margin)
+	{
+		for (auto &t : occluders) {
+			auto area = (t.v[1].x - t.v[0].x) * (t.v[2].y - t.v[0].y) - (t.v[1].y - t.v[0].y) * (t.v[2].x - t.v[0].x);
+			if (area == 0.0f)
+				continue;
+			float w[3];
+			bool inside = true;
+			for (auto k = 0u; k < 3; ++k) {
+				auto &p = t.v[k];
+				auto &q = t.v[(k + 1) % 3];
+				auto edge = glm::vec2(q - p);
+				auto d = (edge.x * (s.y - p.y) - edge.y * (s.x - p.x)) / glm::length(edge);
+				inside &= (area > 0.0f ? d : -d) >= -margin;
+				w[(k + 2) % 3] = (edge.x * (s.y - p.y) - edge.y * (s.x - p.x)) / area;
+			}
+			// interpolated depth (screen-space linear), in front of the point
+			auto z = w[0] * t.v[0].z + w[1] * t.v[1].z + w[2] * t.v[2].z;
+			if (inside && z < s.z)
+				return false;
+		}
+		return true;
+	}
+
+	bool testConservative()
+	{
+		std::mt19937 rng(1234);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		auto viewProj = makeViewProj();
+		auto quad = makeGrid(1.0f, 1);
+		auto proxy = OccluderMesh::fromMeshData(quad, 256);
+
+		unsigned numOccluded = 0;
+		unsigned numBoxes = 0;
+		unsigned numWrong = 0;
+		for (auto scene = 0u; scene < 20; ++scene) {
+			OcclusionBuffer buffer(kWidth, kHeight);
+			buffer.clear(viewProj);
+			std::vector<RefTriangle> reference;
+			for (auto i = 0u; i < 8; ++i) {
+				auto m = glm::translate(glm::mat4(1.0f), glm::vec3(unit(rng) * 8.0f, unit(rng) * 4.0f, -12.0f + unit(rng) * 4.0f));
+				m = glm::rotate(m, unit(rng) * 0.5f, glm::vec3(unit(rng), unit(rng), 1.0f));
+				m = glm::scale(m, glm::vec3(2.0f + unit(rng), 2.0f + unit(rng), 1.0f));
+				buffer.rasterize(*proxy, m);
+				for (auto t = 0u; t < proxy->getNumTriangles(); ++t) {
+					RefTriangle tri;
+					for (auto k = 0u; k < 3; ++k)
+						tri.v[k] = project(viewProj, glm::vec3(m * glm::vec4(proxy->vertices[proxy->indices[t * 3 + k]], 1.0f)));
+					reference.push_back(tri);
+				}
+			}
+			buffer.finish();
+
+			for (auto b = 0u; b < 200; ++b) {
+				auto center = glm::vec3(unit(rng) * 10.0f, unit(rng) * 5.0f, -25.0f + unit(rng) * 10.0f);
+				auto extent = glm::vec3(0.2f + 0.6f * glm::abs(unit(rng)));
+				++numBoxes;
+				if (!buffer.isOccluded(center, extent))
+					continue;
+				++numOccluded;
+				// points on the faces of the box
+				const unsigned n = 8;
+				bool visible = false;
+				for (auto axis = 0; axis < 3 && !visible; ++axis)
+					for (auto side = -1; side <= 1 && !visible; side += 2)
+						for (auto i = 0u; i <= n && !visible; ++i)
+							for (auto j = 0u; j <= n && !visible; ++j) {
+								glm::vec3 p;
+								p[axis] = float(side);
+								p[(axis + 1) % 3] = float(i) / n * 2.0f - 1.0f;
+								p[(axis + 2) % 3] = float(j) / n * 2.0f - 1.0f;
+								auto s = project(viewProj, center + p * extent);
+								if (s.x < 0.0f || s.y < 0.0f || s.x >= kWidth || s.y >= kHeight)
+									continue;
+								// one pixel of slack: coverage is sampled at pixel centers
+								visible = isClearlyVisible(reference, s, 1.5f);
+							}
+				numWrong += visible;
+			}
+		}
+		std::printf("    -> %u/%u boxes culled, %u of them visible in the reference\n", numOccluded, numBoxes, numWrong);
+		return check(numOccluded > 0 && numWrong == 0, "culled boxes are hidden in the reference");
+	}
+
+	bool testScene()
+	{
+		Shader shader;
+		Material material;
+		material.shader = &shader;
+
+		auto wallData = makeGrid(5.0f, 8);
+		Mesh wall;
+		wall.aabb = wallData.aabb;
+		wall.boundingSphere = wallData.boundingSphere;
+		wall.occluder = OccluderMesh::fromMeshData(wallData, 256);
+		Mesh box;
+		box.aabb = AABB{ glm::vec3(-0.5f), glm::vec3(0.5f) };
+		box.boundingSphere = Sphere{ glm::vec3(0.0f), glm::length(glm::vec3(0.5f)) };
+
+		Scene scene;
+		scene.createMeshPrefab(Transform().move({ 0.0f, 0.0f, -10.0f }), wall, material);
+		// 10x10 boxes behind the wall, 10x10 in front of it
+		for (auto i = 0u; i < 100; ++i) {
+			auto x = float(i % 10) - 4.5f;
+			auto y = float(i / 10) * 0.5f - 2.25f;
+			scene.createMeshPrefab(Transform().move({ x, y, -30.0f }), box, material);
+			scene.createMeshPrefab(Transform().move({ x * 0.5f, y * 0.5f, -6.0f }), box, material);
+		}
+		scene.transforms.update();
+		auto numOccluders = scene.markOccluders(2.0f);
+
+		auto viewProj = makeViewProj();
+		OcclusionCuller culler(kWidth, kHeight);
+		culler.beginFrame(scene, viewProj);
+		DrawListRecorder plain;
+		plain.record(scene, material, viewProj, nullptr);
+		DrawListRecorder culled;
+		culled.record(scene, material, viewProj, nullptr, &culler.getBuffer());
+
+		std::printf("    -> %u occluders rasterized, %u visible, %u occluded (%u without occlusion)\n",
+			culler.getNumOccluders(), culled.getNumVisible(), culled.getNumOccluded(), plain.getNumVisible());
+		bool ok = check(numOccluders == 1 && culler.getNumOccluders() == 1, "one occluder marked and rasterized");
+		ok &= check(culled.getNumOccluded() == 100 && culled.getNumVisible() == 101
+			&& culled.getNumVisible() + culled.getNumOccluded() == plain.getNumVisible(), "boxes behind the wall occluded");
+		return ok;
+	}
+
+	void benchmark()
+	{
+		std::mt19937 rng(99);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		auto viewProj = makeViewProj();
+		auto gridData = makeGrid(2.0f, 8);
+		auto proxy = OccluderMesh::fromMeshData(gridData, 256);
+		std::vector<glm::mat4> occluders(64);
+		for (auto &m : occluders)
+			m = glm::translate(glm::mat4(1.0f), glm::vec3(unit(rng) * 15.0f, unit(rng) * 8.0f, -20.0f + unit(rng) * 8.0f));
+		std::vector<glm::vec3> centers(20000);
+		for (auto &c : centers)
+			c = glm::vec3(unit(rng) * 30.0f, unit(rng) * 15.0f, -40.0f + unit(rng) * 15.0f);
+
+		for (auto simd : { false, true }) {
+			OcclusionBuffer buffer(kWidth, kHeight);
+			buffer.setSimdEnabled(simd);
+			const unsigned iterations = 20;
+			unsigned culled = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (auto it = 0u; it < iterations; ++it) {
+				buffer.clear(viewProj);
+				for (auto &m : occluders)
+					buffer.rasterize(*proxy, m);
+				buffer.finish();
+			}
+			auto mid = std::chrono::high_resolution_clock::now();
+			for (auto it = 0u; it < iterations; ++it) {
+				culled = 0;
+				for (auto &c : centers)
+					culled += buffer.isOccluded(c, glm::vec3(0.5f));
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			std::printf("%-7s: rasterize %u triangles %.3f ms, test %u boxes %.3f ms (%u culled)\n",
+				simd ? "SSE" : "scalar",
+				buffer.getNumTrianglesRasterized(),
+				std::chrono::duration<double, std::milli>(mid - start).count() / iterations,
+				unsigned(centers.size()),
+				std::chrono::duration<double, std::milli>(end - mid).count() / iterations,
+				culled);
+		}
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= testProxies();
+	ok &= testSimdMatchesScalar();
+	ok &= testSimpleCases();
+	ok &= testConservative();
+	ok &= testScene();
+	benchmark();
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_occlusion_culling"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_occlusion_culling"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
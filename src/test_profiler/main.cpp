@@ -0,0 +1,395 @@
+// Frame profiler test: scope hierarchy and averages, worker threads, disabled
+// cost, buffer overflow, GPU queries read back a few frames later (headless
+// device), and Chrome trace JSON
+#include <profiler.hpp>
+#include <rendering/device.hpp>
+#include <utils/thread_pool.hpp>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	void spin(unsigned microseconds)
+	{
+		auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+		while (std::chrono::steady_clock::now() < end)
+			;
+	}
+
+	const profiler::ScopeStats *findStats(const std::vector<profiler::ScopeStats> &stats, const char *name, bool gpu = false)
+	{
+		for (auto &st : stats)
+			if (st.gpu == gpu && !std::strcmp(st.name, name))
+				return &st;
+		return nullptr;
+	}
+
+	// query results become available a fixed number of frames after they were issued
+	class LatentDevice : public RecordingDevice
+	{
+	public:
+		explicit LatentDevice(unsigned latency_) : latency(latency_) {}
+
+		void queryTimestamp(GLuint query) override {
+			RecordingDevice::queryTimestamp(query);
+			issueFrame[query] = frame;
+		}
+
+		bool getQueryResult(GLuint query, uint64_t &result) override {
+			++numPolls;
+			if (frame < issueFrame.at(query) + latency)
+				return false;
+			return RecordingDevice::getQueryResult(query, result);
+		}
+
+		unsigned frame = 0;
+		unsigned numPolls = 0;
+
+	private:
+		unsigned latency;
+		std::unordered_map<GLuint, unsigned> issueFrame;
+	};
+
+	// minimal JSON syntax check
+	struct JsonChecker
+	{
+		const char *p;
+
+		void skipSpace() {
+			while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+				++p;
+		}
+
+		bool string() {
+			if (*p++ != '"')
+				return false;
+			for (; *p && *p != '"'; ++p)
+				if (*p == '\\' && !*++p)
+					return false;
+			return *p++ == '"';
+		}
+
+		bool value() {
+			skipSpace();
+			if (*p == '{' || *p == '[') {
+				auto close = *p == '{' ? '}' : ']';
+				auto object = *p++ == '{';
+				skipSpace();
+				if (*p == close)
+					return ++p, true;
+				for (;;) {
+					if (object) {
+						skipSpace();
+						if (!string())
+							return false;
+						skipSpace();
+						if (*p++ != ':')
+							return false;
+					}
+					if (!value())
+						return false;
+					skipSpace();
+					if (*p == close)
+						return ++p, true;
+					if (*p++ != ',')
+						return false;
+				}
+			}
+			if (*p == '"')
+				return string();
+			auto start = p;
+			while (*p && std::strchr("-+.eE0123456789truefalsn", *p))
+				++p;
+			return p != start;
+		}
+
+		bool document() {
+			if (!value())
+				return false;
+			skipSpace();
+			return !*p;
+		}
+	};
+
+	unsigned countOccurrences(const std::string &str, const char *pattern)
+	{
+		unsigned count = 0;
+		for (auto pos = str.find(pattern); pos != std::string::npos; pos = str.find(pattern, pos + 1))
+			++count;
+		return count;
+	}
+
+	bool testHierarchy()
+	{
+		profiler::reset();
+		profiler::setEnabled(true);
+		auto firstFrame = profiler::getFrameIndex();
+		double totals[4];
+		for (auto frame = 0u; frame < 4; ++frame) {
+			{
+				PROFILE_SCOPE("frame");
+				{
+					PROFILE_SCOPE("update");
+					spin(200 * (frame + 1));
+				}
+				for (auto i = 0; i < 2; ++i) {
+					PROFILE_SCOPE("render");
+					PROFILE_SCOPE("draw");
+					spin(100);
+				}
+			}
+			profiler::endFrame();
+			auto stats = profiler::getScopeStats();
+			auto update = findStats(stats, "update");
+			totals[frame] = update ? update->lastMs : 0.0;
+		}
+
+		auto stats = profiler::getScopeStats();
+		auto frame = findStats(stats, "frame");
+		auto update = findStats(stats, "update");
+		auto render = findStats(stats, "render");
+		auto draw = findStats(stats, "draw");
+		bool ok = true;
+		ok &= check(frame && update && render && draw && stats.size() == 4, "all scopes found");
+		if (!ok)
+			return false;
+		ok &= check(frame->depth == 0 && update->depth == 1 && render->depth == 1 && draw->depth == 2, "nesting depths");
+		ok &= check(stats[0].name == frame->name && stats[1].name == update->name
+			&& stats[2].name == render->name && stats[3].name == draw->name, "parents before children, siblings in order");
+		ok &= check(render->lastCalls == 2 && draw->lastCalls == 2 && update->lastCalls == 1, "calls per frame");
+		ok &= check(render->lastMs >= draw->lastMs && draw->lastMs >= 0.2, "parent time includes the children");
+		auto mean = (totals[0] + totals[1] + totals[2] + totals[3]) / 4.0;
+		ok &= check(totals[3] > totals[0] && std::abs(update->avgMs - mean) < 1e-9, "rolling average of the frame totals");
+		ok &= check(update->lastFrame == firstFrame + 3 && frame->lastFrame == firstFrame + 3, "frame of the last sample");
+		return ok;
+	}
+
+	bool testDisabled()
+	{
+		profiler::reset();
+		profiler::setEnabled(false);
+		const unsigned n = 10000000;
+		volatile unsigned sink = 0;
+		auto t0 = std::chrono::steady_clock::now();
+		for (auto i = 0u; i < n; ++i) {
+			PROFILE_SCOPE("disabled");
+			sink = sink + i;
+		}
+		auto t1 = std::chrono::steady_clock::now();
+		for (auto i = 0u; i < n; ++i)
+			sink = sink + i;
+		auto t2 = std::chrono::steady_clock::now();
+		profiler::endFrame();
+		auto disabledNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / n;
+		auto baseNs = std::chrono::duration<double, std::nano>(t2 - t1).count() / n;
+
+		profiler::setEnabled(true);
+		const unsigned m = 10000;
+		auto t3 = std::chrono::steady_clock::now();
+		for (auto i = 0u; i < m; ++i) {
+			PROFILE_SCOPE("enabled");
+			sink = sink + i;
+		}
+		auto t4 = std::chrono::steady_clock::now();
+		profiler::endFrame();
+		auto enabledNs = std::chrono::duration<double, std::nano>(t4 - t3).count() / m;
+		std::printf("scope cost: %.2f ns disabled (loop alone %.2f ns), %.1f ns enabled\n", disabledNs, baseNs, enabledNs);
+
+		auto stats = profiler::getScopeStats();
+		bool ok = true;
+		ok &= check(!findStats(stats, "disabled"), "no events when disabled");
+		ok &= check(findStats(stats, "enabled") && findStats(stats, "enabled")->lastCalls == m, "events when enabled");
+		ok &= check(disabledNs - baseNs < 5.0, "disabled scope costs less than 5 ns");
+		return ok;
+	}
+
+	bool testThreads()
+	{
+		profiler::reset();
+		profiler::setEnabled(true);
+		util::thread_pool pool(4);
+		const unsigned numJobs = 64;
+		std::atomic<unsigned> inner(0);
+		// the calling thread runs jobs too
+		pool.parallel_for(numJobs, 1, [&](unsigned begin, unsigned end) {
+			for (auto i = begin; i < end; ++i) {
+				PROFILE_SCOPE("job");
+				spin(20);
+				if (i % 2) {
+					PROFILE_SCOPE("inner");
+					inner++;
+				}
+			}
+		});
+		// a short-lived thread: its events are collected, then its buffer is freed
+		std::thread([] {
+			profiler::setThreadName("short-lived");
+			PROFILE_SCOPE("thread");
+		}).join();
+		profiler::endFrame();
+
+		auto stats = profiler::getScopeStats();
+		auto job = findStats(stats, "job");
+		auto innerStats = findStats(stats, "inner");
+		auto events = profiler::getTraceEvents();
+		std::unordered_map<unsigned, unsigned> jobsPerThread;
+		unsigned numJobEvents = 0;
+		for (auto &e : events)
+			if (!std::strcmp(e.name, "job")) {
+				++numJobEvents;
+				jobsPerThread[e.thread]++;
+			}
+		bool ok = true;
+		ok &= check(job && job->lastCalls == numJobs && job->depth == 0, "worker scopes merged across threads");
+		ok &= check(innerStats && innerStats->lastCalls == inner && innerStats->depth == 1, "nesting on worker threads");
+		ok &= check(numJobEvents == numJobs && findStats(stats, "thread"), "all events collected");
+		std::printf("job events on %u threads\n", static_cast<unsigned>(jobsPerThread.size()));
+
+		std::ostringstream trace;
+		profiler::writeChromeTrace(trace);
+		ok &= check(trace.str().find("short-lived") == std::string::npos
+			&& trace.str().find("\"main\"") != std::string::npos, "exited threads are unregistered");
+		return ok;
+	}
+
+	bool testOverflow()
+	{
+		profiler::reset();
+		profiler::setEnabled(true);
+		for (auto i = 0u; i < profiler::kThreadBufferSize + 10; ++i)
+			PROFILE_SCOPE("overflow");
+		profiler::endFrame();
+		auto stats = profiler::getScopeStats();
+		auto st = findStats(stats, "overflow");
+		bool ok = true;
+		ok &= check(profiler::getNumDroppedEvents() == 10, "events beyond the buffer size are dropped");
+		ok &= check(st && st->lastCalls == profiler::kThreadBufferSize, "buffered events are kept");
+		return ok;
+	}
+
+	bool testGpu()
+	{
+		bool ok = true;
+		profiler::reset();
+		profiler::setEnabled(true);
+		{
+			RecordingDevice device;
+			setGraphicsDevice(&device);
+			{
+				PROFILE_GPU_SCOPE("pass");
+				spin(50);
+				PROFILE_GPU_SCOPE("subpass");
+				spin(100);
+			}
+			profiler::endFrame();
+			setGraphicsDevice(nullptr);
+		}
+		auto stats = profiler::getScopeStats();
+		auto pass = findStats(stats, "pass", true);
+		auto subpass = findStats(stats, "subpass", true);
+		ok &= check(pass && subpass && subpass->depth == 1 && findStats(stats, "pass"), "GPU scopes, with their CPU scopes");
+		ok &= check(pass && stats.back().gpu && pass->lastMs >= subpass->lastMs && subpass->lastMs >= 0.1, "GPU times");
+		auto events = profiler::getTraceEvents();
+		const profiler::Event *cpu = nullptr, *gpu = nullptr;
+		for (auto &e : events)
+			if (!std::strcmp(e.name, "subpass"))
+				(e.thread == profiler::kGpuThread ? gpu : cpu) = &e;
+		ok &= check(cpu && gpu && gpu->begin >= cpu->begin && gpu->end - gpu->begin <= cpu->end - cpu->begin + 1000,
+			"GPU events aligned with their submission");
+
+		// results come two frames late: no waiting, the stats lag behind
+		profiler::reset();
+		{
+			LatentDevice device(2);
+			setGraphicsDevice(&device);
+			bool lagging = true;
+			auto firstFrame = profiler::getFrameIndex();
+			for (auto frame = 0u; frame < 8; ++frame) {
+				device.frame = frame;
+				{
+					PROFILE_GPU_SCOPE("latent");
+				}
+				profiler::endFrame();
+				auto stats = profiler::getScopeStats();
+				auto st = findStats(stats, "latent", true);
+				if (frame < 2)
+					lagging &= !st;
+				else
+					lagging &= st && st->lastFrame == firstFrame + frame - 2;
+			}
+			ok &= check(lagging && profiler::getNumDroppedEvents() == 0, "GPU results read back frames later");
+
+			// never available in time: the queries are recycled
+			profiler::reset();
+			LatentDevice slowDevice(100);
+			setGraphicsDevice(&slowDevice);
+			for (auto frame = 0u; frame < 2 * profiler::kGpuLatency; ++frame) {
+				slowDevice.frame = frame;
+				{
+					PROFILE_GPU_SCOPE("slow");
+				}
+				profiler::endFrame();
+			}
+			// a slot is reused kGpuLatency - 1 frames after it was filled
+			ok &= check(!findStats(profiler::getScopeStats(), "slow", true)
+				&& profiler::getNumDroppedEvents() == profiler::kGpuLatency + 1, "late GPU frames are dropped");
+			// pending frames are polled oldest first, up to the first that is not ready
+			ok &= check(slowDevice.numPolls == 2 * profiler::kGpuLatency, "one poll per frame while waiting");
+			setGraphicsDevice(nullptr);
+		}
+		return ok;
+	}
+
+	bool testChromeTrace()
+	{
+		profiler::reset();
+		profiler::setEnabled(true);
+		RecordingDevice device;
+		setGraphicsDevice(&device);
+		const unsigned numFrames = profiler::kTraceFrames + 4;
+		for (auto frame = 0u; frame < numFrames; ++frame) {
+			PROFILE_SCOPE("frame \"quoted\\name\"");
+			{
+				PROFILE_GPU_SCOPE("gpu");
+			}
+			profiler::endFrame();
+		}
+		profiler::endFrame();
+		setGraphicsDevice(nullptr);
+
+		std::ostringstream out;
+		profiler::writeChromeTrace(out);
+		auto json = out.str();
+		JsonChecker checker{ json.c_str() };
+		auto events = profiler::getTraceEvents();
+		bool ok = true;
+		ok &= check(checker.document(), "valid JSON");
+		ok &= check(json.find("{\"traceEvents\":[") == 0 && json.find("\"displayTimeUnit\":\"ms\"") != std::string::npos, "trace event format");
+		ok &= check(countOccurrences(json, "\"ph\":\"X\"") == events.size()
+			&& countOccurrences(json, "\"cat\":\"gpu\"") == profiler::kTraceFrames - 1, "one complete event per scope");
+		ok &= check(countOccurrences(json, "\"ph\":\"i\"") == profiler::kTraceFrames, "last frames only");
+		ok &= check(json.find("frame \\\"quoted\\\\name\\\"") != std::string::npos, "names are escaped");
+		ok &= check(json.find("\"ts\":-") == std::string::npos, "timestamps relative to the first frame");
+		return ok;
+	}
+}
+
+int main()
+{
+	profiler::setThreadName("main");
+	bool ok = true;
+	ok &= testHierarchy();
+	ok &= testDisabled();
+	ok &= testThreads();
+	ok &= testOverflow();
+	ok &= testGpu();
+	ok &= testChromeTrace();
+	return reportTestResults(ok);
+}
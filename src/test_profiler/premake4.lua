@@ -0,0 +1,10 @@
+project "test_profiler"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_profiler"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,212 @@
+// Program cache test: program keys (preprocessed sources, keywords, driver),
+// index and binary files of the cache directory without a GL context, loading
+// and recompiling of binaries on a recording device, and the time to create
+// the programs of the scene renderer with a cold and a warm cache
+// (run from the repository root: loads resources/shaders/*.glsl)
+#include <rendering/opengl4.hpp>
+#include <rendering/program_cache.hpp>
+#include <rendering/device.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	const char *kSource =
+		"#version 440\n"
+		"#ifdef _VERTEX_\n"
+		"void main() { gl_Position = vec4(0.0); }\n"
+		"#endif\n"
+		"#ifdef _FRAGMENT_\n"
+		"out vec4 color;\n"
+		"void main() { color = vec4(1.0); }\n"
+		"#endif\n";
+
+	std::string testDirectory()
+	{
+		auto dir = fs::temp_directory_path() / "rift_test_program_cache";
+		fs::remove_all(dir);
+		return dir.string();
+	}
+
+	bool testKeys()
+	{
+		bool ok = true;
+		auto vs = preprocessShader(kSource, "", gl::VERTEX_SHADER, {});
+		auto ps = preprocessShader(kSource, "", gl::FRAGMENT_SHADER, {});
+		auto key = ProgramCache::hashProgram(vs, "", ps, "driver");
+		ok &= check(key == ProgramCache::hashProgram(vs, "", ps, "driver"), "same sources: same key");
+		ok &= check(key != ProgramCache::hashProgram(vs, "", ps, "driver 2")
+			&& key != ProgramCache::hashProgram(ps, "", vs, "driver")
+			&& key != ProgramCache::hashProgram(vs, vs, ps, "driver"), "driver and stages in the key");
+		auto psKeyword = preprocessShader(kSource, "", gl::FRAGMENT_SHADER, { { "SHADOW_PASS", "" } });
+		ok &= check(key != ProgramCache::hashProgram(vs, "", psKeyword, "driver"), "keywords in the key");
+		ok &= check(ProgramCache::hashProgram("ab", "", "c", "") != ProgramCache::hashProgram("a", "", "bc", ""),
+			"stage boundaries in the key");
+		ok &= check(ProgramCache::getFileName(0x12abull) == "00000000000012ab.bin", "file name of a key");
+		return ok;
+	}
+
+	bool testIndex()
+	{
+		bool ok = true;
+		auto dir = testDirectory();
+		ProgramCache::Binary binary;
+		binary.format = 7;
+		binary.data = { 'b', 'i', 'n', 'a', 'r', 'y' };
+		{
+			ProgramCache cache;
+			cache.setDirectory(dir);
+			ok &= check(cache.isEnabled() && fs::is_directory(dir) && cache.size() == 0, "directory created");
+			ok &= check(cache.writeBinary(0x1234, binary) && cache.contains(0x1234), "binary written");
+		}
+		// garbage in the directory
+		std::ofstream(fs::path(dir) / "notes.txt") << "not a binary";
+		std::ofstream(fs::path(dir) / "zzzzzzzzzzzzzzzz.bin") << "not a key";
+		fs::copy_file(fs::path(dir) / ProgramCache::getFileName(0x1234), fs::path(dir) / ProgramCache::getFileName(0x5678));
+		std::ofstream(fs::path(dir) / ProgramCache::getFileName(0x9abc), std::ios::binary) << "RPCB";
+
+		ProgramCache cache;
+		cache.setDirectory(dir);
+		ok &= check(cache.size() == 3 && cache.contains(0x1234) && cache.contains(0x5678) && cache.contains(0x9abc),
+			"binaries indexed, other files ignored");
+		ProgramCache::Binary read;
+		ok &= check(cache.readBinary(0x1234, read) && read.format == 7 && read.data == binary.data, "binary read back");
+		ok &= check(!cache.readBinary(0x5678, read), "file of another key rejected");
+		ok &= check(!cache.readBinary(0x9abc, read), "truncated file rejected");
+		ok &= check(!cache.readBinary(0xdead, read), "missing key");
+		fs::remove_all(dir);
+		return ok;
+	}
+
+	bool testPrograms(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		auto dir = testDirectory();
+		auto vs = preprocessShader(kSource, "", gl::VERTEX_SHADER, {});
+		auto ps = preprocessShader(kSource, "", gl::FRAGMENT_SHADER, {});
+		GLenum format;
+		std::vector<char> compiledBinary, loadedBinary;
+
+		// disabled: compiled, nothing written
+		ProgramCache disabled;
+		auto shaders = device.getShadersCompiled();
+		disabled.getProgram(vs, "", ps);
+		ok &= check(device.getShadersCompiled() == shaders + 2 && disabled.getStats().numCompiled == 1
+			&& !fs::exists(dir), "disabled cache compiles");
+
+		// cold
+		ProgramCache cold;
+		cold.setDirectory(dir);
+		auto program = cold.getProgram(vs, "", ps);
+		device.getProgramBinary(program, format, compiledBinary);
+		ok &= check(cold.getStats().numCompiled == 1 && cold.getStats().numLoaded == 0 && cold.size() == 1,
+			"cold cache: compiled and saved");
+
+		// warm (next run)
+		ProgramCache warm;
+		warm.setDirectory(dir);
+		shaders = device.getShadersCompiled();
+		auto linked = device.getProgramsLinked();
+		program = warm.getProgram(vs, "", ps);
+		device.getProgramBinary(program, format, loadedBinary);
+		ok &= check(program && warm.getStats().numLoaded == 1 && device.getShadersCompiled() == shaders
+			&& device.getProgramsLinked() == linked, "warm cache: loaded without compiling");
+		ok &= check(loadedBinary == compiledBinary, "same program as compiled");
+
+		// another driver: another key
+		device.setDriverString("RecordingDevice 2");
+		program = warm.getProgram(vs, "", ps);
+		ok &= check(warm.getStats().numCompiled == 1 && warm.getStats().numRejected == 0 && warm.size() == 2,
+			"driver update: compiled under a new key");
+		device.setDriverString("RecordingDevice");
+
+		// binary rejected by the driver: compiled again and replaced
+		auto key = ProgramCache::hashProgram(vs, "", ps, device.getDriverString());
+		ProgramCache::Binary binary;
+		binary.format = format;
+		binary.data = { 'b', 'a', 'd' };
+		warm.writeBinary(key, binary);
+		warm.resetStats();
+		program = warm.getProgram(vs, "", ps);
+		ok &= check(program && warm.getStats().numRejected == 1 && warm.getStats().numCompiled == 1, "rejected binary recompiled");
+		program = warm.getProgram(vs, "", ps);
+		ok &= check(warm.getStats().numLoaded == 1, "rejected binary replaced");
+
+		// through the graphics context
+		gc.getProgramCache().setDirectory(dir);
+		gc.getProgramCache().resetStats();
+		compileProgram(gc, kSource, "", kSource, "", {});
+		compileProgram(gc, kSource, "", kSource, "", { { "SHADOW_PASS", "" } });
+		ok &= check(gc.getProgramCache().getStats().numLoaded == 1 && gc.getProgramCache().getStats().numCompiled == 1,
+			"compileProgram uses the cache of the context");
+		gc.getProgramCache().setDirectory("");
+		fs::remove_all(dir);
+		return ok;
+	}
+
+	// the programs created at startup by the scene renderer and the default material
+	void createStartupPrograms(GraphicsContext &gc)
+	{
+		for (auto path : { "resources/shaders/text.glsl", "resources/shaders/terrain.glsl", "resources/shaders/immediate.glsl",
+			"resources/shaders/debug_draw.glsl", "resources/shaders/passthrough.glsl" }) {
+			auto src = loadShaderSource(path);
+			compileProgram(gc, src.c_str(), path, src.c_str(), path, {});
+		}
+		const char *nanovgPath = "resources/shaders/nanovg.glsl";
+		auto nanovg = loadShaderSource(nanovgPath);
+		compileProgram(gc, nanovg.c_str(), nanovgPath, nanovg.c_str(), nanovgPath, { { "EDGE_AA", "1" } });
+		const char *path = "resources/shaders/default.glsl";
+		const char *shadowPath = "resources/shaders/shadow.glsl";
+		auto src = loadShaderSource(path);
+		auto shadowSrc = loadShaderSource(shadowPath);
+		for (auto keyword : { "POINT_LIGHT", "DIRECTIONAL_LIGHT", "SPOT_LIGHT", "CLUSTERED_LIGHTING" })
+			compileProgram(gc, src.c_str(), path, src.c_str(), path, { { keyword, "" } });
+		compileProgram(gc, src.c_str(), path, shadowSrc.c_str(), shadowPath, { { "SHADOW_PASS", "" } });
+	}
+
+	bool testStartup(GraphicsContext &gc)
+	{
+		auto dir = testDirectory();
+		auto &cache = gc.getProgramCache();
+		auto run = [&](const char *what) {
+			cache.setDirectory(dir);
+			cache.resetStats();
+			auto t0 = std::chrono::high_resolution_clock::now();
+			createStartupPrograms(gc);
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - t0;
+			auto &stats = cache.getStats();
+			std::printf("    %s: %u loaded, %u compiled, %.3f ms\n", what, stats.numLoaded, stats.numCompiled, elapsed.count());
+			return stats;
+		};
+		auto coldStats = run("cold cache");
+		auto warmStats = run("warm cache");
+		cache.setDirectory("");
+		fs::remove_all(dir);
+		return check(coldStats.numCompiled == 11 && coldStats.numLoaded == 0 && warmStats.numLoaded == 11
+			&& warmStats.numCompiled == 0, "startup programs loaded from a warm cache");
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	ok &= testKeys();
+	ok &= testIndex();
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testPrograms(gc, device);
+		ok &= testStartup(gc);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_program_cache"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_program_cache"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
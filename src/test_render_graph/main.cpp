@@ -0,0 +1,310 @@
+// Render graph test: pass culling, ordering of the dependencies, aliasing of
+// the transient render targets and memory stats (no GPU needed), then
+// execution on a recording device (framebuffers, texture pool across frames)
+#include <rendering/render_graph.hpp>
+#include <rendering/device.hpp>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const RenderTargetDesc kColor = { glm::ivec2(640, 360), ElementFormat::Float16x4 };
+	const RenderTargetDesc kDepth = { glm::ivec2(640, 360), ElementFormat::Depth32 };
+	const RenderTargetDesc kBackbuffer = { glm::ivec2(640, 360), ElementFormat::Unorm8x4 };
+
+	// names of the passes in execution order, separated by spaces
+	std::string orderString(const RenderGraph &graph)
+	{
+		std::string str;
+		for (auto pass : graph.getPassOrder())
+			str += (str.empty() ? "" : " ") + std::string(graph.getPassName(pass));
+		return str;
+	}
+
+	void noop(RenderGraph &)
+	{
+	}
+
+	bool testCulling()
+	{
+		bool ok = true;
+		RenderGraph graph;
+		auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		auto gbuffer = graph.addPass("gbuffer", noop);
+		auto color = gbuffer.create("color", kColor);
+		auto depth = gbuffer.create("depth", kDepth);
+		// its output is never read
+		auto unused = graph.addPass("unused", noop);
+		unused.read(depth);
+		unused.create("unusedTarget", kColor);
+		// reads the unused pass only
+		auto unusedChain = graph.addPass("unusedChain", noop);
+		unusedChain.read(color);
+		auto upload = graph.addPass("upload", noop);
+		upload.setSideEffects();
+		auto resolve = graph.addPass("resolve", noop);
+		resolve.read(color);
+		resolve.read(depth);
+		backbuffer = resolve.write(backbuffer);
+
+		ok &= check(graph.compile(), "compile");
+		ok &= check(orderString(graph) == "gbuffer upload resolve", "passes without visible results culled");
+		ok &= check(graph.isPassCulled(1) && graph.isPassCulled(2) && !graph.isPassCulled(3), "culled flags");
+		ok &= check(graph.getMemoryStats().numTransientResources == 2, "culled passes allocate nothing");
+		return ok;
+	}
+
+	bool testOrdering()
+	{
+		bool ok = true;
+		RenderGraph graph;
+		auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		// declared before the pass that produces its input
+		auto composite = graph.addPass("composite", noop);
+		auto scene = graph.addPass("scene", noop);
+		auto color = scene.create("color", kColor);
+		auto blur = graph.addPass("blur", noop);
+		blur.read(color);
+		auto blurred = blur.create("blurred", kColor);
+		composite.read(blurred);
+		backbuffer = composite.write(backbuffer);
+		ok &= check(graph.compile() && orderString(graph) == "scene blur composite", "producers run first");
+
+		// read of an old version: the reader runs before the next write
+		graph.reset();
+		backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		auto draw = graph.addPass("draw", noop);
+		auto target = draw.create("target", kColor);
+		auto overwrite = graph.addPass("overwrite", noop);
+		auto target2 = overwrite.write(target);
+		auto readOld = graph.addPass("readOld", noop);
+		readOld.read(target);
+		readOld.setSideEffects();
+		auto present = graph.addPass("present", noop);
+		present.read(target2);
+		backbuffer = present.write(backbuffer);
+		ok &= check(graph.compile() && orderString(graph) == "draw readOld overwrite present", "write after read ordered");
+
+		// overlay drawn on top of the previous content
+		graph.reset();
+		backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		auto first = graph.addPass("first", noop);
+		backbuffer = first.write(backbuffer);
+		auto overlay = graph.addPass("overlay", noop);
+		backbuffer = overlay.write(backbuffer);
+		ok &= check(graph.compile() && orderString(graph) == "first overlay", "writes of the same resource in order");
+
+		// cycle
+		graph.reset();
+		backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		auto a = graph.addPass("a", noop);
+		auto b = graph.addPass("b", noop);
+		auto outA = a.create("outA", kColor);
+		auto outB = b.create("outB", kColor);
+		a.read(outB);
+		b.read(outA);
+		auto c = graph.addPass("c", noop);
+		c.read(outB);
+		backbuffer = c.write(backbuffer);
+		ok &= check(!graph.compile() && graph.getPassOrder().empty(), "cycle detected");
+		return ok;
+	}
+
+	bool testAliasing()
+	{
+		bool ok = true;
+		RenderGraph graph;
+		auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+		// chain of post-processing passes: each target lives for two passes
+		auto scene = graph.addPass("scene", noop);
+		auto prev = scene.create("scene", kColor);
+		auto depth = scene.create("depth", kDepth);
+		std::vector<RenderResource> targets = { prev };
+		const unsigned kChain = 5;
+		for (auto i = 0u; i < kChain; ++i) {
+			auto pass = graph.addPass("post", noop);
+			pass.read(prev);
+			prev = pass.create("post", kColor);
+			targets.push_back(prev);
+		}
+		// another size, alive at the end of the chain
+		auto half = graph.addPass("half", noop);
+		half.read(depth);
+		auto halfTarget = half.create("half", RenderTargetDesc{ glm::ivec2(320, 180), ElementFormat::Float16x4 });
+		auto present = graph.addPass("present", noop);
+		present.read(prev);
+		present.read(halfTarget);
+		present.read(depth);
+		backbuffer = present.write(backbuffer);
+
+		ok &= check(graph.compile(), "compile");
+		// the depth lives for the whole frame, the color targets alternate between two textures
+		for (auto i = 0u; i < targets.size(); ++i)
+			ok &= graph.getTextureIndex(targets[i]) == graph.getTextureIndex(targets[i % 2]);
+		ok &= check(ok && graph.getTextureIndex(targets[0]) != graph.getTextureIndex(targets[1]), "ping-pong targets share two textures");
+		ok &= check(graph.getTextureIndex(halfTarget) != graph.getTextureIndex(targets[0])
+			&& graph.getTextureIndex(halfTarget) != graph.getTextureIndex(targets[1]), "different sizes never aliased");
+		ok &= check(graph.getTextureIndex(depth) != graph.getTextureIndex(targets[0])
+			&& graph.getTextureIndex(backbuffer) == -1, "depth and imported resources");
+
+		auto &stats = graph.getMemoryStats();
+		auto colorSize = getRenderTargetMemorySize(kColor);
+		auto depthSize = getRenderTargetMemorySize(kDepth);
+		auto halfSize = getRenderTargetMemorySize(graph.getDesc(halfTarget));
+		ok &= check(stats.numTransientResources == kChain + 3 && stats.numTextures == 4, "resource and texture counts");
+		ok &= check(stats.unaliasedBytes == (kChain + 1) * colorSize + depthSize + halfSize, "unaliased memory");
+		ok &= check(stats.allocatedBytes == 2 * colorSize + depthSize + halfSize, "allocated memory");
+		// two color targets and the depth, before the half target is created
+		ok &= check(stats.peakLiveBytes == 2 * colorSize + depthSize, "peak live memory");
+		std::printf("    %u targets, %zu KB unaliased, %zu KB allocated, %zu KB peak\n", stats.numTransientResources,
+			stats.unaliasedBytes >> 10, stats.allocatedBytes >> 10, stats.peakLiveBytes >> 10);
+		return ok;
+	}
+
+	// framebuffers bound by the recorded commands
+	std::vector<GLuint> boundFramebuffers(const RecordingDevice &device)
+	{
+		std::vector<GLuint> fbs;
+		for (auto &cmd : device.getCommands())
+			if (cmd.type == RecordingDevice::CommandType::BindFramebuffer)
+				fbs.push_back(cmd.obj);
+		return fbs;
+	}
+
+	// attachments of the framebuffers created
+	class AttachmentDevice : public RecordingDevice
+	{
+	public:
+		GLuint createFramebuffer(util::array_ref<GLuint> colorTargets, GLuint depthTarget) override {
+			numColorTargets.push_back(static_cast<unsigned>(colorTargets.size()));
+			depthTargets.push_back(depthTarget);
+			return RecordingDevice::createFramebuffer(colorTargets, depthTarget);
+		}
+
+		std::vector<unsigned> numColorTargets;
+		std::vector<GLuint> depthTargets;
+	};
+
+	bool testDepthTargets()
+	{
+		bool ok = true;
+		ok &= check(isDepthFormat(ElementFormat::Depth32) && isDepthFormat(ElementFormat::Depth24)
+			&& isDepthFormat(ElementFormat::Depth16) && isDepthFormat(ElementFormat::Depth32F)
+			&& !isDepthFormat(ElementFormat::Float) && !isDepthFormat(ElementFormat::Unorm8x4), "depth formats");
+
+		// depth only pass (shadow atlas), and color + depth
+		AttachmentDevice device;
+		setGraphicsDevice(&device);
+		{
+			RenderGraph graph;
+			auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+			auto shadows = graph.addPass("shadows", noop);
+			auto atlas = shadows.create("shadowAtlas", RenderTargetDesc{ glm::ivec2(2048, 2048), ElementFormat::Depth32F });
+			auto scene = graph.addPass("scene", noop);
+			scene.read(atlas);
+			auto color = scene.create("color", kColor);
+			auto depth = scene.create("depth", kDepth);
+			auto present = graph.addPass("present", noop);
+			present.read(color);
+			present.read(depth);
+			backbuffer = present.write(backbuffer);
+			ok &= check(graph.compile(), "compile");
+			graph.execute();
+			ok &= check(device.numColorTargets.size() == 2
+				&& device.numColorTargets[0] == 0 && device.depthTargets[0] != 0
+				&& device.numColorTargets[1] == 1 && device.depthTargets[1] != 0, "Depth32F and Depth32 attached as depth");
+		}
+		setGraphicsDevice(nullptr);
+		return ok;
+	}
+
+	bool testExecution()
+	{
+		bool ok = true;
+		RecordingDevice device;
+		setGraphicsDevice(&device);
+		{
+			RenderGraph graph;
+			std::vector<std::string> executed;
+			GLuint sceneTexture = 0, postTexture = 0, finalTexture = 0;
+			unsigned numPooled = 0;
+			for (auto frame = 0u; frame < 3; ++frame) {
+				device.reset();
+				executed.clear();
+				graph.reset();
+				auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+				RenderResource color, depth, post, sharpened;
+				auto scene = graph.addPass("scene", [&](RenderGraph &g) {
+					executed.push_back("scene");
+					sceneTexture = g.getTexture(color);
+				});
+				color = scene.create("color", kColor);
+				depth = scene.create("depth", kDepth);
+				auto blur = graph.addPass("blur", [&](RenderGraph &g) {
+					executed.push_back("blur");
+					postTexture = g.getTexture(post);
+				});
+				blur.read(color);
+				post = blur.create("post", kColor);
+				auto sharpen = graph.addPass("sharpen", [&](RenderGraph &g) {
+					executed.push_back("sharpen");
+					finalTexture = g.getTexture(sharpened);
+				});
+				sharpen.read(post);
+				sharpened = sharpen.create("sharpened", kColor);
+				auto unused = graph.addPass("unused", [&](RenderGraph &) {
+					executed.push_back("unused");
+				});
+				unused.read(depth);
+				auto present = graph.addPass("present", [&](RenderGraph &) {
+					executed.push_back("present");
+				});
+				present.read(sharpened);
+				present.read(depth);
+				backbuffer = present.write(backbuffer);
+				if (!graph.compile())
+					return check(false, "compile");
+				graph.execute();
+				if (frame == 0)
+					numPooled = graph.getNumPooledTextures();
+			}
+			ok &= check(executed == std::vector<std::string>{ "scene", "blur", "sharpen", "present" }, "culled pass not executed");
+			ok &= check(sceneTexture && postTexture && sceneTexture != postTexture && finalTexture == sceneTexture, "aliased target gets the same texture");
+			ok &= check(numPooled == 3 && graph.getNumPooledTextures() == 3, "pool reused across frames");
+			auto fbs = boundFramebuffers(device);
+			// scene, blur, sharpen, present (default), and the final rebind
+			ok &= check(fbs.size() == 5 && fbs[0] && fbs[1] && fbs[2] && fbs[0] != fbs[1] && fbs[3] == 0 && fbs[4] == 0, "framebuffer of each pass");
+			ok &= check(device.getCommandCount(RecordingDevice::CommandType::Viewport) == 4, "viewport of each pass");
+
+			// another size: the old textures are retired after a few frames
+			const RenderTargetDesc small = { glm::ivec2(64, 64), ElementFormat::Float16x4 };
+			for (auto frame = 0u; frame < 8; ++frame) {
+				graph.reset();
+				auto backbuffer = graph.importTexture("backbuffer", kBackbuffer, 0);
+				auto pass = graph.addPass("small", noop);
+				auto target = pass.create("small", small);
+				auto present = graph.addPass("present", noop);
+				present.read(target);
+				backbuffer = present.write(backbuffer);
+				graph.compile();
+				graph.execute();
+			}
+			ok &= check(graph.getNumPooledTextures() == 1, "unused pooled textures retired");
+		}
+		setGraphicsDevice(nullptr);
+		return ok;
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= testCulling();
+	ok &= testOrdering();
+	ok &= testAliasing();
+	ok &= testDepthTargets();
+	ok &= testExecution();
+	return reportTestResults(ok);
+}
@@ -0,0 +1,200 @@
+// Headless scene rendering test: renderScene on the recording device (no GPU),
+// draw calls and state changes of a frame with each drawing path (a draw per
+// item, instanced draws, multi-draw indirect) checked against the counters of
+// the renderer, and the CPU time of a frame
+// (run from the repository root: loads resources/shaders/*.glsl)
+#include <rendering/scene_renderer.hpp>
+#include <rendering/device.hpp>
+#include <scene/scene.hpp>
+#include <mesh_data.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdio>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const glm::ivec2 kViewportSize = glm::ivec2(1280, 720);
+	const unsigned kNumMeshes = 4;
+	const unsigned kNumMaterials = 4;
+	// grid of mesh nodes in front of the camera
+	const unsigned kGridSize = 24;
+	const unsigned kNumFrames = 20;
+
+	// a quad per submesh
+	MeshData makeMeshData(unsigned numSubmeshes)
+	{
+		MeshData data;
+		data.uv.push_back(std::vector<glm::vec2>());
+		for (auto s = 0u; s < numSubmeshes; ++s) {
+			Submesh sm;
+			sm.primitiveType = PrimitiveType::Triangle;
+			sm.startVertex = static_cast<unsigned>(data.vertices.size());
+			sm.startIndex = static_cast<unsigned>(data.indices.size());
+			sm.numVertices = 4;
+			sm.numIndices = 6;
+			for (auto v = 0u; v < 4; ++v) {
+				data.vertices.push_back(glm::vec3(v & 1, v >> 1, 0.1f * s));
+				data.normals.push_back(glm::vec3(0.0f, 0.0f, 1.0f));
+				data.tangents.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
+				data.uv[0].push_back(glm::vec2(v & 1, v >> 1));
+			}
+			for (auto i : { 0, 1, 2, 2, 1, 3 })
+				data.indices.push_back(i);
+			data.submeshes.push_back(sm);
+		}
+		data.computeBounds();
+		return data;
+	}
+
+	Camera makeCamera()
+	{
+		Camera camera;
+		camera.mode = Camera::Mode::Perspective;
+		camera.wEye = glm::vec3(0.0f, 0.0f, 30.0f);
+		camera.viewMat = glm::lookAt(camera.wEye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		camera.projMat = glm::perspective(glm::radians(60.0f), float(kViewportSize.x) / kViewportSize.y, 0.1f, 500.0f);
+		return camera;
+	}
+
+	struct FrameCounts
+	{
+		SceneRenderStats stats;
+		unsigned deviceDraws;
+		unsigned deviceStateChanges;
+		unsigned multiDraws;
+		StateCacheStats stateCache;
+		// per frame
+		double cpuTime;
+	};
+
+	FrameCounts renderFrames(GraphicsContext &gc, RecordingDevice &device, SceneRenderer &renderer, Scene &scene)
+	{
+		FrameCounts counts;
+		// warm-up: variants compiled, buffers grown
+		gc.beginFrame();
+		renderer.renderScene(scene, 0.016f);
+		gc.endFrame();
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto i = 0u; i < kNumFrames; ++i) {
+			device.reset();
+			gc.beginFrame();
+			renderer.renderScene(scene, 0.016f);
+			gc.endFrame();
+		}
+		std::chrono::duration<double, std::milli> time = std::chrono::high_resolution_clock::now() - t0;
+		counts.stats = renderer.getLastFrameStats();
+		counts.deviceDraws = device.getDrawCount();
+		counts.deviceStateChanges = device.getStateChangeCount();
+		counts.multiDraws = device.getCommandCount(RecordingDevice::CommandType::MultiDrawElementsIndirect);
+		// rolled over by beginFrame
+		gc.beginFrame();
+		counts.stateCache = gc.getStateCache().getLastFrameStats();
+		gc.endFrame();
+		counts.cpuTime = time.count() / kNumFrames;
+		return counts;
+	}
+
+	void printCounts(const char *name, const FrameCounts &counts)
+	{
+		std::printf("    %-10s: %.3f ms/frame, %u draw calls (%u on the device, %u shadow), %u state changes on the device (%u issued, %u filtered)\n",
+			name, counts.cpuTime, counts.stats.numDrawCalls, counts.deviceDraws, counts.stats.numShadowDrawCalls,
+			counts.deviceStateChanges, counts.stateCache.getTotalIssued(), counts.stateCache.getTotalFiltered());
+	}
+
+	bool testRenderScene(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		AssetDatabase assetDb;
+		SceneRenderer renderer(kViewportSize, gc, assetDb);
+		renderer.setSceneCamera(makeCamera());
+		renderer.setLightingMode(LightingMode::Clustered);
+		renderer.setShadows(true);
+
+		std::vector<Mesh::Ptr> meshes;
+		unsigned numSubmeshes[kNumMeshes];
+		for (auto i = 0u; i < kNumMeshes; ++i) {
+			auto data = makeMeshData(1 + i % 3);
+			numSubmeshes[i] = 1 + i % 3;
+			meshes.push_back(createMesh(gc, data));
+		}
+		std::vector<Material> materials(kNumMaterials);
+		for (auto &m : materials) {
+			m.shader = loadShaderAsset(assetDb, gc, "resources/shaders/default.glsl");
+			m.diffuseMap = loadTexture2DAsset(assetDb, gc, "resources/img/default.tga");
+		}
+
+		Scene scene;
+		unsigned totalSubmeshes = 0;
+		for (auto y = 0u; y < kGridSize; ++y) {
+			for (auto x = 0u; x < kGridSize; ++x) {
+				auto i = y * kGridSize + x;
+				Transform t;
+				t.setPosition(glm::vec3(float(x) - kGridSize * 0.5f, float(y) - kGridSize * 0.5f, 0.0f));
+				scene.createMeshPrefab(t, *meshes[i % kNumMeshes], materials[(i / kNumMeshes) % kNumMaterials]);
+				totalSubmeshes += numSubmeshes[i % kNumMeshes];
+			}
+		}
+		scene.createLightPrefab(Transform().move({ 0.0f, -50.0f, 0.0f }), LightMode::Directional, { 1.0f, 1.0f, 1.0f });
+
+		// a draw per submesh of each item
+		renderer.setInstancingThreshold(0);
+		renderer.setMultiDrawIndirect(false);
+		auto perItem = renderFrames(gc, device, renderer, scene);
+		printCounts("per item", perItem);
+		ok &= check(perItem.stats.numQueued == kGridSize * kGridSize && perItem.stats.numInstances == totalSubmeshes,
+			"every node drawn");
+		ok &= check(perItem.stats.numDrawCalls == totalSubmeshes && perItem.stats.numInstancedDrawCalls == 0,
+			"a draw call per submesh");
+		ok &= check(perItem.deviceDraws >= perItem.stats.numDrawCalls + perItem.stats.numShadowDrawCalls,
+			"draw calls reach the device");
+		ok &= check(perItem.stats.numProgramChanges == 1 && perItem.stats.numMaterialChanges == kNumMaterials,
+			"sorted queue: one change per material");
+		ok &= check(perItem.stats.numShadowDrawCalls > 0, "shadow casters drawn");
+		ok &= check(perItem.deviceStateChanges < perItem.stats.numDrawCalls, "sorted queue: fewer state changes than draws");
+		ok &= check(perItem.stateCache.getTotalFiltered() > 0, "redundant state changes filtered");
+
+		// same scene, same view: same frame
+		auto again = renderFrames(gc, device, renderer, scene);
+		ok &= check(again.deviceDraws == perItem.deviceDraws && again.deviceStateChanges == perItem.deviceStateChanges,
+			"same counts every frame");
+
+		// runs of the same mesh and material: an instanced draw per submesh
+		renderer.setInstancingThreshold(2);
+		auto instanced = renderFrames(gc, device, renderer, scene);
+		printCounts("instanced", instanced);
+		ok &= check(instanced.stats.numInstances == totalSubmeshes && instanced.stats.numDrawCalls < perItem.stats.numDrawCalls
+			&& instanced.stats.numInstancedDrawCalls > 0, "instancing: fewer draw calls");
+		// the other draws of the frame (post-processing, overlays) do not depend on the path
+		ok &= check(perItem.deviceDraws - instanced.deviceDraws
+			== (perItem.stats.numDrawCalls + perItem.stats.numShadowDrawCalls) - (instanced.stats.numDrawCalls + instanced.stats.numShadowDrawCalls),
+			"instancing: device draws match the renderer");
+		ok &= check(instanced.deviceStateChanges <= perItem.deviceStateChanges, "instancing: no more state changes");
+
+		// meshes in the megabuffer: the commands of the frame in a few multi-draws
+		renderer.setMultiDrawIndirect(true);
+		auto indirect = renderFrames(gc, device, renderer, scene);
+		printCounts("indirect", indirect);
+		ok &= check(indirect.stats.numInstances == totalSubmeshes && indirect.stats.numMultiDrawCommands > 0
+			&& indirect.multiDraws > 0 && indirect.stats.numDrawCalls < instanced.stats.numDrawCalls,
+			"multi-draw indirect: fewer draw calls");
+		ok &= check(indirect.deviceStateChanges <= instanced.deviceStateChanges, "multi-draw indirect: no more state changes");
+		return ok;
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		gc.enableMeshMegabuffer(kMeshVertexStride, 1024 * 1024, 1024 * 1024);
+		ok &= testRenderScene(gc, device);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_render_scene"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_render_scene"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,240 @@
+// Shader preprocessor test: #line mapping of the assembled sources back to the
+// files, include graph (includes, dependents), invalidation of a changed file,
+// circular includes, and the time to preprocess the keyword variants of the
+// default material with and without the cached files
+// (run from the repository root: loads resources/shaders/*.glsl)
+#include <rendering/shader_preprocessor.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	std::string testDirectory()
+	{
+		auto dir = fs::temp_directory_path() / "rift_test_shader_preprocessor";
+		fs::remove_all(dir);
+		fs::create_directories(dir);
+		return dir.string();
+	}
+
+	std::string file(const std::string &dir, const char *name)
+	{
+		return (fs::path(dir) / name).string();
+	}
+
+	void writeFile(const std::string &path, const char *text)
+	{
+		std::ofstream(path) << text;
+	}
+
+	std::string readFile(const std::string &path)
+	{
+		std::ifstream fileIn(path);
+		std::stringstream ss;
+		ss << fileIn.rdbuf();
+		return ss.str();
+	}
+
+	std::vector<std::string> readLines(const std::string &path)
+	{
+		std::vector<std::string> lines;
+		std::ifstream fileIn(path);
+		std::string line;
+		while (std::getline(fileIn, line))
+			lines.push_back(line);
+		return lines;
+	}
+
+	bool contains(const std::vector<std::string> &paths, const std::string &path)
+	{
+		return std::find(paths.begin(), paths.end(), path) != paths.end();
+	}
+
+	// every line after a #line directive is the line of the file it names
+	// (lines before the first directive: version, stage and keyword defines)
+	bool linesMapToFiles(const ShaderPreprocessor &pp, const std::string &sourcePath, const std::string &out, int glslVersion)
+	{
+		std::istringstream in(out);
+		std::string line;
+		int source = -1, lineNumber = 0;
+		int mapped = 0;
+		while (std::getline(in, line)) {
+			int l, s;
+			if (std::sscanf(line.c_str(), "#line %d %d", &l, &s) == 2) {
+				source = s;
+				lineNumber = glslVersion < 330 ? l + 1 : l;
+				continue;
+			}
+			if (source < 0 || line.compare(0, 16, "// Include file ") == 0)
+				continue;
+			auto lines = readLines(pp.getSourceName(sourcePath, source));
+			if (lineNumber < 1 || lineNumber > static_cast<int>(lines.size()) || lines[lineNumber - 1] != line) {
+				std::printf("    %s(%d): '%s'\n", pp.getSourceName(sourcePath, source).c_str(), lineNumber, line.c_str());
+				return false;
+			}
+			++lineNumber;
+			++mapped;
+		}
+		return mapped > 0;
+	}
+
+	bool testGraph()
+	{
+		bool ok = true;
+		auto dir = testDirectory();
+		auto root = file(dir, "root.glsl");
+		auto legacy = file(dir, "legacy.glsl");
+		auto common = file(dir, "common.glsl");
+		auto math = file(dir, "math.glsl");
+		writeFile(root,
+			"// root\n"
+			"#version 430\n"
+			"#pragma include <common.glsl>\n"
+			"uniform vec4 color;\n"
+			"\n"
+			"void main() {}\n");
+		writeFile(legacy,
+			"#version 150\n"
+			"#pragma include <common.glsl>\n"
+			"void main() {}\n");
+		writeFile(common,
+			"// common\n"
+			"#pragma include <math.glsl>\n"
+			"float twice(float x) { return add(x, x); }\n");
+		writeFile(math,
+			"float add(float a, float b) { return a + b; }\n");
+
+		ShaderPreprocessor pp;
+		auto out = pp.preprocess(readFile(root), root, gl::VERTEX_SHADER, { { "KEYWORD", "2" } });
+		ok &= check(out.compare(0, 13, "#version 430\n") == 0 && out.find("#define _VERTEX_\n") != std::string::npos
+			&& out.find("#define KEYWORD 2\n") != std::string::npos, "version, stage and keyword defines");
+		ok &= check(out.find("return a + b;") != std::string::npos && out.find("return add(x, x);") != std::string::npos
+			&& out.find("#pragma include") == std::string::npos, "includes expanded");
+		ok &= check(linesMapToFiles(pp, root, out, 430), "#line directives map to the files");
+		auto legacyOut = pp.preprocess(readFile(legacy), legacy, gl::FRAGMENT_SHADER, {});
+		ok &= check(legacyOut.compare(0, 13, "#version 150\n") == 0 && linesMapToFiles(pp, legacy, legacyOut, 150),
+			"#line directives before GLSL 3.30");
+
+		// numbered per source: the text does not depend on what was preprocessed before
+		ShaderPreprocessor fresh;
+		ok &= check(fresh.preprocess(readFile(legacy), legacy, gl::FRAGMENT_SHADER, {}) == legacyOut
+			&& legacyOut.find("#line 0 1\n") != std::string::npos && fresh.getSourceName(legacy, 0) == legacy
+			&& fresh.getSourceName(legacy, 1) == common && fresh.getSourceName(legacy, 3) == "<unknown>",
+			"source string numbers independent of the load order");
+
+		auto stats = pp.getStats();
+		ok &= check(stats.numFilesRead == 2 && stats.numSourcesParsed == 2, "shared include read once");
+		pp.preprocess(readFile(root), root, gl::FRAGMENT_SHADER, {});
+		ok &= check(pp.getStats().numFilesRead == 2 && pp.getStats().numSourcesParsed == 2, "same source not scanned again");
+
+		auto includes = pp.getIncludes(root);
+		ok &= check(includes.size() == 2 && contains(includes, common) && contains(includes, math), "includes of a source");
+		auto dependents = pp.getDependents(math);
+		ok &= check(dependents.size() == 3 && contains(dependents, common) && contains(dependents, root)
+			&& contains(dependents, legacy), "dependents of an include");
+		ok &= check(pp.getDependents(root).empty() && pp.getIncludes("unknown.glsl").empty(), "no dependents of a root");
+
+		// change on disk: only the invalidated file is read again
+		writeFile(math, "float add(float a, float b) { return b + a; }\n");
+		out = pp.preprocess(readFile(root), root, gl::VERTEX_SHADER, {});
+		ok &= check(out.find("return a + b;") != std::string::npos, "unchanged until invalidated");
+		pp.invalidate(math);
+		out = pp.preprocess(readFile(root), root, gl::VERTEX_SHADER, {});
+		ok &= check(out.find("return b + a;") != std::string::npos && pp.getStats().numFilesRead == 3,
+			"invalidated include read again");
+
+		// new include in a root source: new edge
+		auto extra = file(dir, "extra.glsl");
+		writeFile(extra, "const float kExtra = 1.0;\n");
+		out = pp.preprocess(readFile(root) + "#pragma include <extra.glsl>\n", root, gl::VERTEX_SHADER, {});
+		ok &= check(out.find("kExtra") != std::string::npos && contains(pp.getDependents(extra), root),
+			"edited source: graph updated");
+
+		// missing include: found once it exists
+		out = pp.preprocess("#version 430\n#pragma include <later.glsl>\n", root, gl::VERTEX_SHADER, {});
+		writeFile(file(dir, "later.glsl"), "const float kLater = 1.0;\n");
+		pp.invalidate(file(dir, "later.glsl"));
+		out = pp.preprocess("#version 430\n#pragma include <later.glsl>\n", root, gl::VERTEX_SHADER, {});
+		ok &= check(out.find("kLater") != std::string::npos, "missing include found after invalidate");
+
+		// circular
+		writeFile(file(dir, "loop_a.glsl"), "#pragma include <loop_b.glsl>\nconst int a = 0;\n");
+		writeFile(file(dir, "loop_b.glsl"), "#pragma include <loop_a.glsl>\nconst int b = 0;\n");
+		auto loop = file(dir, "loop_a.glsl");
+		out = pp.preprocess(readFile(loop), loop, gl::VERTEX_SHADER, {});
+		ok &= check(!out.empty() && out.size() < 4096, "circular include stops");
+
+		fs::remove_all(dir);
+		return ok;
+	}
+
+	// the 2^7 keyword sets of the default material, both stages
+	std::vector<std::vector<ShaderKeyword>> variants()
+	{
+		const char *names[] = { "POINT_LIGHT", "DIRECTIONAL_LIGHT", "SPOT_LIGHT", "CLUSTERED_LIGHTING",
+			"SHADOW_PASS", "NORMAL_MAP", "ALPHA_TEST" };
+		std::vector<std::vector<ShaderKeyword>> sets;
+		for (int mask = 0; mask < 128; ++mask) {
+			std::vector<ShaderKeyword> keywords;
+			for (int i = 0; i < 7; ++i)
+				if (mask & (1 << i))
+					keywords.push_back(ShaderKeyword{ names[i], "" });
+			sets.push_back(std::move(keywords));
+		}
+		return sets;
+	}
+
+	bool testVariants()
+	{
+		bool ok = true;
+		const std::string path = "resources/shaders/default.glsl";
+		auto src = readFile(path);
+		auto sets = variants();
+
+		// every variant from the files (the preprocessor before the include graph)
+		ShaderPreprocessor pp;
+		std::vector<std::string> coldOut;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (auto &keywords : sets) {
+			for (auto stage : { gl::VERTEX_SHADER, gl::FRAGMENT_SHADER }) {
+				pp.clear();
+				coldOut.push_back(pp.preprocess(src, path, stage, keywords));
+			}
+		}
+		std::chrono::duration<double, std::milli> cold = std::chrono::high_resolution_clock::now() - t0;
+		auto coldReads = pp.getStats().numFilesRead;
+
+		ShaderPreprocessor warm;
+		std::vector<std::string> warmOut;
+		t0 = std::chrono::high_resolution_clock::now();
+		for (auto &keywords : sets)
+			for (auto stage : { gl::VERTEX_SHADER, gl::FRAGMENT_SHADER })
+				warmOut.push_back(warm.preprocess(src, path, stage, keywords));
+		std::chrono::duration<double, std::milli> cached = std::chrono::high_resolution_clock::now() - t0;
+
+		std::printf("    %u variants: %.3f ms from the files (%u reads), %.3f ms cached (%u reads)\n",
+			static_cast<unsigned>(warmOut.size()), cold.count(), coldReads, cached.count(), warm.getStats().numFilesRead);
+		ok &= check(coldOut == warmOut, "cached variants identical");
+		ok &= check(warm.getStats().numFilesRead == 2 && warm.getStats().numSourcesParsed == 1, "default.glsl includes read once");
+		ok &= check(linesMapToFiles(warm, path, warmOut.back(), 430), "default.glsl #line mapping");
+		auto dependents = warm.getDependents(warm.getIncludes(path).front());
+		ok &= check(dependents.size() == 1 && dependents[0] == path, "default.glsl depends on its includes");
+		return ok;
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= testGraph();
+	ok &= testVariants();
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_shader_preprocessor"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_shader_preprocessor"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
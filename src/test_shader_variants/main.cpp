@@ -0,0 +1,174 @@
+// Shader variants test: keys of keyword sets, program table, lazy compilation
+// of the variants of the default material shader on a recording device,
+// prewarming, and the usage list saved for the next runs
+// (run from the repository root: loads resources/shaders/*.glsl)
+#include <rendering/opengl4.hpp>
+#include <rendering/shader_variants.hpp>
+#include <rendering/device.hpp>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include "../test_common/check.hpp"
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+	const char *kShaderPath = "resources/shaders/default.glsl";
+	const char *kShadowPath = "resources/shaders/shadow.glsl";
+
+	std::string usagePath()
+	{
+		return (fs::temp_directory_path() / "rift_test_shader_variants.txt").string();
+	}
+
+	std::vector<char> binaryOf(RecordingDevice &device, GLuint program)
+	{
+		GLenum format;
+		std::vector<char> binary;
+		device.getProgramBinary(program, format, binary);
+		return binary;
+	}
+
+	bool testKeys()
+	{
+		bool ok = true;
+		ShaderVariant a({ { "POINT_LIGHT", "" }, { "SHADOW_PASS", "" } });
+		ShaderVariant b({ { "SHADOW_PASS", "" }, { "POINT_LIGHT", "" } });
+		ok &= check(a.key == b.key && a.keywords[0].define == "POINT_LIGHT", "key and keywords independent of the order");
+		// values in the key; (define, value) pairs that summed hashes confused
+		ok &= check(ShaderVariant({ { "A", "1" } }).key != ShaderVariant({ { "A", "2" } }).key
+			&& ShaderVariant({ { "A", "B" } }).key != ShaderVariant({ { "B", "A" } }).key
+			&& ShaderVariant({ { "A", "" }, { "B", "" } }).key != ShaderVariant({ { "AB", "" } }).key
+			&& ShaderVariant().key != ShaderVariant({ { "", "" } }).key, "distinct keyword sets: distinct keys");
+		// written to the usage list: must not change between runs or builds
+		ok &= check(ShaderVariant().key == 0xcbf29ce484222325ull
+			&& ShaderVariant({ { "POINT_LIGHT", "" } }).key == 0x1709cd9542cd6f57ull, "stable keys");
+		return ok;
+	}
+
+	bool testTable()
+	{
+		bool ok = true;
+		ProgramTable table;
+		ok &= check(table.find(42) == 0 && table.size() == 0, "empty table");
+		const unsigned n = 10000;
+		for (unsigned i = 0; i < n; ++i)
+			table.insert(ShaderVariant({ { "K", std::to_string(i) } }).key, i + 1);
+		bool found = true;
+		for (unsigned i = 0; i < n; ++i)
+			found &= table.find(ShaderVariant({ { "K", std::to_string(i) } }).key) == i + 1;
+		ok &= check(found && table.size() == n && table.find(ShaderVariant({ { "K", "x" } }).key) == 0, "10000 keys found after growing");
+		// sequential keys: probing still short
+		ProgramTable sequential;
+		for (uint64_t key = 1; key <= n; ++key)
+			sequential.insert(key << 32, static_cast<GLuint>(key));
+		found = true;
+		for (uint64_t key = 1; key <= n; ++key)
+			found &= sequential.find(key << 32) == key;
+		ok &= check(found, "sequential keys found");
+		table.insert(ShaderVariant({ { "K", "0" } }).key, 77);
+		ok &= check(table.find(ShaderVariant({ { "K", "0" } }).key) == 77 && table.size() == n, "insert replaces");
+
+		// lookups of the forward passes (a few variants per shader)
+		std::vector<ShaderVariant> variants = { ShaderVariant({ { "POINT_LIGHT", "" } }), ShaderVariant({ { "SPOT_LIGHT", "" } }),
+			ShaderVariant({ { "DIRECTIONAL_LIGHT", "" } }), ShaderVariant({ { "SHADOW_PASS", "" } }), ShaderVariant({ { "CLUSTERED_LIGHTING", "" } }) };
+		ProgramTable small;
+		std::unordered_map<uint64_t, GLuint> map;
+		for (GLuint i = 0; i < variants.size(); ++i) {
+			small.insert(variants[i].key, i + 1);
+			map[variants[i].key] = i + 1;
+		}
+		const unsigned lookups = 5000000;
+		GLuint sum = 0;
+		auto t0 = std::chrono::high_resolution_clock::now();
+		for (unsigned i = 0; i < lookups; ++i)
+			sum += small.find(variants[i % 5].key);
+		std::chrono::duration<double, std::nano> flat = std::chrono::high_resolution_clock::now() - t0;
+		t0 = std::chrono::high_resolution_clock::now();
+		for (unsigned i = 0; i < lookups; ++i)
+			sum += map.find(variants[i % 5].key)->second;
+		std::chrono::duration<double, std::nano> node = std::chrono::high_resolution_clock::now() - t0;
+		std::printf("    lookup: %.2f ns flat table, %.2f ns std::unordered_map (%u)\n",
+			flat.count() / lookups, node.count() / lookups, sum % 2);
+		return ok;
+	}
+
+	bool testVariants(GraphicsContext &gc, RecordingDevice &device)
+	{
+		bool ok = true;
+		AssetDatabase assetDb;
+		auto linked = device.getProgramsLinked();
+		auto shader = loadShaderAsset(assetDb, gc, kShaderPath);
+		auto &variants = shader->variants;
+		ok &= check(device.getProgramsLinked() == linked && variants.getCompiledVariants().empty(),
+			"nothing compiled at load without usage");
+		ok &= check(variants.getNumPermutations() == 10, "permutations of the axes");
+		ok &= check(variants.isValid(ShaderVariant({ { "POINT_LIGHT", "" }, { "SHADOW_PASS", "" } }))
+			&& !variants.isValid(ShaderVariant({ { "POINT_LIGHT", "" }, { "SPOT_LIGHT", "" } }))
+			&& !variants.isValid(ShaderVariant({ { "SKINNING", "" } })), "variants checked against the axes");
+
+		ShaderVariant point({ { "POINT_LIGHT", "" } });
+		ShaderVariant shadow({ { "SHADOW_PASS", "" } });
+		auto program = variants.getProgram(gc, point);
+		ok &= check(program && device.getProgramsLinked() == linked + 1 && variants.findProgram(point.key) == program,
+			"variant compiled on first use");
+		ok &= check(variants.getProgram(gc, ShaderVariant({ { "POINT_LIGHT", "" } })) == program
+			&& device.getProgramsLinked() == linked + 1, "then looked up");
+
+		// same program as the depth only stage compiled directly
+		auto src = loadShaderSource(kShaderPath);
+		auto shadowSrc = loadShaderSource(kShadowPath);
+		auto expected = compileProgram(gc, src.c_str(), kShaderPath, shadowSrc.c_str(), kShadowPath, { { "SHADOW_PASS", "" } });
+		auto expectedForward = compileProgram(gc, src.c_str(), kShaderPath, src.c_str(), kShaderPath, { { "POINT_LIGHT", "" } });
+		ok &= check(binaryOf(device, variants.getProgram(gc, shadow)) == binaryOf(device, expected)
+			&& binaryOf(device, program) == binaryOf(device, expectedForward), "shadow pass: fragment stage of shadow.glsl");
+
+		auto &usage = gc.getShaderVariantUsage();
+		ok &= check(usage.isDirty() && usage.getVariants(kShaderPath).size() == 2, "used variants recorded");
+		auto path = usagePath();
+		ok &= check(usage.save(path) && !usage.isDirty(), "usage saved");
+
+		// next run: prewarmed at load
+		ShaderVariantUsage nextUsage;
+		ok &= check(nextUsage.load(path) && nextUsage.size() == 2 && nextUsage.getVariants(kShaderPath)[0].key == point.key
+			&& nextUsage.getVariants(kShaderPath)[1].key == shadow.key, "usage loaded");
+		ok &= check(!nextUsage.load(path + ".missing") && nextUsage.size() == 2, "missing usage file");
+		{
+			AssetDatabase nextDb;
+			usage.load(path);
+			linked = device.getProgramsLinked();
+			auto next = loadShaderAsset(nextDb, gc, kShaderPath);
+			ok &= check(device.getProgramsLinked() == linked + 2 && next->variants.findProgram(point.key)
+				&& next->variants.findProgram(shadow.key), "recorded variants prewarmed at load");
+			linked = device.getProgramsLinked();
+			next->variants.getProgram(gc, point);
+			next->variants.getProgram(gc, shadow);
+			ok &= check(device.getProgramsLinked() == linked, "no compilation on first use");
+			ok &= check(next->variants.prewarmAll(gc) == 8 && next->variants.getCompiledVariants().size() == 10
+				&& next->variants.prewarmAll(gc) == 0, "all permutations prewarmed");
+		}
+		fs::remove(path);
+		return ok;
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	ok &= testKeys();
+	ok &= testTable();
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		ok &= testVariants(gc, device);
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_shader_variants"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_shader_variants"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,269 @@
+// Cascaded shadow maps test: cascade splits, orthographic fits (the slice of
+// the view frustum is covered, clipped to the casters, stable texels), and
+// per-cascade caster culling against a reference, serial and parallel
+#include <rendering/shadows.hpp>
+#include <rendering/occlusion.hpp>
+#include <scene/scene.hpp>
+#include <utils/thread_pool.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cfloat>
+#include <cstdio>
+#include <random>
+#include <set>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const float kNear = 0.1f;
+	const float kFar = 500.0f;
+	// light coming from above, slightly tilted
+	const glm::vec3 kLightDir = glm::normalize(glm::vec3(0.3f, -1.0f, 0.2f));
+
+	glm::mat4 makeProj()
+	{
+		return glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, kNear, kFar);
+	}
+
+	glm::mat4 makeView(const glm::vec3 &eye, float yaw, float pitch)
+	{
+		auto dir = glm::vec3(glm::sin(yaw) * glm::cos(pitch), glm::sin(pitch), -glm::cos(yaw) * glm::cos(pitch));
+		return glm::lookAt(eye, eye + dir, glm::vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	// random world-space point of the slice [splitNear, splitFar] of a view
+	glm::vec3 randomSlicePoint(std::mt19937 &rng, const glm::mat4 &view, const glm::mat4 &proj, float splitNear, float splitFar)
+	{
+		std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+		std::uniform_real_distribution<float> t(0.0f, 1.0f);
+		auto p = glm::inverse(proj) * glm::vec4(u(rng), u(rng), -1.0f, 1.0f);
+		auto ray = glm::vec3(p) / p.w;
+		ray /= -ray.z;
+		auto depth = glm::mix(splitNear, splitFar, t(rng));
+		return glm::vec3(glm::inverse(view) * glm::vec4(ray * depth, 1.0f));
+	}
+
+	bool insideClip(const glm::mat4 &viewProj, const glm::vec3 &p, float eps)
+	{
+		auto c = viewProj * glm::vec4(p, 1.0f);
+		return glm::abs(c.x) <= 1.0f + eps && glm::abs(c.y) <= 1.0f + eps && glm::abs(c.z) <= 1.0f + eps;
+	}
+
+	bool testSplits()
+	{
+		float splits[kMaxShadowCascades];
+		computeCascadeSplits(1.0f, 100.0f, 4, 0.0f, splits);
+		bool ok = check(glm::abs(splits[0] - 25.75f) < 1e-3f && splits[3] == 100.0f, "uniform splits");
+		computeCascadeSplits(1.0f, 100.0f, 4, 1.0f, splits);
+		ok &= check(glm::abs(splits[1] - 10.0f) < 1e-3f && glm::abs(splits[0] - glm::sqrt(10.0f)) < 1e-3f, "logarithmic splits");
+
+		ShadowParams params;
+		ShadowCascade cascades[kMaxShadowCascades];
+		AABB casters{ glm::vec3(-1000.0f), glm::vec3(1000.0f) };
+		auto n = computeShadowCascades(makeView(glm::vec3(0.0f), 0.0f, 0.0f), makeProj(), kLightDir, casters, params, cascades);
+		bool increasing = n == params.numCascades && glm::abs(cascades[0].splitNear - kNear) < 1e-4f;
+		for (auto i = 0u; i < n; ++i) {
+			std::printf("    -> cascade %u: %7.2f to %7.2f, texel %.4f\n", i, cascades[i].splitNear, cascades[i].splitFar, cascades[i].texelSize);
+			increasing &= cascades[i].splitFar > cascades[i].splitNear;
+			if (i)
+				increasing &= cascades[i].splitNear == cascades[i - 1].splitFar && cascades[i].texelSize > cascades[i - 1].texelSize;
+		}
+		ok &= check(increasing && cascades[n - 1].splitFar == params.maxDistance, "cascades cover the view up to the max distance");
+		return ok;
+	}
+
+	bool testFit()
+	{
+		std::mt19937 rng(7);
+		std::uniform_real_distribution<float> angle(-3.0f, 3.0f);
+		std::uniform_real_distribution<float> pitch(-1.2f, 1.2f);
+		auto proj = makeProj();
+		AABB everything{ glm::vec3(-1000.0f), glm::vec3(1000.0f) };
+		bool covered = true;
+		bool tighter = true;
+		for (auto stabilize : { false, true }) {
+			ShadowParams params;
+			params.stabilize = stabilize;
+			for (auto trial = 0; trial < 50; ++trial) {
+				auto view = makeView(glm::vec3(angle(rng), 1.0f, angle(rng)), angle(rng), pitch(rng));
+				ShadowCascade cascades[kMaxShadowCascades];
+				auto n = computeShadowCascades(view, proj, kLightDir, everything, params, cascades);
+				for (auto c = 0u; c < n; ++c) {
+					for (auto i = 0; i < 100; ++i)
+						covered &= insideClip(cascades[c].viewProjMatrix, randomSlicePoint(rng, view, proj, cascades[c].splitNear, cascades[c].splitFar), 1e-4f);
+					if (!stabilize) {
+						ShadowParams stable = params;
+						stable.stabilize = true;
+						auto sphere = fitShadowCascade(view, proj, cascades[c].splitNear, cascades[c].splitFar, kLightDir, everything, stable);
+						tighter &= cascades[c].texelSize <= sphere.texelSize;
+					}
+				}
+			}
+		}
+		bool ok = check(covered, "cascades contain their slice of the view");
+		ok &= check(tighter, "tight fits have smaller texels than stable fits");
+
+		// casters in a small box: the cascade is clipped to them sideways, but
+		// reaches them towards the light even when they are out of the view
+		auto view = makeView(glm::vec3(0.0f, 1.0f, 0.0f), 0.0f, -0.3f);
+		AABB casters{ glm::vec3(-2.0f, 0.0f, -12.0f), glm::vec3(2.0f, 60.0f, -8.0f) };
+		ShadowParams params;
+		auto cascade = fitShadowCascade(view, proj, 5.0f, 20.0f, kLightDir, casters, params);
+		auto unclipped = fitShadowCascade(view, proj, 5.0f, 20.0f, kLightDir, everything, params);
+		ok &= check(cascade.texelSize < unclipped.texelSize * 0.5f, "cascade clipped to the caster bounds");
+		// (the top of the caster column is far above the view)
+		bool reaches = true;
+		for (auto i = 0; i < 8; ++i) {
+			auto corner = glm::vec3(i & 1 ? casters.max.x : casters.min.x, i & 2 ? casters.max.y : casters.min.y, i & 4 ? casters.max.z : casters.min.z);
+			auto clip = cascade.viewProjMatrix * glm::vec4(corner, 1.0f);
+			reaches &= clip.z >= -1.0f - 1e-4f;
+		}
+		ok &= check(reaches, "cascade reaches the casters towards the light");
+		return ok;
+	}
+
+	bool testStability()
+	{
+		auto proj = makeProj();
+		AABB everything{ glm::vec3(-1000.0f), glm::vec3(1000.0f) };
+		ShadowParams params;
+		params.stabilize = true;
+		bool sameTexels = true;
+		bool wholeTexels = true;
+		auto reference = fitShadowCascade(makeView(glm::vec3(0.0f), 0.0f, 0.0f), proj, 10.0f, 40.0f, kLightDir, everything, params);
+		for (auto i = 0; i < 100; ++i) {
+			auto eye = glm::vec3(0.037f * i, 0.5f, -0.021f * i);
+			auto cascade = fitShadowCascade(makeView(eye, 0.05f * i, 0.01f * i), proj, 10.0f, 40.0f, kLightDir, everything, params);
+			sameTexels &= glm::abs(cascade.texelSize - reference.texelSize) < 1e-6f;
+			// left and bottom edges of the box, in texels
+			auto left = (-1.0f - cascade.projMatrix[3][0]) / cascade.projMatrix[0][0] / cascade.texelSize;
+			auto bottom = (-1.0f - cascade.projMatrix[3][1]) / cascade.projMatrix[1][1] / cascade.texelSize;
+			wholeTexels &= glm::abs(left - glm::round(left)) < 0.02f && glm::abs(bottom - glm::round(bottom)) < 0.02f;
+		}
+		bool ok = check(sameTexels, "stable fits keep their texel size");
+		ok &= check(wholeTexels, "stable fits move by whole texels");
+
+		// atlas: the tile of each cascade
+		ShadowCascade cascades[kMaxShadowCascades];
+		auto view = makeView(glm::vec3(0.0f), 0.3f, -0.2f);
+		auto n = computeShadowCascades(view, proj, kLightDir, everything, ShadowParams(), cascades);
+		std::mt19937 rng(3);
+		bool inTile = true;
+		for (auto c = 0u; c < n; ++c) {
+			auto m = getShadowAtlasMatrix(cascades[c], c);
+			auto viewport = getShadowAtlasViewport(c, 1024);
+			auto tileMin = glm::vec2(viewport.x, viewport.y) / 2048.0f;
+			for (auto i = 0; i < 100; ++i) {
+				auto s = glm::vec3(m * glm::vec4(randomSlicePoint(rng, view, proj, cascades[c].splitNear, cascades[c].splitFar), 1.0f));
+				inTile &= s.x >= tileMin.x - 1e-5f && s.x <= tileMin.x + 0.5f + 1e-5f
+					&& s.y >= tileMin.y - 1e-5f && s.y <= tileMin.y + 0.5f + 1e-5f
+					&& s.z >= -1e-5f && s.z <= 1.0f + 1e-5f;
+			}
+		}
+		ok &= check(inTile, "atlas coordinates stay in the tile of the cascade");
+		return ok;
+	}
+
+	bool testCasterCulling()
+	{
+		Shader shader;
+		Material material;
+		material.shader = &shader;
+		Mesh box;
+		box.aabb = AABB{ glm::vec3(-0.5f), glm::vec3(0.5f) };
+		box.boundingSphere = Sphere{ glm::vec3(0.0f), glm::sqrt(0.75f) };
+		Mesh pebble;
+		pebble.aabb = AABB{ glm::vec3(-0.005f), glm::vec3(0.005f) };
+		pebble.boundingSphere = Sphere{ glm::vec3(0.0f), 0.0087f };
+
+		// a field of boxes and pebbles, and a few floating boxes high above the view
+		Scene scene;
+		std::mt19937 rng(11);
+		std::uniform_real_distribution<float> pos(-200.0f, 200.0f);
+		std::uniform_real_distribution<float> height(0.0f, 5.0f);
+		const unsigned numObjects = 20000;
+		for (auto i = 0u; i < numObjects; ++i)
+			scene.createMeshPrefab(Transform().move({ pos(rng), height(rng), pos(rng) }), i % 4 ? box : pebble, material);
+		for (auto i = 0; i < 10; ++i)
+			scene.createMeshPrefab(Transform().move({ float(i) * 2.0f, 80.0f, -20.0f }), box, material);
+		scene.transforms.update();
+
+		auto view = makeView(glm::vec3(0.0f, 3.0f, 0.0f), 0.0f, -0.3f);
+		auto proj = makeProj();
+		ShadowParams params;
+		ShadowCasterCuller serial;
+		serial.gather(scene, material, nullptr);
+		ShadowCascade cascades[kMaxShadowCascades];
+		auto n = computeShadowCascades(view, proj, kLightDir, serial.getCasterBounds(), params, cascades);
+		auto cascadeRef = util::make_array_ref(cascades, n);
+		serial.cull(cascadeRef, params, nullptr);
+
+		util::thread_pool pool(3);
+		ShadowCasterCuller parallel;
+		parallel.gather(scene, material, &pool);
+		parallel.cull(cascadeRef, params, &pool);
+
+		// reference: bounds of every node against every cascade volume
+		bool same = serial.getNumCandidates() == numObjects + 10 && parallel.getNumCandidates() == serial.getNumCandidates();
+		bool floating = true;
+		unsigned total = 0;
+		for (auto c = 0u; c < n; ++c) {
+			std::set<const glm::mat4*> expected;
+			for (auto &it : scene.meshNodes) {
+				auto &transform = scene.transforms.getWorldMatrix(it.first);
+				auto aabb = transformAABB(it.second.mesh->aabb, transform);
+				auto sphere = transformSphere(it.second.mesh->boundingSphere, transform);
+				if (cascades[c].frustum.intersects(aabb) && cascades[c].frustum.intersects(sphere)
+					&& sphere.radius >= 0.5f * params.minCasterTexels * cascades[c].texelSize)
+					expected.insert(&transform);
+			}
+			RenderQueue a, b;
+			serial.merge(c, a);
+			parallel.merge(c, b);
+			std::set<const glm::mat4*> gotSerial, gotParallel;
+			unsigned numFloating = 0;
+			for (auto i = 0u; i < a.size(); ++i) {
+				gotSerial.insert(a[i].modelToWorld);
+				numFloating += (*a[i].modelToWorld)[3].y > 50.0f;
+			}
+			for (auto i = 0u; i < b.size(); ++i)
+				gotParallel.insert(b[i].modelToWorld);
+			std::printf("    -> cascade %u: %5u casters (%u floating)\n", c, serial.getNumCasters(c), numFloating);
+			same &= gotSerial == expected && gotParallel == expected && serial.getNumCasters(c) == expected.size();
+			total += serial.getNumCasters(c);
+			if (c == n - 1)
+				floating &= numFloating > 0;
+		}
+		bool ok = check(same, "casters match the reference, serial and parallel");
+		ok &= check(floating, "casters above the view are kept");
+		ok &= check(total > 0 && total < n * (numObjects + 10), "casters outside the cascades are culled");
+
+		// cost of the caster lists against the culling of the view
+		auto time = [&](const std::function<void()> &fn) {
+			auto start = std::chrono::high_resolution_clock::now();
+			for (auto i = 0; i < 10; ++i)
+				fn();
+			auto end = std::chrono::high_resolution_clock::now();
+			return std::chrono::duration<double, std::milli>(end - start).count() / 10.0;
+		};
+		DrawListRecorder recorder;
+		auto viewMs = time([&] { recorder.record(scene, material, proj * view, &pool); });
+		auto shadowMs = time([&] {
+			parallel.gather(scene, material, &pool);
+			computeShadowCascades(view, proj, kLightDir, parallel.getCasterBounds(), params, cascades);
+			parallel.cull(cascadeRef, params, &pool);
+		});
+		std::printf("    -> %u objects: view %.2f ms, %u cascades %.2f ms\n", numObjects, viewMs, n, shadowMs);
+		return ok;
+	}
+}
+
+int main()
+{
+	bool ok = true;
+	ok &= testSplits();
+	ok &= testFit();
+	ok &= testStability();
+	ok &= testCasterCulling();
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_shadow_cascades"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_shadow_cascades"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
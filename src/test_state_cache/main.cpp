@@ -0,0 +1,120 @@
+// State cache test: state changes go through a StateCache in front of a
+// recording device, and the commands that reach the device are checked
+#include <rendering/state_cache.hpp>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	using CommandType = RecordingDevice::CommandType;
+
+	unsigned filtered(const StateCache &cache, StateCategory category)
+	{
+		return cache.getLastFrameStats().filtered[static_cast<int>(category)];
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	bool ok = true;
+
+	{
+		StateCache cache(device);
+		cache.useProgram(1);
+		cache.useProgram(1);
+		cache.useProgram(2);
+		cache.setEnabled(gl::DEPTH_TEST, true);
+		cache.setEnabled(gl::DEPTH_TEST, true);
+		cache.depthFunc(gl::LEQUAL);
+		cache.depthFunc(gl::LEQUAL);
+		cache.polygonMode(gl::LINE);
+		cache.polygonMode(gl::FILL);
+		cache.polygonMode(gl::FILL);
+		cache.blendFunc(0, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+		cache.blendFunc(0, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA, gl::SRC_ALPHA, gl::ONE_MINUS_SRC_ALPHA);
+		cache.beginFrame();
+		ok &= check(device.getCommandCount(CommandType::UseProgram) == 2, "redundant program binds filtered");
+		ok &= check(device.getCommandCount(CommandType::SetEnabled) == 1, "redundant enables filtered");
+		ok &= check(device.getCommandCount(CommandType::DepthFunc) == 1, "redundant depth func filtered");
+		ok &= check(device.getCommandCount(CommandType::PolygonMode) == 2, "polygon mode toggles issued");
+		ok &= check(device.getCommandCount(CommandType::BlendFunc) == 1, "redundant blend func filtered");
+		ok &= check(filtered(cache, StateCategory::Program) == 1
+			&& filtered(cache, StateCategory::Depth) == 2
+			&& filtered(cache, StateCategory::Raster) == 1
+			&& filtered(cache, StateCategory::Blend) == 1, "per-category counters");
+		ok &= check(cache.getLastFrameStats().getTotalIssued() == 7, "issued counter");
+	}
+
+	// multi-bind calls are narrowed to the slots that change
+	{
+		device.reset();
+		StateCache cache(device);
+		GLuint textures[3] = { 10, 11, 12 };
+		cache.bindTextures(0, 3, textures);
+		textures[2] = 13;
+		cache.bindTextures(0, 3, textures);
+		cache.bindTextures(0, 3, textures);
+		auto &cmds = device.getCommands();
+		ok &= check(device.getCommandCount(CommandType::BindTextures) == 2, "identical texture binds filtered");
+		ok &= check(cmds.size() == 2 && cmds[1].first == 2 && cmds[1].count == 1
+			&& device.getObjectNames()[cmds[1].objects_begin] == 13, "texture binds narrowed to changed units");
+
+		GLuint bufs[2] = { 5, 6 };
+		GLintptr offsets[2] = { 0, 256 };
+		GLsizeiptr sizes[2] = { 64, 64 };
+		cache.bindBuffersRange(gl::UNIFORM_BUFFER, 0, 2, bufs, offsets, sizes);
+		offsets[0] = 512;
+		cache.bindBuffersRange(gl::UNIFORM_BUFFER, 0, 2, bufs, offsets, sizes);
+		// same buffers on another target: not redundant
+		cache.bindBuffersRange(gl::SHADER_STORAGE_BUFFER, 0, 2, bufs, offsets, sizes);
+		ok &= check(device.getCommandCount(CommandType::BindBuffersRange) == 3, "buffer range offsets compared, targets separate");
+		ok &= check(cmds.back().first == 0 && cmds.back().count == 2
+			&& cmds[cmds.size() - 2].first == 0 && cmds[cmds.size() - 2].count == 1, "buffer ranges narrowed");
+	}
+
+	// vertex buffer bindings belong to the VAO
+	{
+		device.reset();
+		StateCache cache(device);
+		GLuint vbo = 7;
+		GLintptr offset = 0;
+		GLsizei stride = 24;
+		cache.bindVertexArray(1);
+		cache.bindVertexBuffers(0, 1, &vbo, &offset, &stride);
+		cache.bindVertexBuffers(0, 1, &vbo, &offset, &stride);
+		cache.bindVertexArray(2);
+		cache.bindVertexBuffers(0, 1, &vbo, &offset, &stride);
+		ok &= check(device.getCommandCount(CommandType::BindVertexBuffers) == 2, "vertex buffers rebound after VAO change");
+	}
+
+	// deleted objects are forgotten (GL reuses names)
+	{
+		device.reset();
+		StateCache cache(device);
+		cache.useProgram(3);
+		cache.deleteProgram(3);
+		cache.useProgram(3);
+		GLuint tex = 4;
+		cache.bindTextures(0, 1, &tex);
+		cache.deleteTexture(4);
+		cache.bindTextures(0, 1, &tex);
+		ok &= check(device.getCommandCount(CommandType::UseProgram) == 2
+			&& device.getCommandCount(CommandType::BindTextures) == 2, "deleted objects are rebound");
+	}
+
+	// invalidate and disabled filtering
+	{
+		device.reset();
+		StateCache cache(device);
+		cache.depthMask(true);
+		cache.invalidate();
+		cache.depthMask(true);
+		cache.setFilteringEnabled(false);
+		cache.depthMask(true);
+		cache.beginFrame();
+		ok &= check(device.getCommandCount(CommandType::DepthMask) == 3, "invalidate / filtering disabled");
+		ok &= check(cache.getLastFrameStats().getTotalFiltered() == 0, "nothing filtered");
+	}
+
+	return reportTestResults(ok);
+}
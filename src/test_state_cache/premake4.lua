@@ -0,0 +1,10 @@
+project "test_state_cache"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_state_cache"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
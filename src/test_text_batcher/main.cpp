@@ -0,0 +1,162 @@
+// Text batcher test: glyph run cache (hits, eviction), drop shadow quads in
+// the same stream, one draw call per font for a HUD, split of large batches,
+// and the cost of a 40-line HUD with and without the cache
+// (run from the repository root: loads resources/img/fonts/debug.fnt)
+#include <rendering/text_batcher.hpp>
+#include <rendering/device.hpp>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const unsigned kHudLines = 40;
+
+	// mostly static lines, a few with numbers that change every frame
+	std::string hudLine(unsigned line, unsigned frame)
+	{
+		std::string str = "STATS " + std::to_string(line) + " : ";
+		if (line % 8 == 0)
+			return str + std::to_string(frame * 7919 % 100000) + " draws, " + std::to_string(frame % 97) + " ms";
+		return str + "static line of the debug HUD, " + std::to_string(line * 100) + " instances";
+	}
+
+	unsigned countDraws(const RecordingDevice &device, unsigned &numIndices)
+	{
+		unsigned numDraws = 0;
+		numIndices = 0;
+		for (auto &cmd : device.getCommands())
+			if (cmd.type == RecordingDevice::CommandType::DrawElements) {
+				++numDraws;
+				numIndices += cmd.count;
+			}
+		return numDraws;
+	}
+
+	bool testLayout(const Font &font)
+	{
+		bool ok = true;
+		TextBatcher batcher;
+		auto &quads = batcher.layout(font, "Hello");
+		ok &= check(quads.size() == 5, "one quad per glyph");
+		bool advancing = true;
+		for (auto i = 1u; i < quads.size(); ++i)
+			advancing &= quads[i].min.x > quads[i - 1].min.x;
+		ok &= check(advancing, "glyphs laid out left to right");
+		auto &again = batcher.layout(font, "Hello");
+		ok &= check(&again == &quads && batcher.getStats().numCacheHits == 1 && batcher.getStats().numCacheMisses == 1, "second layout is a cache hit");
+
+		batcher.addTextShadow(font, glm::ivec2(10, 20), "Hello", glm::vec4(1.0f), glm::ivec2(2, 2), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		auto &vertices = batcher.getVertices(font);
+		ok &= check(vertices.size() == 2 * 4 * quads.size(), "shadow and text in the same stream");
+		bool offset = true;
+		auto half = vertices.size() / 2;
+		for (auto i = 0u; i < half; ++i) {
+			auto &shadow = vertices[i];
+			auto &text = vertices[half + i];
+			offset &= shadow.x == text.x + 2.0f && shadow.y == text.y + 2.0f && shadow.tx == text.tx && shadow.ty == text.ty;
+			offset &= shadow.color == glm::packUnorm4x8(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)) && text.color == 0xFFFFFFFFu;
+		}
+		ok &= check(offset, "shadow drawn first, at an offset");
+		ok &= check(vertices[half].x == quads[0].min.x + 10.0f && vertices[half].y == quads[0].min.y + 20.0f, "text at its position");
+		ok &= check(batcher.getStats().numCacheMisses == 1, "shadow reuses the run");
+
+		// eviction of the runs not used for a while
+		batcher.endFrame();
+		for (auto frame = 0u; frame < TextBatcher::kRunCacheFrames; ++frame) {
+			batcher.layout(font, "kept");
+			batcher.endFrame();
+		}
+		ok &= check(batcher.getNumCachedRuns() == 1, "unused runs evicted");
+		return ok;
+	}
+
+	bool testDraws(GraphicsContext &gc, RecordingDevice &device, const Font &font)
+	{
+		bool ok = true;
+		TextBatcher batcher;
+		unsigned numIndices;
+		for (auto frame = 0u; frame < 3; ++frame) {
+			device.reset();
+			gc.beginFrame();
+			for (auto line = 0u; line < kHudLines; ++line)
+				batcher.addTextShadow(font, glm::ivec2(5, 5 + line * 16), hudLine(line, frame).c_str(),
+					glm::vec4(1.0f), glm::ivec2(2, 2), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+			auto numQuads = batcher.getStats().numQuads;
+			auto misses = batcher.getStats().numCacheMisses;
+			batcher.flush(gc, 1, glm::ivec2(1280, 720));
+			auto numDraws = countDraws(device, numIndices);
+			if (frame == 0) {
+				ok &= check(misses == kHudLines, "first frame lays out every line");
+			}
+			else if (frame == 2) {
+				ok &= check(misses == kHudLines / 8, "later frames lay out the changed lines only");
+				ok &= check(numDraws == 1 && numIndices == numQuads * 6, "one draw call for the HUD");
+				ok &= check(batcher.getVertices(font).empty(), "batch emptied by the flush");
+			}
+			batcher.endFrame();
+			gc.endFrame();
+		}
+
+		// more quads than 16-bit indices can address
+		device.reset();
+		gc.beginFrame();
+		std::string longLine(1000, 'x');
+		for (auto i = 0u; i < 20; ++i)
+			batcher.addText(font, glm::ivec2(0, i * 16), longLine.c_str(), glm::vec4(1.0f));
+		batcher.flush(gc, 1, glm::ivec2(1280, 720));
+		auto numDraws = countDraws(device, numIndices);
+		ok &= check(numDraws == 2 && numIndices == 20000 * 6, "large batch split in 16K quad draws");
+		bool baseVertex = false;
+		for (auto &cmd : device.getCommands())
+			if (cmd.type == RecordingDevice::CommandType::DrawElements && cmd.baseVertex == int(TextBatcher::kMaxQuadsPerDraw * 4))
+				baseVertex = true;
+		ok &= check(baseVertex, "second draw starts at the next quad");
+		batcher.endFrame();
+		gc.endFrame();
+		return ok;
+	}
+
+	void benchHud(GraphicsContext &gc, const Font &font)
+	{
+		const unsigned kFrames = 1000;
+		for (auto cached = 0; cached < 2; ++cached) {
+			TextBatcher batcher;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (auto frame = 0u; frame < kFrames; ++frame) {
+				gc.beginFrame();
+				if (!cached)
+					batcher.clearCache();
+				for (auto line = 0u; line < kHudLines; ++line)
+					batcher.addTextShadow(font, glm::ivec2(5, 5 + line * 16), hudLine(line, frame).c_str(),
+						glm::vec4(1.0f), glm::ivec2(2, 2), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+				batcher.flush(gc, 1, glm::ivec2(1280, 720));
+				batcher.endFrame();
+				gc.endFrame();
+			}
+			std::chrono::duration<double, std::micro> us = std::chrono::high_resolution_clock::now() - start;
+			std::printf("    %u-line HUD, %s: %.1f us/frame\n", kHudLines, cached ? "cached runs" : "no cache", us.count() / kFrames);
+		}
+	}
+}
+
+int main()
+{
+	RecordingDevice device;
+	setGraphicsDevice(&device);
+	bool ok = true;
+	{
+		GraphicsContext gc;
+		gc.initialize();
+		auto font = Font::loadFromFile("resources/img/fonts/debug.fnt");
+		ok &= testLayout(*font);
+		ok &= testDraws(gc, device, *font);
+		device.setStoreCommands(false);
+		benchHud(gc, *font);
+		font.reset();
+		gc.tearDown();
+	}
+	setGraphicsDevice(nullptr);
+	return reportTestResults(ok);
+}
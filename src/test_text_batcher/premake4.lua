@@ -0,0 +1,10 @@
+project "test_text_batcher"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_text_batcher"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()
@@ -0,0 +1,174 @@
+// Transform hierarchy test: world matrices against a naive walk of the parent
+// chains, after local changes and structural changes, with and without
+// threads; then times a full and an incremental update of 60k nodes
+#include <scene/transform_hierarchy.hpp>
+#include <utils/thread_pool.hpp>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <random>
+#include "../test_common/check.hpp"
+
+namespace
+{
+	const unsigned kNumNodes = 60000;
+
+	// reference: the entity hierarchy as a plain parent table
+	struct NaiveHierarchy
+	{
+		std::vector<EntityID> parents;
+		std::vector<Transform> locals;
+
+		glm::mat4 getWorldMatrix(EntityID id) const {
+			auto m = locals[id].toMatrix();
+			for (auto p = parents[id]; p != static_cast<EntityID>(-1); p = parents[p])
+				m = locals[p].toMatrix() * m;
+			return m;
+		}
+	};
+
+	Transform randomTransform(std::mt19937 &rng)
+	{
+		std::uniform_real_distribution<float> pos(-10.0f, 10.0f);
+		std::uniform_real_distribution<float> scale(0.8f, 1.2f);
+		Transform t;
+		t.position = glm::vec3(pos(rng), pos(rng), pos(rng));
+		t.rotation = glm::angleAxis(pos(rng), glm::normalize(glm::vec3(pos(rng), pos(rng), 1.0f)));
+		t.scaling = glm::vec3(scale(rng));
+		return t;
+	}
+
+	bool compare(const TransformHierarchy &h, const NaiveHierarchy &ref, const std::vector<bool> &alive, const char *what)
+	{
+		float maxError = 0.0f;
+		for (auto id = 0u; id < ref.parents.size(); ++id) {
+			if (!alive[id])
+				continue;
+			auto a = h.getWorldMatrix(id);
+			auto b = ref.getWorldMatrix(id);
+			for (auto c = 0; c < 4; ++c)
+				for (auto r = 0; r < 4; ++r)
+					maxError = std::max(maxError, std::abs(a[c][r] - b[c][r]) / std::max(1.0f, std::abs(b[c][r])));
+		}
+		auto ok = maxError < 1e-4f;
+		std::printf("%-44s: %6u updated, max error %g | %s\n", what, h.getNumUpdated(), maxError, ok ? "OK" : "FAILED");
+		return ok;
+	}
+
+	template <typename Fn>
+	double measure(Fn fn, unsigned iterations)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		for (auto i = 0u; i < iterations; ++i)
+			fn();
+		auto end = std::chrono::high_resolution_clock::now();
+		return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	util::thread_pool pool(3);
+	bool ok = true;
+
+	// empty, then emptied: nothing to update (a pool without workers runs the jobs inline)
+	{
+		util::thread_pool inlinePool(0);
+		TransformHierarchy empty;
+		empty.update(&inlinePool);
+		auto emptyOk = empty.getNumUpdated() == 0;
+		empty.add(1, Transform());
+		empty.update(&inlinePool);
+		empty.remove(1);
+		empty.update(&inlinePool);
+		emptyOk &= empty.getNumUpdated() == 0;
+		ok &= check(emptyOk, "empty hierarchy");
+	}
+
+	// random forest: 1/8 roots, otherwise a parent among the previous nodes
+	// (nodes are added in shuffled order to exercise the reordering)
+	TransformHierarchy h;
+	NaiveHierarchy ref;
+	std::vector<bool> alive(kNumNodes, true);
+	ref.parents.resize(kNumNodes);
+	ref.locals.resize(kNumNodes);
+	for (auto id = 0u; id < kNumNodes; ++id) {
+		ref.parents[id] = (id == 0 || rng() % 8 == 0) ? static_cast<EntityID>(-1) : rng() % id;
+		ref.locals[id] = randomTransform(rng);
+	}
+	std::vector<EntityID> addOrder(kNumNodes);
+	for (auto i = 0u; i < kNumNodes; ++i)
+		addOrder[i] = i;
+	std::shuffle(addOrder.begin(), addOrder.end(), rng);
+	for (auto id : addOrder)
+		h.add(id, ref.locals[id]);
+	for (auto id : addOrder)
+		h.setParent(id, ref.parents[id]);
+	h.update(&pool);
+	ok &= compare(h, ref, alive, "initial update (threads)");
+
+	// nothing moved
+	h.update(&pool);
+	ok &= compare(h, ref, alive, "no changes") && h.getNumUpdated() == 0;
+
+	// local changes
+	for (auto i = 0u; i < 500; ++i) {
+		auto id = rng() % kNumNodes;
+		ref.locals[id] = randomTransform(rng);
+		h.setLocalTransform(id, ref.locals[id]);
+	}
+	h.update(nullptr);
+	ok &= compare(h, ref, alive, "500 local changes (serial)");
+
+	// reparenting (to an earlier node: no cycles) and removals
+	for (auto i = 0u; i < 200; ++i) {
+		auto id = 1 + rng() % (kNumNodes - 1);
+		auto parent = rng() % id;
+		if (!alive[id] || !alive[parent])
+			continue;
+		ref.parents[id] = parent;
+		h.setParent(id, parent);
+	}
+	for (auto i = 0u; i < 100; ++i) {
+		auto id = rng() % kNumNodes;
+		if (!alive[id])
+			continue;
+		alive[id] = false;
+		h.remove(id);
+		for (auto &p : ref.parents)
+			if (p == id)
+				p = static_cast<EntityID>(-1);
+	}
+	h.update(&pool);
+	ok &= compare(h, ref, alive, "reparenting + removals (threads)");
+
+	// timings
+	auto naiveTime = measure([&] {
+		volatile float sink = 0.0f;
+		for (auto id = 0u; id < kNumNodes; ++id)
+			if (alive[id])
+				sink = sink + ref.getWorldMatrix(id)[3][0];
+	}, 5);
+	auto dirtyAll = [&] {
+		for (auto id = 0u; id < kNumNodes; ++id)
+			if (alive[id])
+				h.setLocalTransform(id, ref.locals[id]);
+	};
+	auto fullSerial = measure([&] { dirtyAll(); h.update(nullptr); }, 10);
+	auto fullThreads = measure([&] { dirtyAll(); h.update(&pool); }, 10);
+	auto incremental = measure([&] {
+		for (auto i = 0u; i < kNumNodes / 100; ++i) {
+			auto id = rng() % kNumNodes;
+			if (alive[id])
+				h.setLocalTransform(id, ref.locals[id]);
+		}
+		h.update(&pool);
+	}, 50);
+	std::printf("%u nodes, parent chain walk     : %.3f ms\n", kNumNodes, naiveTime);
+	std::printf("full update (+ set all), serial : %.3f ms\n", fullSerial);
+	std::printf("full update (+ set all), %u thr : %.3f ms\n", pool.num_threads(), fullThreads);
+	std::printf("1%% moved, incremental          : %.3f ms\n", incremental);
+
+	return reportTestResults(ok);
+}
@@ -0,0 +1,10 @@
+project "test_transform_hierarchy"
+	use_librift()
+	kind "ConsoleApp"
+	location "../../build/test_transform_hierarchy"
+	language "C++"
+	files {
+		"**.cpp"
+	}
+	includedirs { "../../include/**" }
+	use_gl()